@@ -0,0 +1,312 @@
+#include "bintext.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#if defined(__SSSE3__)
+#	include <tmmintrin.h>
+#elif defined(__SSE2__)
+#	include <emmintrin.h>
+#endif
+
+static const char base64_digits[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char hex_digits[16] = "0123456789abcdef";
+
+//Digit values plus one, so that 0 means "not a digit". Base64 also takes the URL-safe alphabet's - and _.
+static const unsigned char base64_values[256] = {
+	['A'] =  1, ['B'] =  2, ['C'] =  3, ['D'] =  4, ['E'] =  5, ['F'] =  6, ['G'] =  7, ['H'] =  8,
+	['I'] =  9, ['J'] = 10, ['K'] = 11, ['L'] = 12, ['M'] = 13, ['N'] = 14, ['O'] = 15, ['P'] = 16,
+	['Q'] = 17, ['R'] = 18, ['S'] = 19, ['T'] = 20, ['U'] = 21, ['V'] = 22, ['W'] = 23, ['X'] = 24,
+	['Y'] = 25, ['Z'] = 26, ['a'] = 27, ['b'] = 28, ['c'] = 29, ['d'] = 30, ['e'] = 31, ['f'] = 32,
+	['g'] = 33, ['h'] = 34, ['i'] = 35, ['j'] = 36, ['k'] = 37, ['l'] = 38, ['m'] = 39, ['n'] = 40,
+	['o'] = 41, ['p'] = 42, ['q'] = 43, ['r'] = 44, ['s'] = 45, ['t'] = 46, ['u'] = 47, ['v'] = 48,
+	['w'] = 49, ['x'] = 50, ['y'] = 51, ['z'] = 52, ['0'] = 53, ['1'] = 54, ['2'] = 55, ['3'] = 56,
+	['4'] = 57, ['5'] = 58, ['6'] = 59, ['7'] = 60, ['8'] = 61, ['9'] = 62, ['+'] = 63, ['/'] = 64,
+	['-'] = 63, ['_'] = 64,
+};
+static const unsigned char hex_values[256] = {
+	['0'] =  1, ['1'] =  2, ['2'] =  3, ['3'] =  4, ['4'] =  5, ['5'] =  6, ['6'] =  7, ['7'] =  8,
+	['8'] =  9, ['9'] = 10, ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+static inline bool is_whitespace(unsigned char c) {
+	return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
+bool pb_bintext_format_for_name(const char *name, enum pb_bintext_format *out_format) {
+	if(strcasecmp(name, "base64") == 0)
+		*out_format = pb_bintext_base64;
+	else if(strcasecmp(name, "hex") == 0)
+		*out_format = pb_bintext_hex;
+	else
+		return false;
+	return true;
+}
+const char *pb_bintext_format_name(enum pb_bintext_format format) {
+	switch(format) {
+		case pb_bintext_base64: return "base64";
+		case pb_bintext_hex:    return "hex";
+		case pb_bintext_none:   break;
+	}
+	return "none";
+}
+
+#pragma mark Encoding
+
+#if defined(__SSSE3__)
+//Spreads 12 bytes out into 16 six-bit values, one per byte. (After Wojciech Muła and Alfred Klomp's base64 work.)
+static inline __m128i base64_reshuffle(__m128i in) {
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	__m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+	__m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	__m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+	__m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(t1, t3);
+}
+//Turns six-bit values into base64 digits by adding the offset for the range each one falls in.
+static inline __m128i base64_translate(__m128i in) {
+	const __m128i offsets = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+	__m128i indices = _mm_subs_epu8(in, _mm_set1_epi8(51));
+	__m128i is_lowercase_or_more = _mm_cmpgt_epi8(in, _mm_set1_epi8(25));
+	indices = _mm_sub_epi8(indices, is_lowercase_or_more);
+	return _mm_add_epi8(in, _mm_shuffle_epi8(offsets, indices));
+}
+#endif
+
+//Encodes whole three-byte groups; in_length must be a multiple of 3. Returns the number of characters written.
+static size_t base64_encode_groups(const unsigned char *in, size_t in_length, char *out) {
+	char *start = out;
+#if defined(__SSSE3__)
+	//Each step reads 16 bytes but uses only 12 of them, so stop while there are still 16 to read.
+	while(in_length >= 16U) {
+		__m128i block = _mm_loadu_si128((const __m128i *)in);
+		_mm_storeu_si128((__m128i *)out, base64_translate(base64_reshuffle(block)));
+		in += 12;
+		in_length -= 12U;
+		out += 16;
+	}
+#endif
+	for(; in_length >= 3U; in += 3, in_length -= 3U) {
+		uint32_t group = ((uint32_t)in[0] << 16) | ((uint32_t)in[1] << 8) | (uint32_t)in[2];
+		*out++ = base64_digits[(group >> 18) & 0x3FU];
+		*out++ = base64_digits[(group >> 12) & 0x3FU];
+		*out++ = base64_digits[(group >>  6) & 0x3FU];
+		*out++ = base64_digits[ group        & 0x3FU];
+	}
+	return (size_t)(out - start);
+}
+
+static size_t hex_encode(const unsigned char *in, size_t in_length, char *out) {
+	char *start = out;
+#if defined(__SSE2__)
+	//Sixteen bytes at a time: split into nibbles, turn each into '0'-'9' or 'a'-'f', and interleave high and low.
+	const __m128i low_mask = _mm_set1_epi8(0x0F), nine = _mm_set1_epi8(9), zero_digit = _mm_set1_epi8('0'), letter_adjust = _mm_set1_epi8('a' - '0' - 10);
+	for(; in_length >= 16U; in += 16, in_length -= 16U, out += 32) {
+		__m128i block = _mm_loadu_si128((const __m128i *)in);
+		__m128i high = _mm_and_si128(_mm_srli_epi16(block, 4), low_mask);
+		__m128i low  = _mm_and_si128(block, low_mask);
+		high = _mm_add_epi8(_mm_add_epi8(high, zero_digit), _mm_and_si128(_mm_cmpgt_epi8(high, nine), letter_adjust));
+		low  = _mm_add_epi8(_mm_add_epi8(low,  zero_digit), _mm_and_si128(_mm_cmpgt_epi8(low,  nine), letter_adjust));
+		_mm_storeu_si128((__m128i *)out,        _mm_unpacklo_epi8(high, low));
+		_mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi8(high, low));
+	}
+#endif
+	for(; in_length; ++in, --in_length) {
+		*out++ = hex_digits[*in >> 4];
+		*out++ = hex_digits[*in & 0x0FU];
+	}
+	return (size_t)(out - start);
+}
+
+void pb_bintext_encoder_init(struct pb_bintext_encoder *encoder, enum pb_bintext_format format) {
+	encoder->format = format;
+	encoder->num_held = 0U;
+}
+size_t pb_bintext_encoded_length_max(enum pb_bintext_format format, size_t in_length) {
+	switch(format) {
+		case pb_bintext_base64: return ((in_length + 2U) / 3U) * 4U + 4U;
+		case pb_bintext_hex:    return in_length * 2U;
+		case pb_bintext_none:   break;
+	}
+	return in_length;
+}
+
+size_t pb_bintext_encode(struct pb_bintext_encoder *encoder, const void *in, size_t in_length, char *out) {
+	const unsigned char *p = in;
+	if(encoder->format == pb_bintext_hex)
+		return hex_encode(p, in_length, out);
+	if(encoder->format != pb_bintext_base64) {
+		memcpy(out, p, in_length);
+		return in_length;
+	}
+
+	size_t n = 0U;
+	if(encoder->num_held) {
+		//Finish the group left over from last time, if this piece has enough to do it.
+		unsigned char group[3];
+		memcpy(group, encoder->held, encoder->num_held);
+		size_t needed = 3U - encoder->num_held;
+		if(in_length < needed) {
+			memcpy(&encoder->held[encoder->num_held], p, in_length);
+			encoder->num_held += (unsigned)in_length;
+			return 0U;
+		}
+		memcpy(&group[encoder->num_held], p, needed);
+		p += needed;
+		in_length -= needed;
+		encoder->num_held = 0U;
+		n += base64_encode_groups(group, 3U, out);
+	}
+
+	size_t whole_groups_length = in_length - (in_length % 3U);
+	n += base64_encode_groups(p, whole_groups_length, out + n);
+	encoder->num_held = (unsigned)(in_length - whole_groups_length);
+	memcpy(encoder->held, p + whole_groups_length, encoder->num_held);
+	return n;
+}
+size_t pb_bintext_encode_finish(struct pb_bintext_encoder *encoder, char *out) {
+	if((encoder->format != pb_bintext_base64) || !encoder->num_held)
+		return 0U;
+
+	uint32_t group = (uint32_t)encoder->held[0] << 16;
+	if(encoder->num_held > 1U)
+		group |= (uint32_t)encoder->held[1] << 8;
+	out[0] = base64_digits[(group >> 18) & 0x3FU];
+	out[1] = base64_digits[(group >> 12) & 0x3FU];
+	out[2] = (encoder->num_held > 1U) ? base64_digits[(group >> 6) & 0x3FU] : '=';
+	out[3] = '=';
+	encoder->num_held = 0U;
+	return 4U;
+}
+
+#pragma mark Decoding
+
+void pb_bintext_decoder_init(struct pb_bintext_decoder *decoder, enum pb_bintext_format format) {
+	decoder->format = format;
+	decoder->num_held = 0U;
+	decoder->finished = false;
+}
+size_t pb_bintext_decoded_length_max(enum pb_bintext_format format, size_t in_length) {
+	switch(format) {
+		case pb_bintext_base64: return ((in_length + 4U) / 4U) * 3U;
+		case pb_bintext_hex:    return (in_length + 2U) / 2U;
+		case pb_bintext_none:   break;
+	}
+	return in_length;
+}
+
+//Turns the held base64 digits (2 to 4 of them) into bytes.
+static size_t base64_flush_held(struct pb_bintext_decoder *decoder, unsigned char *out) {
+	const unsigned char *v = decoder->held;
+	size_t n = 0U;
+	if(decoder->num_held >= 2U)
+		out[n++] = (unsigned char)((v[0] << 2) | (v[1] >> 4));
+	if(decoder->num_held >= 3U)
+		out[n++] = (unsigned char)((v[1] << 4) | (v[2] >> 2));
+	if(decoder->num_held >= 4U)
+		out[n++] = (unsigned char)((v[2] << 6) | v[3]);
+	decoder->num_held = 0U;
+	return n;
+}
+
+static bool base64_decode(struct pb_bintext_decoder *decoder, const unsigned char *p, const unsigned char *end, unsigned char *out, size_t *out_length) {
+	size_t n = 0U;
+	while(p < end) {
+		//Four digits at a time, as long as nothing is held over and there's no whitespace or padding in the way.
+		if(!decoder->num_held && !decoder->finished) {
+			while((size_t)(end - p) >= 4U) {
+				unsigned a = base64_values[p[0]], b = base64_values[p[1]], c = base64_values[p[2]], d = base64_values[p[3]];
+				if(!(a && b && c && d))
+					break;
+				uint32_t group = ((uint32_t)(a - 1U) << 18) | ((uint32_t)(b - 1U) << 12) | ((uint32_t)(c - 1U) << 6) | (uint32_t)(d - 1U);
+				out[n++] = (unsigned char)(group >> 16);
+				out[n++] = (unsigned char)(group >> 8);
+				out[n++] = (unsigned char)group;
+				p += 4;
+			}
+			if(p >= end)
+				break;
+		}
+
+		unsigned char c = *p++;
+		unsigned value = base64_values[c];
+		if(is_whitespace(c))
+			continue;
+		if(c == '=') {
+			//Padding ends the data. It may only follow two or three digits of a group (or more padding).
+			if(!decoder->finished) {
+				if(decoder->num_held < 2U)
+					return false;
+				n += base64_flush_held(decoder, &out[n]);
+				decoder->finished = true;
+			}
+			continue;
+		}
+		if(!value || decoder->finished)
+			return false;
+		decoder->held[decoder->num_held++] = (unsigned char)(value - 1U);
+		if(decoder->num_held == 4U)
+			n += base64_flush_held(decoder, &out[n]);
+	}
+	*out_length = n;
+	return true;
+}
+
+static bool hex_decode(struct pb_bintext_decoder *decoder, const unsigned char *p, const unsigned char *end, unsigned char *out, size_t *out_length) {
+	size_t n = 0U;
+	while(p < end) {
+		if(!decoder->num_held) {
+			while((size_t)(end - p) >= 2U) {
+				unsigned high = hex_values[p[0]], low = hex_values[p[1]];
+				if(!(high && low))
+					break;
+				out[n++] = (unsigned char)(((high - 1U) << 4) | (low - 1U));
+				p += 2;
+			}
+			if(p >= end)
+				break;
+		}
+
+		unsigned char c = *p++;
+		unsigned value = hex_values[c];
+		if(is_whitespace(c))
+			continue;
+		if(!value)
+			return false;
+		if(decoder->num_held) {
+			out[n++] = (unsigned char)((decoder->held[0] << 4) | (value - 1U));
+			decoder->num_held = 0U;
+		} else {
+			decoder->held[0] = (unsigned char)(value - 1U);
+			decoder->num_held = 1U;
+		}
+	}
+	*out_length = n;
+	return true;
+}
+
+bool pb_bintext_decode(struct pb_bintext_decoder *decoder, const char *in, size_t in_length, unsigned char *out, size_t *out_length) {
+	const unsigned char *p = (const unsigned char *)in;
+	switch(decoder->format) {
+		case pb_bintext_base64:
+			return base64_decode(decoder, p, p + in_length, out, out_length);
+		case pb_bintext_hex:
+			return hex_decode(decoder, p, p + in_length, out, out_length);
+		case pb_bintext_none:
+			break;
+	}
+	memcpy(out, p, in_length);
+	*out_length = in_length;
+	return true;
+}
+bool pb_bintext_decode_finish(struct pb_bintext_decoder *decoder, unsigned char *out, size_t *out_length) {
+	*out_length = 0U;
+	if(!decoder->num_held)
+		return true;
+	//A lone base64 digit or hex digit is half a byte at best.
+	if((decoder->format != pb_bintext_base64) || (decoder->num_held < 2U))
+		return false;
+	*out_length = base64_flush_held(decoder, out);
+	return true;
+}
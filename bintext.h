@@ -0,0 +1,44 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+//Ways of writing binary data as text.
+enum pb_bintext_format {
+	pb_bintext_none,
+	pb_bintext_base64, //RFC 4648, with padding, no line breaks
+	pb_bintext_hex,    //Lowercase, two digits per byte
+};
+
+//Looks up a format by name ("base64", "hex"), ignoring case. Returns false if the name is not one we know.
+bool pb_bintext_format_for_name(const char *name, enum pb_bintext_format *out_format);
+const char *pb_bintext_format_name(enum pb_bintext_format format);
+
+//Data can be fed to the encoder in pieces of any size; the bytes that don't make a whole group yet are held over to the next piece.
+struct pb_bintext_encoder {
+	enum pb_bintext_format format;
+	unsigned char held[2];
+	unsigned num_held;
+};
+
+void pb_bintext_encoder_init(struct pb_bintext_encoder *encoder, enum pb_bintext_format format);
+//The most text that one call to pb_bintext_encode with in_length bytes (or pb_bintext_encode_finish) can produce.
+size_t pb_bintext_encoded_length_max(enum pb_bintext_format format, size_t in_length);
+//Encodes as much of the data as makes whole groups. Returns the number of characters written to out.
+size_t pb_bintext_encode(struct pb_bintext_encoder *encoder, const void *in, size_t in_length, char *out);
+//Encodes whatever bytes are still held, with padding. Returns the number of characters written to out.
+size_t pb_bintext_encode_finish(struct pb_bintext_encoder *encoder, char *out);
+
+//Text can be fed to the decoder in pieces of any size. Whitespace (including line breaks) is ignored anywhere.
+struct pb_bintext_decoder {
+	enum pb_bintext_format format;
+	unsigned char held[4]; //Digit values that don't make a whole group yet
+	unsigned num_held;
+	bool finished; //Padding has been seen; nothing but more padding and whitespace may follow.
+};
+
+void pb_bintext_decoder_init(struct pb_bintext_decoder *decoder, enum pb_bintext_format format);
+//The most data that one call to pb_bintext_decode with in_length characters (or pb_bintext_decode_finish) can produce.
+size_t pb_bintext_decoded_length_max(enum pb_bintext_format format, size_t in_length);
+//Decodes a piece of text. Returns false if it contains anything other than digits of the format, padding, and whitespace.
+bool pb_bintext_decode(struct pb_bintext_decoder *decoder, const char *in, size_t in_length, unsigned char *out, size_t *out_length);
+//Decodes whatever is still held (base64 without its padding, for instance). Returns false if the text ended in the middle of a byte.
+bool pb_bintext_decode_finish(struct pb_bintext_decoder *decoder, unsigned char *out, size_t *out_length);
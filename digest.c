@@ -0,0 +1,224 @@
+#include "digest.h"
+
+#include <string.h>
+
+#pragma mark XXH64
+
+//XXH64 as specified by Yann Collet (https://github.com/Cyan4973/xxHash). The four lanes are independent of each other until the very end, which lets the CPU (and the compiler's vectorizer) work on them in parallel.
+
+static const uint64_t xxh64_prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t xxh64_prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t xxh64_prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t xxh64_prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t xxh64_prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t xxh64_rotl(uint64_t x, unsigned r) {
+	return (x << r) | (x >> (64U - r));
+}
+static inline uint64_t xxh64_read64(const unsigned char *p) {
+	//Always little-endian, regardless of the host.
+	return ((uint64_t)p[0])       | ((uint64_t)p[1] << 8)  | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+	     | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+static inline uint32_t xxh64_read32(const unsigned char *p) {
+	return ((uint32_t)p[0]) | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+	acc += input * xxh64_prime2;
+	acc  = xxh64_rotl(acc, 31);
+	return acc * xxh64_prime1;
+}
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t lane) {
+	acc ^= xxh64_round(0, lane);
+	return acc * xxh64_prime1 + xxh64_prime4;
+}
+
+//Consumes as many whole 32-byte stripes as there are. Returns the number of bytes consumed.
+static size_t xxh64_consume_stripes(uint64_t lanes[4], const unsigned char *p, size_t length) {
+	uint64_t v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+	const unsigned char *start = p;
+	const unsigned char *limit = p + (length & ~(size_t)31U);
+	while(p < limit) {
+		v1 = xxh64_round(v1, xxh64_read64(p));
+		v2 = xxh64_round(v2, xxh64_read64(p + 8));
+		v3 = xxh64_round(v3, xxh64_read64(p + 16));
+		v4 = xxh64_round(v4, xxh64_read64(p + 24));
+		p += 32;
+	}
+	lanes[0] = v1; lanes[1] = v2; lanes[2] = v3; lanes[3] = v4;
+	return (size_t)(p - start);
+}
+
+static void xxh64_init(struct pb_digest_context *context) {
+	const uint64_t seed = 0U;
+	context->state.xxh64.total_length = 0U;
+	context->state.xxh64.lanes[0] = seed + xxh64_prime1 + xxh64_prime2;
+	context->state.xxh64.lanes[1] = seed + xxh64_prime2;
+	context->state.xxh64.lanes[2] = seed;
+	context->state.xxh64.lanes[3] = seed - xxh64_prime1;
+	context->state.xxh64.buffer_length = 0U;
+}
+static void xxh64_update(struct pb_digest_context *context, const unsigned char *p, size_t length) {
+	context->state.xxh64.total_length += length;
+
+	unsigned buffer_length = context->state.xxh64.buffer_length;
+	if(buffer_length) {
+		//Top off the partial stripe left over from the last update.
+		size_t fill = 32U - buffer_length;
+		if(fill > length)
+			fill = length;
+		memcpy(&context->state.xxh64.buffer[buffer_length], p, fill);
+		buffer_length += fill;
+		p += fill;
+		length -= fill;
+		if(buffer_length < 32U) {
+			context->state.xxh64.buffer_length = buffer_length;
+			return;
+		}
+		xxh64_consume_stripes(context->state.xxh64.lanes, context->state.xxh64.buffer, 32U);
+		buffer_length = 0U;
+	}
+
+	size_t consumed = xxh64_consume_stripes(context->state.xxh64.lanes, p, length);
+	p += consumed;
+	length -= consumed;
+
+	memcpy(context->state.xxh64.buffer, p, length);
+	context->state.xxh64.buffer_length = (unsigned)length;
+}
+static uint64_t xxh64_final(struct pb_digest_context *context) {
+	const uint64_t *lanes = context->state.xxh64.lanes;
+	uint64_t h;
+	if(context->state.xxh64.total_length >= 32U) {
+		h = xxh64_rotl(lanes[0], 1) + xxh64_rotl(lanes[1], 7) + xxh64_rotl(lanes[2], 12) + xxh64_rotl(lanes[3], 18);
+		h = xxh64_merge_round(h, lanes[0]);
+		h = xxh64_merge_round(h, lanes[1]);
+		h = xxh64_merge_round(h, lanes[2]);
+		h = xxh64_merge_round(h, lanes[3]);
+	} else {
+		//Never got a full stripe; lane 2 still holds the seed.
+		h = lanes[2] + xxh64_prime5;
+	}
+	h += context->state.xxh64.total_length;
+
+	const unsigned char *p = context->state.xxh64.buffer;
+	unsigned remaining = context->state.xxh64.buffer_length;
+	for(; remaining >= 8U; p += 8, remaining -= 8U) {
+		h ^= xxh64_round(0, xxh64_read64(p));
+		h  = xxh64_rotl(h, 27) * xxh64_prime1 + xxh64_prime4;
+	}
+	if(remaining >= 4U) {
+		h ^= (uint64_t)xxh64_read32(p) * xxh64_prime1;
+		h  = xxh64_rotl(h, 23) * xxh64_prime2 + xxh64_prime3;
+		p += 4;
+		remaining -= 4U;
+	}
+	for(; remaining; ++p, --remaining) {
+		h ^= (*p) * xxh64_prime5;
+		h  = xxh64_rotl(h, 11) * xxh64_prime1;
+	}
+
+	h ^= h >> 33;
+	h *= xxh64_prime2;
+	h ^= h >> 29;
+	h *= xxh64_prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+#pragma mark -
+
+bool pb_digest_algorithm_for_name(const char *name, enum pb_digest_algorithm *out_algorithm) {
+	enum pb_digest_algorithm algorithm;
+	if((name == NULL) || (strcmp(name, "xxh64") == 0) || (strcmp(name, "xxhash") == 0))
+		algorithm = pb_digest_xxh64;
+	else if((strcmp(name, "sha256") == 0) || (strcmp(name, "sha-256") == 0))
+		algorithm = pb_digest_sha256;
+	else
+		return false;
+
+	if(out_algorithm)
+		*out_algorithm = algorithm;
+	return true;
+}
+const char *pb_digest_name(enum pb_digest_algorithm algorithm) {
+	switch(algorithm) {
+		case pb_digest_xxh64:  return "xxh64";
+		case pb_digest_sha256: return "sha256";
+	}
+	return "???";
+}
+size_t pb_digest_length(enum pb_digest_algorithm algorithm) {
+	switch(algorithm) {
+		case pb_digest_xxh64:  return sizeof(uint64_t);
+		case pb_digest_sha256: return CC_SHA256_DIGEST_LENGTH;
+	}
+	return 0U;
+}
+
+void pb_digest_init(struct pb_digest_context *context, enum pb_digest_algorithm algorithm) {
+	context->algorithm = algorithm;
+	switch(algorithm) {
+		case pb_digest_xxh64:
+			xxh64_init(context);
+			break;
+		case pb_digest_sha256:
+			CC_SHA256_Init(&context->state.sha256);
+			break;
+	}
+}
+void pb_digest_update(struct pb_digest_context *context, const void *bytes, size_t length) {
+	switch(context->algorithm) {
+		case pb_digest_xxh64:
+			xxh64_update(context, bytes, length);
+			break;
+		case pb_digest_sha256:
+			//CC_LONG is only 32 bits wide, so feed enormous buffers in pieces.
+			while(length) {
+				CC_LONG this_length = (length > 0x40000000U) ? 0x40000000U : (CC_LONG)length;
+				CC_SHA256_Update(&context->state.sha256, bytes, this_length);
+				bytes = (const unsigned char *)bytes + this_length;
+				length -= this_length;
+			}
+			break;
+	}
+}
+void pb_digest_final(struct pb_digest_context *context, unsigned char *out_digest) {
+	switch(context->algorithm) {
+		case pb_digest_xxh64: {
+			//Canonical (big-endian) order, same as xxhsum prints.
+			uint64_t h = xxh64_final(context);
+			for(unsigned i = 0U; i < 8U; ++i)
+				out_digest[i] = (unsigned char)(h >> (56U - (i * 8U)));
+			break;
+		}
+		case pb_digest_sha256:
+			CC_SHA256_Final(out_digest, &context->state.sha256);
+			break;
+	}
+}
+
+void pb_digest_buffer(enum pb_digest_algorithm algorithm, const void *bytes, size_t length, unsigned char *out_digest) {
+	enum { chunk_size = 1048576U };
+
+	struct pb_digest_context context;
+	pb_digest_init(&context, algorithm);
+	while(length) {
+		size_t this_length = (length > chunk_size) ? chunk_size : length;
+		pb_digest_update(&context, bytes, this_length);
+		bytes = (const unsigned char *)bytes + this_length;
+		length -= this_length;
+	}
+	pb_digest_final(&context, out_digest);
+}
+
+char *pb_digest_format_hex(const unsigned char *digest, size_t length, char *out_hex) {
+	static const char hex_digits[16] = "0123456789abcdef";
+	char *p = out_hex;
+	for(size_t i = 0U; i < length; ++i) {
+		*p++ = hex_digits[digest[i] >> 4];
+		*p++ = hex_digits[digest[i] & 0xf];
+	}
+	*p = '\0';
+	return out_hex;
+}
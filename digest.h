@@ -0,0 +1,44 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <CommonCrypto/CommonDigest.h>
+
+enum pb_digest_algorithm {
+	pb_digest_xxh64,  //Fast, non-cryptographic (64-bit XXH64). The default.
+	pb_digest_sha256, //Cryptographic (SHA-256, from CommonCrypto).
+};
+
+enum { pb_digest_max_length = CC_SHA256_DIGEST_LENGTH };
+
+struct pb_digest_context {
+	enum pb_digest_algorithm algorithm;
+	union {
+		struct {
+			uint64_t total_length;
+			uint64_t lanes[4];
+			unsigned char buffer[32];
+			unsigned buffer_length;
+		} xxh64;
+		CC_SHA256_CTX sha256;
+	} state;
+};
+
+/*
+ *Looks up an algorithm by the name the user gave (e.g. "xxh64", "sha256"). NULL gets you the default algorithm.
+ *Returns false if the name is not one we know.
+ */
+bool pb_digest_algorithm_for_name(const char *name, enum pb_digest_algorithm *out_algorithm);
+const char *pb_digest_name(enum pb_digest_algorithm algorithm);
+//Length in bytes of a finished digest.
+size_t pb_digest_length(enum pb_digest_algorithm algorithm);
+
+//Streaming interface. Feed data with update as many times as you like; out_digest must have room for pb_digest_length bytes.
+void pb_digest_init(struct pb_digest_context *context, enum pb_digest_algorithm algorithm);
+void pb_digest_update(struct pb_digest_context *context, const void *bytes, size_t length);
+void pb_digest_final(struct pb_digest_context *context, unsigned char *out_digest);
+
+//One-shot. The buffer is fed to the streaming interface in chunks, so this works on buffers of any size.
+void pb_digest_buffer(enum pb_digest_algorithm algorithm, const void *bytes, size_t length, unsigned char *out_digest);
+
+//Writes the digest as lowercase hex, NUL-terminated. out_hex must have room for (length * 2 + 1) chars. Returns out_hex.
+char *pb_digest_format_hex(const unsigned char *digest, size_t length, char *out_hex);
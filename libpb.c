@@ -0,0 +1,1050 @@
+#include <CoreFoundation/CoreFoundation.h>
+#include <ApplicationServices/ApplicationServices.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dispatch/dispatch.h>
+#include "libpb.h"
+#include "digest.h"
+#include "markup.h"
+
+struct pb_pasteboard {
+	PasteboardRef ref;
+	unsigned long timeout_msec; //0 means as long as it takes.
+	pb_unavailable_flavor_callback unavailable_flavor_callback;
+	void *unavailable_flavor_context;
+	pb_flavor_data_copier copy_flavor_data;
+	//One reference for the handle, and one for each fetch still running on a worker thread. Fetches we've given up on can outlive the handle, so this does too; whoever lets go last frees it.
+	int32_t *fetch_references;
+};
+
+static CFStringRef MacRoman_UTI = CFSTR("com.apple.traditional-mac-plain-text");
+const CFStringRef pb_copied_digest_type = CFSTR("org.boredzo.pb.copied-digest");
+
+//Returns a malloc'd UTF-8 copy of the string, or NULL if memory runs out.
+static char *copy_cstr_for_CFStr(CFStringRef string) {
+	CFIndex size = CFStringGetMaximumSizeForEncoding(CFStringGetLength(string), kCFStringEncodingUTF8) + 1;
+	char *buf = malloc((size_t)size);
+	if(buf && !CFStringGetCString(string, buf, size, kCFStringEncodingUTF8)) {
+		free(buf);
+		buf = NULL;
+	}
+	return buf;
+}
+
+#pragma mark Handles
+
+static pb_status open_pasteboard(CFStringRef name, pb_pasteboard **out_pasteboard) {
+	pb_pasteboard *pasteboard = calloc(1U, sizeof(pb_pasteboard));
+	int32_t *fetch_references = pasteboard ? malloc(sizeof(int32_t)) : NULL;
+	if(!fetch_references) {
+		free(pasteboard);
+		return memFullErr;
+	}
+	OSStatus err = PasteboardCreate(name, &(pasteboard->ref));
+	if(err != noErr) {
+		free(fetch_references);
+		free(pasteboard);
+		return err;
+	}
+	*fetch_references = 1;
+	pasteboard->fetch_references = fetch_references;
+	pasteboard->copy_flavor_data = PasteboardCopyItemFlavorData;
+	*out_pasteboard = pasteboard;
+	return noErr;
+}
+pb_status pb_pasteboard_open(const char *name, pb_pasteboard **out_pasteboard) {
+	if(!name)
+		return open_pasteboard(kPasteboardClipboard, out_pasteboard);
+
+	CFStringRef nameCF = CFStringCreateWithCString(kCFAllocatorDefault, name, kCFStringEncodingUTF8);
+	if(!nameCF)
+		return paramErr;
+	pb_status err = open_pasteboard(nameCF, out_pasteboard);
+	CFRelease(nameCF);
+	return err;
+}
+pb_status pb_pasteboard_open_unique(pb_pasteboard **out_pasteboard) {
+	return open_pasteboard(kPasteboardUniqueName, out_pasteboard);
+}
+static void release_fetch_references(int32_t *fetch_references) {
+	if(__atomic_sub_fetch(fetch_references, 1, __ATOMIC_ACQ_REL) == 0)
+		free(fetch_references);
+}
+void pb_pasteboard_close(pb_pasteboard *pasteboard) {
+	if(pasteboard) {
+		CFRelease(pasteboard->ref);
+		release_fetch_references(pasteboard->fetch_references);
+		free(pasteboard);
+	}
+}
+
+void pb_pasteboard_set_timeout(pb_pasteboard *pasteboard, unsigned long msec) {
+	pasteboard->timeout_msec = msec;
+}
+void pb_pasteboard_set_unavailable_flavor_callback(pb_pasteboard *pasteboard, pb_unavailable_flavor_callback callback, void *context) {
+	pasteboard->unavailable_flavor_callback = callback;
+	pasteboard->unavailable_flavor_context = context;
+}
+PasteboardRef pb_pasteboard_get_ref(pb_pasteboard *pasteboard) {
+	return pasteboard->ref;
+}
+void pb_pasteboard_set_flavor_data_copier(pb_pasteboard *pasteboard, pb_flavor_data_copier copier) {
+	pasteboard->copy_flavor_data = copier ? copier : PasteboardCopyItemFlavorData;
+}
+
+#pragma mark Items
+
+PasteboardItemID pb_random_item_ID(void) {
+	//Item IDs are determined by the application creating the item.
+	//Their meaning is up to that same application.
+	//pb doesn't need to associate any meaning with the item, so we just pull
+	//  the ID out of a hat.
+
+	PasteboardItemID item;
+
+	item = (PasteboardItemID)(unsigned long)arc4random();
+
+	//An item ID of 0 is illegal. Make sure it doesn't happen.
+	if(item == 0)
+		++item;
+
+	return item;
+}
+PasteboardItemID pb_sequential_item_ID(CFIndex index) {
+	return (PasteboardItemID)(uintptr_t)(index + 1);
+}
+
+//A fetch of one flavor's data, run on a worker thread so that we can stop waiting for it. The fetch and the thread waiting on it each hold a reference; whichever lets go last frees it, so a fetch that finishes after we've given up on it cleans up after itself.
+struct flavor_fetch {
+	pb_flavor_data_copier copy_flavor_data;
+	int32_t *fetch_references;
+	PasteboardRef pasteboard;
+	PasteboardItemID item;
+	CFStringRef type;
+	CFDataRef data;
+	OSStatus err;
+	dispatch_semaphore_t done;
+	int32_t refcount;
+};
+static void release_flavor_fetch(struct flavor_fetch *fetch) {
+	if(__atomic_sub_fetch(&(fetch->refcount), 1, __ATOMIC_ACQ_REL) == 0) {
+		if(fetch->data)
+			CFRelease(fetch->data);
+		CFRelease(fetch->type);
+		CFRelease(fetch->pasteboard);
+		dispatch_release(fetch->done);
+		free(fetch);
+	}
+}
+static void run_flavor_fetch(void *context) {
+	struct flavor_fetch *fetch = context;
+	int32_t *fetch_references = fetch->fetch_references;
+	fetch->err = fetch->copy_flavor_data(fetch->pasteboard, fetch->item, fetch->type, &(fetch->data));
+	dispatch_semaphore_signal(fetch->done);
+	release_flavor_fetch(fetch);
+	release_fetch_references(fetch_references);
+}
+
+/*PasteboardCopyItemFlavorData, within the handle's timeout.
+ *An app that promised a flavor renders it when asked, and may take its time about it, or never answer at all. If the data doesn't arrive in time, this returns kMPTimeoutErr and leaves the fetch to finish (or not) on its own thread.
+ *Each of those threads is stuck for as long as the app doesn't answer, so there can only be pb_max_outstanding_fetches of them per handle. Past that, this returns kMPInsufficientResourcesErr without asking until one of them finishes.
+ */
+OSStatus pb_copy_flavor_data(pb_pasteboard *pasteboard, PasteboardItemID item, CFStringRef type, CFDataRef *outData) {
+	if(!pasteboard->timeout_msec)
+		return pasteboard->copy_flavor_data(pasteboard->ref, item, type, outData);
+
+	//The handle's own reference doesn't count against the limit.
+	if(__atomic_add_fetch(pasteboard->fetch_references, 1, __ATOMIC_ACQ_REL) > pb_max_outstanding_fetches + 1) {
+		release_fetch_references(pasteboard->fetch_references);
+		return kMPInsufficientResourcesErr;
+	}
+	struct flavor_fetch *fetch = calloc(1U, sizeof(struct flavor_fetch));
+	dispatch_semaphore_t done = fetch ? dispatch_semaphore_create(0) : NULL;
+	if(!done) {
+		free(fetch);
+		release_fetch_references(pasteboard->fetch_references);
+		return memFullErr;
+	}
+	fetch->copy_flavor_data = pasteboard->copy_flavor_data;
+	fetch->fetch_references = pasteboard->fetch_references;
+	fetch->pasteboard = (PasteboardRef)CFRetain(pasteboard->ref);
+	fetch->item = item;
+	fetch->type = CFRetain(type);
+	fetch->done = done;
+	fetch->refcount = 2;
+	dispatch_async_f(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), fetch, run_flavor_fetch);
+
+	OSStatus err = kMPTimeoutErr;
+	if(dispatch_semaphore_wait(done, dispatch_time(DISPATCH_TIME_NOW, (int64_t)pasteboard->timeout_msec * (int64_t)NSEC_PER_MSEC)) == 0) {
+		err = fetch->err;
+		*outData = fetch->data;
+		fetch->data = NULL;
+	}
+	release_flavor_fetch(fetch);
+	return err;
+}
+
+OSStatus pb_fetch_item(pb_pasteboard *pasteboard, CFIndex itemIndex, const CFStringRef *types, CFIndex numTypes, struct pb_item *out_item) {
+	out_item->ID = NULL;
+	out_item->numFlavors = 0;
+	out_item->flavors = NULL;
+
+	OSStatus err = PasteboardGetItemIdentifier(pasteboard->ref, itemIndex, &(out_item->ID));
+	if(err != noErr)
+		return err;
+
+	CFArrayRef flavorTypes = NULL;
+	err = PasteboardCopyItemFlavors(pasteboard->ref, out_item->ID, &flavorTypes);
+	if(err != noErr)
+		return err;
+
+	CFIndex numFlavorTypes = CFArrayGetCount(flavorTypes);
+	out_item->flavors = calloc(numFlavorTypes ? (size_t)numFlavorTypes : 1U, sizeof(struct pb_flavor));
+	if(!(out_item->flavors)) {
+		CFRelease(flavorTypes);
+		return memFullErr;
+	}
+
+	for(CFIndex i = 0; i < numFlavorTypes; ++i) {
+		CFStringRef flavorType = CFArrayGetValueAtIndex(flavorTypes, i);
+
+		PasteboardFlavorFlags flags = kPasteboardFlavorNoFlags;
+		PasteboardGetItemFlavorFlags(pasteboard->ref, out_item->ID, flavorType, &flags);
+
+		Boolean wanted = (types == NULL) && !(flags & kPasteboardFlavorSystemTranslated);
+		for(CFIndex j = 0; (!wanted) && (j < numTypes); ++j)
+			wanted = UTTypeConformsTo(flavorType, types[j]);
+		if(!wanted)
+			continue;
+
+		CFDataRef data = NULL;
+		OSStatus flavorErr = pb_copy_flavor_data(pasteboard, out_item->ID, flavorType, &data);
+		if(flavorErr != noErr) {
+			bool skips = false;
+			if(pasteboard->unavailable_flavor_callback) {
+				char *flavorType_cstr = copy_cstr_for_CFStr(flavorType);
+				skips = pasteboard->unavailable_flavor_callback(pasteboard->unavailable_flavor_context, (size_t)itemIndex, flavorType_cstr ? flavorType_cstr : "", flavorErr);
+				free(flavorType_cstr);
+			}
+			if(skips)
+				continue;
+			//Putting the item back without this flavor would lose it, so nobody gets a partial item unless they asked for one.
+			pb_release_item(out_item);
+			CFRelease(flavorTypes);
+			return flavorErr;
+		}
+
+		struct pb_flavor *flavor = &(out_item->flavors[(out_item->numFlavors)++]);
+		flavor->type  = CFRetain(flavorType);
+		flavor->data  = data;
+		flavor->flags = flags & ~(PasteboardFlavorFlags)pb_flavor_read_only_flags;
+	}
+
+	CFRelease(flavorTypes);
+	return noErr;
+}
+void pb_release_item(struct pb_item *item) {
+	for(CFIndex i = 0; i < item->numFlavors; ++i) {
+		CFRelease(item->flavors[i].type);
+		CFRelease(item->flavors[i].data);
+	}
+	free(item->flavors);
+	item->flavors = NULL;
+	item->numFlavors = 0;
+}
+
+OSStatus pb_publish_items(pb_pasteboard *pasteboard, const struct pb_item *items, CFIndex numItems) {
+	OSStatus err = PasteboardClear(pasteboard->ref);
+	if(err != noErr)
+		return err;
+
+	for(CFIndex i = 0; i < numItems; ++i) {
+		for(CFIndex j = 0; j < items[i].numFlavors; ++j) {
+			const struct pb_flavor *flavor = &(items[i].flavors[j]);
+			err = PasteboardPutItemFlavor(pasteboard->ref, items[i].ID, flavor->type, flavor->data, flavor->flags);
+			if(err != noErr)
+				return err;
+		}
+	}
+
+	return noErr;
+}
+
+static Boolean item_has_flavor_of_type(const struct pb_item *item, CFStringRef type) {
+	for(CFIndex i = 0; i < item->numFlavors; ++i) {
+		if(UTTypeEqual(item->flavors[i].type, type))
+			return true;
+	}
+	return false;
+}
+
+/*The items already there are fetched and published again along with the new flavors, which costs as much as the whole pasteboard. Even the pasteboard's owner, who could put the new flavors straight on, goes through pb_publish_items: one flavor at a time, anyone watching could see the item without its alternates, or with a digest that no longer matches it.
+ */
+OSStatus pb_add_to_pasteboard(pb_pasteboard *pasteboard, struct pb_item *newItem, CFIndex itemIndex) {
+	PasteboardSynchronize(pasteboard->ref);
+
+	ItemCount numItems = 0U;
+	OSStatus err = PasteboardGetItemCount(pasteboard->ref, &numItems);
+	if(err != noErr)
+		return err;
+	if(itemIndex > (CFIndex)numItems)
+		return badPasteboardIndexErr;
+
+	struct pb_item *items = calloc((size_t)numItems + 1U, sizeof(struct pb_item));
+	if(!items)
+		return memFullErr;
+
+	//The IDs come first, so that a new item doesn't take one.
+	for(CFIndex i = 0; (err == noErr) && (i < (CFIndex)numItems); ++i)
+		err = PasteboardGetItemIdentifier(pasteboard->ref, i + 1, &(items[i].ID));
+	if(err != noErr)
+		goto end;
+
+	if(itemIndex) {
+		newItem->ID = items[itemIndex - 1].ID;
+	} else {
+		Boolean taken;
+		do {
+			taken = false;
+			for(CFIndex i = 0; (!taken) && (i < (CFIndex)numItems); ++i)
+				taken = (items[i].ID == newItem->ID);
+			if(taken)
+				newItem->ID = pb_random_item_ID();
+		} while(taken);
+	}
+
+	for(CFIndex i = 0; (err == noErr) && (i < (CFIndex)numItems); ++i) {
+		err = pb_fetch_item(pasteboard, i + 1, /*types*/ NULL, /*numTypes*/ 0, &items[i]);
+		if((err != noErr) || (i + 1 != itemIndex))
+			continue;
+
+		//Drop the flavors being replaced, then add the new ones after the rest.
+		struct pb_flavor *flavors = realloc(items[i].flavors, (size_t)(items[i].numFlavors + newItem->numFlavors) * sizeof(struct pb_flavor));
+		if(!flavors) {
+			err = memFullErr;
+			continue;
+		}
+		items[i].flavors = flavors;
+		CFIndex numKept = 0;
+		for(CFIndex j = 0; j < items[i].numFlavors; ++j) {
+			//The item won't be what its digest describes anymore.
+			if(item_has_flavor_of_type(newItem, flavors[j].type) || UTTypeEqual(flavors[j].type, pb_copied_digest_type)) {
+				CFRelease(flavors[j].type);
+				CFRelease(flavors[j].data);
+			} else
+				flavors[numKept++] = flavors[j];
+		}
+		for(CFIndex j = 0; j < newItem->numFlavors; ++j) {
+			flavors[numKept] = newItem->flavors[j];
+			CFRetain(flavors[numKept].type);
+			CFRetain(flavors[numKept].data);
+			++numKept;
+		}
+		items[i].numFlavors = numKept;
+	}
+	if(err == noErr) {
+		//The new item goes last. It's only borrowed, so it's left out of the cleanup below.
+		CFIndex numItemsToPublish = (CFIndex)numItems;
+		if(!itemIndex)
+			items[numItemsToPublish++] = *newItem;
+		err = pb_publish_items(pasteboard, items, numItemsToPublish);
+	}
+
+end:
+	for(CFIndex i = 0; i < (CFIndex)numItems; ++i)
+		pb_release_item(&items[i]);
+	free(items);
+	return err;
+}
+
+//XXH64 of the type and the data. Including the type's NUL keeps the two from running together.
+static void digest_copied_data(CFStringRef type, CFDataRef data, unsigned char *out_digest) {
+	struct pb_digest_context context;
+	pb_digest_init(&context, pb_digest_xxh64);
+	char *type_cstr = copy_cstr_for_CFStr(type);
+	if(type_cstr)
+		pb_digest_update(&context, type_cstr, strlen(type_cstr) + 1U);
+	free(type_cstr);
+	pb_digest_update(&context, CFDataGetBytePtr(data), (size_t)CFDataGetLength(data));
+	pb_digest_final(&context, out_digest);
+}
+
+//The digest flavor holds the digest, followed by the main flavor's type in UTF-8.
+struct copied_digest {
+	unsigned char digest[pb_digest_max_length];
+	CFStringRef type;
+};
+static CFDataRef create_copied_digest_data(CFStringRef type, CFDataRef data) {
+	char *type_cstr = copy_cstr_for_CFStr(type);
+	size_t digestLength = pb_digest_length(pb_digest_xxh64), typeLength = type_cstr ? strlen(type_cstr) : 0U;
+	CFMutableDataRef digestData = type_cstr ? CFDataCreateMutable(kCFAllocatorDefault, (CFIndex)(digestLength + typeLength)) : NULL;
+	if(digestData) {
+		unsigned char digest[pb_digest_max_length];
+		digest_copied_data(type, data, digest);
+		CFDataAppendBytes(digestData, digest, (CFIndex)digestLength);
+		CFDataAppendBytes(digestData, (const UInt8 *)type_cstr, (CFIndex)typeLength);
+	}
+	free(type_cstr);
+	return digestData;
+}
+static Boolean read_copied_digest(CFDataRef digestData, struct copied_digest *out_digest) {
+	size_t digestLength = pb_digest_length(pb_digest_xxh64);
+	out_digest->type = NULL;
+	if((size_t)CFDataGetLength(digestData) <= digestLength)
+		return false;
+	memcpy(out_digest->digest, CFDataGetBytePtr(digestData), digestLength);
+	out_digest->type = CFStringCreateWithBytes(kCFAllocatorDefault, CFDataGetBytePtr(digestData) + digestLength, CFDataGetLength(digestData) - (CFIndex)digestLength, kCFStringEncodingUTF8, /*isExternalRepresentation*/ false);
+	return (out_digest->type != NULL);
+}
+
+//Whether a flavor of this type could have come from copying data of mainType: the main flavor itself, its digest, or (for text) an alternate encoding.
+static Boolean is_copied_flavor_type(CFStringRef flavorType, CFStringRef mainType, Boolean isText) {
+	if(UTTypeEqual(flavorType, mainType) || UTTypeEqual(flavorType, pb_copied_digest_type))
+		return true;
+	return isText && (UTTypeEqual(flavorType, kUTTypeUTF16PlainText) || UTTypeEqual(flavorType, kUTTypeUTF16ExternalPlainText) || UTTypeEqual(flavorType, kUTTypeUTF8PlainText) || UTTypeEqual(flavorType, MacRoman_UTI));
+}
+
+Boolean pb_pasteboard_holds_copy(pb_pasteboard *pasteboard, CFStringRef type, CFDataRef data) {
+	PasteboardSynchronize(pasteboard->ref);
+	ItemCount numItems = 0U;
+	PasteboardItemID item = NULL;
+	CFArrayRef flavorTypes = NULL;
+	if(!((PasteboardGetItemCount(pasteboard->ref, &numItems) == noErr) && (numItems == 1U)
+	  && (PasteboardGetItemIdentifier(pasteboard->ref, 1, &item) == noErr)
+	  && (PasteboardCopyItemFlavors(pasteboard->ref, item, &flavorTypes) == noErr)))
+		return false;
+
+	//Looking at the types costs nothing; do that before fetching any data.
+	Boolean isText = UTTypeConformsTo(type, kUTTypeUTF16PlainText) || UTTypeConformsTo(type, kUTTypeUTF16ExternalPlainText) || UTTypeConformsTo(type, kUTTypeUTF8PlainText) || UTTypeConformsTo(type, MacRoman_UTI);
+	Boolean hasMainFlavor = false, hasDigest = false, onlyCopiedFlavors = true;
+	for(CFIndex i = 0; onlyCopiedFlavors && (i < CFArrayGetCount(flavorTypes)); ++i) {
+		CFStringRef flavorType = CFArrayGetValueAtIndex(flavorTypes, i);
+		onlyCopiedFlavors = is_copied_flavor_type(flavorType, type, isText);
+		hasMainFlavor = hasMainFlavor || UTTypeEqual(flavorType, type);
+		hasDigest = hasDigest || UTTypeEqual(flavorType, pb_copied_digest_type);
+	}
+	CFRelease(flavorTypes);
+	if(!(onlyCopiedFlavors && hasMainFlavor))
+		return false;
+
+	Boolean same = false;
+	CFDataRef currentData = NULL;
+	if(hasDigest && (pb_copy_flavor_data(pasteboard, item, pb_copied_digest_type, &currentData) == noErr)) {
+		//A few bytes, rather than the whole flavor. If the item was copied as this type, the digest settles it either way.
+		struct copied_digest current;
+		Boolean sameType = read_copied_digest(currentData, &current) && UTTypeEqual(current.type, type);
+		if(sameType) {
+			unsigned char digest[pb_digest_max_length];
+			digest_copied_data(type, data, digest);
+			same = (memcmp(current.digest, digest, pb_digest_length(pb_digest_xxh64)) == 0);
+		}
+		if(current.type)
+			CFRelease(current.type);
+		CFRelease(currentData);
+		if(sameType)
+			return same;
+	}
+	if(pb_copy_flavor_data(pasteboard, item, type, &currentData) == noErr) {
+		same = (CFDataGetLength(currentData) == CFDataGetLength(data)) && (memcmp(CFDataGetBytePtr(currentData), CFDataGetBytePtr(data), (size_t)CFDataGetLength(data)) == 0);
+		CFRelease(currentData);
+	}
+	return same;
+}
+
+void pb_make_copied_item(CFStringRef type, CFDataRef data, struct pb_flavor *flavors, struct pb_item *outItem) {
+	outItem->ID = pb_random_item_ID();
+	outItem->flavors = flavors;
+	outItem->numFlavors = 0;
+
+	//The main flavor always goes first.
+	flavors[outItem->numFlavors++] = (struct pb_flavor){ .type = type, .data = data, .flags = kPasteboardFlavorNoFlags };
+
+	//Translate encodings.
+	CFDataRef UTF16Data = NULL, UTF16ExtData = NULL, UTF8Data = NULL, MacRomanData = NULL;
+	Boolean typeIsUTF16 = false, typeIsUTF16Ext = false, typeIsUTF8 = false, typeIsMacRoman = false;
+	Boolean isTextData = false; //Note: We can't just test conformance to public.text because that includes formats like public.rtf.
+	if(UTTypeConformsTo(type, kUTTypeUTF16PlainText)) {
+		UTF16Data = data;
+		isTextData = typeIsUTF16 = true;
+	} else if(UTTypeConformsTo(type, kUTTypeUTF16ExternalPlainText)) {
+		UTF16ExtData = data;
+		isTextData = typeIsUTF16Ext = true;
+	} else if(UTTypeConformsTo(type, kUTTypeUTF8PlainText)) {
+		UTF8Data = data;
+		isTextData = typeIsUTF8 = true;
+	} else if(UTTypeConformsTo(type, MacRoman_UTI)) {
+		MacRomanData = data;
+		isTextData = typeIsMacRoman = true;
+	}
+	if(isTextData) {
+		pb_convert_text_encodings(&UTF16Data, &UTF16ExtData, &UTF8Data, &MacRomanData);
+		//Only add it if it is not the main flavor.
+		if(UTF16Data && !typeIsUTF16)
+			flavors[outItem->numFlavors++] = (struct pb_flavor){ .type = kUTTypeUTF16PlainText, .data = UTF16Data, .flags = kPasteboardFlavorSenderTranslated };
+		if(UTF16ExtData && !typeIsUTF16Ext)
+			flavors[outItem->numFlavors++] = (struct pb_flavor){ .type = kUTTypeUTF16ExternalPlainText, .data = UTF16ExtData, .flags = kPasteboardFlavorSenderTranslated };
+		if(UTF8Data && !typeIsUTF8)
+			flavors[outItem->numFlavors++] = (struct pb_flavor){ .type = kUTTypeUTF8PlainText, .data = UTF8Data, .flags = kPasteboardFlavorSenderTranslated };
+		if(MacRomanData && !typeIsMacRoman)
+			flavors[outItem->numFlavors++] = (struct pb_flavor){ .type = MacRoman_UTI, .data = MacRomanData, .flags = kPasteboardFlavorSenderTranslated };
+	}
+
+	//Only pb has any use for this, and only while the item is on the pasteboard.
+	CFDataRef digestData = create_copied_digest_data(type, data);
+	if(digestData)
+		flavors[outItem->numFlavors++] = (struct pb_flavor){ .type = pb_copied_digest_type, .data = digestData, .flags = kPasteboardFlavorNotSaved };
+}
+
+#pragma mark Encodings
+
+CFDataRef pb_create_transcoded_data(const UInt8 *bytes, CFIndex length, enum pb_text_encoding from, enum pb_text_encoding to, Boolean addBOM) {
+	const UniChar BOM = 0xFEFF;
+	size_t leading_space = addBOM ? sizeof(BOM) : 0U;
+
+	void *buffer = NULL;
+	size_t convertedLength = 0U;
+	if(!pb_transcode(from, to, bytes, (size_t)length, leading_space, &buffer, &convertedLength))
+		return NULL;
+	if(addBOM)
+		memcpy(buffer, &BOM, sizeof(BOM));
+
+	//The CFData takes ownership of the buffer; no copy.
+	CFDataRef data = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, buffer, (CFIndex)(leading_space + convertedLength), /*bytesDeallocator*/ kCFAllocatorMalloc);
+	if(!data)
+		free(buffer);
+	return data;
+}
+
+//Returns a CFData containing UTF-16 (without BOM) data for the string. Counterpart to CFStringCreateExternalRepresentation.
+static CFDataRef createCFDataFromCFString(CFStringRef string) {
+	CFDataRef data = NULL;
+
+	if(string) {
+		CFRange range = { 0, CFStringGetLength(string) };
+		CFIndex dataSize = range.length * sizeof(UniChar);
+		CFMutableDataRef mutableData = CFDataCreateMutable(kCFAllocatorDefault, dataSize);
+		if(mutableData) {
+			CFDataSetLength(mutableData, dataSize);
+			CFStringGetCharacters(string, range, (UniChar *)CFDataGetMutableBytePtr(mutableData));
+			data = mutableData;/*CFDataCreateCopy(kCFAllocatorDefault, mutableData);
+			CFRelease(mutableData);
+			 */
+		}
+	}
+
+	return data;
+}
+
+//Converts large texts in parallel, directly from the best available encoding to each missing one. Whatever this can't convert (such as characters that MacRoman doesn't have) is left for the CFString-based conversions in pb_convert_text_encodings.
+static void convert_encodings_in_parallel(CFDataRef *inoutUTF16Data, CFDataRef *inoutUTF16ExtData, CFDataRef *inoutUTF8Data, CFDataRef *inoutMacRomanData) {
+	CFDataRef source = NULL;
+	enum pb_text_encoding from = pb_text_encoding_utf8;
+	CFIndex BOMLength = 0;
+	if(inoutUTF8Data && *inoutUTF8Data) {
+		source = *inoutUTF8Data;
+		from = pb_text_encoding_utf8;
+	} else if(inoutUTF16Data && *inoutUTF16Data) {
+		source = *inoutUTF16Data;
+		from = pb_text_encoding_utf16_host;
+	} else if(inoutUTF16ExtData && *inoutUTF16ExtData) {
+		//Same rules as CFStringCreateFromExternalRepresentation: the BOM tells us the byte order, and without one, it's big-endian.
+		source = *inoutUTF16ExtData;
+		from = pb_text_encoding_utf16be;
+		if(CFDataGetLength(source) >= 2) {
+			const UInt8 *bytes = CFDataGetBytePtr(source);
+			if((bytes[0] == 0xFE) && (bytes[1] == 0xFF))
+				BOMLength = 2;
+			else if((bytes[0] == 0xFF) && (bytes[1] == 0xFE)) {
+				BOMLength = 2;
+				from = pb_text_encoding_utf16le;
+			}
+		}
+	} else if(inoutMacRomanData && *inoutMacRomanData) {
+		source = *inoutMacRomanData;
+		from = pb_text_encoding_macroman;
+	}
+
+	if(!source)
+		return;
+	const UInt8 *bytes = CFDataGetBytePtr(source) + BOMLength;
+	CFIndex length = CFDataGetLength(source) - BOMLength;
+	if(length < (CFIndex)pb_transcode_parallel_threshold)
+		return;
+
+	if(inoutUTF16Data && !*inoutUTF16Data)
+		*inoutUTF16Data    = pb_create_transcoded_data(bytes, length, from, pb_text_encoding_utf16_host, /*addBOM*/ false);
+	if(inoutUTF16ExtData && !*inoutUTF16ExtData)
+		*inoutUTF16ExtData = pb_create_transcoded_data(bytes, length, from, pb_text_encoding_utf16_host, /*addBOM*/ true);
+	if(inoutUTF8Data && !*inoutUTF8Data)
+		*inoutUTF8Data     = pb_create_transcoded_data(bytes, length, from, pb_text_encoding_utf8, /*addBOM*/ false);
+	if(inoutMacRomanData && !*inoutMacRomanData)
+		*inoutMacRomanData = pb_create_transcoded_data(bytes, length, from, pb_text_encoding_macroman, /*addBOM*/ false);
+}
+
+Boolean pb_convert_text_encodings(CFDataRef *inoutUTF16Data, CFDataRef *inoutUTF16ExtData, CFDataRef *inoutUTF8Data, CFDataRef *inoutMacRomanData) {
+	convert_encodings_in_parallel(inoutUTF16Data, inoutUTF16ExtData, inoutUTF8Data, inoutMacRomanData);
+
+	//If a format is not requested, it has not failed, and so we should consider it to have succeeded, so we set its variable to true.
+	//But if it is requested, it has not succeeded until it has been attempted, so we set its variable to false.
+	Boolean success_UTF16    = ((!inoutUTF16Data)    || *inoutUTF16Data);
+	Boolean success_UTF16Ext = ((!inoutUTF16ExtData) || *inoutUTF16ExtData);
+	Boolean success_UTF8     = ((!inoutUTF8Data)     || *inoutUTF8Data);
+	Boolean success_MacRoman = ((!inoutMacRomanData) || *inoutMacRomanData);
+
+	CFStringRef string = NULL;
+
+	//Convert UTF-16 (with BOM), UTF-8, or MacRoman to UTF-16.
+	if(inoutUTF16Data && !*inoutUTF16Data) {
+		if(!string) {
+			if(inoutUTF16ExtData && *inoutUTF16ExtData) {
+				string = CFStringCreateFromExternalRepresentation(kCFAllocatorDefault,
+			                                 	 	 	 		  *inoutUTF16ExtData,
+			                                 	 	 	 		  kCFStringEncodingUnicode);
+			} else if(inoutUTF8Data && *inoutUTF8Data) {
+				string = CFStringCreateWithBytes(kCFAllocatorDefault,
+			                                 	 CFDataGetBytePtr(*inoutUTF8Data),
+			                                 	 CFDataGetLength(*inoutUTF8Data),
+			                                 	 kCFStringEncodingUTF8,
+			                                 	 false);
+			} else if(inoutMacRomanData && *inoutMacRomanData) {
+				string = CFStringCreateWithBytes(kCFAllocatorDefault,
+			                                 	 CFDataGetBytePtr(*inoutMacRomanData),
+			                                 	 CFDataGetLength(*inoutMacRomanData),
+			                                 	 kCFStringEncodingMacRoman,
+			                                 	 false);
+			}
+		}
+
+		if(string) {
+			*inoutUTF16Data = createCFDataFromCFString(string);
+			success_UTF16 = (*inoutUTF16Data != NULL);
+		}
+	}
+
+	//Convert UTF-16, UTF-8, or MacRoman to UTF-16 (with BOM).
+	if(inoutUTF16ExtData && !*inoutUTF16ExtData) {
+		if(!string) {
+			if(inoutUTF16Data && *inoutUTF16Data) {
+				string = CFStringCreateWithCharactersNoCopy(kCFAllocatorDefault,
+			                                      	  (const UniChar *)CFDataGetBytePtr(*inoutUTF16Data),
+			                                      	  CFDataGetLength(*inoutUTF16Data) / sizeof(UniChar),
+													  kCFAllocatorNull);
+				if(!string)
+					string = CFStringCreateWithCharacters(kCFAllocatorDefault,
+			                                      	  	  (const UniChar *)CFDataGetBytePtr(*inoutUTF16Data),
+			                                      	  	  CFDataGetLength(*inoutUTF16Data) / sizeof(UniChar));
+			} else if(inoutUTF8Data && *inoutUTF8Data) {
+				string = CFStringCreateWithBytes(kCFAllocatorDefault,
+			                                 	 CFDataGetBytePtr(*inoutUTF8Data),
+			                                 	 CFDataGetLength(*inoutUTF8Data),
+			                                 	 kCFStringEncodingUTF8,
+			                                 	 false);
+			} else if(inoutMacRomanData && *inoutMacRomanData) {
+				string = CFStringCreateWithBytes(kCFAllocatorDefault,
+			                                 	 CFDataGetBytePtr(*inoutMacRomanData),
+			                                 	 CFDataGetLength(*inoutMacRomanData),
+			                                 	 kCFStringEncodingMacRoman,
+			                                 	 false);
+			}
+		}
+
+		if(string) {
+			*inoutUTF16ExtData = CFStringCreateExternalRepresentation(kCFAllocatorDefault, string, kCFStringEncodingUnicode, /*lossByte*/ 0U);
+			success_UTF16Ext = (*inoutUTF16ExtData != NULL);
+		}
+	}
+
+	//Convert UTF-16, UTF-16 (with BOM), or MacRoman to UTF-8.
+	if(inoutUTF8Data && !*inoutUTF8Data) {
+		if(!string) {
+			if(inoutUTF16Data && *inoutUTF16Data) {
+				string = CFStringCreateWithCharactersNoCopy(kCFAllocatorDefault,
+			                                      	  (const UniChar *)CFDataGetBytePtr(*inoutUTF16Data),
+			                                      	  CFDataGetLength(*inoutUTF16Data) / sizeof(UniChar),
+													  kCFAllocatorNull);
+				if(!string)
+					string = CFStringCreateWithCharacters(kCFAllocatorDefault,
+			                                      	  	  (const UniChar *)CFDataGetBytePtr(*inoutUTF16Data),
+			                                      	  	  CFDataGetLength(*inoutUTF16Data) / sizeof(UniChar));
+			} else if(inoutUTF16ExtData && *inoutUTF16ExtData) {
+				string = CFStringCreateFromExternalRepresentation(kCFAllocatorDefault,
+			                                 	 	 	 		  *inoutUTF16ExtData,
+			                                 	 	 	 		  kCFStringEncodingUnicode);
+			} else if(inoutMacRomanData && *inoutMacRomanData) {
+				string = CFStringCreateWithBytes(kCFAllocatorDefault,
+			                                 	 CFDataGetBytePtr(*inoutMacRomanData),
+			                                 	 CFDataGetLength(*inoutMacRomanData),
+			                                 	 kCFStringEncodingMacRoman,
+			                                 	 false);
+			}
+		}
+
+		if(string) {
+			CFRange range = { 0, CFStringGetLength(string) };
+			CFIndex numBytes = 0;
+			CFIndex maxBytes = CFStringGetMaximumSizeForEncoding(range.length, kCFStringEncodingUTF8);
+
+			CFIndex numCharsConverted = CFStringGetBytes(string,
+			                                             range,
+			                                             kCFStringEncodingUTF8,
+			                                             /*lossByte*/ 0U,
+			                                             /*isExternalRepresentation*/ false,
+			                                             /*buffer*/ NULL,
+			                                             /*maxBufLen*/ maxBytes,
+			                                             &numBytes);
+			if(numCharsConverted) {
+				CFMutableDataRef mutableData = CFDataCreateMutable(kCFAllocatorDefault, numBytes);
+				if(mutableData) {
+					CFDataSetLength(mutableData, numBytes);
+					numCharsConverted = CFStringGetBytes(string,
+					                                     range,
+					                                     kCFStringEncodingUTF8,
+					                                     /*lossByte*/ 0U,
+					                                     /*isExternalRepresentation*/ false,
+					                                     CFDataGetMutableBytePtr(mutableData),
+					                                     /*maxBufLen*/ numBytes,
+					                                     &numBytes);
+					*inoutUTF8Data = mutableData;/*CFDataCreateCopy(kCFAllocatorDefault, mutableData);
+					CFRelease(mutableData);
+				 	 */
+					success_UTF8 = (*inoutUTF8Data != NULL);
+				}
+			}
+		}
+	}
+
+	//Convert UTF-16, UTF-16 (with BOM), or UTF-8 to MacRoman.
+	if(inoutMacRomanData && !*inoutMacRomanData) {
+		if(!string) {
+			if(inoutUTF16Data && *inoutUTF16Data) {
+				string = CFStringCreateWithCharactersNoCopy(kCFAllocatorDefault,
+			                                      	  (const UniChar *)CFDataGetBytePtr(*inoutUTF16Data),
+			                                      	  CFDataGetLength(*inoutUTF16Data) / sizeof(UniChar),
+													  kCFAllocatorNull);
+				if(!string)
+					string = CFStringCreateWithCharacters(kCFAllocatorDefault,
+			                                      	  	  (const UniChar *)CFDataGetBytePtr(*inoutUTF16Data),
+			                                      	  	  CFDataGetLength(*inoutUTF16Data) / sizeof(UniChar));
+			} else if(inoutUTF16ExtData && *inoutUTF16ExtData) {
+				string = CFStringCreateFromExternalRepresentation(kCFAllocatorDefault,
+			                                 	 	 	 		  *inoutUTF16ExtData,
+			                                 	 	 	 		  kCFStringEncodingUnicode);
+			} else if(inoutUTF8Data && *inoutUTF8Data) {
+				string = CFStringCreateWithBytes(kCFAllocatorDefault,
+			                                 	 CFDataGetBytePtr(*inoutUTF8Data),
+			                                 	 CFDataGetLength(*inoutUTF8Data),
+			                                 	 kCFStringEncodingUTF8,
+			                                 	 false);
+			}
+		}
+
+		if(string) {
+			CFRange range = { 0, CFStringGetLength(string) };
+			CFIndex numBytes = 0;
+			CFIndex maxBytes = CFStringGetMaximumSizeForEncoding(range.length, kCFStringEncodingMacRoman);
+
+			CFIndex numCharsConverted = CFStringGetBytes(string,
+			                                             range,
+			                                             kCFStringEncodingMacRoman,
+			                                             /*lossByte*/ '?',
+			                                             /*isExternalRepresentation*/ false,
+			                                             /*buffer*/ NULL,
+			                                             /*maxBufLen*/ maxBytes,
+			                                             &numBytes);
+			if(numCharsConverted) {
+				CFMutableDataRef mutableData = CFDataCreateMutable(kCFAllocatorDefault, numBytes);
+				if(mutableData) {
+					CFDataSetLength(mutableData, numBytes);
+					numCharsConverted = CFStringGetBytes(string,
+					                                     range,
+					                                     kCFStringEncodingMacRoman,
+					                                     /*lossByte*/ '?',
+					                                     /*isExternalRepresentation*/ false,
+					                                     CFDataGetMutableBytePtr(mutableData),
+					                                     /*maxBufLen*/ numBytes,
+					                                     &numBytes);
+					*inoutMacRomanData = mutableData;/*CFDataCreateCopy(kCFAllocatorDefault, mutableData);
+					CFRelease(mutableData);
+				 	 */
+					success_MacRoman = (*inoutMacRomanData != NULL);
+				}
+			}
+		}
+	}
+
+	if(string)
+		CFRelease(string);
+
+	return success_UTF16 && success_UTF16Ext && success_UTF8 && success_MacRoman;
+}
+
+#pragma mark Text
+
+OSStatus pb_copy_text_flavor_data(pb_pasteboard *pasteboard, PasteboardItemID item, CFStringRef *outType, CFDataRef *outData) {
+	//Rich text comes last: it's only worth extracting text from when there's no plain text to be had.
+	CFStringRef types[] = { kUTTypeUTF8PlainText, kUTTypeUTF16PlainText, kUTTypeUTF16ExternalPlainText, MacRoman_UTI, kUTTypeRTF, kUTTypeHTML };
+	OSStatus err = badPasteboardFlavorErr;
+	*outData = NULL;
+	for(size_t i = 0U; i < sizeof(types) / sizeof(*types); ++i) {
+		err = pb_copy_flavor_data(pasteboard, item, types[i], outData);
+		if(*outData) {
+			*outType = types[i];
+			break;
+		}
+		//If the owner stops answering, it won't answer for the other flavors either, so don't wait on them.
+		if(err == kMPTimeoutErr)
+			break;
+	}
+	return err;
+}
+//Whether the type is one that pb_extract_markup_text reads, and which.
+static Boolean markup_format_for_type(CFStringRef type, enum pb_markup_format *outFormat) {
+	if(UTTypeEqual(type, kUTTypeRTF))
+		*outFormat = pb_markup_rtf;
+	else if(UTTypeEqual(type, kUTTypeHTML))
+		*outFormat = pb_markup_html;
+	else
+		return false;
+	return true;
+}
+static bool append_to_mutable_data(void *context, const void *bytes, size_t length) {
+	CFDataAppendBytes(context, bytes, (CFIndex)length);
+	return true;
+}
+
+CFDataRef pb_create_UTF8_data_for_text(CFStringRef type, CFDataRef data) {
+	if(UTTypeEqual(type, kUTTypeUTF8PlainText))
+		return CFRetain(data);
+
+	enum pb_markup_format format;
+	if(markup_format_for_type(type, &format)) {
+		CFMutableDataRef UTF8Data = CFDataCreateMutable(kCFAllocatorDefault, /*capacity*/ 0);
+		//Half the text is no better than none.
+		if(UTF8Data && !pb_extract_markup_text(format, CFDataGetBytePtr(data), (size_t)CFDataGetLength(data), append_to_mutable_data, UTF8Data)) {
+			CFRelease(UTF8Data);
+			UTF8Data = NULL;
+		}
+		return UTF8Data;
+	}
+
+	CFDataRef UTF16Data = NULL, UTF16ExtData = NULL, UTF8Data = NULL, MacRomanData = NULL;
+	if(UTTypeEqual(type, kUTTypeUTF16PlainText))
+		UTF16Data = data;
+	else if(UTTypeEqual(type, kUTTypeUTF16ExternalPlainText))
+		UTF16ExtData = data;
+	else
+		MacRomanData = data;
+	pb_convert_text_encodings(UTF16Data ? &UTF16Data : NULL,
+	                          UTF16ExtData ? &UTF16ExtData : NULL,
+	                          &UTF8Data,
+	                          MacRomanData ? &MacRomanData : NULL);
+	return UTF8Data;
+}
+
+//Which encoding text of one of those types is in, and how much BOM it starts with. Same rules as CFStringCreateFromExternalRepresentation for UTF-16 with BOM: without one, it's big-endian.
+static enum pb_text_encoding encoding_for_text(CFStringRef type, CFDataRef data, CFIndex *outBOMLength) {
+	*outBOMLength = 0;
+	if(UTTypeEqual(type, kUTTypeUTF8PlainText))
+		return pb_text_encoding_utf8;
+	if(UTTypeEqual(type, kUTTypeUTF16PlainText))
+		return pb_text_encoding_utf16_host;
+	if(UTTypeEqual(type, kUTTypeUTF16ExternalPlainText)) {
+		const UInt8 *bytes = CFDataGetBytePtr(data);
+		if(CFDataGetLength(data) >= 2) {
+			if((bytes[0] == 0xFE) && (bytes[1] == 0xFF))
+				*outBOMLength = 2;
+			else if((bytes[0] == 0xFF) && (bytes[1] == 0xFE)) {
+				*outBOMLength = 2;
+				return pb_text_encoding_utf16le;
+			}
+		}
+		return pb_text_encoding_utf16be;
+	}
+	return pb_text_encoding_macroman;
+}
+
+//Tells pb_write_text's caller whether it was the callback that stopped the conversion.
+struct text_stream {
+	pb_data_callback callback;
+	void *context;
+	bool stopped;
+};
+static bool write_text_chunk(void *context, const void *bytes, size_t length) {
+	struct text_stream *stream = context;
+	stream->stopped = !stream->callback(stream->context, bytes, length);
+	return !stream->stopped;
+}
+
+//Text extracted from markup comes out as UTF-8, a piece at a time; each piece is converted on its way to the callback.
+struct markup_stream {
+	struct text_stream *stream;
+	enum pb_text_encoding encoding;
+	bool unrepresentable;
+};
+static bool write_markup_text_piece(void *context, const void *bytes, size_t length) {
+	struct markup_stream *markup = context;
+	if(markup->encoding == pb_text_encoding_utf8)
+		return write_text_chunk(markup->stream, bytes, length);
+	if(pb_transcode_stream(pb_text_encoding_utf8, markup->encoding, bytes, length, write_text_chunk, markup->stream))
+		return true;
+	markup->unrepresentable = !markup->stream->stopped;
+	return false;
+}
+
+OSStatus pb_write_text(CFStringRef type, CFDataRef data, enum pb_text_encoding encoding, pb_data_callback callback, void *context) {
+	enum pb_markup_format format;
+	if(markup_format_for_type(type, &format)) {
+		struct text_stream stream = { callback, context, false };
+		struct markup_stream markup = { &stream, encoding, false };
+		if(pb_extract_markup_text(format, CFDataGetBytePtr(data), (size_t)CFDataGetLength(data), write_markup_text_piece, &markup))
+			return noErr;
+		return markup.unrepresentable ? badPasteboardFlavorErr : userCanceledErr;
+	}
+
+	CFIndex BOMLength = 0;
+	enum pb_text_encoding from = encoding_for_text(type, data, &BOMLength);
+	const UInt8 *bytes = CFDataGetBytePtr(data) + BOMLength;
+	size_t length = (size_t)(CFDataGetLength(data) - BOMLength);
+	if(from == encoding)
+		return callback(context, bytes, length) ? noErr : userCanceledErr;
+
+	struct text_stream stream = { callback, context, false };
+	if(pb_transcode_stream(from, encoding, bytes, length, write_text_chunk, &stream))
+		return noErr;
+	return stream.stopped ? userCanceledErr : badPasteboardFlavorErr;
+}
+
+#pragma mark Simple API
+
+pb_status pb_pasteboard_count(pb_pasteboard *pasteboard, size_t *out_count) {
+	PasteboardSynchronize(pasteboard->ref);
+	ItemCount numItems = 0U;
+	OSStatus err = PasteboardGetItemCount(pasteboard->ref, &numItems);
+	if(err == noErr)
+		*out_count = (size_t)numItems;
+	return err;
+}
+pb_status pb_pasteboard_clear(pb_pasteboard *pasteboard) {
+	return PasteboardClear(pasteboard->ref);
+}
+
+//Makes an item of the data and puts it on the pasteboard: in place of everything there if addsToPasteboard is false, or as pb_add_to_pasteboard does if it's true.
+static pb_status put_copied_item(pb_pasteboard *pasteboard, const char *type, const void *bytes, size_t length, Boolean addsToPasteboard, CFIndex itemIndex) {
+	CFStringRef typeCF = type ? CFStringCreateWithCString(kCFAllocatorDefault, type, kCFStringEncodingUTF8) : CFRetain(kUTTypeUTF8PlainText);
+	if(!typeCF)
+		return paramErr;
+	CFDataRef data = CFDataCreate(kCFAllocatorDefault, bytes, (CFIndex)length);
+	if(!data) {
+		CFRelease(typeCF);
+		return memFullErr;
+	}
+
+	if(!addsToPasteboard && pb_pasteboard_holds_copy(pasteboard, typeCF, data)) {
+		CFRelease(data);
+		CFRelease(typeCF);
+		return noErr;
+	}
+
+	struct pb_flavor flavors[pb_max_copied_flavors];
+	struct pb_item item;
+	pb_make_copied_item(typeCF, data, flavors, &item);
+	OSStatus err = addsToPasteboard ? pb_add_to_pasteboard(pasteboard, &item, itemIndex) : pb_publish_items(pasteboard, &item, /*numItems*/ 1);
+
+	for(CFIndex i = 0; i < item.numFlavors; ++i)
+		CFRelease(flavors[i].data);
+	CFRelease(typeCF);
+	return err;
+}
+pb_status pb_pasteboard_copy(pb_pasteboard *pasteboard, const char *type, const void *bytes, size_t length, unsigned options) {
+	return put_copied_item(pasteboard, type, bytes, length, (options & pb_copy_append) != 0U, /*itemIndex*/ 0);
+}
+pb_status pb_pasteboard_add_flavor(pb_pasteboard *pasteboard, size_t item_index, const char *type, const void *bytes, size_t length) {
+	if(item_index == 0U)
+		return badPasteboardIndexErr;
+	return put_copied_item(pasteboard, type, bytes, length, /*addsToPasteboard*/ true, (CFIndex)item_index);
+}
+
+pb_status pb_pasteboard_paste(pb_pasteboard *pasteboard, size_t item_index, const char *type, pb_data_callback callback, void *context) {
+	PasteboardSynchronize(pasteboard->ref);
+	PasteboardItemID item;
+	OSStatus err = PasteboardGetItemIdentifier(pasteboard->ref, (CFIndex)item_index, &item);
+	if(err != noErr)
+		return err;
+
+	CFDataRef data = NULL;
+	if(type) {
+		CFStringRef typeCF = CFStringCreateWithCString(kCFAllocatorDefault, type, kCFStringEncodingUTF8);
+		if(!typeCF)
+			return paramErr;
+		err = pb_copy_flavor_data(pasteboard, item, typeCF, &data);
+		CFRelease(typeCF);
+	} else {
+		//The text goes to the callback as it's converted, rather than all at once afterward.
+		CFStringRef sourceType = NULL;
+		err = pb_copy_text_flavor_data(pasteboard, item, &sourceType, &data);
+		if(data) {
+			err = pb_write_text(sourceType, data, pb_text_encoding_utf8, callback, context);
+			CFRelease(data);
+		}
+		return err;
+	}
+	if(err != noErr)
+		return err;
+
+	bool keepGoing = callback(context, CFDataGetBytePtr(data), (size_t)CFDataGetLength(data));
+	CFRelease(data);
+	return keepGoing ? noErr : userCanceledErr;
+}
+
+struct buffer_sink {
+	unsigned char *buffer;
+	size_t capacity;
+	size_t length;
+};
+static bool append_to_buffer_sink(void *context, const void *bytes, size_t length) {
+	struct buffer_sink *sink = context;
+	if(sink->length < sink->capacity) {
+		size_t amt_to_copy = sink->capacity - sink->length;
+		if(amt_to_copy > length)
+			amt_to_copy = length;
+		memcpy(sink->buffer + sink->length, bytes, amt_to_copy);
+	}
+	sink->length += length;
+	return true;
+}
+pb_status pb_pasteboard_paste_into(pb_pasteboard *pasteboard, size_t item_index, const char *type, void *buffer, size_t capacity, size_t *out_length) {
+	struct buffer_sink sink = { buffer, capacity, 0U };
+	pb_status err = pb_pasteboard_paste(pasteboard, item_index, type, append_to_buffer_sink, &sink);
+	if(err == noErr)
+		*out_length = sink.length;
+	return err;
+}
+
+pb_status pb_pasteboard_list(pb_pasteboard *pasteboard, pb_flavor_callback callback, void *context) {
+	PasteboardSynchronize(pasteboard->ref);
+	ItemCount numItems = 0U;
+	OSStatus err = PasteboardGetItemCount(pasteboard->ref, &numItems);
+	bool keepGoing = true;
+	for(ItemCount i = 1U; keepGoing && (err == noErr) && (i <= numItems); ++i) {
+		PasteboardItemID item;
+		CFArrayRef flavorTypes = NULL;
+		err = PasteboardGetItemIdentifier(pasteboard->ref, (CFIndex)i, &item);
+		if(err == noErr)
+			err = PasteboardCopyItemFlavors(pasteboard->ref, item, &flavorTypes);
+		for(CFIndex j = 0; keepGoing && (err == noErr) && (j < CFArrayGetCount(flavorTypes)); ++j) {
+			CFStringRef flavorType = CFArrayGetValueAtIndex(flavorTypes, j);
+			PasteboardFlavorFlags flags = kPasteboardFlavorNoFlags;
+			PasteboardGetItemFlavorFlags(pasteboard->ref, item, flavorType, &flags);
+
+			char *flavorType_cstr = copy_cstr_for_CFStr(flavorType);
+			if(flavorType_cstr)
+				keepGoing = callback(context, (size_t)i, flavorType_cstr, (uint32_t)flags);
+			else
+				err = memFullErr;
+			free(flavorType_cstr);
+		}
+		if(flavorTypes)
+			CFRelease(flavorTypes);
+	}
+	return err;
+}
@@ -0,0 +1,158 @@
+#ifndef LIBPB_H
+#define LIBPB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ *libpb: pb's pasteboard engine, for programs that would otherwise run pb as a subprocess.
+ *All state lives in a pb_pasteboard handle; the library has no globals, so any number of handles can be used at once, from any threads. One handle should be used by one thread at a time.
+ *Data comes back through a callback or into a buffer that the caller provides, so callers never have to free anything the library allocated.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pb_pasteboard pb_pasteboard;
+
+//0 for success; otherwise an OSStatus from the Pasteboard Manager, memFullErr (-108) if memory ran out, kMPTimeoutErr (-29290) if a flavor's data didn't arrive within the handle's timeout, or kMPInsufficientResourcesErr (-29293) if too many fetches that timed out are still waiting for theirs.
+typedef int32_t pb_status;
+
+//Opens the pasteboard with the given name, or the clipboard if name is NULL.
+pb_status pb_pasteboard_open(const char *name, pb_pasteboard **out_pasteboard);
+//Opens a new pasteboard with a name nobody else has, for scratch work.
+pb_status pb_pasteboard_open_unique(pb_pasteboard **out_pasteboard);
+void pb_pasteboard_close(pb_pasteboard *pasteboard);
+
+/*How long to wait for the data of any one flavor, in milliseconds. 0 (the default) means as long as it takes.
+ *A fetch that times out keeps a thread waiting for the data until the app that promised it answers. At most pb_max_outstanding_fetches of them can be waiting per handle; while they all are, fetches from that handle fail at once with kMPInsufficientResourcesErr.
+ */
+enum { pb_max_outstanding_fetches = 8 };
+void pb_pasteboard_set_timeout(pb_pasteboard *pasteboard, unsigned long msec);
+
+/*Called for each flavor that can't be fetched while reading a whole item, as adding to a pasteboard has to in order to put back what was there. item_index is 1-based.
+ *Return true to go on without that flavor, which is then lost from the pasteboard. Return false, or set no callback (the default), to stop: the call fails with status, and the pasteboard is left as it was.
+ */
+typedef bool (*pb_unavailable_flavor_callback)(void *context, size_t item_index, const char *type, pb_status status);
+void pb_pasteboard_set_unavailable_flavor_callback(pb_pasteboard *pasteboard, pb_unavailable_flavor_callback callback, void *context);
+
+pb_status pb_pasteboard_count(pb_pasteboard *pasteboard, size_t *out_count);
+pb_status pb_pasteboard_clear(pb_pasteboard *pasteboard);
+
+enum {
+	pb_copy_append = 1U << 0, //Add a new item after the ones already there, rather than replacing them.
+};
+//Puts data on the pasteboard as a flavor of the given type (a UTI), or as UTF-8 text if type is NULL. Plain text gets its alternate encodings too. options is zero or more of the pb_copy_ flags. If the pasteboard already holds exactly this, it's left alone, so nobody watching it is told of a change.
+pb_status pb_pasteboard_copy(pb_pasteboard *pasteboard, const char *type, const void *bytes, size_t length, unsigned options);
+//Adds a flavor to the existing item at item_index (1-based), replacing any flavor of the same type.
+pb_status pb_pasteboard_add_flavor(pb_pasteboard *pasteboard, size_t item_index, const char *type, const void *bytes, size_t length);
+
+//Receives data in one or more pieces. Return false to stop; the call that delivered the data then returns userCanceledErr (-128).
+typedef bool (*pb_data_callback)(void *context, const void *bytes, size_t length);
+//Passes the data of the item at item_index (1-based) in the given type to the callback. If type is NULL, the item's text is passed, as UTF-8, whichever encoding it was copied in (or extracted from its RTF or HTML, if it has no plain text).
+pb_status pb_pasteboard_paste(pb_pasteboard *pasteboard, size_t item_index, const char *type, pb_data_callback callback, void *context);
+//Like pb_pasteboard_paste, into buffer. As with snprintf, *out_length is set to the full length of the data even if it doesn't all fit; anything beyond capacity is left out.
+pb_status pb_pasteboard_paste_into(pb_pasteboard *pasteboard, size_t item_index, const char *type, void *buffer, size_t capacity, size_t *out_length);
+
+//Called once per flavor, in order. flags are the Pasteboard Manager's PasteboardFlavorFlags. Return false to stop listing.
+typedef bool (*pb_flavor_callback)(void *context, size_t item_index, const char *type, uint32_t flags);
+pb_status pb_pasteboard_list(pb_pasteboard *pasteboard, pb_flavor_callback callback, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ *Programs that already use the Pasteboard Manager (such as pb itself) can work at its level: with CF objects, whole items, and the handle's PasteboardRef.
+ */
+#ifdef __APPLICATIONSERVICES__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//For enum pb_text_encoding, and the converters that take it. It's installed alongside this header.
+#include "transcode.h"
+
+PasteboardRef pb_pasteboard_get_ref(pb_pasteboard *pasteboard);
+
+//What the handle fetches flavor data with, in place of PasteboardCopyItemFlavorData (which NULL restores). For tests that need a slow or unresponsive provider.
+typedef OSStatus (*pb_flavor_data_copier)(PasteboardRef pasteboard, PasteboardItemID item, CFStringRef type, CFDataRef *outData);
+void pb_pasteboard_set_flavor_data_copier(pb_pasteboard *pasteboard, pb_flavor_data_copier copier);
+
+//An item as fetched from (or to be put on) a pasteboard. All the data objects and type strings are retained.
+struct pb_flavor {
+	CFStringRef type;
+	CFDataRef data;
+	PasteboardFlavorFlags flags;
+};
+struct pb_item {
+	PasteboardItemID ID;
+	CFIndex numFlavors;
+	struct pb_flavor *flavors;
+};
+
+//Flags that describe how a flavor came to be on the pasteboard, as opposed to how its sender wants it treated. PasteboardPutItemFlavor doesn't accept these.
+enum { pb_flavor_read_only_flags = kPasteboardFlavorSystemTranslated | kPasteboardFlavorPromised };
+
+//The main flavor, up to four alternate encodings of it, and its digest.
+enum { pb_max_copied_flavors = 6 };
+
+//The flavor pb_make_copied_item adds to each item: the XXH64 of the main flavor's type and data, for pb_pasteboard_holds_copy to check against.
+extern const CFStringRef pb_copied_digest_type;
+
+PasteboardItemID pb_random_item_ID(void);
+//For when we're putting many items on a pasteboard we've just cleared: numbering them from 1 can't collide, which random IDs eventually would.
+PasteboardItemID pb_sequential_item_ID(CFIndex index);
+
+//PasteboardCopyItemFlavorData, within the handle's timeout. Returns kMPTimeoutErr if the data doesn't arrive in time.
+OSStatus pb_copy_flavor_data(pb_pasteboard *pasteboard, PasteboardItemID item, CFStringRef type, CFDataRef *outData);
+
+/*Fetches every flavor of the item at itemIndex (1-based) into out_item.
+ *If types is not NULL, only flavors that conform to one of those types are fetched; otherwise, all flavors are fetched except those the system translated (which the destination pasteboard can produce on its own).
+ *If a flavor can't be fetched, this fails with the reason, and out_item is left empty, unless the handle's unavailable-flavor callback says to go on without it.
+ */
+OSStatus pb_fetch_item(pb_pasteboard *pasteboard, CFIndex itemIndex, const CFStringRef *types, CFIndex numTypes, struct pb_item *out_item);
+void pb_release_item(struct pb_item *item);
+//Clears the pasteboard and puts every flavor of every item on it. The data objects are handed over as-is; nothing is copied. Everything pb puts on a pasteboard goes through here, whole items at a time, never a flavor at a time.
+OSStatus pb_publish_items(pb_pasteboard *pasteboard, const struct pb_item *items, CFIndex numItems);
+/*Puts the flavors of newItem on the pasteboard without losing what's already there: as an item of its own if itemIndex is 0, or as more flavors of the existing item at itemIndex (1-based), replacing any flavors of the same types. For a new item, newItem->ID is changed if it's already taken.
+ *Returns badPasteboardIndexErr if there is no item at itemIndex.
+ */
+OSStatus pb_add_to_pasteboard(pb_pasteboard *pasteboard, struct pb_item *newItem, CFIndex itemIndex);
+
+//Fetches the item's text in the first of these that it has: UTF-8, UTF-16, UTF-16 with BOM, MacRoman, and failing those, RTF or HTML to extract it from. *outType is set to the one that was found. A timeout ends the search.
+OSStatus pb_copy_text_flavor_data(pb_pasteboard *pasteboard, PasteboardItemID item, CFStringRef *outType, CFDataRef *outData);
+//Returns text of one of those types as UTF-8 (data itself, retained, if it already is), or NULL if it can't be converted. From RTF or HTML, it's the text without the markup.
+CFDataRef pb_create_UTF8_data_for_text(CFStringRef type, CFDataRef data);
+
+/*Passes text of one of those types to the callback in the given encoding, converting it a chunk at a time as it goes, so that memory use stays the same however long the text is. Text that's already in that encoding is passed in one piece; RTF and HTML have their text extracted on the way, in the same single pass.
+ *Returns userCanceledErr if the callback returned false, or badPasteboardFlavorErr if the text is malformed or can't be represented in that encoding.
+ */
+OSStatus pb_write_text(CFStringRef type, CFDataRef data, enum pb_text_encoding encoding, pb_data_callback callback, void *context);
+
+/*Whether copying data as type would only put back what's already on the pasteboard: a single item whose only flavors are that one and its alternate encodings, and whose flavor of that type holds the same bytes.
+ *Items that pb copied carry a digest of their main flavor, so for those, only the digest is fetched. For anything else, the flavor of that type is fetched and compared.
+ */
+Boolean pb_pasteboard_holds_copy(pb_pasteboard *pasteboard, CFStringRef type, CFDataRef data);
+
+//Makes an item with data as its main flavor, followed by the alternate encodings if data is plain text, and the digest flavor. The item takes over the caller's reference to data; release the data of each of its flavors when done. flavors must have room for pb_max_copied_flavors flavors.
+void pb_make_copied_item(CFStringRef type, CFDataRef data, struct pb_flavor *flavors, struct pb_item *outItem);
+
+//Fills in whichever of the encodings are requested (non-NULL pointers to NULL) from whichever one is present. Returns false if any of them couldn't be made.
+//Note: Any created data objects are implicitly retained (Create/Copy rule).
+//Data objects passed in are not implicitly retained.
+//Encodings: UTF-16, UTF-16 (with BOM), UTF-8, MacRoman
+Boolean pb_convert_text_encodings(CFDataRef *inoutUTF16Data, CFDataRef *inoutUTF16ExtData, CFDataRef *inoutUTF8Data, CFDataRef *inoutMacRomanData);
+//Converts text from one encoding to another, wrapping the result without copying it. Returns NULL if the text can't be converted. If addBOM is true, the data starts with a host-order BOM (as from CFStringCreateExternalRepresentation).
+CFDataRef pb_create_transcoded_data(const UInt8 *bytes, CFIndex length, enum pb_text_encoding from, enum pb_text_encoding to, Boolean addBOM);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__APPLICATIONSERVICES__
+
+#endif //LIBPB_H
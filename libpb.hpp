@@ -0,0 +1,154 @@
+#ifndef LIBPB_HPP
+#define LIBPB_HPP
+
+#include <cstdio>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "libpb.h"
+
+/*
+ *A thin C++ wrapper around libpb. The pasteboard is closed when the object goes out of scope, and errors are thrown as pb::error.
+ *Callbacks may throw: the exception is caught before it can unwind through libpb's C frames, the call is stopped, and the exception is rethrown once libpb has returned.
+ */
+namespace pb {
+	class error : public std::runtime_error {
+	public:
+		explicit error(pb_status status) : std::runtime_error(describe(status)), status_(status) {}
+		pb_status status() const { return status_; }
+	private:
+		static std::string describe(pb_status status) {
+			char buf[64];
+			snprintf(buf, sizeof(buf), "libpb: Pasteboard Manager error %ld", (long)status);
+			return buf;
+		}
+		pb_status status_;
+	};
+
+	struct flavor {
+		size_t item_index; //1-based
+		std::string type;
+		uint32_t flags;
+	};
+
+	class pasteboard {
+	public:
+		//The clipboard.
+		pasteboard() : handle_(NULL) { check(pb_pasteboard_open(NULL, &handle_)); }
+		explicit pasteboard(const std::string &name) : handle_(NULL) { check(pb_pasteboard_open(name.c_str(), &handle_)); }
+		~pasteboard() { pb_pasteboard_close(handle_); }
+
+		void set_timeout(unsigned long msec) { pb_pasteboard_set_timeout(handle_, msec); }
+
+		size_t count() {
+			size_t num = 0U;
+			check(pb_pasteboard_count(handle_, &num));
+			return num;
+		}
+		void clear() { check(pb_pasteboard_clear(handle_)); }
+
+		//An empty type means UTF-8 text.
+		void copy(const std::string &data, const std::string &type = std::string(), unsigned options = 0U) {
+			check(pb_pasteboard_copy(handle_, type_or_null(type), data.data(), data.size(), options));
+		}
+		void add_flavor(size_t item_index, const std::string &type, const std::string &data) {
+			check(pb_pasteboard_add_flavor(handle_, item_index, type.c_str(), data.data(), data.size()));
+		}
+		//Passes the data to receive(const char *bytes, size_t length) in one or more pieces. receive returns false to stop, which throws pb::error with userCanceledErr (-128).
+		template <typename Receiver>
+		void paste(size_t item_index, const std::string &type, Receiver receive) {
+			callback_context<Receiver> context(receive);
+			pb_status status = pb_pasteboard_paste(handle_, item_index, type_or_null(type), receive_data<Receiver>, &context);
+			context.rethrow();
+			check(status);
+		}
+		//An empty type means the item's text, as UTF-8.
+		std::string paste(size_t item_index = 1U, const std::string &type = std::string()) {
+			std::string data;
+			paste(item_index, type, string_appender(data));
+			return data;
+		}
+		//Passes each flavor to visit(const pb::flavor &), in order. visit returns false to stop listing.
+		template <typename Visitor>
+		void list(Visitor visit) {
+			callback_context<Visitor> context(visit);
+			pb_status status = pb_pasteboard_list(handle_, visit_flavor<Visitor>, &context);
+			context.rethrow();
+			check(status);
+		}
+		std::vector<flavor> list() {
+			std::vector<flavor> flavors;
+			list(vector_appender(flavors));
+			return flavors;
+		}
+
+		pb_pasteboard *handle() { return handle_; }
+
+	private:
+		pasteboard(const pasteboard &);
+		pasteboard &operator=(const pasteboard &);
+
+		static void check(pb_status status) {
+			if(status != 0)
+				throw error(status);
+		}
+		static const char *type_or_null(const std::string &type) {
+			return type.empty() ? NULL : type.c_str();
+		}
+
+		//What the trampolines below need: the function to call, and whatever it threw.
+		template <typename Function>
+		struct callback_context {
+			explicit callback_context(Function &function) : function(function) {}
+			void rethrow() {
+				if(exception)
+					std::rethrow_exception(exception);
+			}
+			Function &function;
+			std::exception_ptr exception;
+		};
+		template <typename Receiver>
+		static bool receive_data(void *context, const void *bytes, size_t length) {
+			callback_context<Receiver> *c = static_cast<callback_context<Receiver> *>(context);
+			try {
+				return c->function(static_cast<const char *>(bytes), length);
+			} catch(...) {
+				c->exception = std::current_exception();
+				return false;
+			}
+		}
+		template <typename Visitor>
+		static bool visit_flavor(void *context, size_t item_index, const char *type, uint32_t flags) {
+			callback_context<Visitor> *c = static_cast<callback_context<Visitor> *>(context);
+			try {
+				const flavor f = { item_index, type, flags };
+				return c->function(f);
+			} catch(...) {
+				c->exception = std::current_exception();
+				return false;
+			}
+		}
+
+		struct string_appender {
+			explicit string_appender(std::string &data) : data(data) {}
+			bool operator()(const char *bytes, size_t length) {
+				data.append(bytes, length);
+				return true;
+			}
+			std::string &data;
+		};
+		struct vector_appender {
+			explicit vector_appender(std::vector<flavor> &flavors) : flavors(flavors) {}
+			bool operator()(const flavor &f) {
+				flavors.push_back(f);
+				return true;
+			}
+			std::vector<flavor> &flavors;
+		};
+
+		pb_pasteboard *handle_;
+	};
+}
+
+#endif //LIBPB_HPP
@@ -1,11 +1,25 @@
 #include <CoreFoundation/CoreFoundation.h>
 #include <ApplicationServices/ApplicationServices.h>
 #include <sys/errno.h>
+#include <stdarg.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <limits.h>
+#include <copyfile.h>
+#include <regex.h>
+#include <dispatch/dispatch.h>
+#include <pthread.h>
+#include <mach/mach_time.h>
 #include "compare_argument.h"
+#include "digest.h"
+#include "libpb.h"
+#include "normalize.h"
+#include "transform.h"
+#include "sniff.h"
+#include "bintext.h"
+#include "pastecache.h"
 
 struct argblock {
 	int (*proc)(struct argblock *);
@@ -17,16 +31,26 @@ struct argblock {
 	int argc;
 	const char **argv;
 
-	PasteboardRef pasteboard;
+	pb_pasteboard *handle;
+	PasteboardRef pasteboard; //The handle's
 	CFStringRef pasteboardID;
 	const char *pasteboardID_cstr;
 
 	CFIndex itemIndex;
 
 	CFStringRef type; //UTI
+	enum pb_text_encoding encoding; //paste: the encoding to write text in
+	enum pb_normalization_form normalization; //paste: the normalization form to put text in
+	enum pb_line_ending lineEnding; //copy, paste: the line endings to put text in
+	enum pb_bintext_format bintextFormat; //copy: the input is written in this format; paste: write the output in this format
+	const char *cacheDirectory; //paste: keep converted output in this directory, and reuse it while the pasteboard holds the same data
+	unsigned long timeoutMsec; //--timeout: how long to wait for the data of any one flavor, in milliseconds. 0 means as long as it takes.
 
 	struct {
-		unsigned reserved: 29;
+		unsigned reserved: 27;
+		unsigned skip_unavailable: 1; //--skip-unavailable: rewrite the pasteboard without flavors whose data can't be fetched, rather than failing
+		unsigned resolve_references: 1; //paste: write the contents of the file an item refers to, rather than the item itself
+
 		enum {
 			global_options,
 			subcommand,
@@ -40,12 +64,10 @@ static void *pb_allocate  (size_t nbytes);
 static void  pb_deallocate(void *buf);
 static void  pb_deallocateall(void);
 
-//Note: Any created data objects are implicitly retained (Create/Copy rule).
-//Data objects passed in are not implicitly retained.
-//Encodings: UTF-16, UTF-16 (with BOM), UTF-8, MacRoman
-static Boolean convert_encodings(CFDataRef *inoutUTF16Data, CFDataRef *inoutUTF16ExtData, CFDataRef *inoutUTF8Data, CFDataRef *inoutMacRomanData);
-//Returns a CFData containing UTF-16 (without BOM) data for the string. Counterpart to CFStringCreateExternalRepresentation.
-static CFDataRef createCFDataFromCFString(CFStringRef string);
+//Which of our encodings the data of a plain-text flavor is in. Returns false for flavors that aren't one of the plain-text types.
+static Boolean text_encoding_for_flavor(CFStringRef type, CFDataRef data, enum pb_text_encoding *outEncoding);
+//Returns the data with its line endings rewritten (possibly data itself, retained, if they were already right), or NULL if memory runs out.
+static CFDataRef create_data_with_line_endings(CFDataRef data, enum pb_text_encoding encoding, enum pb_line_ending lineEnding);
 
 //If the given C-string is not a known UTI, returns NULL. Otherwise returns a CFString for it.
 static CFStringRef create_UTI_with_cstr(const char *arg);
@@ -55,6 +77,8 @@ static Boolean copy_type_by_filename(struct argblock *pbptr);
 static inline void initpb(struct argblock *pbptr);
 static const char *make_cstr_for_CFStr(CFStringRef in, CFStringEncoding encoding, void (**outDeallocator)(const char *ptr));
 static const char *make_pasteboardID_cstr(struct argblock *pbptr, void (**outDeallocator)(const char *ptr));
+//Applies the global options (such as --timeout) to a pasteboard we've opened.
+static void set_pasteboard_options(struct argblock *pbptr, pb_pasteboard *pasteboard);
 
 int parsearg(const char *arg, struct argblock *pbptr);
 
@@ -63,6 +87,10 @@ int paste(struct argblock *pbptr);
 int count(struct argblock *pbptr);
 int  list(struct argblock *pbptr);
 int clear(struct argblock *pbptr);
+int transfer(struct argblock *pbptr);
+int transform(struct argblock *pbptr);
+int bench(struct argblock *pbptr);
+int stress(struct argblock *pbptr);
 int  help(struct argblock *pbptr);
 int version(struct argblock *pbptr);
 
@@ -70,6 +98,9 @@ const char *argv0 = NULL;
 
 static CFStringRef MacRoman_UTI = CFSTR("com.apple.traditional-mac-plain-text");
 
+//copy: below this, a guess at the encoding of untyped input is no better than assuming MacRoman, as pb always used to.
+enum { min_detection_confidence = 50U };
+
 int main(int argc, const char **argv) {
 	argv0 = argv[0];
 
@@ -96,10 +127,13 @@ int main(int argc, const char **argv) {
 		if(pb.pasteboardID == NULL)
 			pb.pasteboardID = CFRetain(kPasteboardClipboard);
 
-		err = PasteboardCreate(pb.pasteboardID, &(pb.pasteboard));
+		err = pb_pasteboard_open(pb.pasteboardID_cstr, &(pb.handle));
 		if(err != noErr) {
 			fprintf(stderr, "%s: could not create pasteboard reference for pasteboard ID %s", argv0, make_pasteboardID_cstr(&pb, /*deallocator*/ NULL));
 			retval = 1;
+		} else {
+			set_pasteboard_options(&pb, pb.handle);
+			pb.pasteboard = pb_pasteboard_get_ref(pb.handle);
 		}
 	}
 
@@ -115,13 +149,14 @@ int main(int argc, const char **argv) {
 		} else {
 			retval = pb.proc(&pb);
 		}
-		if(pb.pasteboard)
-			CFRelease(pb.pasteboard);
+		pb_pasteboard_close(pb.handle);
 	}
 	if(pb.pasteboardID)
 		CFRelease(pb.pasteboardID);
 	if(pb.type)
 		CFRelease(pb.type);
+	//Anything printf'd to stdout is still in stdio's buffer; get it out before the descriptor goes away.
+	fflush(stdout);
 	if(pb.in_fd > -1)
 		close(pb.in_fd);
 	if(pb.out_fd > -1)
@@ -149,15 +184,24 @@ static inline void initpb(struct argblock *pbptr) {
 	pbptr->in_fd  = -1;
 	pbptr->out_fd = -1;
 
+	pbptr->handle                         = NULL;
 	pbptr->pasteboard                     = NULL;
 
 	pbptr->pasteboardID                   =
 	pbptr->type                           = NULL;
 	pbptr->pasteboardID_cstr              = NULL;
+	pbptr->encoding                       = pb_text_encoding_utf8;
+	pbptr->normalization                  = pb_normalization_none;
+	pbptr->lineEnding                     = pb_line_ending_keep;
+	pbptr->bintextFormat                  = pb_bintext_none;
+	pbptr->cacheDirectory                 = NULL;
+	pbptr->timeoutMsec                    = 0UL;
 
 	pbptr->flags.reserved                 = 0U;
 	pbptr->flags.phase                    = global_options;
 	pbptr->flags.has_args                 = false;
+	pbptr->flags.resolve_references       = false;
+	pbptr->flags.skip_unavailable         = false;
 }
 
 int parsearg(const char *arg, struct argblock *pbptr) {
@@ -174,6 +218,15 @@ int parsearg(const char *arg, struct argblock *pbptr) {
 				pbptr->in_fd = open(param, O_RDONLY, 0644);
 				if(pbptr->in_fd != -1)
 					pbptr->filename = param;
+			} else if(testarg(arg, "--timeout=", &param)) {
+				char *end = NULL;
+				pbptr->timeoutMsec = strtoul(param, &end, 10);
+				if((*param == '\0') || *end || (pbptr->timeoutMsec == 0UL)) {
+					fprintf(stderr, "%s: invalid timeout '%s' (it should be a number of milliseconds)\n", argv0, param);
+					return 1;
+				}
+			} else if(testarg(arg, "--skip-unavailable", NULL)) {
+				pbptr->flags.skip_unavailable = true;
 			} else if(testarg(arg, "--out-file=", &param)) {
 				pbptr->out_fd = open(param, O_WRONLY | O_CREAT, 0644);
 				if(pbptr->out_fd != -1)
@@ -183,6 +236,10 @@ int parsearg(const char *arg, struct argblock *pbptr) {
 				 || testarg(arg, "clear", NULL)
 				 || testarg(arg, "count", NULL)
 				 || testarg(arg, "list", NULL)
+				 || testarg(arg, "transfer", NULL)
+				 || testarg(arg, "transform", NULL)
+				 || testarg(arg, "bench", NULL)
+				 || testarg(arg, "stress", NULL)
 				 || testarg(arg, "help", NULL)
 				 || testarg(arg, "--version", NULL))
 			{
@@ -207,6 +264,14 @@ int parsearg(const char *arg, struct argblock *pbptr) {
 					pbptr->proc = count;
 				else if(testarg(arg, "list", NULL))
 					pbptr->proc = list;
+				else if(testarg(arg, "transfer", NULL))
+					pbptr->proc = transfer;
+				else if(testarg(arg, "transform", NULL))
+					pbptr->proc = transform;
+				else if(testarg(arg, "bench", NULL))
+					pbptr->proc = bench;
+				else if(testarg(arg, "stress", NULL))
+					pbptr->proc = stress;
 				else if(testarg(arg, "help", NULL))
 					pbptr->proc = help;
 				else if(testarg(arg, "--version", NULL))
@@ -316,26 +381,879 @@ static const char *make_pasteboardID_cstr(struct argblock *pbptr, void(**outDeal
 	return pbptr->pasteboardID_cstr;
 }
 
-static PasteboardItemID getRandomPasteboardItemID(void) {
-	//Item IDs are determined by the application creating the item.
-	//Their meaning is up to that same application.
-	//pb doesn't need to associate any meaning with the item, so we just pull
-	//  the ID out of a hat.
+static bool skip_unavailable_flavor(void *context, size_t item_index, const char *type, pb_status status) {
+	fprintf(stderr, "%s: skipping flavor \"%s\" of item %li: PasteboardCopyItemFlavorData returned %li (%s)\n", argv0, type, (long)item_index, (long)status, GetMacOSStatusCommentString(status));
+	return true;
+}
+static void set_pasteboard_options(struct argblock *pbptr, pb_pasteboard *pasteboard) {
+	pb_pasteboard_set_timeout(pasteboard, pbptr->timeoutMsec);
+	//Otherwise, a flavor we can't read stops anything that would have to put it back.
+	if(pbptr->flags.skip_unavailable)
+		pb_pasteboard_set_unavailable_flavor_callback(pasteboard, skip_unavailable_flavor, /*context*/ NULL);
+}
 
-	PasteboardItemID item;
 
-	item = (PasteboardItemID)(unsigned long)arc4random();
+#pragma mark -
+
+//Item indices are 1-based, as everywhere else in the Pasteboard Manager. Each range is inclusive; an open-ended range ("5-") has a last of item_range_end.
+static const CFIndex item_range_end = LONG_MAX;
+struct item_ranges {
+	CFIndex count;
+	struct item_range {
+		CFIndex first, last;
+	} *ranges;
+};
+
+//Parses a comma-separated list of indices and ranges, such as "1,3-5,9-". Returns false (after reporting the problem) if the list is malformed.
+static Boolean parse_item_ranges(const char *spec, struct item_ranges *out_ranges) {
+	CFIndex count = 1;
+	for(const char *p = spec; *p; ++p)
+		if(*p == ',') ++count;
+
+	struct item_range *ranges = pb_allocate((size_t)count * sizeof(struct item_range));
+	if(!ranges) {
+		fprintf(stderr, "%s: could not allocate memory for item ranges: %s\n", argv0, strerror(errno));
+		return false;
+	}
+
+	const char *p = spec;
+	for(CFIndex i = 0; i < count; ++i) {
+		char *end;
+		unsigned long first = strtoul(p, &end, 10), last = first;
+		if((end == p) || (first == 0UL))
+			goto malformed;
+		if(*end == '-') {
+			p = end + 1;
+			if((*p == ',') || (*p == '\0')) {
+				last = item_range_end;
+				end = (char *)p;
+			} else {
+				last = strtoul(p, &end, 10);
+				if((end == p) || (last < first))
+					goto malformed;
+			}
+		}
+		if((*end != ',') && (*end != '\0'))
+			goto malformed;
+		ranges[i].first = (CFIndex)first;
+		ranges[i].last  = (CFIndex)last;
+		p = end + (*end == ',');
+	}
+
+	out_ranges->count  = count;
+	out_ranges->ranges = ranges;
+	return true;
+
+malformed:
+	fprintf(stderr, "%s: malformed item list '%s' (expected something like 1,3-5,9-)\n", argv0, spec);
+	pb_deallocate(ranges);
+	return false;
+}
+static Boolean item_ranges_contain(const struct item_ranges *ranges, CFIndex itemIndex) {
+	if(!(ranges && ranges->count))
+		return true; //No ranges means all items.
+	for(CFIndex i = 0; i < ranges->count; ++i) {
+		if((itemIndex >= ranges->ranges[i].first) && (itemIndex <= ranges->ranges[i].last))
+			return true;
+	}
+	return false;
+}
+
+#pragma mark -
+
+//Writes all of buf, retrying after short writes and interruptions. Returns false (with errno set) if a write fails.
+static Boolean write_all(int fd, const void *buf, size_t length) {
+	const char *p = buf;
+	while(length) {
+		ssize_t amt_written = write(fd, p, length);
+		if(amt_written < 0) {
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		p += amt_written;
+		length -= (size_t)amt_written;
+	}
+	return true;
+}
+
+//Collects many small writes (such as the lines of a listing) and writes them out in large blocks.
+struct buffered_output {
+	int fd;
+	Boolean failed; //Once a write fails, everything after it is dropped; errno tells why.
+	size_t length;
+	char buffer[65536];
+};
+static Boolean flush_buffered_output(struct buffered_output *output) {
+	if(!output->failed && output->length && !write_all(output->fd, output->buffer, output->length))
+		output->failed = true;
+	output->length = 0U;
+	return !output->failed;
+}
+static Boolean buffered_write(struct buffered_output *output, const void *bytes, size_t length) {
+	if(output->length + length > sizeof(output->buffer)) {
+		if(!flush_buffered_output(output))
+			return false;
+		if(length >= sizeof(output->buffer)) {
+			if(!write_all(output->fd, bytes, length))
+				output->failed = true;
+			return !output->failed;
+		}
+	}
+	memcpy(output->buffer + output->length, bytes, length);
+	output->length += length;
+	return true;
+}
+static Boolean buffered_printf(struct buffered_output *output, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static Boolean buffered_printf(struct buffered_output *output, const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	size_t space = sizeof(output->buffer) - output->length;
+	int length = vsnprintf(output->buffer + output->length, space, format, args);
+	va_end(args);
+	if(length < 0)
+		return false;
+	if((size_t)length < space) {
+		output->length += (size_t)length;
+		return true;
+	}
+
+	//It didn't fit. Make room and try again, or failing that, format it on its own.
+	if(!flush_buffered_output(output))
+		return false;
+	va_start(args, format);
+	if((size_t)length < sizeof(output->buffer)) {
+		output->length = (size_t)vsnprintf(output->buffer, sizeof(output->buffer), format, args);
+		va_end(args);
+		return true;
+	}
+	char *formatted = NULL;
+	length = vasprintf(&formatted, format, args);
+	va_end(args);
+	if(length < 0)
+		return false;
+	Boolean success = buffered_write(output, formatted, (size_t)length);
+	free(formatted);
+	return success;
+}
+//Writes str as a JSON string literal, quotes and all.
+static Boolean buffered_write_JSON_string(struct buffered_output *output, const char *str) {
+	buffered_write(output, "\"", 1U);
+	for(const char *p = str; *p; ) {
+		//Everything up to the next character that needs escaping goes out as it is.
+		const char *run = p;
+		while(*p && (*p != '"') && (*p != '\\') && ((unsigned char)*p >= 0x20U))
+			++p;
+		buffered_write(output, run, (size_t)(p - run));
+		if(!*p)
+			break;
+		if((*p == '"') || (*p == '\\'))
+			buffered_printf(output, "\\%c", *p);
+		else
+			buffered_printf(output, "\\u%04x", (unsigned)(unsigned char)*p);
+		++p;
+	}
+	return buffered_write(output, "\"", 1U);
+}
+
+/*Maps the rest of a regular file, from fd's current position to the end: a descriptor we were handed (such as stdin) may have been read partway already, and what was read is not ours. The mapping starts at the page that position is in.
+ *Returns a pointer to the data at that position, or NULL if there's nothing left or it can't be mapped (so read it instead). Unmap it with munmap(*out_mapping, *out_mapping_length).
+ */
+static const char *map_rest_of_file(int fd, const struct stat *sb, void **out_mapping, size_t *out_mapping_length, size_t *out_length) {
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+	if((offset < 0) || (offset >= sb->st_size))
+		return NULL;
+	off_t page_start = offset - (offset % (off_t)getpagesize());
+	size_t mapping_length = (size_t)(sb->st_size - page_start);
+	void *mapping = mmap(NULL, mapping_length, PROT_READ, MAP_SHARED, fd, page_start);
+	if(mapping == MAP_FAILED)
+		return NULL;
+	//Leave the descriptor where reading the data would have, for anyone who shares it.
+	lseek(fd, sb->st_size, SEEK_SET);
+	*out_mapping = mapping;
+	*out_mapping_length = mapping_length;
+	*out_length = (size_t)(sb->st_size - offset);
+	return (const char *)mapping + (offset - page_start);
+}
+
+//Copies the contents of in_fd (a file we've just opened) to out_fd, keeping the data out of our own buffers wherever the OS lets us. Returns false (with errno set) on failure.
+static Boolean stream_file(int in_fd, int out_fd) {
+	struct stat in_sb, out_sb;
+	if(fstat(in_fd, &in_sb) < 0)
+		return false;
+
+	//File to file: the kernel (or the file system, by cloning) can do the whole thing.
+	if(S_ISREG(in_sb.st_mode) && (fstat(out_fd, &out_sb) == 0) && S_ISREG(out_sb.st_mode)) {
+		if(fcopyfile(in_fd, out_fd, /*state*/ NULL, COPYFILE_DATA) == 0)
+			return true;
+	}
+
+	//File to anything else (such as a pipe): write straight out of a mapping of the file, so the only copy is the one into the pipe.
+	if(S_ISREG(in_sb.st_mode)) {
+		if(in_sb.st_size == 0)
+			return true;
+		void *mapping = NULL;
+		size_t mappingLength = 0U, length = 0U;
+		const char *bytes = map_rest_of_file(in_fd, &in_sb, &mapping, &mappingLength, &length);
+		if(bytes) {
+			madvise(mapping, mappingLength, MADV_SEQUENTIAL);
+			Boolean success = write_all(out_fd, bytes, length);
+			munmap(mapping, mappingLength);
+			return success;
+		}
+	}
+
+	//Anything else (a FIFO, a device): plain old read and write.
+	enum { bufsize = 1048576U };
+	char *buf = malloc(bufsize);
+	if(!buf)
+		return false;
+	Boolean success = true;
+	ssize_t amt_read;
+	while((amt_read = read(in_fd, buf, bufsize)) != 0) {
+		if(amt_read < 0) {
+			if(errno == EINTR)
+				continue;
+			success = false;
+			break;
+		}
+		if(!(success = write_all(out_fd, buf, (size_t)amt_read)))
+			break;
+	}
+	free(buf);
+	return success;
+}
+
+//copy --reference: put one item on the pasteboard for each file, carrying a file URL (and the path, as plain text) instead of the file's contents.
+static int copy_references(struct argblock *pbptr) {
+	CFIndex numItems = 0;
+	while(pbptr->argv[numItems])
+		++numItems;
+	if(!numItems) {
+		fprintf(stderr, "%s copy: --reference requires at least one file\n", argv0);
+		return 1;
+	}
+
+	struct pb_item *items = calloc((size_t)numItems, sizeof(struct pb_item));
+	if(!items) {
+		fprintf(stderr, "%s copy: could not allocate memory for %li items: %s\n", argv0, (long)numItems, strerror(errno));
+		return 2;
+	}
+
+	int retval = 0;
+	for(CFIndex i = 0; i < numItems; ++i) {
+		const char *path = pbptr->argv[i];
+		char resolved[PATH_MAX];
+		struct stat sb;
+		if(!realpath(path, resolved) || (stat(resolved, &sb) < 0)) {
+			fprintf(stderr, "%s copy: could not find %s: %s\n", argv0, path, strerror(errno));
+			retval = 1;
+			break;
+		}
+
+		CFURLRef URL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)resolved, (CFIndex)strlen(resolved), /*isDirectory*/ S_ISDIR(sb.st_mode));
+		CFDataRef URLData = URL ? CFURLCreateData(kCFAllocatorDefault, URL, kCFStringEncodingUTF8, /*escapeWhitespace*/ true) : NULL;
+		CFDataRef pathData = CFDataCreate(kCFAllocatorDefault, (const UInt8 *)resolved, (CFIndex)strlen(resolved));
+		if(URL)
+			CFRelease(URL);
+		items[i].flavors = calloc(2U, sizeof(struct pb_flavor));
+		if(!(URLData && pathData && items[i].flavors)) {
+			fprintf(stderr, "%s copy: could not create a file URL for %s\n", argv0, resolved);
+			if(URLData)  CFRelease(URLData);
+			if(pathData) CFRelease(pathData);
+			retval = 2;
+			break;
+		}
+
+		items[i].ID = pb_sequential_item_ID(i);
+		items[i].flavors[0] = (struct pb_flavor){ CFRetain(kUTTypeFileURL), URLData, kPasteboardFlavorNoFlags };
+		items[i].flavors[1] = (struct pb_flavor){ CFRetain(kUTTypeUTF8PlainText), pathData, kPasteboardFlavorSenderTranslated };
+		items[i].numFlavors = 2;
+	}
+
+	if(retval == 0) {
+		OSStatus err = pb_publish_items(pbptr->handle, items, numItems);
+		if(err != noErr) {
+			fprintf(stderr, "%s copy: could not copy references to pasteboard %s: %li (%s)\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
+			retval = 2;
+		}
+	}
+
+	for(CFIndex i = 0; i < numItems; ++i)
+		pb_release_item(&items[i]);
+	free(items);
+	return retval;
+}
+
+//paste --resolve: write out the contents of the file that the item's file URL refers to.
+static int paste_one_reference(struct argblock *pbptr, PasteboardItemID item) {
+	CFDataRef URLData = NULL;
+	OSStatus err = pb_copy_flavor_data(pbptr->handle, item, kUTTypeFileURL, &URLData);
+	if(err == kMPTimeoutErr) {
+		fprintf(stderr, "%s: gave up on item %lu of pasteboard \"%s\": its file URL did not arrive within %lu ms\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), pbptr->timeoutMsec);
+		return 3;
+	} else if(err != noErr) {
+		fprintf(stderr, "%s: item %lu of pasteboard \"%s\" does not refer to a file: PasteboardCopyItemFlavorData (for flavor type \"%s\") returned error %li (%s)\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), make_cstr_for_CFStr(kUTTypeFileURL, kCFStringEncodingUTF8, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
+		return 2;
+	}
+
+	UInt8 path[PATH_MAX];
+	CFURLRef URL = CFURLCreateWithBytes(kCFAllocatorDefault, CFDataGetBytePtr(URLData), CFDataGetLength(URLData), kCFStringEncodingUTF8, /*baseURL*/ NULL);
+	Boolean gotPath = URL && CFURLGetFileSystemRepresentation(URL, /*resolveAgainstBase*/ true, path, sizeof(path));
+	if(URL)
+		CFRelease(URL);
+	CFRelease(URLData);
+	if(!gotPath) {
+		fprintf(stderr, "%s: item %lu of pasteboard \"%s\" has a file URL that is not a valid path\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL));
+		return 2;
+	}
+
+	int in_fd = open((const char *)path, O_RDONLY);
+	if(in_fd < 0) {
+		fprintf(stderr, "%s: could not open %s: %s\n", argv0, path, strerror(errno));
+		return 2;
+	}
+	int retval = 0;
+	if(!stream_file(in_fd, pbptr->out_fd)) {
+		fprintf(stderr, "%s: could not paste the contents of %s: %s\n", argv0, path, strerror(errno));
+		retval = 2;
+	}
+	close(in_fd);
+	return retval;
+}
+
+//copy --split: cut the input into records and put each one on the pasteboard as an item of its own.
+enum split_mode {
+	split_lines,
+	split_nul,
+	split_regex
+};
+struct splitter {
+	enum split_mode mode;
+	regex_t regex;
+};
+
+static Boolean make_splitter(const char *spec, struct splitter *out_splitter) {
+	if(strcmp(spec, "lines") == 0) {
+		out_splitter->mode = split_lines;
+	} else if(strcmp(spec, "nul") == 0) {
+		out_splitter->mode = split_nul;
+	} else {
+		out_splitter->mode = split_regex;
+		int regerr = regcomp(&(out_splitter->regex), spec, REG_EXTENDED);
+		if(regerr != 0) {
+			char message[256];
+			regerror(regerr, &(out_splitter->regex), message, sizeof(message));
+			fprintf(stderr, "%s copy: invalid delimiter pattern '%s': %s\n", argv0, spec, message);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*Finds the first delimiter in [p, end), returning its bounds through out_delimiter_start and out_delimiter_end.
+ *A pattern match that runs right up to end might continue in data we haven't read yet, so unless atEOF is true, such a match is not reported.
+ */
+static Boolean find_delimiter(struct splitter *splitter, const char *p, const char *end, Boolean atEOF, const char **out_delimiter_start, const char **out_delimiter_end) {
+	const char *found;
+	switch(splitter->mode) {
+		case split_lines:
+		case split_nul:
+			//memchr is vectorized in libc, which is about as fast as a scan can get.
+			found = memchr(p, (splitter->mode == split_lines) ? '\n' : '\0', (size_t)(end - p));
+			if(!found)
+				return false;
+			*out_delimiter_start = found;
+			*out_delimiter_end   = found + 1;
+			return true;
+
+		case split_regex:
+			while(p < end) {
+				regmatch_t match = { .rm_so = 0, .rm_eo = end - p };
+				if(regexec(&(splitter->regex), p, 1U, &match, REG_STARTEND) != 0)
+					return false;
+				if(match.rm_eo > match.rm_so) {
+					if((p + match.rm_eo == end) && !atEOF)
+						return false;
+					*out_delimiter_start = p + match.rm_so;
+					*out_delimiter_end   = p + match.rm_eo;
+					return true;
+				}
+				//An empty match doesn't delimit anything. Look past it.
+				p += match.rm_so + 1;
+			}
+			return false;
+	}
+	return false;
+}
+
+//copy --flavor: one source of data for the item, and what came of reading it.
+struct flavor_source {
+	const char *type_cstr;
+	const char *path; //"-" for the input (stdin, or --in-file).
+	int fd;
+
+	//Files are mapped (from wherever the descriptor was, for the input), and bytes points into the mapping; anything else is read into buf.
+	void *mapping;
+	size_t mapping_length;
+	const char *bytes;
+	char *buf;
+	size_t length;
+	int error; //An errno, if it couldn't be read.
+};
+
+//dispatch_apply_f callback: context is the array of struct flavor_source; index selects one source.
+static void read_flavor_source(void *context, size_t index) {
+	struct flavor_source *source = &((struct flavor_source *)context)[index];
+	struct stat sb;
+	if(fstat(source->fd, &sb) < 0) {
+		source->error = errno;
+		return;
+	}
+	if(S_ISREG(sb.st_mode) && (source->bytes = map_rest_of_file(source->fd, &sb, &(source->mapping), &(source->mapping_length), &(source->length))))
+		return;
+
+	//A pipe, or something else we can't map: read it a chunk at a time.
+	enum { increment = 1048576U };
+	size_t bufsize = 0U;
+	for(;;) {
+		if((bufsize - source->length) < increment) {
+			size_t newSize = bufsize ? bufsize * 2U : increment;
+			char *newBuf = realloc(source->buf, newSize);
+			if(!newBuf) {
+				source->error = errno;
+				return;
+			}
+			source->buf = newBuf;
+			bufsize = newSize;
+		}
+		ssize_t amt_read = read(source->fd, &source->buf[source->length], increment);
+		if(amt_read < 0) {
+			if(errno == EINTR)
+				continue;
+			source->error = errno;
+			return;
+		} else if(amt_read == 0)
+			break;
+		source->length += (size_t)amt_read;
+	}
+}
+
+//copy --flavor UTI=PATH ...: read every source at once, and put them all on the pasteboard as the flavors of one item.
+static int copy_flavors(struct argblock *pbptr, struct flavor_source *sources, size_t numSources, Boolean append, unsigned long itemIndex) {
+	int retval = 0;
+	size_t numOpened = 0U;
+	for(; numOpened < numSources; ++numOpened) {
+		struct flavor_source *source = &sources[numOpened];
+		if(strcmp(source->path, "-") == 0)
+			source->fd = pbptr->in_fd;
+		else if((source->fd = open(source->path, O_RDONLY)) < 0) {
+			fprintf(stderr, "%s copy: could not open %s for flavor %s: %s\n", argv0, source->path, source->type_cstr, strerror(errno));
+			retval = 2;
+			goto end;
+		}
+	}
+
+	dispatch_apply_f(numSources, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), sources, read_flavor_source);
+
+	//Room for every source, plus the alternate encodings of a text flavor.
+	struct pb_flavor *flavors = pb_allocate((numSources + pb_max_copied_flavors) * sizeof(struct pb_flavor));
+	if(!flavors) {
+		fprintf(stderr, "%s copy: could not allocate memory for %lu flavors: %s\n", argv0, (unsigned long)numSources, strerror(errno));
+		retval = 2;
+		goto end;
+	}
+	struct pb_item item = { pb_random_item_ID(), 0, flavors };
+	CFIndex textFlavorIndex = -1;
+	for(size_t i = 0U; i < numSources; ++i) {
+		struct flavor_source *source = &sources[i];
+		if(source->error) {
+			fprintf(stderr, "%s copy: could not read %s for flavor %s: %s\n", argv0, source->path, source->type_cstr, strerror(source->error));
+			retval = 2;
+			continue;
+		}
+		//Don't use create_UTI_with_cstr here because the user should be able to explicitly request a type that might not have been declared.
+		CFStringRef type = CFStringCreateWithCString(kCFAllocatorDefault, source->type_cstr, kCFStringEncodingUTF8);
+		//Mapped data stays ours, and is unmapped once it's on the pasteboard; data we read is handed over.
+		CFDataRef data = NULL;
+		if(source->mapping)
+			data = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, (const UInt8 *)source->bytes, (CFIndex)source->length, /*bytesDeallocator*/ kCFAllocatorNull);
+		else if(source->buf) {
+			data = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, (const UInt8 *)source->buf, (CFIndex)source->length, /*bytesDeallocator*/ kCFAllocatorMalloc);
+			if(data)
+				source->buf = NULL;
+		} else
+			data = CFDataCreate(kCFAllocatorDefault, NULL, 0);
+		if(!(type && data)) {
+			fprintf(stderr, "%s copy: could not create CFData object for flavor %s\n", argv0, source->type_cstr);
+			if(type)
+				CFRelease(type);
+			if(data)
+				CFRelease(data);
+			retval = 2;
+			continue;
+		}
+		if((textFlavorIndex < 0) && (UTTypeConformsTo(type, kUTTypeUTF16PlainText) || UTTypeConformsTo(type, kUTTypeUTF16ExternalPlainText) || UTTypeConformsTo(type, kUTTypeUTF8PlainText) || UTTypeConformsTo(type, MacRoman_UTI)))
+			textFlavorIndex = item.numFlavors;
+		flavors[item.numFlavors++] = (struct pb_flavor){ .type = type, .data = data, .flags = kPasteboardFlavorNoFlags };
+	}
+
+	if((retval == 0) && (textFlavorIndex >= 0)) {
+		//Plain text gets its alternate encodings, as in a plain copy, except for any that were given as flavors of their own.
+		struct pb_flavor textFlavors[pb_max_copied_flavors];
+		struct pb_item textItem;
+		pb_make_copied_item(flavors[textFlavorIndex].type, CFRetain(flavors[textFlavorIndex].data), textFlavors, &textItem);
+		CFRelease(textFlavors[0].data);
+		for(CFIndex i = 1; i < textItem.numFlavors; ++i) {
+			Boolean isWanted = !CFEqual(textFlavors[i].type, pb_copied_digest_type);
+			for(CFIndex j = 0; isWanted && (j < item.numFlavors); ++j)
+				isWanted = !UTTypeEqual(textFlavors[i].type, flavors[j].type);
+			if(isWanted)
+				flavors[item.numFlavors++] = (struct pb_flavor){ .type = CFRetain(textFlavors[i].type), .data = textFlavors[i].data, .flags = textFlavors[i].flags };
+			else
+				CFRelease(textFlavors[i].data);
+		}
+	}
+
+	if(retval == 0) {
+		OSStatus err;
+		if(append || itemIndex)
+			err = pb_add_to_pasteboard(pbptr->handle, &item, (CFIndex)itemIndex);
+		else
+			err = pb_publish_items(pbptr->handle, &item, /*numItems*/ 1);
+		if(err != noErr) {
+			fprintf(stderr, "%s copy: could not put item on pasteboard %s: %li (%s)\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
+			retval = (err == kMPTimeoutErr) ? 3 : 2;
+		}
+	}
+	for(CFIndex i = 0; i < item.numFlavors; ++i) {
+		CFRelease(flavors[i].type);
+		CFRelease(flavors[i].data);
+	}
+	pb_deallocate(flavors);
+
+end:
+	for(size_t i = 0U; i < numOpened; ++i) {
+		struct flavor_source *source = &sources[i];
+		if(source->mapping)
+			munmap(source->mapping, source->mapping_length);
+		free(source->buf);
+		if(source->fd != pbptr->in_fd)
+			close(source->fd);
+	}
+	return retval;
+}
+
+//Records are cut on bytes, so text in them has to be in an encoding where those bytes mean the same thing.
+static Boolean is_splittable_encoding(enum pb_text_encoding encoding) {
+	return (encoding == pb_text_encoding_utf8) || (encoding == pb_text_encoding_macroman) || (encoding == pb_text_encoding_latin1) || (encoding == pb_text_encoding_cp1252);
+}
+static Boolean is_valid_UTF8(const char *bytes, size_t length) {
+	const unsigned char *p = (const unsigned char *)bytes, *end = p + length;
+	uint32_t c;
+	while(p < end) {
+		if(!pb_decode_utf8(&p, end, &c))
+			return false;
+	}
+	return true;
+}
+/*Makes the data for one record, as UTF-8 if it's text: from inputEncoding if there is one, checked if the type says it's already UTF-8, and if there's no type at all, worked out from the record's bytes as copy does for a whole input (MacRoman when all else fails).
+ *Returns 0, or (having said why) 1 if the record isn't valid in its encoding or 2 if memory runs out.
+ */
+static int make_split_record_data(const char *record, size_t length, CFStringRef type, const enum pb_text_encoding *inputEncoding, CFIndex itemIndex, CFDataRef *outData) {
+	enum pb_text_encoding encoding = pb_text_encoding_utf8;
+	Boolean isText = true;
+	if(inputEncoding)
+		encoding = *inputEncoding;
+	else if(!type) {
+		struct pb_text_encoding_guess guess;
+		if(pb_detect_text_encoding(record, length, &guess) && (guess.confidence >= min_detection_confidence) && is_splittable_encoding(guess.encoding)) {
+			encoding = guess.encoding;
+			record += guess.bom_length;
+			length -= guess.bom_length;
+		} else
+			encoding = pb_text_encoding_macroman;
+	} else
+		isText = UTTypeEqual(type, kUTTypeUTF8PlainText);
+
+	void *converted = NULL;
+	size_t convertedSize = 0U;
+	if(isText && (encoding == pb_text_encoding_utf8) && !is_valid_UTF8(record, length)) {
+		fprintf(stderr, "%s copy: item %li is not valid UTF-8 (use --encoding to say what it is)\n", argv0, (long)itemIndex);
+		return 1;
+	} else if(isText && (encoding != pb_text_encoding_utf8)) {
+		if(!pb_transcode(encoding, pb_text_encoding_utf8, record, length, /*leading_space*/ 0U, &converted, &convertedSize)) {
+			fprintf(stderr, "%s copy: item %li is not valid %s\n", argv0, (long)itemIndex, pb_text_encoding_name(encoding));
+			return 1;
+		}
+		record = converted;
+		length = convertedSize;
+	}
+	*outData = CFDataCreate(kCFAllocatorDefault, (const UInt8 *)record, (CFIndex)length);
+	free(converted);
+	if(!*outData) {
+		fprintf(stderr, "%s copy: could not create CFData object for item %li\n", argv0, (long)itemIndex);
+		return 2;
+	}
+	return 0;
+}
+
+static int copy_split(struct argblock *pbptr, const char *spec, const enum pb_text_encoding *inputEncoding) {
+	if(inputEncoding && !is_splittable_encoding(*inputEncoding)) {
+		fprintf(stderr, "%s copy: --split cuts the input on single bytes, so it can't read %s\n", argv0, pb_text_encoding_name(*inputEncoding));
+		return 1;
+	}
+	struct splitter splitter;
+	if(!make_splitter(spec, &splitter))
+		return 1;
+
+	//Text goes on the pasteboard as UTF-8, whatever it came in.
+	CFStringRef type = (inputEncoding || !pbptr->type) ? kUTTypeUTF8PlainText : pbptr->type;
+	int retval = 0;
+
+	//The buffer only holds the record we're working on plus whatever we've read past it. It only grows if a single record outgrows it.
+	size_t bufsize = 1048576U;
+	char *buf = malloc(bufsize);
+	if(!buf) {
+		fprintf(stderr, "%s copy: could not allocate memory: %s\n", argv0, strerror(errno));
+		retval = 2;
+		goto end;
+	}
+
+	//The records are all kept, with their alternate encodings, until the input ends. Then they go on the pasteboard in one go, so that input we couldn't read (or empty input) leaves the pasteboard as it was, and nobody watching it sees some of the items without the rest.
+	struct pb_item *items = NULL;
+	struct pb_flavor *flavors = NULL;
+	CFIndex numItems = 0, capacity = 0;
+	size_t record_start = 0U, scan_start = 0U, data_end = 0U;
+	Boolean atEOF = false;
+	while(retval == 0) {
+		const char *delimiter_start = NULL, *delimiter_end = NULL;
+		Boolean found = find_delimiter(&splitter, buf + scan_start, buf + data_end, atEOF, &delimiter_start, &delimiter_end);
+
+		const char *record = buf + record_start;
+		size_t record_length;
+		if(found) {
+			record_length = (size_t)(delimiter_start - record);
+			scan_start = record_start = (size_t)(delimiter_end - buf);
+			//A CRLF ends a line as much as an LF does.
+			if((splitter.mode == split_lines) && record_length && (record[record_length - 1U] == '\r'))
+				--record_length;
+		} else if(atEOF) {
+			//Whatever's left after the last delimiter is the last record (unless there's nothing left).
+			record_length = data_end - record_start;
+			if(!record_length)
+				break;
+			record_start = data_end;
+		} else {
+			//Need more data. Move the partial record to the front of the buffer, growing it only if the record fills it.
+			if(record_start) {
+				memmove(buf, buf + record_start, data_end - record_start);
+				data_end -= record_start;
+				record_start = 0U;
+			}
+			if(data_end == bufsize) {
+				char *newbuf = realloc(buf, bufsize *= 2U);
+				if(!newbuf) {
+					fprintf(stderr, "%s copy: could not allocate memory for a record of more than %zu bytes: %s\n", argv0, data_end, strerror(errno));
+					retval = 2;
+					break;
+				}
+				buf = newbuf;
+			}
+			//Patterns get searched again from the start of the record, since a match might span the old and new data. memchr can pick up where it left off.
+			scan_start = (splitter.mode == split_regex) ? record_start : data_end;
+
+			ssize_t amt_read = read(pbptr->in_fd, buf + data_end, bufsize - data_end);
+			if(amt_read < 0) {
+				if(errno == EINTR)
+					continue;
+				fprintf(stderr, "%s copy: could not read input: %s\n", argv0, strerror(errno));
+				retval = 2;
+			} else if(amt_read == 0)
+				atEOF = true;
+			else
+				data_end += (size_t)amt_read;
+			continue;
+		}
+
+		if(numItems == capacity) {
+			CFIndex newCapacity = capacity ? capacity * 2 : 64;
+			struct pb_item *newItems = realloc(items, (size_t)newCapacity * sizeof(struct pb_item));
+			if(newItems)
+				items = newItems;
+			struct pb_flavor *newFlavors = newItems ? realloc(flavors, (size_t)newCapacity * pb_max_copied_flavors * sizeof(struct pb_flavor)) : NULL;
+			if(!newFlavors) {
+				fprintf(stderr, "%s copy: could not allocate memory for %li items: %s\n", argv0, (long)newCapacity, strerror(errno));
+				retval = 2;
+				break;
+			}
+			flavors = newFlavors;
+			capacity = newCapacity;
+			//The items point into the flavors, which may have moved.
+			for(CFIndex i = 0; i < numItems; ++i)
+				items[i].flavors = &flavors[i * pb_max_copied_flavors];
+		}
+
+		CFDataRef data = NULL;
+		retval = make_split_record_data(record, record_length, (inputEncoding ? NULL : pbptr->type), inputEncoding, numItems + 1, &data);
+		if(retval != 0)
+			break;
+		pb_make_copied_item(type, data, &flavors[numItems * pb_max_copied_flavors], &items[numItems]);
+		items[numItems].ID = pb_sequential_item_ID(numItems);
+		++numItems;
+	}
+	free(buf);
 
-	//An item ID of 0 is illegal. Make sure it doesn't happen.
-	if(item == 0)
-		++item;
+	if((retval == 0) && numItems) {
+		OSStatus err = pb_publish_items(pbptr->handle, items, numItems);
+		if(err != noErr) {
+			fprintf(stderr, "%s copy: could not put %li items on pasteboard %s: %li (%s)\n", argv0, (long)numItems, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
+			retval = 2;
+		}
+	}
+	//The types are all constants (or pbptr's).
+	for(CFIndex i = 0; i < numItems; ++i) {
+		for(CFIndex j = 0; j < items[i].numFlavors; ++j)
+			CFRelease(items[i].flavors[j].data);
+	}
+	free(items);
+	free(flavors);
 
-	return item;
+end:
+	if(splitter.mode == split_regex)
+		regfree(&(splitter.regex));
+	return retval;
 }
 
 #pragma mark -
 
 int copy(struct argblock *pbptr) {
+	const char *split_spec = NULL;
+	enum pb_text_encoding inputEncoding = pb_text_encoding_utf8;
+	Boolean hasInputEncoding = false;
+	//--append puts a new item after the ones already there; --add-flavor adds to an existing item (the first, unless --item says otherwise). Either way, nothing is cleared.
+	Boolean append = false, addFlavor = false;
+	//--reference copies the paths that follow it as file URLs, one item each.
+	Boolean reference = false;
+	unsigned long itemIndex = 0UL;
+	//--flavor UTI=PATH, as many times as you like: one item, with a flavor from each.
+	struct flavor_source *flavorSources = NULL;
+	size_t numFlavorSources = 0U;
+	Boolean flavorFromInput = false;
+	while(pbptr->argc) {
+		const char *option_arg = NULL;
+		unsigned args_consumed = 0U;
+		if(strcmp(*(pbptr->argv), "--") == 0) {
+			++(pbptr->argv); --(pbptr->argc);
+			break;
+		} else if(compare_argument('r', "reference", pbptr->argv, &pbptr->argv, &args_consumed, /*option_arg_optional*/ false, /*out_option_arg*/ NULL) & option_comparison_eitheropt) {
+			reference = true;
+		} else if(compare_argument(0, "split", pbptr->argv, &pbptr->argv, &args_consumed, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			if(!(option_arg && *option_arg)) {
+				fprintf(stderr, "%s copy: --split requires lines, nul, or a delimiter pattern\n", argv0);
+				return 1;
+			}
+			split_spec = option_arg;
+		} else if(compare_argument('e', "encoding", pbptr->argv, &pbptr->argv, &args_consumed, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			if(!(option_arg && pb_text_encoding_for_name(option_arg, &inputEncoding))) {
+				fprintf(stderr, "%s copy: unknown encoding '%s'\n", argv0, option_arg ? option_arg : "");
+				return 1;
+			}
+			hasInputEncoding = true;
+		} else if(compare_argument(0, "eol", pbptr->argv, &pbptr->argv, &args_consumed, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			if(!(option_arg && pb_line_ending_for_name(option_arg, &(pbptr->lineEnding)))) {
+				fprintf(stderr, "%s copy: unknown line ending style '%s' (known styles: lf, crlf, cr, keep)\n", argv0, option_arg ? option_arg : "");
+				return 1;
+			}
+		} else if(compare_argument(0, "decode", pbptr->argv, &pbptr->argv, &args_consumed, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			if(!(option_arg && pb_bintext_format_for_name(option_arg, &(pbptr->bintextFormat)))) {
+				fprintf(stderr, "%s copy: unknown encoding format '%s' (known formats: base64, hex)\n", argv0, option_arg ? option_arg : "");
+				return 1;
+			}
+		} else if(compare_argument(0, "flavor", pbptr->argv, &pbptr->argv, &args_consumed, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			const char *equals = option_arg ? strchr(option_arg, '=') : NULL;
+			if(!(equals && (equals > option_arg) && equals[1])) {
+				fprintf(stderr, "%s copy: invalid flavor '%s' (it should be UTI=PATH, or UTI=- for the input)\n", argv0, option_arg ? option_arg : "");
+				return 1;
+			}
+			if(!flavorSources) {
+				//There can't be more flavors than arguments.
+				flavorSources = pb_allocate((size_t)pbptr->argc * sizeof(struct flavor_source));
+				if(!flavorSources) {
+					fprintf(stderr, "%s copy: could not allocate memory for flavors: %s\n", argv0, strerror(errno));
+					return 2;
+				}
+			}
+			struct flavor_source *source = &flavorSources[numFlavorSources];
+			memset(source, 0, sizeof(*source));
+			source->type_cstr = pb_allocate((size_t)(equals - option_arg) + 1U);
+			if(!source->type_cstr) {
+				fprintf(stderr, "%s copy: could not allocate memory for flavors: %s\n", argv0, strerror(errno));
+				return 2;
+			}
+			memcpy((char *)source->type_cstr, option_arg, (size_t)(equals - option_arg));
+			((char *)source->type_cstr)[equals - option_arg] = '\0';
+			source->path = equals + 1;
+			source->fd = -1;
+			for(size_t i = 0U; i < numFlavorSources; ++i) {
+				if(strcmp(flavorSources[i].type_cstr, source->type_cstr) == 0) {
+					fprintf(stderr, "%s copy: more than one --flavor of type %s\n", argv0, source->type_cstr);
+					return 1;
+				}
+			}
+			if(strcmp(source->path, "-") == 0) {
+				if(flavorFromInput) {
+					fprintf(stderr, "%s copy: only one --flavor can come from the input\n", argv0);
+					return 1;
+				}
+				flavorFromInput = true;
+			}
+			++numFlavorSources;
+		} else if(compare_argument(0, "append", pbptr->argv, &pbptr->argv, &args_consumed, /*option_arg_optional*/ false, /*out_option_arg*/ NULL) & option_comparison_eitheropt) {
+			append = true;
+		} else if(compare_argument(0, "add-flavor", pbptr->argv, &pbptr->argv, &args_consumed, /*option_arg_optional*/ false, /*out_option_arg*/ NULL) & option_comparison_eitheropt) {
+			addFlavor = true;
+		} else if(compare_argument(0, "item", pbptr->argv, &pbptr->argv, &args_consumed, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			char *end = NULL;
+			itemIndex = option_arg ? strtoul(option_arg, &end, 10) : 0UL;
+			if((itemIndex == 0UL) || (itemIndex > LONG_MAX) || *end) {
+				fprintf(stderr, "%s copy: invalid item number '%s' (items are numbered from 1)\n", argv0, option_arg ? option_arg : "");
+				return 1;
+			}
+		} else
+			break;
+		pbptr->argc -= (int)args_consumed;
+	}
+	if(reference) {
+		if(append || addFlavor || itemIndex || split_spec || numFlavorSources) {
+			fprintf(stderr, "%s copy: --reference makes an item of each path, so it can't be combined with --append, --add-flavor, --item, --split, or --flavor\n", argv0);
+			return 1;
+		}
+		return copy_references(pbptr);
+	}
+	if(append && (addFlavor || itemIndex)) {
+		fprintf(stderr, "%s copy: --append makes a new item, so it can't be combined with --add-flavor or --item\n", argv0);
+		return 1;
+	} else if(itemIndex && !addFlavor) {
+		fprintf(stderr, "%s copy: --item requires --add-flavor\n", argv0);
+		return 1;
+	} else if(addFlavor && !itemIndex)
+		itemIndex = 1UL;
+	if((append || addFlavor) && split_spec) {
+		fprintf(stderr, "%s copy: --split can't be combined with --append or --add-flavor\n", argv0);
+		return 1;
+	}
+	if(numFlavorSources) {
+		if(split_spec || hasInputEncoding || (pbptr->bintextFormat != pb_bintext_none) || (pbptr->lineEnding != pb_line_ending_keep)) {
+			fprintf(stderr, "%s copy: --flavor takes each flavor's data as it is, so it can't be combined with --split, --encoding, --decode, or --eol\n", argv0);
+			return 1;
+		} else if(pbptr->argc) {
+			fprintf(stderr, "%s copy: --flavor names the type and file of every flavor, so '%s' is one argument too many\n", argv0, *(pbptr->argv));
+			return 1;
+		}
+		return copy_flavors(pbptr, flavorSources, numFlavorSources, append, itemIndex);
+	}
+
 #	define CONSUME_ARG                                                                                   \
 		if(pbptr->argc) {                                                                                 \
 			/*If we don't already have an explicit type, try to get one. Otherwise, just get a filename.*/ \
@@ -355,48 +1273,134 @@ int copy(struct argblock *pbptr) {
 	CONSUME_ARG
 #	undef CONSUME_ARG
 
+	if(split_spec)
+		return copy_split(pbptr, split_spec, hasInputEncoding ? &inputEncoding : NULL);
+
 	char *buf = NULL;
-	size_t total_size = 0U;
+	size_t total_size = 0U, bufsize = 0U;
 
+	//With --decode, input is read into a staging buffer and decoded from there into buf, so the text form never has to be held in memory all at once.
 	enum { increment = 1048576U };
-	ssize_t amt_read = 0;
-	size_t bufsize = 0U;
-	do {
-		if(total_size % increment == 0U)
-			buf = realloc(buf, bufsize += increment);
-		total_size += amt_read = read(pbptr->in_fd, &buf[total_size], bufsize - (total_size % increment));
-	} while(amt_read);
+	struct pb_bintext_decoder decoder;
+	pb_bintext_decoder_init(&decoder, pbptr->bintextFormat);
+	Boolean decoding = (pbptr->bintextFormat != pb_bintext_none);
+	char *staging = decoding ? malloc(increment) : NULL;
+	if(decoding && !staging) {
+		fprintf(stderr, "%s copy: could not allocate memory to read input: %s\n", argv0, strerror(errno));
+		return 2;
+	}
 
-	OSStatus err;
-	int retval = 0;
+	for(;;) {
+		//Always have room for another increment's worth. (Decoding never makes data longer.)
+		if((bufsize - total_size) < increment) {
+			size_t newSize = bufsize ? bufsize * 2U : increment;
+			char *newBuf = realloc(buf, newSize);
+			if(!newBuf) {
+				fprintf(stderr, "%s copy: could not allocate memory to read input: %s\n", argv0, strerror(errno));
+				free(buf);
+				free(staging);
+				return 2;
+			}
+			buf = newBuf;
+			bufsize = newSize;
+		}
 
-	err = PasteboardClear(pbptr->pasteboard);
-	if(err != noErr) {
-		fprintf(stderr, "%s copy: could not clear pasteboard %s because PasteboardClear returned %li (%s)\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
-		return 2;
+		ssize_t amt_read = read(pbptr->in_fd, decoding ? staging : &buf[total_size], increment);
+		if(amt_read < 0) {
+			if(errno == EINTR)
+				continue;
+			fprintf(stderr, "%s copy: could not read input: %s\n", argv0, strerror(errno));
+			free(buf);
+			free(staging);
+			return 2;
+		} else if(amt_read == 0)
+			break;
+
+		if(decoding) {
+			size_t decodedLength = 0U;
+			if(!pb_bintext_decode(&decoder, staging, (size_t)amt_read, (unsigned char *)&buf[total_size], &decodedLength)) {
+				fprintf(stderr, "%s copy: input is not valid %s\n", argv0, pb_bintext_format_name(pbptr->bintextFormat));
+				free(buf);
+				free(staging);
+				return 1;
+			}
+			total_size += decodedLength;
+		} else
+			total_size += (size_t)amt_read;
+	}
+	if(decoding) {
+		size_t decodedLength = 0U;
+		free(staging);
+		if(!pb_bintext_decode_finish(&decoder, (unsigned char *)&buf[total_size], &decodedLength)) {
+			fprintf(stderr, "%s copy: input is not valid %s (it ends in the middle of a byte)\n", argv0, pb_bintext_format_name(pbptr->bintextFormat));
+			free(buf);
+			return 1;
+		}
+		total_size += decodedLength;
+	}
+
+	if(hasInputEncoding) {
+		//Decode the input ourselves, and carry on as if it had been UTF-8 all along.
+		if(inputEncoding != pb_text_encoding_utf8) {
+			void *converted = NULL;
+			size_t convertedSize = 0U;
+			if(!pb_transcode(inputEncoding, pb_text_encoding_utf8, buf, total_size, /*leading_space*/ 0U, &converted, &convertedSize)) {
+				fprintf(stderr, "%s copy: input is not valid %s\n", argv0, pb_text_encoding_name(inputEncoding));
+				free(buf);
+				return 1;
+			}
+			free(buf);
+			buf = converted;
+			total_size = convertedSize;
+		}
+		if(pbptr->type)
+			CFRelease(pbptr->type);
+		pbptr->type = CFRetain(kUTTypeUTF8PlainText);
 	}
 
-	PasteboardItemID item = getRandomPasteboardItemID();
+	OSStatus err;
+	int retval = 0;
 
-	CFStringRef string;
 	CFDataRef data = NULL;
 	if(pbptr->type == NULL) {
-		//Try to get a type by filename extension.
-		if(!copy_type_by_filename(pbptr)) {
-			//We couldn't figure out a type, so let's see whether it's valid UTF-8.
-			string = CFStringCreateWithBytes(kCFAllocatorDefault, (const unsigned char *)buf, total_size, kCFStringEncodingUTF8, /*isExternalRepresentation*/ false);
-			if(string != NULL) {
-				pbptr->type = CFRetain(kUTTypeUTF8PlainText);
-
-				//We don't actually use the string for anything.
-				CFRelease(string);
-			} else {
-				//Apparently not. Our best guess is to call it MacRoman and copy the pure bytes.
+		//A filename is the most specific thing we have: plenty of formats (Office documents, EPUB, HEIC, SVG, …) are made from a more general one that their content alone would be mistaken for. Without one (or if its extension means nothing), look at the content, which works on stdin.
+		const char *sniffedType = NULL;
+		if(!copy_type_by_filename(pbptr) && (sniffedType = pb_sniff_type(buf, total_size)))
+			pbptr->type = CFStringCreateWithCString(kCFAllocatorDefault, sniffedType, kCFStringEncodingUTF8);
+		else if(pbptr->type == NULL) {
+			//We couldn't figure out a type, so it's probably text. Work out which encoding it's in from the bytes themselves, and copy it as the flavor for that encoding.
+			struct pb_text_encoding_guess guess;
+			if(!(pb_detect_text_encoding(buf, total_size, &guess) && (guess.confidence >= min_detection_confidence))) {
+				//No idea. Our best guess is to call it MacRoman and copy the pure bytes.
 				pbptr->type = CFRetain(MacRoman_UTI);
 				goto pure_data;
 			}
 
-			data = CFDataCreate(kCFAllocatorDefault, (const UInt8 *)buf, total_size);
+			if(guess.encoding == pb_text_encoding_utf8) {
+				//The pasteboard's UTF-8 flavor has no BOM.
+				memmove(buf, buf + guess.bom_length, total_size - guess.bom_length);
+				total_size -= guess.bom_length;
+				pbptr->type = CFRetain(kUTTypeUTF8PlainText);
+			} else if(guess.encoding == pb_text_encoding_macroman) {
+				pbptr->type = CFRetain(MacRoman_UTI);
+			} else if((guess.encoding == pb_text_encoding_utf16_host) && !guess.bom_length) {
+				pbptr->type = CFRetain(kUTTypeUTF16PlainText);
+			} else if(((guess.encoding == pb_text_encoding_utf16le) || (guess.encoding == pb_text_encoding_utf16be)) && guess.bom_length) {
+				//The BOM says which byte order it's in, which is what this flavor expects.
+				pbptr->type = CFRetain(kUTTypeUTF16ExternalPlainText);
+			} else {
+				//There's no flavor for this encoding, so convert it to UTF-8.
+				void *converted = NULL;
+				size_t convertedSize = 0U;
+				if(!pb_transcode(guess.encoding, pb_text_encoding_utf8, buf + guess.bom_length, total_size - guess.bom_length, /*leading_space*/ 0U, &converted, &convertedSize)) {
+					pbptr->type = CFRetain(MacRoman_UTI);
+					goto pure_data;
+				}
+				free(buf);
+				buf = converted;
+				total_size = convertedSize;
+				pbptr->type = CFRetain(kUTTypeUTF8PlainText);
+			}
 		}
 	}
 	if(!data) {
@@ -410,124 +1414,294 @@ pure_data:
 		}
 	}
 
-	//Always do this first.
-	err = PasteboardPutItemFlavor(pbptr->pasteboard, item, pbptr->type, data, kPasteboardFlavorNoFlags);
-	if(err != noErr) {
-		fprintf(stderr, "%s copy: could not copy data for main type \"%s\": PasteboardPutItemFlavor returned error %li (%s)\n", argv0, make_cstr_for_CFStr(pbptr->type, kCFStringEncodingUTF8, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
-	}
-
-	//Translate encodings.
-	CFDataRef UTF16Data = NULL, UTF16ExtData = NULL, UTF8Data = NULL, MacRomanData = NULL;
-	Boolean typeIsUTF16 = false, typeIsUTF16Ext = false, typeIsUTF8 = false, typeIsMacRoman = false;
-	Boolean isTextData = false; //Note: We can't just test conformance to public.text because that includes formats like public.rtf.
-	if(UTTypeConformsTo(pbptr->type, kUTTypeUTF16PlainText)) {
-		UTF16Data = data;
-		isTextData = typeIsUTF16 = true;
-	} else if(UTTypeConformsTo(pbptr->type, kUTTypeUTF16ExternalPlainText)) {
-		UTF16ExtData = data;
-		isTextData = typeIsUTF16Ext = true;
-	} else if(UTTypeConformsTo(pbptr->type, kUTTypeUTF8PlainText)) {
-		UTF8Data = data;
-		isTextData = typeIsUTF8 = true;
-	} else if(UTTypeConformsTo(pbptr->type, MacRoman_UTI)) {
-		MacRomanData = data;
-		isTextData = typeIsMacRoman = true;
-	}
-	if(isTextData) {
-		convert_encodings(&UTF16Data, &UTF16ExtData, &UTF8Data, &MacRomanData);
-		//Only copy it if we did not already copy it (which we have done if its type is pbptr->type).
-		if(UTF16Data && !typeIsUTF16) {
-			err = PasteboardPutItemFlavor(pbptr->pasteboard, item, kUTTypeUTF16PlainText, UTF16Data, kPasteboardFlavorSenderTranslated);
-			if(err != noErr) {
-				fprintf(stderr, "%s copy: could not copy alternate \"%s\" data for main type \"%s\": PasteboardPutItemFlavor returned error %li (%s)\n", argv0, make_cstr_for_CFStr(kUTTypeUTF16PlainText, kCFStringEncodingUTF8, /*deallocator*/ NULL), make_cstr_for_CFStr(pbptr->type, kCFStringEncodingUTF8, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
-				err = noErr; //These aren't critically-important.
-			}
-		}
-		if(UTF16ExtData && !typeIsUTF16Ext) {
-			err = PasteboardPutItemFlavor(pbptr->pasteboard, item, kUTTypeUTF16ExternalPlainText, UTF16ExtData, kPasteboardFlavorSenderTranslated);
-			if(err != noErr) {
-				fprintf(stderr, "%s copy: could not copy alternate \"%s\" data for main type \"%s\": PasteboardPutItemFlavor returned error %li (%s)\n", argv0, make_cstr_for_CFStr(kUTTypeUTF16ExternalPlainText, kCFStringEncodingUTF8, /*deallocator*/ NULL), make_cstr_for_CFStr(pbptr->type, kCFStringEncodingUTF8, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
-				err = noErr; //These aren't critically-important.
-			}
-		}
-		if(UTF8Data && !typeIsUTF8) {
-			err = PasteboardPutItemFlavor(pbptr->pasteboard, item, kUTTypeUTF8PlainText, UTF8Data, kPasteboardFlavorSenderTranslated);
-			if(err != noErr) {
-				fprintf(stderr, "%s copy: could not copy alternate \"%s\" data for main type \"%s\": PasteboardPutItemFlavor returned error %li (%s)\n", argv0, make_cstr_for_CFStr(kUTTypeUTF8PlainText, kCFStringEncodingUTF8, /*deallocator*/ NULL), make_cstr_for_CFStr(pbptr->type, kCFStringEncodingUTF8, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
-				err = noErr; //These aren't critically-important.
-			}
-		}
-		if(MacRomanData && !typeIsMacRoman) {
-			err = PasteboardPutItemFlavor(pbptr->pasteboard, item, MacRoman_UTI, MacRomanData, kPasteboardFlavorSenderTranslated);
-			if(err != noErr) {
-				fprintf(stderr, "%s copy: could not copy alternate \"%s\" data for main type \"%s\": PasteboardPutItemFlavor returned error %li (%s)\n", argv0, make_cstr_for_CFStr(MacRoman_UTI, kCFStringEncodingUTF8, /*deallocator*/ NULL), make_cstr_for_CFStr(pbptr->type, kCFStringEncodingUTF8, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
-				err = noErr; //These aren't critically-important.
-			}
+	enum pb_text_encoding dataEncoding;
+	if((pbptr->lineEnding != pb_line_ending_keep) && text_encoding_for_flavor(pbptr->type, data, &dataEncoding)) {
+		CFDataRef convertedData = create_data_with_line_endings(data, dataEncoding, pbptr->lineEnding);
+		if(!convertedData) {
+			fprintf(stderr, "%s copy: could not allocate memory to convert line endings\n", argv0);
+			CFRelease(data);
+			free(buf);
+			return 2;
 		}
+		CFRelease(data);
+		data = convertedData;
 	}
 
-	CFRelease(data);
-	free(buf);
-
-	if(err != noErr) {
-		fprintf(stderr, "%s copy: could not copy to pasteboard %s because PasteboardPutItemFlavor returned %li (%s)\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
-		retval = 2;
+	if(!(append || addFlavor) && pb_pasteboard_holds_copy(pbptr->handle, pbptr->type, data)) {
+		//Putting it back would only make every app watching the pasteboard look at it again.
+		CFRelease(data);
+		free(buf);
+		return 0;
+	}
+
+	//Build the whole item, with every alternate encoding, before touching the pasteboard. Then clear it and put everything on it in one go, so that anyone watching the pasteboard never sees it empty for long, or sees the item without its alternates.
+	struct pb_flavor flavors[pb_max_copied_flavors];
+	struct pb_item item;
+	pb_make_copied_item(pbptr->type, data, flavors, &item);
+
+	if(append || addFlavor)
+		err = pb_add_to_pasteboard(pbptr->handle, &item, (CFIndex)itemIndex);
+	else
+		err = pb_publish_items(pbptr->handle, &item, /*numItems*/ 1);
+
+	for(CFIndex i = 0; i < item.numFlavors; ++i)
+		CFRelease(flavors[i].data);
+	free(buf);
+
+	if(err == badPasteboardIndexErr) {
+		fprintf(stderr, "%s copy: pasteboard %s has no item %lu\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), itemIndex);
+		retval = 1;
+	} else if(err != noErr) {
+		fprintf(stderr, "%s copy: could not copy to pasteboard %s because the Pasteboard Manager returned %li (%s)\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
+		retval = (err == kMPTimeoutErr) ? 3 : 2;
 	}
 
 	return retval;
 }
-int paste_one(struct argblock *pbptr) {
+//Writes data to the paste output, pieces at a time, written out as text (base64 or hex) first if --encode asked for it. Call finish_encoded_output after the last piece.
+struct encoded_output {
+	int fd;
+	struct pb_bintext_encoder encoder;
+	struct pb_paste_cache_entry *cache; //Gets a copy of everything written, if not NULL.
+};
+//If the cache entry can't take any more, it's dropped; the paste itself goes on.
+static Boolean write_output(struct encoded_output *output, const void *bytes, size_t length) {
+	if(output->cache && !pb_paste_cache_append(output->cache, bytes, length)) {
+		pb_paste_cache_abandon(output->cache);
+		output->cache = NULL;
+	}
+	return write_all(output->fd, bytes, length);
+}
+static Boolean write_encoded_output(struct encoded_output *output, const void *bytes, size_t length) {
+	if(output->encoder.format == pb_bintext_none)
+		return write_output(output, bytes, length);
+
+	//A multiple of 3, so that base64 never has to hold bytes over from one chunk to the next.
+	enum { chunk_length = 3U * 262144U };
+	char *text = malloc(pb_bintext_encoded_length_max(output->encoder.format, (length < chunk_length) ? length : chunk_length));
+	if(!text)
+		return false;
+	Boolean success = true;
+	for(const unsigned char *p = bytes; success && length; ) {
+		size_t this_length = (length < chunk_length) ? length : chunk_length;
+		success = write_output(output, text, pb_bintext_encode(&output->encoder, p, this_length, text));
+		p += this_length;
+		length -= this_length;
+	}
+	free(text);
+	return success;
+}
+static Boolean finish_encoded_output(struct encoded_output *output) {
+	if(output->encoder.format == pb_bintext_none)
+		return true;
+	char tail[5];
+	size_t length = pb_bintext_encode_finish(&output->encoder, tail);
+	tail[length++] = '\n';
+	return write_output(output, tail, length);
+}
+
+//Writes pieces of UTF-8 text to the paste output, converting them to another encoding on the way if need be.
+struct text_writer {
+	struct encoded_output *output;
+	enum pb_text_encoding encoding;
+	Boolean unrepresentable; //Set if a piece could not be converted.
+};
+static bool write_text_piece(void *context, const void *bytes, size_t length) {
+	struct text_writer *writer = context;
+	if(writer->encoding == pb_text_encoding_utf8)
+		return write_encoded_output(writer->output, bytes, length);
+
+	void *converted = NULL;
+	size_t convertedLength = 0U;
+	if(!pb_transcode(pb_text_encoding_utf8, writer->encoding, bytes, length, /*leading_space*/ 0U, &converted, &convertedLength)) {
+		writer->unrepresentable = true;
+		return false;
+	}
+	Boolean success = write_encoded_output(writer->output, converted, convertedLength);
+	free(converted);
+	return success;
+}
+
+/*With --cache: if the cache has output made from exactly this data, writes it out and returns true, with *outRetval set to the result. Otherwise, returns false, and starts a cache entry that will get a copy of the output as it's written.
+ *Only worth calling when the output will differ from the data on the pasteboard; otherwise there's nothing to save.
+ */
+static Boolean paste_from_cache(struct argblock *pbptr, CFStringRef sourceType, CFDataRef sourceData, struct encoded_output *output, struct pb_paste_cache_entry *entry, int *outRetval) {
+	if(!(pbptr->cacheDirectory && sourceData))
+		return false;
+
+	//Everything that goes into making the output, apart from the data itself.
+	char *slot = NULL;
+	if(asprintf(&slot, "%s\n%lu\n%s\nencoding=%d normalization=%d eol=%d encode=%d", make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (unsigned long)pbptr->itemIndex, pbptr->type ? make_cstr_for_CFStr(pbptr->type, kCFStringEncodingUTF8, /*deallocator*/ NULL) : "", (int)pbptr->encoding, (int)pbptr->normalization, (int)pbptr->lineEnding, (int)pbptr->bintextFormat) < 0)
+		return false;
+
+	unsigned char sourceDigest[pb_paste_cache_digest_length];
+	pb_paste_cache_digest_source(make_cstr_for_CFStr(sourceType, kCFStringEncodingUTF8, /*deallocator*/ NULL), CFDataGetBytePtr(sourceData), (size_t)CFDataGetLength(sourceData), sourceDigest);
+
+	Boolean served = false;
+	switch(pb_paste_cache_serve(pbptr->cacheDirectory, slot, sourceDigest, (uint64_t)CFDataGetLength(sourceData), output->fd)) {
+		case pb_paste_cache_hit:
+			*outRetval = 0;
+			served = true;
+			break;
+		case pb_paste_cache_write_failed:
+			fprintf(stderr, "%s: could not write item %lu of pasteboard \"%s\": %s\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), strerror(errno));
+			*outRetval = 2;
+			served = true;
+			break;
+		case pb_paste_cache_miss:
+			if(pb_paste_cache_begin(pbptr->cacheDirectory, slot, sourceDigest, (uint64_t)CFDataGetLength(sourceData), entry))
+				output->cache = entry;
+			break;
+	}
+
+	free(slot);
+	return served;
+}
+
+//The text type pb knows how to read that type as: the one it conforms to (public.utf8-tab-separated-values-text is UTF-8, for example), or NULL if it's none of them.
+static CFStringRef known_text_flavor_type(CFStringRef type) {
+	CFStringRef knownTypes[] = { kUTTypeUTF16PlainText, kUTTypeUTF16ExternalPlainText, kUTTypeUTF8PlainText, MacRoman_UTI };
+	for(size_t i = 0U; i < sizeof(knownTypes) / sizeof(*knownTypes); ++i) {
+		if(UTTypeConformsTo(type, knownTypes[i]))
+			return knownTypes[i];
+	}
+	return NULL;
+}
+
+static int paste_item(struct argblock *pbptr, PasteboardItemID item, struct encoded_output *output, struct pb_paste_cache_entry *cacheEntry) {
 	int retval = 0;
 	OSStatus err;
 
-	PasteboardItemID item;
-	err = PasteboardGetItemIdentifier(pbptr->pasteboard, pbptr->itemIndex, &item);
-	if(err != noErr) {
-		fprintf(stderr, "%s: can't find item %lu on pasteboard %s: PasteboardGetItemIdentifier returned %li (%s)\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
-		return 2;
+	//An explicit type gets the text options too, as long as we know what encoding it's in. --eol alone can be done in that encoding, below.
+	CFStringRef knownTextType = pbptr->type ? known_text_flavor_type(pbptr->type) : NULL;
+	if(pbptr->type && !knownTextType && ((pbptr->lineEnding != pb_line_ending_keep) || (pbptr->normalization != pb_normalization_none) || (pbptr->encoding != pb_text_encoding_utf8))) {
+		fprintf(stderr, "%s paste: --encoding, --normalize, and --eol only work on text in UTF-8, UTF-16, or MacRoman, and %s is none of those\n", argv0, make_cstr_for_CFStr(pbptr->type, kCFStringEncodingUTF8, /*deallocator*/ NULL));
+		return 1;
 	}
+	Boolean pastesText = (pbptr->type == NULL) || (knownTextType && ((pbptr->normalization != pb_normalization_none) || (pbptr->encoding != pb_text_encoding_utf8)));
 
 	CFDataRef data = NULL;
-	if(pbptr->type == NULL) {
-		CFDataRef UTF8Data = NULL;
-		err = PasteboardCopyItemFlavorData(pbptr->pasteboard, item, kUTTypeUTF8PlainText, &UTF8Data);
-		if(UTF8Data)
+	if(pastesText) {
+		//Take whichever encoding the item has (or the one asked for); if it's not UTF-8, convert it.
+		CFStringRef sourceType = NULL;
+		CFDataRef sourceData = NULL;
+		if(pbptr->type) {
+			err = pb_copy_flavor_data(pbptr->handle, item, pbptr->type, &sourceData);
+			sourceType = knownTextType;
+		} else
+			err = pb_copy_text_flavor_data(pbptr->handle, item, &sourceType, &sourceData);
+
+		//Anything but UTF-8 passed straight through is worth remembering.
+		if(sourceData && (!UTTypeEqual(sourceType, kUTTypeUTF8PlainText) || (pbptr->lineEnding != pb_line_ending_keep) || (pbptr->normalization != pb_normalization_none) || (pbptr->encoding != pb_text_encoding_utf8) || (pbptr->bintextFormat != pb_bintext_none))) {
+			if(paste_from_cache(pbptr, sourceType, sourceData, output, cacheEntry, &retval)) {
+				CFRelease(sourceData);
+				return retval;
+			}
+		}
+
+		if(!pbptr->type)
 			pbptr->type = CFRetain(kUTTypeUTF8PlainText);
-		else {
-			//Look for UTF-16, then UTF-16 with BOM, then MacRoman. Convert the first of those that we find (if any) to UTF-8.
-			CFDataRef UTF16Data = NULL, UTF16ExtData = NULL, MacRomanData = NULL;
-			err = PasteboardCopyItemFlavorData(pbptr->pasteboard, item, kUTTypeUTF16PlainText, &UTF16Data);
-			if(!UTF16Data)
-				err = PasteboardCopyItemFlavorData(pbptr->pasteboard, item, kUTTypeUTF16ExternalPlainText, &UTF16ExtData);
-			if(!UTF16ExtData)
-				err = PasteboardCopyItemFlavorData(pbptr->pasteboard, item, MacRoman_UTI, &MacRomanData);
-			//If we have anything, convert it to UTF-8.
-			if(UTF16Data || UTF16ExtData || MacRomanData) {
-				convert_encodings(UTF16Data ? &UTF16Data : NULL,
-			                  	  UTF16ExtData ? &UTF16ExtData : NULL,
-			                  	  &UTF8Data,
-			                  	  MacRomanData ? &MacRomanData : NULL);
-				pbptr->type = CFRetain(kUTTypeUTF8PlainText);
-				//Clean up after PasteboardCopyItemFlavorData.
-				if(UTF16Data)    CFRelease(UTF16Data);
-				if(UTF16ExtData) CFRelease(UTF16ExtData);
-				if(MacRomanData) CFRelease(MacRomanData);
+		if(sourceData && (pbptr->lineEnding == pb_line_ending_keep) && (pbptr->normalization == pb_normalization_none)) {
+			//Nothing here needs the whole text at once, so convert it straight into the output a chunk at a time.
+			struct text_writer writer = { output, pb_text_encoding_utf8, false };
+			errno = 0;
+			err = pb_write_text(sourceType, sourceData, pbptr->encoding, write_text_piece, &writer);
+			CFRelease(sourceData);
+			if((err == noErr) && !finish_encoded_output(output))
+				err = userCanceledErr;
+			if(err == noErr)
+				return 0;
+			if(err == userCanceledErr) {
+				fprintf(stderr, "%s: could not write item %lu of pasteboard \"%s\": %s\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), strerror(errno));
+				return 2;
+			}
+			if(pbptr->encoding != pb_text_encoding_utf8) {
+				fprintf(stderr, "%s: could not paste item %lu of pasteboard \"%s\": its text cannot be represented in %s.\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), pb_text_encoding_name(pbptr->encoding));
+				return 2;
+			}
+			//Otherwise, it couldn't be read as text at all, which is reported below like any other missing flavor.
+			sourceData = NULL;
+		}
+
+		CFDataRef UTF8Data = NULL;
+		if(sourceData) {
+			UTF8Data = pb_create_UTF8_data_for_text(sourceType, sourceData);
+			err = UTF8Data ? noErr : badPasteboardFlavorErr;
+			CFRelease(sourceData);
+		}
+
+		if(UTF8Data && (pbptr->lineEnding != pb_line_ending_keep)) {
+			CFDataRef convertedData = create_data_with_line_endings(UTF8Data, pb_text_encoding_utf8, pbptr->lineEnding);
+			CFRelease(UTF8Data);
+			if(!convertedData) {
+				fprintf(stderr, "%s: could not paste item %lu of pasteboard \"%s\": could not allocate memory to convert line endings.\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL));
+				return 2;
 			}
+			UTF8Data = convertedData;
+		}
+		if(UTF8Data && (pbptr->normalization != pb_normalization_none)) {
+			//Normalize and write out in pieces, rather than building the whole normalized text in memory first.
+			struct text_writer writer = { output, pbptr->encoding, false };
+			errno = 0;
+			Boolean success = pb_normalize_utf8(pbptr->normalization, CFDataGetBytePtr(UTF8Data), (size_t)CFDataGetLength(UTF8Data), write_text_piece, &writer) && finish_encoded_output(output);
+			CFRelease(UTF8Data);
+			if(!success) {
+				if(writer.unrepresentable)
+					fprintf(stderr, "%s: could not paste item %lu of pasteboard \"%s\": its text cannot be represented in %s.\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), pb_text_encoding_name(pbptr->encoding));
+				else
+					fprintf(stderr, "%s: could not paste item %lu of pasteboard \"%s\" as %s: %s\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), pb_normalization_form_name(pbptr->normalization), errno ? strerror(errno) : "its text is not valid UTF-8");
+				return 2;
+			}
+			return 0;
+		}
+		if(UTF8Data && (pbptr->encoding != pb_text_encoding_utf8)) {
+			struct text_writer writer = { output, pb_text_encoding_utf8, false };
+			errno = 0;
+			err = pb_write_text(kUTTypeUTF8PlainText, UTF8Data, pbptr->encoding, write_text_piece, &writer);
+			CFRelease(UTF8Data);
+			if((err == noErr) && !finish_encoded_output(output))
+				err = userCanceledErr;
+			if(err == userCanceledErr)
+				fprintf(stderr, "%s: could not write item %lu of pasteboard \"%s\": %s\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), strerror(errno));
+			else if(err != noErr)
+				fprintf(stderr, "%s: could not paste item %lu of pasteboard \"%s\": its text cannot be represented in %s.\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), pb_text_encoding_name(pbptr->encoding));
+			return (err == noErr) ? 0 : 2;
 		}
 		data = UTF8Data;
 	} else {
 		//There is an explicit type.
-		err = PasteboardCopyItemFlavorData(pbptr->pasteboard, item, pbptr->type, &data);
+		err = pb_copy_flavor_data(pbptr->handle, item, pbptr->type, &data);
+
+		enum pb_text_encoding dataEncoding;
+		Boolean convertsLineEndings = data && (pbptr->lineEnding != pb_line_ending_keep) && text_encoding_for_flavor(pbptr->type, data, &dataEncoding);
+		if((convertsLineEndings || (pbptr->bintextFormat != pb_bintext_none)) && paste_from_cache(pbptr, pbptr->type, data, output, cacheEntry, &retval)) {
+			CFRelease(data);
+			return retval;
+		}
+		if(convertsLineEndings) {
+			CFDataRef convertedData = create_data_with_line_endings(data, dataEncoding, pbptr->lineEnding);
+			CFRelease(data);
+			if(!convertedData) {
+				fprintf(stderr, "%s: could not paste item %lu of pasteboard \"%s\": could not allocate memory to convert line endings.\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL));
+				return 2;
+			}
+			data = convertedData;
+		}
 	}
 
-	if(err != noErr) {
+	if(err == kMPTimeoutErr) {
+		//A distinct exit status, so that scripts can tell a hung owner from a missing flavor.
+		fprintf(stderr, "%s: gave up on item %lu of pasteboard \"%s\": its data in flavor type \"%s\" did not arrive within %lu ms.\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), make_cstr_for_CFStr(pbptr->type, kCFStringEncodingUTF8, /*deallocator*/ NULL), pbptr->timeoutMsec);
+		retval = 3;
+	} else if(err != noErr) {
 		if(err == badPasteboardFlavorErr)
 			fprintf(stderr, "%s: could not paste item %lu of pasteboard \"%s\": it does not exist in flavor type \"%s\".\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), make_cstr_for_CFStr(pbptr->type, kCFStringEncodingUTF8, /*deallocator*/ NULL));
 		else
 			fprintf(stderr, "%s: could not paste item %lu of pasteboard \"%s\": PasteboardCopyItemFlavorData (for flavor type \"%s\") returned error %li (%s)\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), make_cstr_for_CFStr(pbptr->type, kCFStringEncodingUTF8, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
 		retval = 2;
-	} else {
-		write(pbptr->out_fd, CFDataGetBytePtr(data), CFDataGetLength(data));
+	} else if(!(write_encoded_output(output, CFDataGetBytePtr(data), (size_t)CFDataGetLength(data)) && finish_encoded_output(output))) {
+		fprintf(stderr, "%s: could not write item %lu of pasteboard \"%s\": %s\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), strerror(errno));
+		retval = 2;
 	}
 
 	if(data)
@@ -535,6 +1709,32 @@ int paste_one(struct argblock *pbptr) {
 
 	return retval;
 }
+int paste_one(struct argblock *pbptr) {
+	PasteboardItemID item;
+	OSStatus err = PasteboardGetItemIdentifier(pbptr->pasteboard, pbptr->itemIndex, &item);
+	if(err != noErr) {
+		fprintf(stderr, "%s: can't find item %lu on pasteboard %s: PasteboardGetItemIdentifier returned %li (%s)\n", argv0, (unsigned long)pbptr->itemIndex, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
+		return 2;
+	}
+
+	if(pbptr->flags.resolve_references)
+		return paste_one_reference(pbptr, item);
+
+	struct encoded_output output = { .fd = pbptr->out_fd, .cache = NULL };
+	pb_bintext_encoder_init(&output.encoder, pbptr->bintextFormat);
+	struct pb_paste_cache_entry cacheEntry;
+
+	int retval = paste_item(pbptr, item, &output, &cacheEntry);
+
+	//Only a complete paste goes in the cache.
+	if(output.cache) {
+		if(retval == 0)
+			pb_paste_cache_commit(output.cache);
+		else
+			pb_paste_cache_abandon(output.cache);
+	}
+	return retval;
+}
 int paste(struct argblock *pbptr) {
 	ItemCount numItems = 0U;
 	OSStatus err = PasteboardGetItemCount(pbptr->pasteboard, &numItems);
@@ -546,8 +1746,6 @@ int paste(struct argblock *pbptr) {
 	if(!(pbptr->argc)) {
 		if((pbptr->out_fd) < 0)
 			pbptr->out_fd = STDOUT_FILENO;
-		if(!(pbptr->type))
-			pbptr->type = CFRetain(kUTTypeUTF8PlainText);
 		if((pbptr->itemIndex) == 0UL)
 			pbptr->itemIndex = 1UL;
 		return paste_one(pbptr);
@@ -568,7 +1766,42 @@ int paste(struct argblock *pbptr) {
 			while(*(pbptr->argv) && !(pbptr->filename && type_cstr && index_cstr)) {
 				const char *option_arg = NULL;
 
-				if(compare_argument('f', "file", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+				if(compare_argument('r', "resolve", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, /*out_option_arg*/ NULL) & option_comparison_eitheropt) {
+					pbptr->flags.resolve_references = true;
+				} else if(compare_argument('e', "encoding", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+					if(!(option_arg && pb_text_encoding_for_name(option_arg, &(pbptr->encoding)))) {
+						fprintf(stderr, "%s paste: unknown encoding '%s'\n", argv0, option_arg ? option_arg : "");
+						return 1;
+					}
+				} else if(compare_argument('n', "normalize", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+					if(!(option_arg && pb_normalization_form_for_name(option_arg, &(pbptr->normalization)))) {
+						fprintf(stderr, "%s paste: unknown normalization form '%s' (known forms: nfc, nfd, nfkc)\n", argv0, option_arg ? option_arg : "");
+						return 1;
+					}
+				} else if(compare_argument(0, "eol", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+					if(!(option_arg && pb_line_ending_for_name(option_arg, &(pbptr->lineEnding)))) {
+						fprintf(stderr, "%s paste: unknown line ending style '%s' (known styles: lf, crlf, cr, keep)\n", argv0, option_arg ? option_arg : "");
+						return 1;
+					}
+				} else if(compare_argument(0, "cache-dir", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+					if(!(option_arg && *option_arg)) {
+						fprintf(stderr, "%s paste: --cache-dir requires a directory\n", argv0);
+						return 1;
+					}
+					pbptr->cacheDirectory = option_arg;
+				} else if(compare_argument(0, "cache", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, /*out_option_arg*/ NULL) & option_comparison_eitheropt) {
+					if(!(pbptr->cacheDirectory))
+						pbptr->cacheDirectory = pb_paste_cache_copy_default_directory();
+					if(!(pbptr->cacheDirectory)) {
+						fprintf(stderr, "%s paste: --cache needs a directory, since HOME is not set (use --cache-dir)\n", argv0);
+						return 1;
+					}
+				} else if(compare_argument(0, "encode", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+					if(!(option_arg && pb_bintext_format_for_name(option_arg, &(pbptr->bintextFormat)))) {
+						fprintf(stderr, "%s paste: unknown encoding format '%s' (known formats: base64, hex)\n", argv0, option_arg ? option_arg : "");
+						return 1;
+					}
+				} else if(compare_argument('f', "file", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
 					if(!(pbptr->filename))
 						pbptr->filename = option_arg;
 					else
@@ -631,12 +1864,14 @@ int paste(struct argblock *pbptr) {
 			these_args = *pbptr;
 			if(these_args_ptr->out_fd < 0)
 				these_args_ptr->out_fd    = pbptr->filename ? open(pbptr->filename, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
-			if(!these_args_ptr->type)
-				these_args_ptr->type      = kUTTypeUTF8PlainText; //Don't retain; borrow the retention by pbptr.
 			if(!these_args_ptr->itemIndex)
 				these_args_ptr->itemIndex = 1U;
 
 			int status = paste_one(these_args_ptr);
+			//The type was either ours or made for this pass; either way, the next pass starts without one.
+			if(these_args.type)
+				CFRelease(these_args.type);
+			pbptr->type = NULL;
 			if(status != 0)
 				return status;
 
@@ -645,7 +1880,6 @@ int paste(struct argblock *pbptr) {
 				pbptr->out_fd = -1;
 			}
 			pbptr->filename = NULL;
-			pbptr->type = NULL;
 			++pbptr->itemIndex;
 		}
 	}
@@ -653,8 +1887,8 @@ int paste(struct argblock *pbptr) {
 	return 0;
 }
 int count(struct argblock *pbptr) {
-	ItemCount num;
-	OSStatus err = PasteboardGetItemCount(pbptr->pasteboard, &num);
+	size_t num;
+	OSStatus err = pb_pasteboard_count(pbptr->handle, &num);
 	if(err != noErr) {
 		fprintf(stderr, "%s count: PasteboardGetItemCount for pasteboard %s returned %li (%s)\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
 		return 2;
@@ -662,85 +1896,1205 @@ int count(struct argblock *pbptr) {
 	printf("%lu\n", (unsigned long)num);
 	return 0;
 }
+struct list_flavor_data {
+	CFDataRef data;
+	OSStatus err;
+	enum pb_digest_algorithm digestAlgorithm;
+	unsigned char digest[pb_digest_max_length];
+};
+//dispatch_apply_f callback: context is the item's array of struct list_flavor_data; index selects one flavor.
+static void list_digest_flavor(void *context, size_t index) {
+	struct list_flavor_data *flavorData = &((struct list_flavor_data *)context)[index];
+	if(flavorData->data)
+		pb_digest_buffer(flavorData->digestAlgorithm, CFDataGetBytePtr(flavorData->data), (size_t)CFDataGetLength(flavorData->data), flavorData->digest);
+}
+
+enum list_format {
+	list_format_text,
+	list_format_tsv,
+	list_format_JSON,
+};
+//Like make_cstr_for_CFStr, but into a buffer of ours, so that listing thousands of flavors doesn't allocate for each one. Falls back to allocating for strings that don't fit.
+static const char *get_cstr_for_CFStr(CFStringRef in, char *buffer, size_t size, void (**outDeallocator)(const char *ptr)) {
+	*outDeallocator = null_deallocator;
+	const char *result = CFStringGetCStringPtr(in, kCFStringEncodingUTF8);
+	if(result)
+		return result;
+	if(CFStringGetCString(in, buffer, (CFIndex)size, kCFStringEncodingUTF8))
+		return buffer;
+	return make_cstr_for_CFStr(in, kCFStringEncodingUTF8, outDeallocator);
+}
+
 int list(struct argblock *pbptr) {
 	bool showSizes = false;
-	if (pbptr->argc > 0) {
+	bool showDigests = false;
+	bool showOSTypes = false;
+	enum pb_digest_algorithm digestAlgorithm = pb_digest_xxh64;
+	enum list_format format = list_format_text;
+	struct item_ranges itemRanges = { 0, NULL };
+	bool anyTimedOut = false;
+	while ((pbptr->argc > 0) && *(pbptr->argv)) {
+		const char **argv_before = pbptr->argv;
+		const char *option_arg = NULL;
 		if (compare_argument('s', "show-sizes", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, /*out_option_arg*/ NULL) & option_comparison_eitheropt) {
 			showSizes = true;
+		} else if (strncmp(*(pbptr->argv), "--digest=", strlen("--digest=")) == 0) {
+			//The algorithm has to be attached: a bare --digest means the default, and never takes the next argument (which is usually another option).
+			option_arg = *(pbptr->argv)++ + strlen("--digest=");
+			if (!pb_digest_algorithm_for_name(option_arg, &digestAlgorithm)) {
+				fprintf(stderr, "%s list: unknown digest algorithm '%s' (known algorithms: xxh64, sha256)\n", argv0, option_arg);
+				return 1;
+			}
+			showDigests = true;
+		} else if (compare_argument('d', "digest", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, /*out_option_arg*/ NULL) & option_comparison_eitheropt) {
+			digestAlgorithm = pb_digest_xxh64;
+			showDigests = true;
+		} else if (compare_argument('i', "items", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			if (!(option_arg && parse_item_ranges(option_arg, &itemRanges)))
+				return 1;
+		} else if (compare_argument('f', "format", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			if (option_arg && (strcasecmp(option_arg, "text") == 0))
+				format = list_format_text;
+			else if (option_arg && (strcasecmp(option_arg, "tsv") == 0))
+				format = list_format_tsv;
+			else if (option_arg && (strcasecmp(option_arg, "json") == 0))
+				format = list_format_JSON;
+			else {
+				fprintf(stderr, "%s list: unknown format '%s' (known formats: text, tsv, json)\n", argv0, option_arg ? option_arg : "");
+				return 1;
+			}
+		} else if (compare_argument(0, "ostypes", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, /*out_option_arg*/ NULL) & option_comparison_eitheropt) {
+			showOSTypes = true;
+		} else {
+			fprintf(stderr, "%s list: unrecognised option '%s'\n", argv0, *(pbptr->argv));
+			return 1;
 		}
+		pbptr->argc -= (int)(pbptr->argv - argv_before);
 	}
+	//The text format has always shown them.
+	if (format == list_format_text)
+		showOSTypes = true;
+
 	ItemCount num;
 	OSStatus err = PasteboardGetItemCount(pbptr->pasteboard, &num);
 	if(err != noErr) {
 		fprintf(stderr, "%s list: PasteboardGetItemCount for pasteboard %s returned %li (%s)\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
 		return 2;
 	}
-	CFShow(pbptr->pasteboardID);
-	printf("%lu items\n", (unsigned long)num);
-	if(num) {
-		for(UInt32 i = 1U; i <= num; ++i) {
-			CFArrayRef flavors = NULL;
-			PasteboardItemID item = NULL;
 
-			err = PasteboardGetItemIdentifier(pbptr->pasteboard, i, &item);
-			if(err != noErr) {
-				fprintf(stderr, "%s list: PasteboardGetItemIdentifier for pasteboard %s item %lu returned %li (%s)\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (unsigned long)i, (long)err, GetMacOSStatusCommentString(err));
-				break;
-			}
+	//Only walk the items that the ranges can reach.
+	CFIndex firstItem = 1, lastItem = (CFIndex)num;
+	if (itemRanges.count) {
+		firstItem = item_range_end;
+		lastItem = 0;
+		for (CFIndex r = 0; r < itemRanges.count; ++r) {
+			if (itemRanges.ranges[r].first < firstItem)
+				firstItem = itemRanges.ranges[r].first;
+			if (itemRanges.ranges[r].last > lastItem)
+				lastItem = itemRanges.ranges[r].last;
+		}
+		if (lastItem > (CFIndex)num)
+			lastItem = (CFIndex)num;
+	}
 
-			err = PasteboardCopyItemFlavors(pbptr->pasteboard, item, &flavors);
-			if(err != noErr) {
-				fprintf(stderr, "%s list: PasteboardCopyItemFlavors for pasteboard %s item %lu (object address %p) returned %li (%s)\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (unsigned long)i, item, (long)err, GetMacOSStatusCommentString(err));
+	struct buffered_output *output = malloc(sizeof(struct buffered_output));
+	if (output == NULL) {
+		fprintf(stderr, "%s list: could not allocate memory for the output buffer: %s\n", argv0, strerror(errno));
+		return 2;
+	}
+	output->fd = pbptr->out_fd;
+	output->failed = false;
+	output->length = 0U;
+
+	switch (format) {
+		case list_format_text:
+			fprintf(stderr, "%s\n", make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL));
+			buffered_printf(output, "%lu items\n", (unsigned long)num);
+			break;
+		case list_format_tsv:
+			buffered_printf(output, "item\ttype%s%s%s%s\n", showOSTypes ? "\tostype" : "", showSizes ? "\tsize" : "", showDigests ? "\t" : "", showDigests ? pb_digest_name(digestAlgorithm) : "");
+			break;
+		case list_format_JSON:
+			buffered_write(output, "{\"pasteboard\":", 14U);
+			buffered_write_JSON_string(output, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL));
+			buffered_printf(output, ",\"count\":%lu,\"items\":[", (unsigned long)num);
+			break;
+	}
+
+	int retval = 0;
+	bool firstListedItem = true;
+	for(CFIndex i = firstItem; (i <= lastItem) && !output->failed; ++i) {
+		if (!item_ranges_contain(&itemRanges, i))
+			continue;
+
+		CFArrayRef flavors = NULL;
+		PasteboardItemID item = NULL;
+
+		err = PasteboardGetItemIdentifier(pbptr->pasteboard, i, &item);
+		if(err != noErr) {
+			fprintf(stderr, "%s list: PasteboardGetItemIdentifier for pasteboard %s item %lu returned %li (%s)\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (unsigned long)i, (long)err, GetMacOSStatusCommentString(err));
+			break;
+		}
+
+		err = PasteboardCopyItemFlavors(pbptr->pasteboard, item, &flavors);
+		if(err != noErr) {
+			fprintf(stderr, "%s list: PasteboardCopyItemFlavors for pasteboard %s item %lu (object address %p) returned %li (%s)\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (unsigned long)i, item, (long)err, GetMacOSStatusCommentString(err));
+			break;
+		}
+
+		CFIndex numFlavors = CFArrayGetCount(flavors);
+
+		//Fetch every flavor's data up front, so that we can hash them all at once.
+		//The flavors are fetched one at a time (each within the --timeout, if any); the hashing is what gets spread across cores.
+		struct list_flavor_data *allFlavorData = NULL;
+		if ((showSizes || showDigests) && numFlavors) {
+			allFlavorData = calloc((size_t)numFlavors, sizeof(struct list_flavor_data));
+			if (allFlavorData == NULL) {
+				fprintf(stderr, "%s list: could not allocate memory for %li flavors of item %lu: %s\n", argv0, (long)numFlavors, (unsigned long)i, strerror(errno));
+				CFRelease(flavors);
+				retval = 2;
 				break;
 			}
-
-			CFIndex numFlavors = CFArrayGetCount(flavors);
-			printf("\n#%u: %lu flavors\n", i, numFlavors);
 			for(CFIndex j = 0U; j < numFlavors; ++j) {
-				CFStringRef flavor = CFArrayGetValueAtIndex(flavors, j);
-				void (*flavor_deallocator)(const char *ptr) = null_deallocator;
-				const char *flavor_c = make_cstr_for_CFStr(flavor, kCFStringEncodingUTF8, &flavor_deallocator);
-				CFStringRef tag = UTTypeCopyPreferredTagWithClass(flavor, kUTTagClassOSType);
-				void (*tag_deallocator)(const char *ptr) = null_deallocator;
-				const char *tag_c = tag ? make_cstr_for_CFStr(tag, kCFStringEncodingUTF8, &tag_deallocator) : NULL;
-
-				CFDataRef flavorData = NULL;
-				if (showSizes) {
-					err = PasteboardCopyItemFlavorData(pbptr->pasteboard, item, flavor, &flavorData);
-				}
+				allFlavorData[j].digestAlgorithm = digestAlgorithm;
+				allFlavorData[j].err = pb_copy_flavor_data(pbptr->handle, item, CFArrayGetValueAtIndex(flavors, j), &(allFlavorData[j].data));
+				if(allFlavorData[j].err == kMPTimeoutErr)
+					anyTimedOut = true;
+			}
+			if (showDigests)
+				dispatch_apply_f((size_t)numFlavors, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), allFlavorData, list_digest_flavor);
+		}
 
-				printf("\t%s ", flavor_c);
-				if (tag_c != NULL && *tag_c != '\0') {
-					printf("'%s' ", tag_c);
-				}
-				if (showSizes) {
-					if(err == noErr) {
-						printf("(%lli bytes)\n", (long long)CFDataGetLength(flavorData));
-						CFRelease(flavorData);
-					} else {
-						printf("(??? bytes; PasteboardCopyItemFlavorData returned %li (%s))\n", (long)err, GetMacOSStatusCommentString(err));
+		if (format == list_format_text)
+			buffered_printf(output, "\n#%li: %li flavors\n", (long)i, (long)numFlavors);
+		else if (format == list_format_JSON)
+			buffered_printf(output, "%s{\"item\":%li,\"flavors\":[", firstListedItem ? "" : ",", (long)i);
+		firstListedItem = false;
+
+		for(CFIndex j = 0U; j < numFlavors; ++j) {
+			CFStringRef flavor = CFArrayGetValueAtIndex(flavors, j);
+			char flavor_buf[256];
+			void (*flavor_deallocator)(const char *ptr) = null_deallocator;
+			const char *flavor_c = get_cstr_for_CFStr(flavor, flavor_buf, sizeof(flavor_buf), &flavor_deallocator);
+			CFStringRef tag = showOSTypes ? UTTypeCopyPreferredTagWithClass(flavor, kUTTagClassOSType) : NULL;
+			char tag_buf[16];
+			void (*tag_deallocator)(const char *ptr) = null_deallocator;
+			const char *tag_c = tag ? get_cstr_for_CFStr(tag, tag_buf, sizeof(tag_buf), &tag_deallocator) : NULL;
+			bool hasTag = (tag_c != NULL) && (*tag_c != '\0');
+
+			struct list_flavor_data *flavorData = allFlavorData ? &allFlavorData[j] : NULL;
+			char digest_hex[pb_digest_max_length * 2U + 1U];
+			if (flavorData && (flavorData->err == noErr) && showDigests)
+				pb_digest_format_hex(flavorData->digest, pb_digest_length(digestAlgorithm), digest_hex);
+
+			switch (format) {
+				case list_format_text:
+					buffered_printf(output, "\t%s ", flavor_c);
+					if (hasTag)
+						buffered_printf(output, "'%s' ", tag_c);
+					if (flavorData) {
+						if(flavorData->err == noErr) {
+							if (showSizes)
+								buffered_printf(output, "(%lli bytes)", (long long)CFDataGetLength(flavorData->data));
+							if (showDigests)
+								buffered_printf(output, "%s%s:%s", showSizes ? " " : "", pb_digest_name(digestAlgorithm), digest_hex);
+						} else if(flavorData->err == kMPTimeoutErr) {
+							buffered_printf(output, "(unavailable; no data after %lu ms)", pbptr->timeoutMsec);
+						} else {
+							buffered_printf(output, "(??? %s; PasteboardCopyItemFlavorData returned %li (%s))", showSizes ? "bytes" : "digest", (long)flavorData->err, GetMacOSStatusCommentString(flavorData->err));
+						}
 					}
-				} else {
-					printf("\n");
-				}
-				//else...
-				//	printf("\t%s\n", flavor_c);
-				flavor_deallocator(flavor_c);
-				tag_deallocator(tag_c);
+					buffered_write(output, "\n", 1U);
+					break;
+
+				case list_format_tsv:
+					//Flavors whose data couldn't be fetched get empty size and digest columns.
+					buffered_printf(output, "%li\t%s", (long)i, flavor_c);
+					if (showOSTypes)
+						buffered_printf(output, "\t%s", hasTag ? tag_c : "");
+					if (showSizes) {
+						if (flavorData->err == noErr)
+							buffered_printf(output, "\t%lli", (long long)CFDataGetLength(flavorData->data));
+						else
+							buffered_write(output, "\t", 1U);
+					}
+					if (showDigests)
+						buffered_printf(output, "\t%s", (flavorData->err == noErr) ? digest_hex : "");
+					buffered_write(output, "\n", 1U);
+					break;
+
+				case list_format_JSON:
+					buffered_printf(output, "%s{\"type\":", j ? "," : "");
+					buffered_write_JSON_string(output, flavor_c);
+					if (hasTag) {
+						buffered_write(output, ",\"ostype\":", 10U);
+						buffered_write_JSON_string(output, tag_c);
+					}
+					if (flavorData) {
+						if (flavorData->err == noErr) {
+							if (showSizes)
+								buffered_printf(output, ",\"size\":%lli", (long long)CFDataGetLength(flavorData->data));
+							if (showDigests)
+								buffered_printf(output, ",\"digest\":\"%s:%s\"", pb_digest_name(digestAlgorithm), digest_hex);
+						} else {
+							buffered_printf(output, ",\"error\":%li", (long)flavorData->err);
+						}
+					}
+					buffered_write(output, "}", 1U);
+					break;
 			}
+
+			if (flavorData && (flavorData->err == noErr))
+				CFRelease(flavorData->data);
+			flavor_deallocator(flavor_c);
+			tag_deallocator(tag_c);
+			if (tag)
+				CFRelease(tag);
 		}
+		if (format == list_format_JSON)
+			buffered_write(output, "]}", 2U);
+
+		free(allFlavorData);
+		CFRelease(flavors);
 	}
+	if (format == list_format_JSON)
+		buffered_write(output, "]}\n", 3U);
 
-	return 0;
+	if (!flush_buffered_output(output)) {
+		fprintf(stderr, "%s list: could not write the listing: %s\n", argv0, strerror(errno));
+		retval = 2;
+	}
+	free(output);
+
+	//The listing is complete apart from the flavors we gave up on, but say so, just as paste would.
+	if ((retval == 0) && anyTimedOut)
+		retval = 3;
+	return retval;
 }
 int clear(struct argblock *pbptr) {
-	OSStatus err = PasteboardClear(pbptr->pasteboard);
+	OSStatus err = pb_pasteboard_clear(pbptr->handle);
 	if(err != noErr) {
 		fprintf(stderr, "%s clear: PasteboardClear for pasteboard %s returned %li (%s)\n", argv0, make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL), (long)err, GetMacOSStatusCommentString(err));
 		return 2;
 	} else
 		return 0;
 }
+int transfer(struct argblock *pbptr) {
+	const char *from_cstr = NULL, *to_cstr = NULL, *types_cstr = NULL;
+	struct item_ranges itemRanges = { 0, NULL };
+	while(*(pbptr->argv)) {
+		const char *option_arg = NULL;
+		if(compare_argument(0, "from", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			from_cstr = option_arg;
+		} else if(compare_argument(0, "to", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			to_cstr = option_arg;
+		} else if(compare_argument('i', "items", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			if(!(option_arg && parse_item_ranges(option_arg, &itemRanges)))
+				return 1;
+		} else if(compare_argument('t', "types", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			types_cstr = option_arg;
+		} else {
+			fprintf(stderr, "%s transfer: unrecognised option '%s'\n", argv0, *(pbptr->argv));
+			return 1;
+		}
+	}
+	if(!(to_cstr && *to_cstr)) {
+		fprintf(stderr, "%s transfer: no destination pasteboard (use --to=ID)\n", argv0);
+		return 1;
+	}
+
+	//Parse the list of types, if any, into an array of UTIs.
+	CFStringRef *types = NULL;
+	CFIndex numTypes = 0;
+	if(types_cstr) {
+		numTypes = 1;
+		for(const char *p = types_cstr; *p; ++p)
+			if(*p == ',') ++numTypes;
+		types = pb_allocate((size_t)numTypes * sizeof(CFStringRef));
+		numTypes = 0;
+		for(const char *start = types_cstr; types && *start; ) {
+			const char *end = strchr(start, ',');
+			if(!end)
+				end = start + strlen(start);
+			if(end > start) {
+				//Don't use create_UTI_with_cstr here because the user should be able to explicitly request a type that might not have been declared.
+				CFStringRef type = CFStringCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)start, end - start, kCFStringEncodingUTF8, /*isExternalRepresentation*/ false);
+				if(type)
+					types[numTypes++] = type;
+			}
+			start = end + (*end == ',');
+		}
+	}
+
+	int retval = 0;
+	OSStatus err;
+
+	pb_pasteboard *source = pbptr->handle, *destination = NULL;
+	const char *source_cstr = make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL);
+	if(from_cstr) {
+		err = pb_pasteboard_open(from_cstr, &source);
+		if(err != noErr) {
+			source = NULL;
+			fprintf(stderr, "%s transfer: could not create pasteboard reference for pasteboard ID %s: PasteboardCreate returned %li (%s)\n", argv0, from_cstr, (long)err, GetMacOSStatusCommentString(err));
+			retval = 2;
+			goto end;
+		}
+		set_pasteboard_options(pbptr, source);
+		source_cstr = from_cstr;
+	}
+	err = pb_pasteboard_open(to_cstr, &destination);
+	if(err != noErr) {
+		destination = NULL;
+		fprintf(stderr, "%s transfer: could not create pasteboard reference for pasteboard ID %s: PasteboardCreate returned %li (%s)\n", argv0, to_cstr, (long)err, GetMacOSStatusCommentString(err));
+		retval = 2;
+		goto end;
+	}
+
+	size_t numItems = 0U;
+	err = pb_pasteboard_count(source, &numItems);
+	if(err != noErr) {
+		fprintf(stderr, "%s transfer: PasteboardGetItemCount for pasteboard %s returned %li (%s)\n", argv0, source_cstr, (long)err, GetMacOSStatusCommentString(err));
+		retval = 2;
+		goto end;
+	}
+
+	//Fetch everything before we touch the destination, so that transferring a pasteboard onto itself works.
+	struct pb_item *items = calloc(numItems ? numItems : 1U, sizeof(struct pb_item));
+	CFIndex numFetchedItems = 0;
+	if(!items) {
+		fprintf(stderr, "%s transfer: could not allocate memory for %lu items: %s\n", argv0, (unsigned long)numItems, strerror(errno));
+		retval = 2;
+		goto end;
+	}
+	for(CFIndex i = 1; i <= (CFIndex)numItems; ++i) {
+		if(!item_ranges_contain(&itemRanges, i))
+			continue;
+		struct pb_item *item = &items[numFetchedItems];
+		err = pb_fetch_item(source, i, types, types ? numTypes : 0, item);
+		if(err != noErr) {
+			fprintf(stderr, "%s transfer: could not read item %li of pasteboard %s: %li (%s)\n", argv0, (long)i, source_cstr, (long)err, GetMacOSStatusCommentString(err));
+			retval = (err == kMPTimeoutErr) ? 3 : 2;
+			break;
+		}
+		//Items with none of the requested types don't come along.
+		if(item->numFlavors)
+			++numFetchedItems;
+		else
+			pb_release_item(item);
+	}
+
+	if(retval == 0) {
+		err = pb_publish_items(destination, items, numFetchedItems);
+		if(err != noErr) {
+			fprintf(stderr, "%s transfer: could not put items on pasteboard %s: %li (%s)\n", argv0, to_cstr, (long)err, GetMacOSStatusCommentString(err));
+			retval = 2;
+		}
+	}
+
+	for(CFIndex i = 0; i < numFetchedItems; ++i)
+		pb_release_item(&items[i]);
+	free(items);
+
+end:
+	for(CFIndex i = 0; i < numTypes; ++i)
+		CFRelease(types[i]);
+	pb_pasteboard_close(destination);
+	if(source != pbptr->handle)
+		pb_pasteboard_close(source);
+	return retval;
+}
+//transform: where the pipeline's output goes, converted back into the encoding the text came in.
+struct transformed_text {
+	CFMutableDataRef data;
+	enum pb_text_encoding encoding;
+};
+static bool append_to_data(void *context, const void *bytes, size_t length) {
+	CFDataAppendBytes(context, bytes, (CFIndex)length);
+	return true;
+}
+static bool write_transformed_text(void *context, const void *bytes, size_t length) {
+	struct transformed_text *output = context;
+	if(output->encoding == pb_text_encoding_utf8)
+		return append_to_data(output->data, bytes, length);
+	//The pipeline's pieces end on line boundaries, so each one can be converted on its own.
+	return pb_transcode_stream(pb_text_encoding_utf8, output->encoding, bytes, length, append_to_data, output->data);
+}
+static bool feed_transform(void *context, const void *bytes, size_t length) {
+	return pb_transform_feed(context, bytes, length);
+}
+
+//Whether a flavor holds the item's text in some form (any kind of text, RTF, HTML, a web archive, or pb's digest of the text), and so would still say what it said before the transform.
+static Boolean is_text_form_flavor(CFStringRef type) {
+	return UTTypeConformsTo(type, kUTTypeText) || UTTypeConformsTo(type, kUTTypeRTFD) || UTTypeConformsTo(type, kUTTypeFlatRTFD) || UTTypeConformsTo(type, CFSTR("com.apple.webarchive")) || UTTypeEqual(type, pb_copied_digest_type);
+}
+
+int transform(struct argblock *pbptr) {
+	unsigned long itemIndex = 1UL;
+	size_t numFilters = 0U;
+	struct pb_transform_filter *filters = pb_allocate(((size_t)pbptr->argc + 1U) * sizeof(*filters));
+	if(!filters) {
+		fprintf(stderr, "%s transform: could not allocate memory for the filters: %s\n", argv0, strerror(errno));
+		return 2;
+	}
+	while(*(pbptr->argv)) {
+		const char *option_arg = NULL;
+		if(compare_argument('i', "item", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			char *end = NULL;
+			itemIndex = option_arg ? strtoul(option_arg, &end, 10) : 0UL;
+			if((itemIndex == 0UL) || (itemIndex > LONG_MAX) || *end) {
+				fprintf(stderr, "%s transform: invalid item number '%s' (items are numbered from 1)\n", argv0, option_arg ? option_arg : "");
+				return 1;
+			}
+		} else if(compare_argument(0, "replace", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			if(!(option_arg && pb_transform_parse_replacement(option_arg, &filters[numFilters]))) {
+				fprintf(stderr, "%s transform: invalid replacement '%s' (it should be /FROM/TO/)\n", argv0, option_arg ? option_arg : "");
+				return 1;
+			}
+			++numFilters;
+		} else if((strncmp(*(pbptr->argv), "--", 2U) == 0) && pb_transform_filter_for_name(*(pbptr->argv) + 2, &filters[numFilters])) {
+			++numFilters;
+			++(pbptr->argv);
+		} else {
+			fprintf(stderr, "%s transform: unrecognised option '%s'\n", argv0, *(pbptr->argv));
+			return 1;
+		}
+	}
+	if(!numFilters) {
+		fprintf(stderr, "%s transform: no filters (use --trim, --fold-case, --dedupe, --sort, or --replace=/FROM/TO/)\n", argv0);
+		return 1;
+	}
+
+	const char *pasteboardID_cstr = make_pasteboardID_cstr(pbptr, /*deallocator*/ NULL);
+	size_t numItems = 0U;
+	OSStatus err = pb_pasteboard_count(pbptr->handle, &numItems);
+	if(err != noErr) {
+		fprintf(stderr, "%s transform: PasteboardGetItemCount for pasteboard %s returned %li (%s)\n", argv0, pasteboardID_cstr, (long)err, GetMacOSStatusCommentString(err));
+		return 2;
+	}
+	if(itemIndex > numItems) {
+		fprintf(stderr, "%s transform: there is no item %lu on pasteboard %s (it has %lu)\n", argv0, itemIndex, pasteboardID_cstr, (unsigned long)numItems);
+		return 1;
+	}
+
+	PasteboardItemID itemID = NULL;
+	err = PasteboardGetItemIdentifier(pbptr->pasteboard, (CFIndex)itemIndex, &itemID);
+	if(err != noErr) {
+		fprintf(stderr, "%s transform: can't find item %lu on pasteboard %s: PasteboardGetItemIdentifier returned %li (%s)\n", argv0, itemIndex, pasteboardID_cstr, (long)err, GetMacOSStatusCommentString(err));
+		return 2;
+	}
+	CFStringRef sourceType = NULL;
+	CFDataRef sourceData = NULL;
+	err = pb_copy_text_flavor_data(pbptr->handle, itemID, &sourceType, &sourceData);
+	if(err != noErr) {
+		fprintf(stderr, "%s transform: item %lu on pasteboard %s has no text: %li (%s)\n", argv0, itemIndex, pasteboardID_cstr, (long)err, GetMacOSStatusCommentString(err));
+		return (err == kMPTimeoutErr) ? 3 : 2;
+	}
+
+	//The result goes back in the encoding the text was in. Text extracted from RTF or HTML goes back as plain UTF-8; the markup can't be kept. Either way, every other form of the text is dropped, since it would still hold the text as it was; flavors that aren't text (such as images) stay as they were.
+	struct transformed_text output = { CFDataCreateMutable(kCFAllocatorDefault, /*capacity*/ 0), pb_text_encoding_utf8 };
+	CFStringRef outputType = kUTTypeUTF8PlainText;
+	if(text_encoding_for_flavor(sourceType, sourceData, &output.encoding)) {
+		outputType = sourceType;
+		if(output.data && UTTypeConformsTo(sourceType, kUTTypeUTF16ExternalPlainText)) {
+			static const UInt8 bigEndianBOM[2] = { 0xFE, 0xFF }, littleEndianBOM[2] = { 0xFF, 0xFE };
+			CFDataAppendBytes(output.data, (output.encoding == pb_text_encoding_utf16le) ? littleEndianBOM : bigEndianBOM, 2);
+		}
+	}
+
+	int retval = 0;
+	struct pb_transform_pipeline *pipeline = output.data ? pb_transform_create(filters, numFilters, write_transformed_text, &output) : NULL;
+	if(!pipeline) {
+		fprintf(stderr, "%s transform: could not allocate memory for the pipeline: %s\n", argv0, strerror(ENOMEM));
+		retval = 2;
+		goto end;
+	}
+	errno = 0;
+	err = pb_write_text(sourceType, sourceData, pb_text_encoding_utf8, feed_transform, pipeline);
+	if((err == noErr) && !pb_transform_finish(pipeline))
+		err = userCanceledErr;
+	if(err != noErr) {
+		if(errno == ENOMEM)
+			fprintf(stderr, "%s transform: could not allocate memory for the text of item %lu: %s\n", argv0, itemIndex, strerror(errno));
+		else if(errno == EILSEQ)
+			fprintf(stderr, "%s transform: the text of item %lu is not valid UTF-8\n", argv0, itemIndex);
+		else if(err == userCanceledErr)
+			fprintf(stderr, "%s transform: the transformed text of item %lu can't be put back in its original encoding\n", argv0, itemIndex);
+		else
+			fprintf(stderr, "%s transform: the text of item %lu is malformed\n", argv0, itemIndex);
+		retval = 2;
+		goto end;
+	}
+
+	//Nothing changed: leave the pasteboard alone, so nobody watching it is told of a change.
+	if(CFEqual(outputType, sourceType) && CFEqual(output.data, sourceData))
+		goto end;
+
+	//Every other item goes back as it was, with the transformed item in its place, all in one publish.
+	struct pb_item *items = calloc(numItems, sizeof(struct pb_item));
+	CFIndex numFetchedItems = 0;
+	if(!items) {
+		fprintf(stderr, "%s transform: could not allocate memory for %lu items: %s\n", argv0, (unsigned long)numItems, strerror(errno));
+		retval = 2;
+		goto end;
+	}
+	for(CFIndex i = 1; i <= (CFIndex)numItems; ++i) {
+		err = pb_fetch_item(pbptr->handle, i, /*types*/ NULL, /*numTypes*/ 0, &items[i - 1]);
+		if(err != noErr) {
+			fprintf(stderr, "%s transform: could not read item %li of pasteboard %s: %li (%s)\n", argv0, (long)i, pasteboardID_cstr, (long)err, GetMacOSStatusCommentString(err));
+			retval = (err == kMPTimeoutErr) ? 3 : 2;
+			break;
+		}
+		++numFetchedItems;
+		if(i == (CFIndex)itemIndex) {
+			struct pb_item *original = &items[i - 1];
+			struct pb_flavor *flavors = calloc((size_t)original->numFlavors + pb_max_copied_flavors, sizeof(struct pb_flavor));
+			if(!flavors) {
+				fprintf(stderr, "%s transform: could not allocate memory for the flavors of item %lu: %s\n", argv0, itemIndex, strerror(errno));
+				retval = 2;
+				break;
+			}
+			//The transformed text comes first, then whatever isn't text. Retaining the types lets the item be released like the others.
+			struct pb_item transformed;
+			pb_make_copied_item(outputType, CFRetain(output.data), flavors, &transformed);
+			for(CFIndex j = 0; j < transformed.numFlavors; ++j)
+				CFRetain(flavors[j].type);
+			for(CFIndex j = 0; j < original->numFlavors; ++j) {
+				if(is_text_form_flavor(original->flavors[j].type))
+					continue;
+				flavors[transformed.numFlavors] = original->flavors[j];
+				CFRetain(flavors[transformed.numFlavors].type);
+				CFRetain(flavors[transformed.numFlavors].data);
+				++transformed.numFlavors;
+			}
+			transformed.ID = itemID;
+			pb_release_item(original);
+			*original = transformed;
+		}
+	}
+	if(retval == 0) {
+		err = pb_publish_items(pbptr->handle, items, numFetchedItems);
+		if(err != noErr) {
+			fprintf(stderr, "%s transform: could not put items on pasteboard %s: %li (%s)\n", argv0, pasteboardID_cstr, (long)err, GetMacOSStatusCommentString(err));
+			retval = 2;
+		}
+	}
+
+	for(CFIndex i = 0; i < numFetchedItems; ++i)
+		pb_release_item(&items[i]);
+	free(items);
+
+end:
+	pb_transform_destroy(pipeline);
+	if(output.data)
+		CFRelease(output.data);
+	CFRelease(sourceData);
+	return retval;
+}
+enum bench_phase {
+	bench_phase_prepare, //pb: making the data and its alternate encodings
+	bench_phase_publish, //pasteboard server: clearing the pasteboard and putting the item on it
+	bench_phase_fetch,   //pasteboard server: getting the item back
+	bench_phase_verify,  //pb: checking that what came back is what went in
+	bench_phase_count
+};
+static const char *const bench_phase_names[bench_phase_count] = { "prepare", "publish", "fetch", "verify" };
+static const Boolean bench_phase_is_in_server[bench_phase_count] = { false, true, true, false };
+
+static uint64_t bench_now_nsec(void) {
+	static mach_timebase_info_data_t timebase;
+	if(timebase.denom == 0U)
+		mach_timebase_info(&timebase);
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+static int compare_uint64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+//Parses a list of sizes like "512,64k,1m" into an array allocated with pb_allocate. Returns false (having reported the error) if any of them is malformed.
+static Boolean parse_bench_sizes(const char *spec, size_t **outSizes, size_t *outNumSizes) {
+	size_t numSizes = 1U;
+	for(const char *p = spec; *p; ++p)
+		if(*p == ',') ++numSizes;
+	size_t *sizes = pb_allocate(numSizes * sizeof(size_t));
+	if(!sizes) {
+		fprintf(stderr, "%s bench: could not allocate memory for sizes: %s\n", argv0, strerror(errno));
+		return false;
+	}
+
+	numSizes = 0U;
+	for(const char *p = spec; *p; ) {
+		char *end = NULL;
+		unsigned long long size = strtoull(p, &end, 10);
+		switch(*end) {
+			case 'k': case 'K': size *= 1024U;        ++end; break;
+			case 'm': case 'M': size *= 1048576U;     ++end; break;
+			case 'g': case 'G': size *= 1073741824U;  ++end; break;
+		}
+		if((end == p) || (size == 0U) || ((*end != ',') && (*end != '\0'))) {
+			fprintf(stderr, "%s bench: invalid size in '%s' (sizes look like 512, 64k, or 1m)\n", argv0, spec);
+			return false;
+		}
+		sizes[numSizes++] = (size_t)size;
+		p = end + (*end == ',');
+	}
+
+	*outSizes = sizes;
+	*outNumSizes = numSizes;
+	return true;
+}
+
+//Text gets accented letters and punctuation outside ASCII, so that every alternate encoding has real work to do (and MacRoman can still represent all of it). Anything else gets noise.
+static void fill_bench_payload(UInt8 *buf, size_t length, Boolean isText) {
+	if(isText) {
+		static const char sentence[] = "The na\xc3\xafve caf\xc3\xa9 owner's fa\xc3\xa7" "ade \xe2\x80\x94 r\xc3\xa9sum\xc3\xa9s welcome.\n";
+		const size_t sentenceLength = sizeof(sentence) - 1U;
+		size_t i = 0U;
+		for(; i + sentenceLength <= length; i += sentenceLength)
+			memcpy(&buf[i], sentence, sentenceLength);
+		//Pad out with ASCII so we never cut a character in half.
+		memset(&buf[i], 'x', length - i);
+	} else {
+		uint64_t state = 0x9E3779B97F4A7C15ULL;
+		for(size_t i = 0U; i < length; ++i) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			buf[i] = (UInt8)state;
+		}
+	}
+}
+
+static void print_bench_row(const char *name, uint64_t *times, unsigned long iterations, size_t payloadSize) {
+	qsort(times, iterations, sizeof(uint64_t), compare_uint64);
+	uint64_t p50 = times[(iterations - 1U) * 50U / 100U];
+	uint64_t p99 = times[(iterations - 1U) * 99U / 100U];
+	uint64_t max = times[iterations - 1U];
+	double throughput = p50 ? ((double)payloadSize / 1048576.0) / ((double)p50 / 1e9) : 0.0;
+	printf("\t%-10s %10.3f ms %10.3f ms %10.3f ms %10.1f MB/s\n", name, (double)p50 / 1e6, (double)p99 / 1e6, (double)max / 1e6, throughput);
+}
+
+static int bench_one_size(pb_pasteboard *pasteboard, const char *pasteboardID_cstr, CFStringRef type, size_t payloadSize, unsigned long iterations) {
+	Boolean isText = UTTypeConformsTo(type, kUTTypeUTF8PlainText);
+	//The fetch is timed straight from the Pasteboard Manager, with no --timeout machinery in the way.
+	PasteboardRef pasteboardRef = pb_pasteboard_get_ref(pasteboard);
+	UInt8 *payload = malloc(payloadSize);
+	uint64_t *times = calloc((size_t)iterations * (bench_phase_count + 1U), sizeof(uint64_t));
+	if(!(payload && times)) {
+		fprintf(stderr, "%s bench: could not allocate memory for a %lu-byte payload: %s\n", argv0, (unsigned long)payloadSize, strerror(errno));
+		free(payload);
+		free(times);
+		return 2;
+	}
+	fill_bench_payload(payload, payloadSize, isText);
+
+	//times is one row per phase, plus one for whole round trips.
+	uint64_t *roundTripTimes = &times[bench_phase_count * iterations];
+	int retval = 0;
+	for(unsigned long i = 0U; (retval == 0) && (i < iterations); ++i) {
+		uint64_t stamps[bench_phase_count + 1];
+		OSStatus err;
+
+		stamps[bench_phase_prepare] = bench_now_nsec();
+		struct pb_flavor flavors[pb_max_copied_flavors];
+		struct pb_item item;
+		pb_make_copied_item(type, CFDataCreate(kCFAllocatorDefault, payload, (CFIndex)payloadSize), flavors, &item);
+
+		stamps[bench_phase_publish] = bench_now_nsec();
+		err = pb_publish_items(pasteboard, &item, /*numItems*/ 1);
+		for(CFIndex j = 0; j < item.numFlavors; ++j)
+			CFRelease(flavors[j].data);
+		if(err != noErr) {
+			fprintf(stderr, "%s bench: could not put item on pasteboard %s: %li (%s)\n", argv0, pasteboardID_cstr, (long)err, GetMacOSStatusCommentString(err));
+			retval = 2;
+			break;
+		}
+
+		stamps[bench_phase_fetch] = bench_now_nsec();
+		PasteboardSynchronize(pasteboardRef);
+		PasteboardItemID itemID;
+		CFDataRef fetchedData = NULL;
+		err = PasteboardGetItemIdentifier(pasteboardRef, 1, &itemID);
+		if(err == noErr)
+			err = PasteboardCopyItemFlavorData(pasteboardRef, itemID, type, &fetchedData);
+		if(err != noErr) {
+			fprintf(stderr, "%s bench: could not get item back from pasteboard %s: %li (%s)\n", argv0, pasteboardID_cstr, (long)err, GetMacOSStatusCommentString(err));
+			retval = 2;
+			break;
+		}
+
+		stamps[bench_phase_verify] = bench_now_nsec();
+		if(((size_t)CFDataGetLength(fetchedData) != payloadSize) || (memcmp(CFDataGetBytePtr(fetchedData), payload, payloadSize) != 0)) {
+			fprintf(stderr, "%s bench: data read back from pasteboard %s does not match what was put there\n", argv0, pasteboardID_cstr);
+			retval = 2;
+		}
+		CFRelease(fetchedData);
+
+		stamps[bench_phase_count] = bench_now_nsec();
+		for(unsigned phase = 0U; phase < bench_phase_count; ++phase)
+			times[(phase * iterations) + i] = stamps[phase + 1U] - stamps[phase];
+		roundTripTimes[i] = stamps[bench_phase_count] - stamps[bench_phase_prepare];
+	}
+
+	if(retval == 0) {
+		uint64_t inPB = 0U, inServer = 0U;
+		for(unsigned phase = 0U; phase < bench_phase_count; ++phase) {
+			for(unsigned long i = 0U; i < iterations; ++i)
+				*(bench_phase_is_in_server[phase] ? &inServer : &inPB) += times[(phase * iterations) + i];
+		}
+
+		printf("%lu bytes of %s, %lu round trips:\n", (unsigned long)payloadSize, make_cstr_for_CFStr(type, kCFStringEncodingUTF8, /*deallocator*/ NULL), iterations);
+		printf("\t%-10s %13s %13s %13s %15s\n", "phase", "p50", "p99", "max", "throughput");
+		for(unsigned phase = 0U; phase < bench_phase_count; ++phase)
+			print_bench_row(bench_phase_names[phase], &times[phase * iterations], iterations, payloadSize);
+		print_bench_row("round trip", roundTripTimes, iterations, payloadSize);
+		if(inPB + inServer)
+			printf("\ttime in pb: %.1f%%; in the pasteboard server: %.1f%%\n", 100.0 * (double)inPB / (double)(inPB + inServer), 100.0 * (double)inServer / (double)(inPB + inServer));
+	}
+
+	free(payload);
+	free(times);
+	return retval;
+}
+
+int bench(struct argblock *pbptr) {
+	unsigned long iterations = 100U;
+	const char *sizes_cstr = "1k,64k,1m";
+	while(*(pbptr->argv)) {
+		const char *option_arg = NULL;
+		if(compare_argument('n', "iterations", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			iterations = option_arg ? strtoul(option_arg, NULL, 10) : 0U;
+			if(iterations == 0U) {
+				fprintf(stderr, "%s bench: invalid number of iterations '%s'\n", argv0, option_arg ? option_arg : "");
+				return 1;
+			}
+		} else if(compare_argument('s', "sizes", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			sizes_cstr = option_arg ? option_arg : "";
+		} else if(compare_argument('t', "type", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			if(pbptr->type)
+				CFRelease(pbptr->type);
+			//Don't use create_UTI_with_cstr here because the user should be able to explicitly request a type that might not have been declared.
+			pbptr->type = CFStringCreateWithCString(kCFAllocatorDefault, option_arg ? option_arg : "", kCFStringEncodingUTF8);
+		} else {
+			fprintf(stderr, "%s bench: unrecognised option '%s'\n", argv0, *(pbptr->argv));
+			return 1;
+		}
+	}
+
+	size_t *sizes = NULL, numSizes = 0U;
+	if(!parse_bench_sizes(sizes_cstr, &sizes, &numSizes))
+		return 1;
+
+	//Unless the user named a pasteboard to use, make a scratch one, so that benchmarking doesn't clobber the clipboard.
+	pb_pasteboard *pasteboard = pbptr->handle;
+	const char *pasteboardID_cstr = "(scratch)";
+	if(pbptr->pasteboardID_cstr)
+		pasteboardID_cstr = pbptr->pasteboardID_cstr;
+	else {
+		OSStatus err = pb_pasteboard_open_unique(&pasteboard);
+		if(err != noErr) {
+			fprintf(stderr, "%s bench: could not create a scratch pasteboard: PasteboardCreate returned %li (%s)\n", argv0, (long)err, GetMacOSStatusCommentString(err));
+			return 2;
+		}
+	}
+
+	CFStringRef type = pbptr->type ? pbptr->type : kUTTypeUTF8PlainText;
+	int retval = 0;
+	for(size_t i = 0U; (retval == 0) && (i < numSizes); ++i)
+		retval = bench_one_size(pasteboard, pasteboardID_cstr, type, sizes[i], iterations);
+
+	if(pasteboard != pbptr->handle) {
+		pb_pasteboard_clear(pasteboard);
+		pb_pasteboard_close(pasteboard);
+	}
+	return retval;
+}
+//stress: every payload starts with this header, so that a reader can tell a whole payload from a partial or mixed-up one.
+struct stress_payload_header {
+	char magic[8];
+	uint32_t writer;
+	uint32_t reserved;
+	uint64_t sequence;
+	uint64_t length; //Of the whole payload, header included.
+	uint64_t bodyDigest; //XXH64 of everything after the header.
+};
+static const char stress_magic[8] = "pbSTRESS";
+static const char stress_type_cstr[] = "org.boredzo.pb.stress";
+//Each writer clears the pasteboard instead of copying once in this many operations.
+enum { stress_clear_interval = 16U };
+
+enum stress_op {
+	stress_op_copy,
+	stress_op_paste,
+	stress_op_clear,
+	stress_op_count
+};
+static const char *const stress_op_names[stress_op_count] = { "copy", "paste", "clear" };
+
+struct stress_latencies {
+	uint64_t *times;
+	size_t count, capacity;
+	unsigned long dropped; //Operations we couldn't record a time for, because memory ran out.
+};
+static void record_stress_latency(struct stress_latencies *latencies, uint64_t nsec) {
+	if(latencies->count == latencies->capacity) {
+		size_t newCapacity = latencies->capacity ? latencies->capacity * 2U : 4096U;
+		uint64_t *newTimes = realloc(latencies->times, newCapacity * sizeof(uint64_t));
+		if(!newTimes) {
+			++latencies->dropped;
+			return;
+		}
+		latencies->times = newTimes;
+		latencies->capacity = newCapacity;
+	}
+	latencies->times[latencies->count++] = nsec;
+}
+
+//Shared by all the workers. Everything but the start gate is read-only once they're running.
+struct stress_run {
+	const char *pasteboardID_cstr;
+	const size_t *sizes;
+	size_t numSizes;
+	size_t maxSize;
+	unsigned long timeoutMsec;
+
+	pthread_mutex_t gateLock;
+	pthread_cond_t gateCondition;
+	Boolean started;
+	uint64_t deadline;
+};
+
+//One per thread; the totals are added up after they're all done.
+struct stress_worker {
+	struct stress_run *run;
+	pthread_t thread;
+	uint32_t index;
+	Boolean isWriter;
+
+	OSStatus openErr;
+	struct stress_latencies latencies[stress_op_count];
+	unsigned long errors;
+	OSStatus firstErr;
+	//Writers: copies that another writer's clear got in the middle of, so that the pasteboard was no longer ours to finish them on.
+	unsigned long lostCopies;
+	//Readers: what each paste found.
+	unsigned long completeReads, emptyReads, partialReads, tornReads;
+};
+
+static void fill_stress_payload(UInt8 *buf, size_t length, uint32_t writer, uint64_t sequence) {
+	struct stress_payload_header header = { .writer = writer, .sequence = sequence, .length = length };
+	memcpy(header.magic, stress_magic, sizeof(header.magic));
+	//Every payload's body is different, so that a read that mixes two of them can't pass for either.
+	uint64_t state = (((uint64_t)writer << 40) ^ sequence) * 0x9E3779B97F4A7C15ULL + 1U;
+	for(size_t i = sizeof(header); i < length; ++i) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		buf[i] = (UInt8)state;
+	}
+	unsigned char digest[pb_digest_max_length];
+	pb_digest_buffer(pb_digest_xxh64, buf + sizeof(header), length - sizeof(header), digest);
+	memcpy(&header.bodyDigest, digest, sizeof(header.bodyDigest));
+	memcpy(buf, &header, sizeof(header));
+}
+//Sorts what a paste got back into complete, partial (shorter than its header says), or torn (anything else that doesn't add up).
+static void check_stress_payload(struct stress_worker *worker, const UInt8 *buf, size_t length) {
+	struct stress_payload_header header;
+	if(length < sizeof(header)) {
+		++worker->partialReads;
+		return;
+	}
+	memcpy(&header, buf, sizeof(header));
+	if(memcmp(header.magic, stress_magic, sizeof(header.magic)) != 0)
+		++worker->tornReads;
+	else if(length < header.length)
+		++worker->partialReads;
+	else if(length > header.length)
+		++worker->tornReads;
+	else {
+		unsigned char digest[pb_digest_max_length];
+		pb_digest_buffer(pb_digest_xxh64, buf + sizeof(header), length - sizeof(header), digest);
+		if(memcmp(digest, &header.bodyDigest, sizeof(header.bodyDigest)) == 0)
+			++worker->completeReads;
+		else
+			++worker->tornReads;
+	}
+}
+
+struct stress_read_buffer {
+	UInt8 *bytes;
+	size_t length, capacity;
+};
+static bool append_to_stress_read_buffer(void *context, const void *bytes, size_t length) {
+	struct stress_read_buffer *buffer = context;
+	if(buffer->length + length > buffer->capacity) {
+		size_t newCapacity = buffer->capacity ? buffer->capacity : 65536U;
+		while(newCapacity < buffer->length + length)
+			newCapacity *= 2U;
+		UInt8 *newBytes = realloc(buffer->bytes, newCapacity);
+		if(!newBytes)
+			return false;
+		buffer->bytes = newBytes;
+		buffer->capacity = newCapacity;
+	}
+	memcpy(buffer->bytes + buffer->length, bytes, length);
+	buffer->length += length;
+	return true;
+}
+
+static void *run_stress_worker(void *context) {
+	struct stress_worker *worker = context;
+	struct stress_run *run = worker->run;
+
+	//Each worker has a handle of its own, just as separate pb processes would.
+	pb_pasteboard *pasteboard = NULL;
+	worker->openErr = pb_pasteboard_open(run->pasteboardID_cstr, &pasteboard);
+	if(worker->openErr == noErr)
+		pb_pasteboard_set_timeout(pasteboard, run->timeoutMsec);
+	UInt8 *payload = worker->isWriter ? malloc(run->maxSize) : NULL;
+	struct stress_read_buffer readBuffer = { NULL, 0U, 0U };
+
+	pthread_mutex_lock(&run->gateLock);
+	while(!run->started)
+		pthread_cond_wait(&run->gateCondition, &run->gateLock);
+	pthread_mutex_unlock(&run->gateLock);
+	if((worker->openErr != noErr) || (worker->isWriter && !payload))
+		goto end;
+
+	for(uint64_t sequence = 0U; ; ++sequence) {
+		uint64_t start = bench_now_nsec();
+		if(start >= run->deadline)
+			break;
+
+		enum stress_op op;
+		OSStatus err;
+		if(!worker->isWriter) {
+			op = stress_op_paste;
+			readBuffer.length = 0U;
+			err = pb_pasteboard_paste(pasteboard, /*item_index*/ 1U, stress_type_cstr, append_to_stress_read_buffer, &readBuffer);
+		} else if((sequence % stress_clear_interval) == (stress_clear_interval - 1U)) {
+			op = stress_op_clear;
+			err = pb_pasteboard_clear(pasteboard);
+		} else {
+			op = stress_op_copy;
+			//Writers take turns through the sizes, starting at different places, so every size is in play at once.
+			size_t size = run->sizes[(sequence + worker->index) % run->numSizes];
+			fill_stress_payload(payload, size, worker->index, sequence);
+			//Time only the copy, not making up what it copies.
+			start = bench_now_nsec();
+			err = pb_pasteboard_copy(pasteboard, stress_type_cstr, payload, size, /*options*/ 0U);
+		}
+		record_stress_latency(&worker->latencies[op], bench_now_nsec() - start);
+
+		if(op == stress_op_paste) {
+			if(err == noErr)
+				check_stress_payload(worker, readBuffer.bytes, readBuffer.length);
+			else if((err == badPasteboardIndexErr) || (err == badPasteboardItemErr) || (err == badPasteboardFlavorErr)) {
+				//A writer cleared it (perhaps while we were reading), or hasn't copied anything yet.
+				++worker->emptyReads;
+				err = noErr;
+			}
+		} else if((op == stress_op_copy) && (err == notPasteboardOwnerErr)) {
+			//Copying is a clear followed by a put, and with several writers, another one's clear can land in between. That's contention, not failure.
+			++worker->lostCopies;
+			err = noErr;
+		}
+		if((err != noErr) && !worker->errors++)
+			worker->firstErr = err;
+	}
+
+end:
+	free(payload);
+	free(readBuffer.bytes);
+	pb_pasteboard_close(pasteboard);
+	return NULL;
+}
+
+static void print_stress_row(const char *name, uint64_t *times, size_t count, double seconds) {
+	if(!count) {
+		printf("\t%-6s %10lu\n", name, 0UL);
+		return;
+	}
+	qsort(times, count, sizeof(uint64_t), compare_uint64);
+	printf("\t%-6s %10lu %10.0f %10.3f ms %10.3f ms %10.3f ms %10.3f ms %10.3f ms\n", name, (unsigned long)count, (double)count / seconds,
+		(double)times[(count - 1U) * 50U / 100U] / 1e6,
+		(double)times[(count - 1U) * 90U / 100U] / 1e6,
+		(double)times[(count - 1U) * 99U / 100U] / 1e6,
+		(double)times[(count - 1U) * 999U / 1000U] / 1e6,
+		(double)times[count - 1U] / 1e6);
+}
+
+int stress(struct argblock *pbptr) {
+	unsigned long numWriters = 4U, numReaders = 4U;
+	double duration = 5.0;
+	const char *sizes_cstr = "256,4k,64k,1m";
+	while(*(pbptr->argv)) {
+		const char *option_arg = NULL;
+		if(compare_argument('w', "writers", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			char *end = NULL;
+			numWriters = option_arg ? strtoul(option_arg, &end, 10) : 0U;
+			if(!option_arg || !*option_arg || *end || (numWriters > 1024U)) {
+				fprintf(stderr, "%s stress: invalid number of writers '%s'\n", argv0, option_arg ? option_arg : "");
+				return 1;
+			}
+		} else if(compare_argument('r', "readers", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			char *end = NULL;
+			numReaders = option_arg ? strtoul(option_arg, &end, 10) : 0U;
+			if(!option_arg || !*option_arg || *end || (numReaders > 1024U)) {
+				fprintf(stderr, "%s stress: invalid number of readers '%s'\n", argv0, option_arg ? option_arg : "");
+				return 1;
+			}
+		} else if(compare_argument('d', "duration", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			char *end = NULL;
+			duration = option_arg ? strtod(option_arg, &end) : 0.0;
+			if(!option_arg || *end || !(duration > 0.0)) {
+				fprintf(stderr, "%s stress: invalid duration '%s' (it should be a number of seconds)\n", argv0, option_arg ? option_arg : "");
+				return 1;
+			}
+		} else if(compare_argument('s', "sizes", pbptr->argv, &pbptr->argv, /*out_args_consumed*/ NULL, /*option_arg_optional*/ false, &option_arg) & option_comparison_eitheropt) {
+			sizes_cstr = option_arg ? option_arg : "";
+		} else {
+			fprintf(stderr, "%s stress: unrecognised option '%s'\n", argv0, *(pbptr->argv));
+			return 1;
+		}
+	}
+	if(!(numWriters + numReaders)) {
+		fprintf(stderr, "%s stress: no writers and no readers\n", argv0);
+		return 1;
+	}
+
+	struct stress_run run = {
+		.timeoutMsec = pbptr->timeoutMsec,
+		.gateLock = PTHREAD_MUTEX_INITIALIZER,
+		.gateCondition = PTHREAD_COND_INITIALIZER,
+	};
+	size_t *sizes = NULL;
+	if(!parse_bench_sizes(sizes_cstr, &sizes, &run.numSizes))
+		return 1;
+	run.sizes = sizes;
+	run.maxSize = 0U;
+	for(size_t i = 0U; i < run.numSizes; ++i) {
+		//Room for the header, at least.
+		if(sizes[i] < sizeof(struct stress_payload_header))
+			sizes[i] = sizeof(struct stress_payload_header);
+		if(sizes[i] > run.maxSize)
+			run.maxSize = sizes[i];
+	}
+
+	//Unless the user named a pasteboard to use, make a scratch one, so that stress testing doesn't clobber the clipboard. The workers open it again by name.
+	pb_pasteboard *scratch = NULL;
+	void (*pasteboardID_deallocator)(const char *ptr) = null_deallocator;
+	run.pasteboardID_cstr = pbptr->pasteboardID_cstr;
+	if(!run.pasteboardID_cstr) {
+		CFStringRef scratchName = NULL;
+		OSStatus err = pb_pasteboard_open_unique(&scratch);
+		if(err == noErr)
+			err = PasteboardCopyName(pb_pasteboard_get_ref(scratch), &scratchName);
+		if(err != noErr) {
+			fprintf(stderr, "%s stress: could not create a scratch pasteboard: %li (%s)\n", argv0, (long)err, GetMacOSStatusCommentString(err));
+			pb_pasteboard_close(scratch);
+			return 2;
+		}
+		run.pasteboardID_cstr = make_cstr_for_CFStr(scratchName, kCFStringEncodingUTF8, &pasteboardID_deallocator);
+		CFRelease(scratchName);
+	}
+
+	int retval = 0;
+	size_t numWorkers = (size_t)(numWriters + numReaders), numStarted = 0U;
+	struct stress_worker *workers = calloc(numWorkers, sizeof(struct stress_worker));
+	if(!workers) {
+		fprintf(stderr, "%s stress: could not allocate memory for %lu workers: %s\n", argv0, (unsigned long)numWorkers, strerror(errno));
+		retval = 2;
+		goto end;
+	}
+	bench_now_nsec(); //Get the timebase before there's anyone to race with.
+	for(; numStarted < numWorkers; ++numStarted) {
+		struct stress_worker *worker = &workers[numStarted];
+		worker->run = &run;
+		worker->isWriter = (numStarted < numWriters);
+		worker->index = (uint32_t)(worker->isWriter ? numStarted : (numStarted - numWriters));
+		int error = pthread_create(&worker->thread, /*attr*/ NULL, run_stress_worker, worker);
+		if(error) {
+			fprintf(stderr, "%s stress: could not start worker %lu: %s\n", argv0, (unsigned long)numStarted + 1U, strerror(error));
+			retval = 2;
+			break;
+		}
+	}
+
+	//Everyone starts at once (or, if we couldn't start them all, stops right away).
+	pthread_mutex_lock(&run.gateLock);
+	uint64_t startTime = bench_now_nsec();
+	run.deadline = (retval == 0) ? (startTime + (uint64_t)(duration * 1e9)) : startTime;
+	run.started = true;
+	pthread_cond_broadcast(&run.gateCondition);
+	pthread_mutex_unlock(&run.gateLock);
+	for(size_t i = 0U; i < numStarted; ++i)
+		pthread_join(workers[i].thread, NULL);
+	double seconds = (double)(bench_now_nsec() - startTime) / 1e9;
+
+	if(retval == 0) {
+		//Add up everyone's numbers.
+		struct stress_latencies totals[stress_op_count] = { { NULL, 0U, 0U, 0UL } };
+		unsigned long errors = 0U, lostCopies = 0U, completeReads = 0U, emptyReads = 0U, partialReads = 0U, tornReads = 0U, dropped = 0U;
+		OSStatus firstErr = noErr;
+		for(size_t i = 0U; i < numWorkers; ++i) {
+			struct stress_worker *worker = &workers[i];
+			if(worker->openErr != noErr) {
+				fprintf(stderr, "%s stress: worker %lu could not open pasteboard %s: %li (%s)\n", argv0, (unsigned long)i + 1U, run.pasteboardID_cstr, (long)worker->openErr, GetMacOSStatusCommentString(worker->openErr));
+				retval = 2;
+			}
+			for(unsigned op = 0U; op < stress_op_count; ++op) {
+				for(size_t j = 0U; j < worker->latencies[op].count; ++j)
+					record_stress_latency(&totals[op], worker->latencies[op].times[j]);
+				dropped += worker->latencies[op].dropped;
+			}
+			if(worker->errors && !errors)
+				firstErr = worker->firstErr;
+			errors += worker->errors;
+			lostCopies += worker->lostCopies;
+			completeReads += worker->completeReads;
+			emptyReads    += worker->emptyReads;
+			partialReads  += worker->partialReads;
+			tornReads     += worker->tornReads;
+		}
+
+		size_t totalOps = 0U;
+		for(unsigned op = 0U; op < stress_op_count; ++op)
+			totalOps += totals[op].count;
+		printf("%lu writers, %lu readers, %.1f s on pasteboard %s:\n", numWriters, numReaders, seconds, pbptr->pasteboardID_cstr ? run.pasteboardID_cstr : "(scratch)");
+		printf("\t%-6s %10s %10s %13s %13s %13s %13s %13s\n", "op", "count", "ops/s", "p50", "p90", "p99", "p99.9", "max");
+		for(unsigned op = 0U; op < stress_op_count; ++op)
+			print_stress_row(stress_op_names[op], totals[op].times, totals[op].count, seconds);
+		printf("\tall ops: %.0f/s\n", (double)totalOps / seconds);
+		printf("\treads: %lu complete, %lu empty, %lu partial, %lu torn\n", completeReads, emptyReads, partialReads, tornReads);
+		printf("\tcontention: %lu copies lost the pasteboard to another writer's clear\n", lostCopies);
+		if(dropped)
+			printf("\t(%lu latencies not recorded; out of memory)\n", dropped);
+		if(errors) {
+			printf("\terrors: %lu (first: %li (%s))\n", errors, (long)firstErr, GetMacOSStatusCommentString(firstErr));
+			retval = 2;
+		}
+		//A torn or partial read is the thing we're here to find, so it fails the run.
+		if(partialReads || tornReads)
+			retval = 2;
+
+		for(unsigned op = 0U; op < stress_op_count; ++op)
+			free(totals[op].times);
+	}
+
+	for(size_t i = 0U; i < numStarted; ++i) {
+		for(unsigned op = 0U; op < stress_op_count; ++op)
+			free(workers[i].latencies[op].times);
+	}
+	free(workers);
+end:
+	pasteboardID_deallocator(run.pasteboardID_cstr);
+	if(scratch) {
+		pb_pasteboard_clear(scratch);
+		pb_pasteboard_close(scratch);
+	}
+	return retval;
+}
 int help(struct argblock *pbptr) {
 	printf("usage: %s [global-options] subcommand [options]\n"
 		   "global-options:\n"
@@ -750,17 +3104,47 @@ int help(struct argblock *pbptr) {
 		   "\t\tcom.apple.pasteboard.clipboard (default)\n"
 		   "\t\tcom.apple.pasteboard.find\n"
 		   "\t--file=path\tspecify the path to a file to use for I/O instead of stdio\n"
+		   "\t--timeout=MS\tgive up on a flavor whose data takes longer than this to arrive (exit status 3)\n"
+		   "\t--skip-unavailable\twhen putting items back (copy --append or --add-flavor, transfer, transform), leave out flavors that can't be read instead of failing\n"
 		   "subcommands:\n"
 		   "\tcopy [UTI] [path]\n"
 		   "\t\tread from the specified file/stdin and copy as the specified flavor type/UTF-8\n"
+		   "\t\t--encoding=NAME\tthe input is text in this encoding\n"
+		   "\t\t--eol=lf|crlf|cr|keep\trewrite the line endings of text\n"
+		   "\t\t--decode=base64|hex\tthe input is binary data written as text\n"
+		   "\t\t--append\tadd a new item, keeping the items already on the pasteboard\n"
+		   "\t\t--item=N --add-flavor\tadd the data as another flavor of item N (default 1)\n"
+		   "\t\t--split=lines|nul|PATTERN\tcopy each line, NUL-terminated record, or run between matches of PATTERN as an item of its own\n"
+		   "\t\t--flavor UTI=PATH ...\tput the contents of each PATH (- for the input) on one item, as a flavor of that type\n"
+		   "\t\t--reference FILE ...\tcopy a reference to each file (its URL and path) instead of its contents, one item per file\n"
 		   "\tpaste [index] [UTI] [path]\n"
 		   "\t\twrite the contents of the specified item/all items in the specified flavor type/any text type to the specified file/stdout\n"
+		   "\t\t--encoding=NAME\twrite text in this encoding rather than UTF-8\n"
+		   "\t\tencodings: utf-8, utf-16le, utf-16be, utf-32le, utf-32be, macroman, latin1, windows-1252\n"
+		   "\t\t--eol=lf|crlf|cr|keep\trewrite the line endings of text\n"
+		   "\t\t--encode=base64|hex\twrite the data out as text\n"
+		   "\t\t--normalize=nfc|nfd|nfkc\tnormalize text to this Unicode normalization form\n"
+		   "\t\t--cache, --cache-dir=DIR\tkeep converted output (in ~/Library/Caches/pb) and reuse it until the pasteboard changes\n"
+		   "\t\t--resolve\tif the item refers to a file, write out the file's contents\n"
 		   "\tclear\n"
 		   "\t\tremove all items from the pasteboard\n"
 		   "\tcount\n"
 		   "\t\tshow the number of items on the pasteboard\n"
-		   "\tlist [index]\n"
-		   "\t\tshow all available flavor types of all items/the specified item (1-based)\n"
+		   "\ttransfer --to=ID [--from=ID] [--items=1,3-5] [--types=UTI,...]\n"
+		   "\t\tcopy items, with all their flavors, from one pasteboard (default the --pasteboard) to another\n"
+		   "\ttransform [--item=N] filters...\n"
+		   "\t\trun the text of item N (default 1) through the filters, in order, and put the result back in its place\n"
+		   "\t\t--trim\tstrip spaces and tabs from both ends of each line\n"
+		   "\t\t--fold-case\tfold each line to lowercase\n"
+		   "\t\t--dedupe\tdrop lines that repeat an earlier line\n"
+		   "\t\t--sort\tsort the lines\n"
+		   "\t\t--replace=/FROM/TO/\treplace FROM with TO throughout each line\n"
+		   "\tbench [--iterations=N] [--sizes=1k,64k,1m] [--type=UTI]\n"
+		   "\t\ttime copy/paste round trips on a scratch pasteboard (or the one given with --pasteboard)\n"
+		   "\tstress [--writers=K] [--readers=K] [--duration=SECONDS] [--sizes=256,4k,64k,1m]\n"
+		   "\t\trun writers (copy, with a clear now and then) and readers (paste) against one pasteboard at once; report throughput, latencies, and torn reads\n"
+		   "\tlist [--items=1,3-5] [--show-sizes] [--digest[=xxh64|sha256]] [--format=text|tsv|json] [--ostypes]\n"
+		   "\t\tshow all available flavor types of all items/the specified items (1-based)\n"
 		   "\thelp\n"
 		   "\t\tview this help\n",
 		   argv0);
@@ -819,9 +3203,10 @@ static void pb_deallocate(void *buf) {
 					//Gotcha. Unlink this element from the list.
 					allocation->next = nextAllocation->next;
 					if(nextAllocation == lastAllocation)
-						lastAllocation = NULL;
+						lastAllocation = allocation;
 					free(nextAllocation);
 					free(buf);
+					break;
 				}
 			}
 			allocation = nextAllocation;
@@ -837,217 +3222,34 @@ static void pb_deallocateall(void) {
 	}
 }
 
-static Boolean convert_encodings(CFDataRef *inoutUTF16Data, CFDataRef *inoutUTF16ExtData, CFDataRef *inoutUTF8Data, CFDataRef *inoutMacRomanData) {
-	//If a format is not requested, it has not failed, and so we should consider it to have succeeded, so we set its variable to true.
-	//But if it is requested, it has not succeeded until it has been attempted, so we set its variable to false.
-	Boolean success_UTF16    = ((!inoutUTF16Data)    || *inoutUTF16Data);
-	Boolean success_UTF16Ext = ((!inoutUTF16ExtData) || *inoutUTF16ExtData);
-	Boolean success_UTF8     = ((!inoutUTF8Data)     || *inoutUTF8Data);
-	Boolean success_MacRoman = ((!inoutMacRomanData) || *inoutMacRomanData);
-
-	CFStringRef string = NULL;
-
-	//Convert UTF-16 (with BOM), UTF-8, or MacRoman to UTF-16.
-	if(inoutUTF16Data && !*inoutUTF16Data) {
-		if(!string) {
-			if(inoutUTF16ExtData && *inoutUTF16ExtData) {
-				string = CFStringCreateFromExternalRepresentation(kCFAllocatorDefault,
-			                                 	 	 	 		  *inoutUTF16ExtData,
-			                                 	 	 	 		  kCFStringEncodingUnicode);
-			} else if(inoutUTF8Data && *inoutUTF8Data) {
-				string = CFStringCreateWithBytes(kCFAllocatorDefault,
-			                                 	 CFDataGetBytePtr(*inoutUTF8Data),
-			                                 	 CFDataGetLength(*inoutUTF8Data),
-			                                 	 kCFStringEncodingUTF8,
-			                                 	 false);
-			} else if(inoutMacRomanData && *inoutMacRomanData) {
-				string = CFStringCreateWithBytes(kCFAllocatorDefault,
-			                                 	 CFDataGetBytePtr(*inoutMacRomanData),
-			                                 	 CFDataGetLength(*inoutMacRomanData),
-			                                 	 kCFStringEncodingMacRoman,
-			                                 	 false);
-			}
-		}
-
-		if(string) {
-			*inoutUTF16Data = createCFDataFromCFString(string);
-			success_UTF16 = (*inoutUTF16Data != NULL);
-		}
-	}
-
-	//Convert UTF-16, UTF-8, or MacRoman to UTF-16 (with BOM).
-	if(inoutUTF16ExtData && !*inoutUTF16ExtData) {
-		if(!string) {
-			if(inoutUTF16Data && *inoutUTF16Data) {
-				string = CFStringCreateWithCharactersNoCopy(kCFAllocatorDefault,
-			                                      	  (const UniChar *)CFDataGetBytePtr(*inoutUTF16Data),
-			                                      	  CFDataGetLength(*inoutUTF16Data) / sizeof(UniChar),
-													  kCFAllocatorNull);
-				if(!string)
-					string = CFStringCreateWithCharacters(kCFAllocatorDefault,
-			                                      	  	  (const UniChar *)CFDataGetBytePtr(*inoutUTF16Data),
-			                                      	  	  CFDataGetLength(*inoutUTF16Data) / sizeof(UniChar));
-			} else if(inoutUTF8Data && *inoutUTF8Data) {
-				string = CFStringCreateWithBytes(kCFAllocatorDefault,
-			                                 	 CFDataGetBytePtr(*inoutUTF8Data),
-			                                 	 CFDataGetLength(*inoutUTF8Data),
-			                                 	 kCFStringEncodingUTF8,
-			                                 	 false);
-			} else if(inoutMacRomanData && *inoutMacRomanData) {
-				string = CFStringCreateWithBytes(kCFAllocatorDefault,
-			                                 	 CFDataGetBytePtr(*inoutMacRomanData),
-			                                 	 CFDataGetLength(*inoutMacRomanData),
-			                                 	 kCFStringEncodingMacRoman,
-			                                 	 false);
-			}
-		}
-
-		if(string) {
-			*inoutUTF16ExtData = CFStringCreateExternalRepresentation(kCFAllocatorDefault, string, kCFStringEncodingUnicode, /*lossByte*/ 0U);
-			success_UTF16Ext = (*inoutUTF16ExtData != NULL);
-		}
-	}
-
-	//Convert UTF-16, UTF-16 (with BOM), or MacRoman to UTF-8.
-	if(inoutUTF8Data && !*inoutUTF8Data) {
-		if(!string) {
-			if(inoutUTF16Data && *inoutUTF16Data) {
-				string = CFStringCreateWithCharactersNoCopy(kCFAllocatorDefault,
-			                                      	  (const UniChar *)CFDataGetBytePtr(*inoutUTF16Data),
-			                                      	  CFDataGetLength(*inoutUTF16Data) / sizeof(UniChar),
-													  kCFAllocatorNull);
-				if(!string)
-					string = CFStringCreateWithCharacters(kCFAllocatorDefault,
-			                                      	  	  (const UniChar *)CFDataGetBytePtr(*inoutUTF16Data),
-			                                      	  	  CFDataGetLength(*inoutUTF16Data) / sizeof(UniChar));
-			} else if(inoutUTF16ExtData && *inoutUTF16ExtData) {
-				string = CFStringCreateFromExternalRepresentation(kCFAllocatorDefault,
-			                                 	 	 	 		  *inoutUTF16ExtData,
-			                                 	 	 	 		  kCFStringEncodingUnicode);
-			} else if(inoutMacRomanData && *inoutMacRomanData) {
-				string = CFStringCreateWithBytes(kCFAllocatorDefault,
-			                                 	 CFDataGetBytePtr(*inoutMacRomanData),
-			                                 	 CFDataGetLength(*inoutMacRomanData),
-			                                 	 kCFStringEncodingMacRoman,
-			                                 	 false);
-			}
-		}
-
-		if(string) {
-			CFRange range = { 0, CFStringGetLength(string) };
-			CFIndex numBytes = 0;
-			CFIndex maxBytes = CFStringGetMaximumSizeForEncoding(range.length, kCFStringEncodingUTF8);
-
-			CFIndex numCharsConverted = CFStringGetBytes(string,
-			                                             range,
-			                                             kCFStringEncodingUTF8,
-			                                             /*lossByte*/ 0U,
-			                                             /*isExternalRepresentation*/ false,
-			                                             /*buffer*/ NULL,
-			                                             /*maxBufLen*/ maxBytes,
-			                                             &numBytes);
-			if(numCharsConverted) {
-				CFMutableDataRef mutableData = CFDataCreateMutable(kCFAllocatorDefault, numBytes);
-				if(mutableData) {
-					CFDataSetLength(mutableData, numBytes);
-					numCharsConverted = CFStringGetBytes(string,
-					                                     range,
-					                                     kCFStringEncodingUTF8,
-					                                     /*lossByte*/ 0U,
-					                                     /*isExternalRepresentation*/ false,
-					                                     CFDataGetMutableBytePtr(mutableData),
-					                                     /*maxBufLen*/ numBytes,
-					                                     &numBytes);
-					*inoutUTF8Data = mutableData;/*CFDataCreateCopy(kCFAllocatorDefault, mutableData);
-					CFRelease(mutableData);
-				 	 */
-					success_UTF8 = (*inoutUTF8Data != NULL);
-				}
-			}
-		}
-	}
-
-	//Convert UTF-16, UTF-16 (with BOM), or UTF-8 to MacRoman.
-	if(inoutMacRomanData && !*inoutMacRomanData) {
-		if(!string) {
-			if(inoutUTF16Data && *inoutUTF16Data) {
-				string = CFStringCreateWithCharactersNoCopy(kCFAllocatorDefault,
-			                                      	  (const UniChar *)CFDataGetBytePtr(*inoutUTF16Data),
-			                                      	  CFDataGetLength(*inoutUTF16Data) / sizeof(UniChar),
-													  kCFAllocatorNull);
-				if(!string)
-					string = CFStringCreateWithCharacters(kCFAllocatorDefault,
-			                                      	  	  (const UniChar *)CFDataGetBytePtr(*inoutUTF16Data),
-			                                      	  	  CFDataGetLength(*inoutUTF16Data) / sizeof(UniChar));
-			} else if(inoutUTF16ExtData && *inoutUTF16ExtData) {
-				string = CFStringCreateFromExternalRepresentation(kCFAllocatorDefault,
-			                                 	 	 	 		  *inoutUTF16ExtData,
-			                                 	 	 	 		  kCFStringEncodingUnicode);
-			} else if(inoutUTF8Data && *inoutUTF8Data) {
-				string = CFStringCreateWithBytes(kCFAllocatorDefault,
-			                                 	 CFDataGetBytePtr(*inoutUTF8Data),
-			                                 	 CFDataGetLength(*inoutUTF8Data),
-			                                 	 kCFStringEncodingUTF8,
-			                                 	 false);
-			}
-		}
-
-		if(string) {
-			CFRange range = { 0, CFStringGetLength(string) };
-			CFIndex numBytes = 0;
-			CFIndex maxBytes = CFStringGetMaximumSizeForEncoding(range.length, kCFStringEncodingMacRoman);
-
-			CFIndex numCharsConverted = CFStringGetBytes(string,
-			                                             range,
-			                                             kCFStringEncodingMacRoman,
-			                                             /*lossByte*/ '?',
-			                                             /*isExternalRepresentation*/ false,
-			                                             /*buffer*/ NULL,
-			                                             /*maxBufLen*/ maxBytes,
-			                                             &numBytes);
-			if(numCharsConverted) {
-				CFMutableDataRef mutableData = CFDataCreateMutable(kCFAllocatorDefault, numBytes);
-				if(mutableData) {
-					CFDataSetLength(mutableData, numBytes);
-					numCharsConverted = CFStringGetBytes(string,
-					                                     range,
-					                                     kCFStringEncodingMacRoman,
-					                                     /*lossByte*/ '?',
-					                                     /*isExternalRepresentation*/ false,
-					                                     CFDataGetMutableBytePtr(mutableData),
-					                                     /*maxBufLen*/ numBytes,
-					                                     &numBytes);
-					*inoutMacRomanData = mutableData;/*CFDataCreateCopy(kCFAllocatorDefault, mutableData);
-					CFRelease(mutableData);
-				 	 */
-					success_MacRoman = (*inoutMacRomanData != NULL);
-				}
-			}
-		}
-	}
-
-	if(string)
-		CFRelease(string);
-
-	return success_UTF16 && success_UTF16Ext && success_UTF8 && success_MacRoman;
+static Boolean text_encoding_for_flavor(CFStringRef type, CFDataRef data, enum pb_text_encoding *outEncoding) {
+	if(UTTypeConformsTo(type, kUTTypeUTF16PlainText))
+		*outEncoding = pb_text_encoding_utf16_host;
+	else if(UTTypeConformsTo(type, kUTTypeUTF16ExternalPlainText)) {
+		//Big-endian unless the BOM says otherwise.
+		const UInt8 *bytes = CFDataGetBytePtr(data);
+		Boolean isLittleEndian = (CFDataGetLength(data) >= 2) && (bytes[0] == 0xFF) && (bytes[1] == 0xFE);
+		*outEncoding = isLittleEndian ? pb_text_encoding_utf16le : pb_text_encoding_utf16be;
+	} else if(UTTypeConformsTo(type, kUTTypeUTF8PlainText))
+		*outEncoding = pb_text_encoding_utf8;
+	else if(UTTypeConformsTo(type, MacRoman_UTI))
+		*outEncoding = pb_text_encoding_macroman;
+	else
+		return false;
+	return true;
 }
-static CFDataRef createCFDataFromCFString(CFStringRef string) {
-	CFDataRef data = NULL;
-
-	if(string) {
-		CFRange range = { 0, CFStringGetLength(string) };
-		CFIndex dataSize = range.length * sizeof(UniChar);
-		CFMutableDataRef mutableData = CFDataCreateMutable(kCFAllocatorDefault, dataSize);
-		if(mutableData) {
-			CFDataSetLength(mutableData, dataSize);
-			CFStringGetCharacters(string, range, (UniChar *)CFDataGetMutableBytePtr(mutableData));
-			data = mutableData;/*CFDataCreateCopy(kCFAllocatorDefault, mutableData);
-			CFRelease(mutableData);
-			 */
-		}
-	}
-
-	return data;
+static CFDataRef create_data_with_line_endings(CFDataRef data, enum pb_text_encoding encoding, enum pb_line_ending lineEnding) {
+	void *converted = NULL;
+	size_t convertedLength = 0U;
+	if(!pb_convert_line_endings(lineEnding, encoding, CFDataGetBytePtr(data), (size_t)CFDataGetLength(data), &converted, &convertedLength))
+		return NULL;
+	if(!converted)
+		return CFRetain(data);
+
+	CFDataRef result = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, converted, (CFIndex)convertedLength, /*bytesDeallocator*/ kCFAllocatorMalloc);
+	if(!result)
+		free(converted);
+	return result;
 }
 
 static CFStringRef create_UTI_with_cstr(const char *arg) {
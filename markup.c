@@ -0,0 +1,467 @@
+#include "markup.h"
+#include "transcode.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma mark Output
+
+struct text_output {
+	pb_markup_writer write_function;
+	void *context;
+	bool stopped;
+	size_t length;
+	unsigned char last; //The last character written (0x80 for anything non-ASCII), for collapsing whitespace and line breaks.
+	unsigned char buffer[65536];
+};
+
+static void flush_output(struct text_output *out) {
+	if(out->length && !out->stopped)
+		out->stopped = !out->write_function(out->context, out->buffer, out->length);
+	out->length = 0U;
+}
+static void put_char(struct text_output *out, uint32_t c) {
+	if(c == 0U)
+		return;
+	//Whatever the markup says, the output has to be valid UTF-8.
+	if(((c >= 0xD800U) && (c <= 0xDFFFU)) || (c > 0x10FFFFU))
+		c = 0xFFFDU;
+	if(out->length > sizeof(out->buffer) - 4U)
+		flush_output(out);
+	out->length += pb_encode_utf8(c, out->buffer + out->length);
+	out->last = (c < 0x80U) ? (unsigned char)c : 0x80U;
+}
+
+static inline bool is_ascii_letter(unsigned char c) {
+	return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'));
+}
+static inline bool is_digit(unsigned char c) {
+	return (c >= '0') && (c <= '9');
+}
+static inline int hex_digit_value(unsigned char c) {
+	if(is_digit(c))
+		return c - '0';
+	if((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	if((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return -1;
+}
+
+//bsearch comparator for sorted tables whose entries start with their name.
+static int compare_name(const void *key, const void *entry) {
+	return strcmp(key, *(const char *const *)entry);
+}
+
+#pragma mark RTF
+
+//Destinations that hold something other than the document's text. Sorted, for binary search. (Any destination marked with \* is skipped as well, so this only needs the ones that predate that convention or that writers don't mark.)
+static const char *const rtf_skipped_destinations[] = {
+	"author", "buptim", "colortbl", "comment", "creatim", "doccomm", "fldinst", "fonttbl",
+	"footer", "footerf", "footerl", "footerr", "footnote", "ftncn", "ftnsep", "ftnsepc",
+	"header", "headerf", "headerl", "headerr", "info", "keywords", "listoverridetable", "listtable",
+	"object", "operator", "pict", "printim", "private", "revtbl", "revtim", "rxe",
+	"stylesheet", "subject", "tc", "title", "txe", "xe",
+};
+
+//Control words that stand for a character. Sorted, for binary search.
+static const struct rtf_character_word {
+	const char *word;
+	uint32_t code_point;
+} rtf_character_words[] = {
+	{ "bullet", 0x2022U }, { "cell", '\t' }, { "emdash", 0x2014U }, { "emspace", 0x2003U },
+	{ "endash", 0x2013U }, { "enspace", 0x2002U }, { "ldblquote", 0x201CU }, { "line", '\n' },
+	{ "lquote", 0x2018U }, { "ltrmark", 0x200EU }, { "page", '\n' }, { "par", '\n' },
+	{ "qmspace", 0x2005U }, { "rdblquote", 0x201DU }, { "row", '\n' }, { "rquote", 0x2019U },
+	{ "rtlmark", 0x200FU }, { "sect", '\n' }, { "tab", '\t' }, { "zwj", 0x200DU },
+	{ "zwnj", 0x200CU },
+};
+
+//Groups nested deeper than this (which no real document does) share the state of the deepest one.
+enum { rtf_max_depth = 64 };
+
+struct rtf_group {
+	bool skipped;  //Not part of the text.
+	long uc;       //How many characters after each \uN are the fallback for readers that don't know \u.
+};
+struct rtf_state {
+	struct text_output *out;
+	struct rtf_group groups[rtf_max_depth];
+	size_t depth, excess_depth;
+	enum pb_text_encoding code_page; //For \'hh and any bytes above 0x7F.
+	long fallback_to_skip;           //Characters left to skip after a \uN.
+	uint32_t high_surrogate;         //From a \uN that needs the next one to make a whole character.
+};
+
+static void rtf_put_char(struct rtf_state *state, uint32_t c) {
+	if(state->groups[state->depth].skipped)
+		return;
+	if(state->high_surrogate) {
+		if((c >= 0xDC00U) && (c <= 0xDFFFU))
+			c = 0x10000U + ((state->high_surrogate - 0xD800U) << 10) + (c - 0xDC00U);
+		else
+			put_char(state->out, 0xFFFDU);
+		state->high_surrogate = 0U;
+	}
+	if((c >= 0xD800U) && (c <= 0xDBFFU))
+		state->high_surrogate = c;
+	else
+		put_char(state->out, c);
+}
+//A character from the document's code page: a byte of text or a \'hh. If it's the fallback for a \uN, it's dropped.
+static void rtf_put_byte(struct rtf_state *state, unsigned char byte) {
+	if(state->fallback_to_skip > 0L) {
+		--(state->fallback_to_skip);
+		return;
+	}
+	rtf_put_char(state, pb_single_byte_code_point(state->code_page, byte));
+}
+
+static void rtf_control_word(struct rtf_state *state, const char *word, bool has_parameter, long parameter) {
+	struct rtf_group *group = &(state->groups[state->depth]);
+	if(strcmp(word, "u") == 0) {
+		if(has_parameter) {
+			//Parameters are signed 16-bit, so characters past U+7FFF come out negative.
+			rtf_put_char(state, (uint32_t)((parameter < 0L) ? parameter + 65536L : parameter));
+			state->fallback_to_skip = group->uc;
+		}
+		return;
+	}
+	state->fallback_to_skip = 0L;
+	if(strcmp(word, "uc") == 0) {
+		group->uc = (has_parameter && (parameter >= 0L)) ? parameter : 1L;
+	} else if(strcmp(word, "ansicpg") == 0) {
+		state->code_page = (parameter == 10000L) ? pb_text_encoding_macroman : (parameter == 28591L) ? pb_text_encoding_latin1 : pb_text_encoding_cp1252;
+	} else if(strcmp(word, "mac") == 0) {
+		state->code_page = pb_text_encoding_macroman;
+	} else if(bsearch(word, rtf_skipped_destinations, sizeof(rtf_skipped_destinations) / sizeof(*rtf_skipped_destinations), sizeof(*rtf_skipped_destinations), compare_name)) {
+		group->skipped = true;
+	} else {
+		const struct rtf_character_word *character = bsearch(word, rtf_character_words, sizeof(rtf_character_words) / sizeof(*rtf_character_words), sizeof(*rtf_character_words), compare_name);
+		if(character)
+			rtf_put_char(state, character->code_point);
+	}
+}
+
+static void extract_rtf(const unsigned char *p, const unsigned char *end, struct text_output *out) {
+	struct rtf_state state = { .out = out, .depth = 0U, .excess_depth = 0U, .code_page = pb_text_encoding_cp1252, .fallback_to_skip = 0L, .high_surrogate = 0U };
+	state.groups[0] = (struct rtf_group){ .skipped = false, .uc = 1L };
+
+	while((p < end) && !out->stopped) {
+		unsigned char c = *p++;
+		if(c == '{') {
+			if(state.depth + 1U < rtf_max_depth) {
+				state.groups[state.depth + 1U] = state.groups[state.depth];
+				++state.depth;
+			} else
+				++state.excess_depth;
+		} else if(c == '}') {
+			if(state.excess_depth)
+				--state.excess_depth;
+			else if(state.depth)
+				--state.depth;
+			state.fallback_to_skip = 0L;
+		} else if((c == '\r') || (c == '\n')) {
+			//Line breaks in the file are only there to keep lines short.
+		} else if(c != '\\') {
+			rtf_put_byte(&state, c);
+		} else if(p < end) {
+			c = *p++;
+			if(is_ascii_letter(c)) {
+				char word[32];
+				size_t word_length = 0U;
+				word[word_length++] = (char)c;
+				while((p < end) && is_ascii_letter(*p)) {
+					if(word_length < sizeof(word) - 1U)
+						word[word_length++] = (char)*p;
+					++p;
+				}
+				word[word_length] = '\0';
+
+				bool has_parameter = false, negative = false;
+				long parameter = 0L;
+				if(((size_t)(end - p) >= 2U) && (*p == '-') && is_digit(p[1])) {
+					negative = true;
+					++p;
+				}
+				while((p < end) && is_digit(*p)) {
+					has_parameter = true;
+					if(parameter < 100000000L)
+						parameter = parameter * 10L + (*p - '0');
+					++p;
+				}
+				if(negative)
+					parameter = -parameter;
+				//A space after a control word is part of it.
+				if((p < end) && (*p == ' '))
+					++p;
+
+				if(strcmp(word, "bin") == 0) {
+					//Raw binary data, not to be parsed.
+					size_t skip = (has_parameter && (parameter > 0L)) ? (size_t)parameter : 0U;
+					p += ((size_t)(end - p) < skip) ? (size_t)(end - p) : skip;
+				} else
+					rtf_control_word(&state, word, has_parameter, parameter);
+			} else if(c == '\'') {
+				int high = (p < end) ? hex_digit_value(*p) : -1;
+				int low = (p + 1 < end) ? hex_digit_value(p[1]) : -1;
+				if((high >= 0) && (low >= 0)) {
+					p += 2;
+					rtf_put_byte(&state, (unsigned char)((high << 4) | low));
+				}
+			} else if(c == '*') {
+				state.groups[state.depth].skipped = true;
+			} else if((c == '\\') || (c == '{') || (c == '}')) {
+				rtf_put_byte(&state, c);
+			} else if(c == '~') {
+				rtf_put_char(&state, 0x00A0U);
+			} else if(c == '_') {
+				rtf_put_char(&state, 0x2011U);
+			} else if((c == '\r') || (c == '\n')) {
+				//A backslash at the end of a line is a paragraph break.
+				rtf_put_char(&state, '\n');
+			}
+			//Anything else (such as \- for an optional hyphen) has no text of its own.
+		}
+	}
+}
+
+#pragma mark HTML
+
+//Named character references: HTML 4's Latin-1 set, plus the punctuation and symbols that turn up in practice. Sorted, for binary search.
+static const struct html_entity {
+	const char *name;
+	uint32_t code_point;
+} html_entities[] = {
+	{ "AElig", 0x00C6U }, { "Aacute", 0x00C1U }, { "Acirc", 0x00C2U }, { "Agrave", 0x00C0U }, { "Aring", 0x00C5U },
+	{ "Atilde", 0x00C3U }, { "Auml", 0x00C4U }, { "Ccedil", 0x00C7U }, { "Dagger", 0x2021U }, { "ETH", 0x00D0U },
+	{ "Eacute", 0x00C9U }, { "Ecirc", 0x00CAU }, { "Egrave", 0x00C8U }, { "Euml", 0x00CBU }, { "Iacute", 0x00CDU },
+	{ "Icirc", 0x00CEU }, { "Igrave", 0x00CCU }, { "Iuml", 0x00CFU }, { "Ntilde", 0x00D1U }, { "OElig", 0x0152U },
+	{ "Oacute", 0x00D3U }, { "Ocirc", 0x00D4U }, { "Ograve", 0x00D2U }, { "Oslash", 0x00D8U }, { "Otilde", 0x00D5U },
+	{ "Ouml", 0x00D6U }, { "Prime", 0x2033U }, { "Scaron", 0x0160U }, { "THORN", 0x00DEU }, { "Uacute", 0x00DAU },
+	{ "Ucirc", 0x00DBU }, { "Ugrave", 0x00D9U }, { "Uuml", 0x00DCU }, { "Yacute", 0x00DDU }, { "Yuml", 0x0178U },
+	{ "aacute", 0x00E1U }, { "acirc", 0x00E2U }, { "acute", 0x00B4U }, { "aelig", 0x00E6U }, { "agrave", 0x00E0U },
+	{ "amp", 0x0026U }, { "apos", 0x0027U }, { "aring", 0x00E5U }, { "asymp", 0x2248U }, { "atilde", 0x00E3U }, { "auml", 0x00E4U },
+	{ "bdquo", 0x201EU }, { "brvbar", 0x00A6U }, { "bull", 0x2022U }, { "ccedil", 0x00E7U }, { "cedil", 0x00B8U },
+	{ "cent", 0x00A2U }, { "circ", 0x02C6U }, { "copy", 0x00A9U }, { "curren", 0x00A4U }, { "dagger", 0x2020U },
+	{ "darr", 0x2193U }, { "deg", 0x00B0U }, { "divide", 0x00F7U }, { "eacute", 0x00E9U }, { "ecirc", 0x00EAU },
+	{ "egrave", 0x00E8U }, { "emsp", 0x2003U }, { "ensp", 0x2002U }, { "eth", 0x00F0U }, { "euml", 0x00EBU }, { "euro", 0x20ACU },
+	{ "fnof", 0x0192U }, { "frac12", 0x00BDU }, { "frac14", 0x00BCU }, { "frac34", 0x00BEU }, { "ge", 0x2265U }, { "gt", 0x003EU },
+	{ "harr", 0x2194U }, { "hearts", 0x2665U }, { "hellip", 0x2026U }, { "iacute", 0x00EDU }, { "icirc", 0x00EEU },
+	{ "iexcl", 0x00A1U }, { "igrave", 0x00ECU }, { "infin", 0x221EU }, { "iquest", 0x00BFU }, { "iuml", 0x00EFU },
+	{ "laquo", 0x00ABU }, { "larr", 0x2190U }, { "ldquo", 0x201CU }, { "le", 0x2264U }, { "lrm", 0x200EU }, { "lsaquo", 0x2039U },
+	{ "lsquo", 0x2018U }, { "lt", 0x003CU }, { "macr", 0x00AFU }, { "mdash", 0x2014U }, { "micro", 0x00B5U }, { "middot", 0x00B7U },
+	{ "minus", 0x2212U }, { "nbsp", 0x00A0U }, { "ndash", 0x2013U }, { "ne", 0x2260U }, { "not", 0x00ACU }, { "ntilde", 0x00F1U },
+	{ "oacute", 0x00F3U }, { "ocirc", 0x00F4U }, { "oelig", 0x0153U }, { "ograve", 0x00F2U }, { "oline", 0x203EU },
+	{ "ordf", 0x00AAU }, { "ordm", 0x00BAU }, { "oslash", 0x00F8U }, { "otilde", 0x00F5U }, { "ouml", 0x00F6U },
+	{ "para", 0x00B6U }, { "permil", 0x2030U }, { "plusmn", 0x00B1U }, { "pound", 0x00A3U }, { "prime", 0x2032U },
+	{ "quot", 0x0022U }, { "raquo", 0x00BBU }, { "rarr", 0x2192U }, { "rdquo", 0x201DU }, { "reg", 0x00AEU }, { "rlm", 0x200FU },
+	{ "rsaquo", 0x203AU }, { "rsquo", 0x2019U }, { "sbquo", 0x201AU }, { "scaron", 0x0161U }, { "sect", 0x00A7U },
+	{ "shy", 0x00ADU }, { "sup1", 0x00B9U }, { "sup2", 0x00B2U }, { "sup3", 0x00B3U }, { "szlig", 0x00DFU }, { "thinsp", 0x2009U },
+	{ "thorn", 0x00FEU }, { "tilde", 0x02DCU }, { "times", 0x00D7U }, { "trade", 0x2122U }, { "uacute", 0x00FAU },
+	{ "uarr", 0x2191U }, { "ucirc", 0x00FBU }, { "ugrave", 0x00F9U }, { "uml", 0x00A8U }, { "uuml", 0x00FCU },
+	{ "yacute", 0x00FDU }, { "yen", 0x00A5U }, { "yuml", 0x00FFU }, { "zwj", 0x200DU }, { "zwnj", 0x200CU },
+};
+
+//Elements that start and end on a line of their own. Sorted, for binary search.
+static const char *const html_block_elements[] = {
+	"address", "article", "aside", "blockquote", "body", "caption", "dd", "div",
+	"dl", "dt", "fieldset", "figcaption", "figure", "footer", "form", "h1",
+	"h2", "h3", "h4", "h5", "h6", "header", "hr", "li",
+	"main", "nav", "ol", "p", "pre", "section", "table", "tbody",
+	"tfoot", "thead", "tr", "ul",
+};
+//Elements whose contents are not text, up to the matching end tag. Sorted, for binary search.
+static const char *const html_skipped_elements[] = {
+	"head", "noscript", "script", "style", "template", "title",
+};
+
+struct html_state {
+	struct text_output *out;
+	bool in_pre;             //Inside <pre>, whitespace is kept as it is.
+	bool pending_space;      //Whitespace has been seen since the last character written.
+};
+
+//Text, with whitespace collapsed to single spaces and dropped at the start of a line.
+static void html_put_char(struct html_state *state, uint32_t c) {
+	if(!state->in_pre && ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') || (c == '\f'))) {
+		state->pending_space = true;
+		return;
+	}
+	if(state->pending_space && (state->out->last != '\n') && (state->out->last != ' ') && (state->out->last != '\t') && state->out->last)
+		put_char(state->out, ' ');
+	state->pending_space = false;
+	if(!((c == '\r') && state->in_pre))
+		put_char(state->out, c);
+}
+static void html_line_break(struct html_state *state, bool always) {
+	state->pending_space = false;
+	if(always || (state->out->last && (state->out->last != '\n')))
+		put_char(state->out, '\n');
+}
+
+//Reads a character reference at p (just past the '&'). Returns the end of the reference, or NULL if it isn't one, in which case the '&' is just an '&'.
+static const unsigned char *html_read_reference(const unsigned char *p, const unsigned char *end, uint32_t *out_code_point) {
+	if((p < end) && (*p == '#')) {
+		++p;
+		bool hex = (p < end) && ((*p == 'x') || (*p == 'X'));
+		if(hex)
+			++p;
+		const unsigned char *digits = p;
+		uint32_t c = 0U;
+		for(; p < end; ++p) {
+			int value = hex ? hex_digit_value(*p) : (is_digit(*p) ? *p - '0' : -1);
+			if(value < 0)
+				break;
+			if(c <= 0x10FFFFU)
+				c = c * (hex ? 16U : 10U) + (uint32_t)value;
+		}
+		if(p == digits)
+			return NULL;
+		if((p < end) && (*p == ';'))
+			++p;
+		//As browsers do: references to the C1 controls mean the Windows-1252 characters at those bytes.
+		if((c >= 0x80U) && (c <= 0x9FU))
+			c = pb_single_byte_code_point(pb_text_encoding_cp1252, (unsigned char)c);
+		*out_code_point = c ? c : 0xFFFDU;
+		return p;
+	}
+
+	char name[16];
+	size_t name_length = 0U;
+	while((p < end) && (is_ascii_letter(*p) || is_digit(*p))) {
+		if(name_length == sizeof(name) - 1U)
+			return NULL;
+		name[name_length++] = (char)*p++;
+	}
+	name[name_length] = '\0';
+	if(!(name_length && (p < end) && (*p == ';')))
+		return NULL;
+	const struct html_entity *entity = bsearch(name, html_entities, sizeof(html_entities) / sizeof(*html_entities), sizeof(*html_entities), compare_name);
+	if(!entity)
+		return NULL;
+	*out_code_point = entity->code_point;
+	return p + 1;
+}
+
+//Finds the next occurrence of needle (lowercase ASCII) in the input, ignoring case. Returns end if there isn't one.
+static const unsigned char *html_find(const unsigned char *p, const unsigned char *end, const char *needle) {
+	size_t needle_length = strlen(needle);
+	for(; (size_t)(end - p) >= needle_length; ++p) {
+		if((*p | 0x20U) != (unsigned char)needle[0])
+			continue;
+		size_t i = 1U;
+		while((i < needle_length) && (((p[i] >= 'A') && (p[i] <= 'Z') ? (p[i] | 0x20U) : p[i]) == (unsigned char)needle[i]))
+			++i;
+		if(i == needle_length)
+			return p;
+	}
+	return end;
+}
+
+//Skips the rest of a tag, up to and past its '>'. A '>' inside a quoted attribute value doesn't count.
+static const unsigned char *html_skip_tag(const unsigned char *p, const unsigned char *end) {
+	unsigned char quote = 0;
+	for(; p < end; ++p) {
+		if(quote) {
+			if(*p == quote)
+				quote = 0;
+		} else if((*p == '"') || (*p == '\'')) {
+			quote = *p;
+		} else if(*p == '>')
+			return p + 1;
+	}
+	return end;
+}
+
+static void extract_html(const unsigned char *p, const unsigned char *end, struct text_output *out) {
+	struct html_state state = { .out = out, .in_pre = false, .pending_space = false };
+
+	while((p < end) && !out->stopped) {
+		unsigned char c = *p;
+		if(c == '<') {
+			const unsigned char *q = p + 1;
+			bool closing = (q < end) && (*q == '/');
+			if(closing)
+				++q;
+			if((q < end) && (*q == '!') && ((size_t)(end - q) >= 3U) && (q[1] == '-') && (q[2] == '-')) {
+				const unsigned char *comment_end = html_find(q + 3, end, "-->");
+				p = (comment_end < end) ? comment_end + 3 : end;
+				continue;
+			}
+			if((q < end) && ((*q == '!') || (*q == '?'))) {
+				//A doctype, CDATA section, or processing instruction.
+				p = html_skip_tag(q, end);
+				continue;
+			}
+			if(!((q < end) && is_ascii_letter(*q))) {
+				//Not a tag after all.
+				html_put_char(&state, '<');
+				++p;
+				continue;
+			}
+
+			char name[16];
+			size_t name_length = 0U;
+			for(; (q < end) && (is_ascii_letter(*q) || is_digit(*q)); ++q) {
+				if(name_length < sizeof(name) - 1U)
+					name[name_length++] = (char)(*q | 0x20U);
+			}
+			name[name_length] = '\0';
+			p = html_skip_tag(q, end);
+
+			if(strcmp(name, "br") == 0) {
+				html_line_break(&state, /*always*/ true);
+			} else if((strcmp(name, "td") == 0) || (strcmp(name, "th") == 0)) {
+				//Cells are separated by tabs; the first cell in a row needs none.
+				if(!closing && out->last && (out->last != '\n')) {
+					state.pending_space = false;
+					put_char(out, '\t');
+				}
+			} else if(bsearch(name, html_block_elements, sizeof(html_block_elements) / sizeof(*html_block_elements), sizeof(*html_block_elements), compare_name)) {
+				html_line_break(&state, /*always*/ false);
+				if(strcmp(name, "pre") == 0)
+					state.in_pre = !closing;
+			} else if(!closing && bsearch(name, html_skipped_elements, sizeof(html_skipped_elements) / sizeof(*html_skipped_elements), sizeof(*html_skipped_elements), compare_name)) {
+				char end_tag[sizeof(name) + 2U] = "</";
+				strcat(end_tag, name);
+				//If it's never closed, it's the document that's broken; carry on from the start tag rather than throw the rest away.
+				const unsigned char *element_end = html_find(p, end, end_tag);
+				if(element_end < end)
+					p = html_skip_tag(element_end, end);
+			}
+		} else if(c == '&') {
+			uint32_t code_point;
+			const unsigned char *reference_end = html_read_reference(p + 1, end, &code_point);
+			if(reference_end) {
+				html_put_char(&state, code_point);
+				p = reference_end;
+			} else {
+				html_put_char(&state, '&');
+				++p;
+			}
+		} else if(c < 0x80U) {
+			html_put_char(&state, c);
+			++p;
+		} else {
+			uint32_t code_point;
+			if(!pb_decode_utf8(&p, end, &code_point))
+				code_point = pb_single_byte_code_point(pb_text_encoding_cp1252, *p++);
+			html_put_char(&state, code_point);
+		}
+	}
+}
+
+#pragma mark -
+
+bool pb_extract_markup_text(enum pb_markup_format format, const void *bytes, size_t length, pb_markup_writer write_function, void *context) {
+	struct text_output out = { .write_function = write_function, .context = context, .stopped = false, .length = 0U, .last = 0 };
+	const unsigned char *p = bytes;
+	if(format == pb_markup_rtf)
+		extract_rtf(p, p + length, &out);
+	else
+		extract_html(p, p + length, &out);
+	flush_output(&out);
+	return !out.stopped;
+}
@@ -0,0 +1,21 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+enum pb_markup_format {
+	pb_markup_rtf,
+	pb_markup_html,
+};
+
+//Called with each piece of output, in order. Pieces always end on a character boundary. Return false to stop.
+typedef bool (*pb_markup_writer)(void *context, const void *bytes, size_t length);
+
+/*
+ *Extracts the text of an RTF or HTML document as UTF-8, handing it to write_function a piece at a time.
+ *
+ *RTF: control words for characters (\'hh in the document's code page, \uN, \emdash, \par, and the like) become those characters; groups that aren't part of the text (font and color tables, stylesheets, pictures, field instructions, and any \* destination) are skipped.
+ *HTML: tags are dropped, block-level elements become line breaks (table cells become tabs), whitespace is collapsed as a browser would outside <pre>, script and style contents are skipped, and character references (named, decimal, and hex) are decoded. Bytes that aren't valid UTF-8 are read as Windows-1252.
+ *
+ *It's one forward pass over the input with a fixed-size output buffer and no allocation, so documents of any size take the same memory.
+ *Returns false only if write_function returns false.
+ */
+bool pb_extract_markup_text(enum pb_markup_format format, const void *bytes, size_t length, pb_markup_writer write_function, void *context);
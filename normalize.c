@@ -0,0 +1,185 @@
+#include "normalize.h"
+#include "transcode.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <CoreFoundation/CoreFoundation.h>
+
+//Spans longer than this get normalized a piece at a time.
+enum { pb_normalization_piece_length = 65536U };
+
+static const struct {
+	const char *name;
+	enum pb_normalization_form form;
+	CFStringNormalizationForm CFForm;
+} form_names[] = {
+	{ "nfc",  pb_normalization_nfc,  kCFStringNormalizationFormC },
+	{ "nfd",  pb_normalization_nfd,  kCFStringNormalizationFormD },
+	{ "nfkc", pb_normalization_nfkc, kCFStringNormalizationFormKC },
+};
+
+bool pb_normalization_form_for_name(const char *name, enum pb_normalization_form *out_form) {
+	for(size_t i = 0U; i < sizeof(form_names) / sizeof(*form_names); ++i) {
+		if(strcasecmp(name, form_names[i].name) == 0) {
+			*out_form = form_names[i].form;
+			return true;
+		}
+	}
+	return false;
+}
+const char *pb_normalization_form_name(enum pb_normalization_form form) {
+	for(size_t i = 0U; i < sizeof(form_names) / sizeof(*form_names); ++i) {
+		if(form_names[i].form == form)
+			return form_names[i].name;
+	}
+	return "none";
+}
+
+#pragma mark Quick check
+
+/*
+ *A stable character is one that the form leaves alone, that has no combining class, and that never composes with anything before it. Text made of nothing but stable characters is already normalized, and a span of text between two stable characters can be normalized without looking outside it.
+ *
+ *Everything below U+0300 is stable for NFC; the first combining marks start there. NFD decomposes the accented Latin-1 letters, and NFKC folds the Latin-1 symbols (NBSP, superscripts, fractions), so those stop earlier. The CJK Unified Ideographs have no decompositions of any kind.
+ */
+static inline uint32_t stable_limit_for_form(enum pb_normalization_form form) {
+	switch(form) {
+		case pb_normalization_nfc:  return 0x300U;
+		case pb_normalization_nfd:  return 0xC0U;
+		case pb_normalization_nfkc: return 0xA0U;
+		case pb_normalization_none: break;
+	}
+	return 0x110000U;
+}
+static inline bool is_stable(uint32_t c, uint32_t stable_limit) {
+	return (c < stable_limit) || ((c >= 0x4E00U) && (c <= 0x9FFFU));
+}
+
+#pragma mark Normalizing
+
+//Normalizes the characters of string in range and writes them out as UTF-8.
+static bool write_normalized(CFStringRef string, CFRange range, CFStringNormalizationForm CFForm, pb_normalization_writer write_function, void *context) {
+	CFStringRef substring = CFStringCreateWithSubstring(kCFAllocatorDefault, string, range);
+	CFMutableStringRef normalized = substring ? CFStringCreateMutableCopy(kCFAllocatorDefault, /*maxLength*/ 0, substring) : NULL;
+	if(substring)
+		CFRelease(substring);
+	if(!normalized)
+		return false;
+	CFStringNormalize(normalized, CFForm);
+
+	bool success = true;
+	UInt8 buffer[16384];
+	CFRange remaining = CFRangeMake(0, CFStringGetLength(normalized));
+	while(success && remaining.length) {
+		CFIndex bytesUsed = 0;
+		CFIndex numCharacters = CFStringGetBytes(normalized, remaining, kCFStringEncodingUTF8, /*lossByte*/ 0, /*isExternalRepresentation*/ false, buffer, sizeof(buffer), &bytesUsed);
+		if(numCharacters <= 0)
+			success = false;
+		else {
+			success = write_function(context, buffer, (size_t)bytesUsed);
+			remaining.location += numCharacters;
+			remaining.length   -= numCharacters;
+		}
+	}
+
+	CFRelease(normalized);
+	return success;
+}
+
+/*
+ *Normalizes and writes out a span of UTF-8 (already validated).
+ *If holdBackLastSequence is true, the last composed character sequence is left alone, since more combining marks may yet follow it; *outConsumed tells how many bytes were actually used (possibly 0, if the span is all one sequence).
+ */
+static bool normalize_span(const unsigned char *bytes, size_t length, CFStringNormalizationForm CFForm, bool holdBackLastSequence, pb_normalization_writer write_function, void *context, size_t *outConsumed) {
+	CFStringRef string = CFStringCreateWithBytes(kCFAllocatorDefault, bytes, (CFIndex)length, kCFStringEncodingUTF8, /*isExternalRepresentation*/ false);
+	if(!string)
+		return false;
+
+	CFRange range = CFRangeMake(0, CFStringGetLength(string));
+	size_t consumed = length;
+	if(holdBackLastSequence && range.length) {
+		CFRange lastSequence = CFStringGetRangeOfComposedCharactersAtIndex(string, range.length - 1);
+		CFIndex lastSequenceLength = 0;
+		CFStringGetBytes(string, lastSequence, kCFStringEncodingUTF8, /*lossByte*/ 0, /*isExternalRepresentation*/ false, /*buffer*/ NULL, /*maxBufLen*/ 0, &lastSequenceLength);
+		range.length = lastSequence.location;
+		consumed -= (size_t)lastSequenceLength;
+	}
+
+	bool success = (range.length == 0) || write_normalized(string, range, CFForm, write_function, context);
+	CFRelease(string);
+	if(success && outConsumed)
+		*outConsumed = range.length ? consumed : 0U;
+	return success;
+}
+
+bool pb_normalize_utf8(enum pb_normalization_form form, const void *bytes, size_t length, pb_normalization_writer write_function, void *context) {
+	CFStringNormalizationForm CFForm = kCFStringNormalizationFormC;
+	for(size_t i = 0U; i < sizeof(form_names) / sizeof(*form_names); ++i) {
+		if(form_names[i].form == form)
+			CFForm = form_names[i].CFForm;
+	}
+	const uint32_t stable_limit = stable_limit_for_form(form);
+
+	const unsigned char *p = bytes, *end = p + length;
+	//Start of the stable text that we haven't written out yet.
+	const unsigned char *clean_start = p;
+	uint32_t c;
+
+	while(p < end) {
+		//Skip over stable characters, eight ASCII bytes at a time where we can.
+		const unsigned char *last_stable = NULL;
+		while(p < end) {
+			if((size_t)(end - p) >= 8U) {
+				uint64_t word;
+				memcpy(&word, p, sizeof(word));
+				if(!(word & 0x8080808080808080ULL)) {
+					last_stable = p + 7;
+					p += 8;
+					continue;
+				}
+			}
+			const unsigned char *next = p;
+			if(!pb_decode_utf8(&next, end, &c))
+				return false;
+			if(!is_stable(c, stable_limit))
+				break;
+			last_stable = p;
+			p = next;
+		}
+		if(p >= end)
+			break;
+
+		//p is at a character that may change. The stable character before it may compose with it, so the span to normalize starts there.
+		const unsigned char *span_start = last_stable ? last_stable : p;
+		if((span_start > clean_start) && !write_function(context, clean_start, (size_t)(span_start - clean_start)))
+			return false;
+
+		//The span runs up to the next stable character. If that's a long way off, normalize what we have so far a piece at a time.
+		size_t piece_length = pb_normalization_piece_length;
+		while(p < end) {
+			const unsigned char *next = p;
+			if(!pb_decode_utf8(&next, end, &c))
+				return false;
+			if(is_stable(c, stable_limit))
+				break;
+			p = next;
+
+			if((size_t)(p - span_start) >= piece_length) {
+				size_t consumed = 0U;
+				if(!normalize_span(span_start, (size_t)(p - span_start), CFForm, /*holdBackLastSequence*/ true, write_function, context, &consumed))
+					return false;
+				span_start += consumed;
+				//If the whole piece was one enormous sequence, let it grow rather than trying again at every character.
+				piece_length = consumed ? pb_normalization_piece_length : (piece_length * 2U);
+			}
+		}
+		if(!normalize_span(span_start, (size_t)(p - span_start), CFForm, /*holdBackLastSequence*/ false, write_function, context, NULL))
+			return false;
+		clean_start = p;
+	}
+
+	if((end > clean_start) && !write_function(context, clean_start, (size_t)(end - clean_start)))
+		return false;
+	return true;
+}
@@ -0,0 +1,25 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+enum pb_normalization_form {
+	pb_normalization_none,
+	pb_normalization_nfc,  //Canonical composition: what most of the world expects.
+	pb_normalization_nfd,  //Canonical decomposition: what HFS+ filenames (and some Mac apps) produce.
+	pb_normalization_nfkc, //Compatibility composition: also folds ligatures, full-width forms, and the like.
+};
+
+//Looks up a form by name ("nfc", "nfd", "nfkc"), ignoring case. Returns false if the name is not one we know.
+bool pb_normalization_form_for_name(const char *name, enum pb_normalization_form *out_form);
+const char *pb_normalization_form_name(enum pb_normalization_form form);
+
+//Called with each piece of output, in order. Pieces always end on a character boundary. Return false to stop.
+typedef bool (*pb_normalization_writer)(void *context, const void *bytes, size_t length);
+
+/*
+ *Normalizes length bytes of UTF-8 text, handing the normalized UTF-8 to write_function a piece at a time.
+ *
+ *A quick-check pass runs over the input first: text that is already normalized (ASCII and Latin-1 letters, for the composed forms; ASCII alone, for NFD) goes to write_function straight from the input without being copied. Only the spans around characters that might change are normalized, and long spans are normalized in pieces, so memory use doesn't grow with the size of the text.
+ *
+ *Returns false if the input isn't valid UTF-8, if memory runs out, or if write_function returns false.
+ */
+bool pb_normalize_utf8(enum pb_normalization_form form, const void *bytes, size_t length, pb_normalization_writer write_function, void *context);
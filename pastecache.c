@@ -0,0 +1,170 @@
+#include "pastecache.h"
+#include "digest.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//Every entry starts with this header. The output follows it.
+struct entry_header {
+	char magic[8];
+	unsigned char source_digest[pb_paste_cache_digest_length];
+	uint64_t source_length;
+	uint64_t length;
+};
+static const char entry_magic[8] = { 'p', 'b', 'c', 'a', 'c', 'h', 'e', '1' };
+
+char *pb_paste_cache_copy_default_directory(void) {
+	const char *home = getenv("HOME");
+	if(!(home && *home))
+		return NULL;
+	char *path = NULL;
+	if(asprintf(&path, "%s/Library/Caches/pb", home) < 0)
+		return NULL;
+	return path;
+}
+
+void pb_paste_cache_digest_source(const char *type, const void *bytes, size_t length, unsigned char *out_digest) {
+	struct pb_digest_context context;
+	pb_digest_init(&context, pb_digest_xxh64);
+	//Including the NUL keeps the type and the data from running together.
+	pb_digest_update(&context, type, strlen(type) + 1U);
+	pb_digest_update(&context, bytes, length);
+	pb_digest_final(&context, out_digest);
+}
+
+//Slots are named by the digest of their description, so any string makes a safe filename.
+static char *copy_path_for_slot(const char *directory, const char *slot) {
+	unsigned char digest[pb_digest_max_length];
+	char digest_hex[pb_digest_max_length * 2U + 1U];
+	pb_digest_buffer(pb_digest_xxh64, slot, strlen(slot), digest);
+	char *path = NULL;
+	if(asprintf(&path, "%s/%s", directory, pb_digest_format_hex(digest, pb_digest_length(pb_digest_xxh64), digest_hex)) < 0)
+		return NULL;
+	return path;
+}
+
+static bool write_all_to(int fd, const unsigned char *p, size_t length) {
+	while(length) {
+		ssize_t amt_written = write(fd, p, length);
+		if(amt_written < 0) {
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		p += amt_written;
+		length -= (size_t)amt_written;
+	}
+	return true;
+}
+
+#pragma mark Reading
+
+enum pb_paste_cache_result pb_paste_cache_serve(const char *directory, const char *slot, const unsigned char *source_digest, uint64_t source_length, int out_fd) {
+	char *path = copy_path_for_slot(directory, slot);
+	if(!path)
+		return pb_paste_cache_miss;
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		free(path);
+		return pb_paste_cache_miss;
+	}
+
+	enum pb_paste_cache_result result = pb_paste_cache_miss;
+	struct stat sb;
+	struct entry_header header;
+	if((fstat(fd, &sb) == 0)
+	&& (pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header))
+	&& (memcmp(header.magic, entry_magic, sizeof(entry_magic)) == 0)
+	&& ((uint64_t)sb.st_size == sizeof(header) + header.length))
+	{
+		if((header.source_length != source_length) || (memcmp(header.source_digest, source_digest, pb_paste_cache_digest_length) != 0)) {
+			//Made from something that was on the pasteboard before. It will never be any use again.
+			unlink(path);
+		} else if(header.length == 0U) {
+			result = pb_paste_cache_hit;
+		} else {
+			//Write straight out of the mapping: the output never gets copied into a buffer of ours.
+			void *mapping = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if(mapping != MAP_FAILED) {
+				madvise(mapping, (size_t)sb.st_size, MADV_SEQUENTIAL);
+				result = write_all_to(out_fd, (const unsigned char *)mapping + sizeof(header), (size_t)header.length) ? pb_paste_cache_hit : pb_paste_cache_write_failed;
+				int saved_errno = errno;
+				munmap(mapping, (size_t)sb.st_size);
+				errno = saved_errno;
+			}
+		}
+	}
+
+	close(fd);
+	free(path);
+	return result;
+}
+
+#pragma mark Writing
+
+bool pb_paste_cache_begin(const char *directory, const char *slot, const unsigned char *source_digest, uint64_t source_length, struct pb_paste_cache_entry *out_entry) {
+	if((mkdir(directory, 0700) < 0) && (errno != EEXIST))
+		return false;
+
+	out_entry->path = copy_path_for_slot(directory, slot);
+	out_entry->temp_path = NULL;
+	if(!(out_entry->path && (asprintf(&(out_entry->temp_path), "%s.XXXXXX", out_entry->path) >= 0))) {
+		free(out_entry->path);
+		return false;
+	}
+	out_entry->fd = mkstemp(out_entry->temp_path);
+	//The header is written last, once we know the length.
+	if((out_entry->fd < 0) || (lseek(out_entry->fd, (off_t)sizeof(struct entry_header), SEEK_SET) < 0)) {
+		pb_paste_cache_abandon(out_entry);
+		return false;
+	}
+
+	memcpy(out_entry->source_digest, source_digest, pb_paste_cache_digest_length);
+	out_entry->source_length = source_length;
+	out_entry->length = 0U;
+	return true;
+}
+
+bool pb_paste_cache_append(struct pb_paste_cache_entry *entry, const void *bytes, size_t length) {
+	if(!write_all_to(entry->fd, bytes, length))
+		return false;
+	entry->length += length;
+	return true;
+}
+
+bool pb_paste_cache_commit(struct pb_paste_cache_entry *entry) {
+	struct entry_header header;
+	memcpy(header.magic, entry_magic, sizeof(entry_magic));
+	memcpy(header.source_digest, entry->source_digest, pb_paste_cache_digest_length);
+	header.source_length = entry->source_length;
+	header.length = entry->length;
+
+	bool success = (pwrite(entry->fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header));
+	success = (close(entry->fd) == 0) && success;
+	entry->fd = -1;
+	success = success && (rename(entry->temp_path, entry->path) == 0);
+	if(!success)
+		unlink(entry->temp_path);
+
+	free(entry->temp_path);
+	free(entry->path);
+	entry->temp_path = entry->path = NULL;
+	return success;
+}
+
+void pb_paste_cache_abandon(struct pb_paste_cache_entry *entry) {
+	if(entry->fd >= 0) {
+		close(entry->fd);
+		unlink(entry->temp_path);
+	}
+	entry->fd = -1;
+	free(entry->temp_path);
+	free(entry->path);
+	entry->temp_path = entry->path = NULL;
+}
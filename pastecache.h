@@ -0,0 +1,42 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ *An on-disk cache of paste output, one file per slot. A slot is a pasteboard, item, type, and set of output options, written out as a string by the caller.
+ *Each entry records the digest of the pasteboard data it was made from. Once the pasteboard holds something else, the digests no longer match, and the entry is thrown away the next time anyone looks at it.
+ */
+
+//XXH64 of the source type and data.
+enum { pb_paste_cache_digest_length = 8U };
+
+struct pb_paste_cache_entry {
+	char *path;      //Where the entry goes once it's finished
+	char *temp_path; //Where it's written until then, so nobody ever reads half an entry
+	int fd;
+	unsigned char source_digest[pb_paste_cache_digest_length];
+	uint64_t source_length;
+	uint64_t length;
+};
+
+//~/Library/Caches/pb. Returns a malloc'd path, or NULL if there's no home directory.
+char *pb_paste_cache_copy_default_directory(void);
+
+//Identifies the data that a paste is made from. out_digest must have room for pb_paste_cache_digest_length bytes.
+void pb_paste_cache_digest_source(const char *type, const void *bytes, size_t length, unsigned char *out_digest);
+
+enum pb_paste_cache_result {
+	pb_paste_cache_miss,
+	pb_paste_cache_hit,
+	pb_paste_cache_write_failed, //The entry was good, but writing it out failed partway (errno is set).
+};
+//If the slot has an entry made from the same source, maps it and writes it to out_fd.
+enum pb_paste_cache_result pb_paste_cache_serve(const char *directory, const char *slot, const unsigned char *source_digest, uint64_t source_length, int out_fd);
+
+//Starts a new entry for the slot, creating the directory if need be. Returns false if the entry can't be created; pasting should go on without it.
+bool pb_paste_cache_begin(const char *directory, const char *slot, const unsigned char *source_digest, uint64_t source_length, struct pb_paste_cache_entry *out_entry);
+bool pb_paste_cache_append(struct pb_paste_cache_entry *entry, const void *bytes, size_t length);
+//Finishes the entry and puts it in place of whatever the slot had before.
+bool pb_paste_cache_commit(struct pb_paste_cache_entry *entry);
+//Throws away an unfinished entry.
+void pb_paste_cache_abandon(struct pb_paste_cache_entry *entry);
@@ -0,0 +1,173 @@
+#include "sniff.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#pragma mark Structure checks
+
+//Some magic numbers are too short to trust by themselves ("BM" starts plenty of text). These look a little further into the header.
+
+//Each check gets the bytes we're looking at (at most pb_sniff_length of them) and the length of the whole input, for formats that record their own size.
+
+static inline uint32_t read_le32(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static inline uint32_t read_be32(const unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static bool looks_like_bmp(const unsigned char *bytes, size_t length, size_t total_length) {
+	if(length < 18U)
+		return false;
+	//The DIB header that follows the file header comes in a handful of sizes.
+	switch(read_le32(&bytes[14])) {
+		case 12U: case 40U: case 52U: case 56U: case 64U: case 108U: case 124U:
+			return true;
+		default:
+			return false;
+	}
+}
+static bool looks_like_ico(const unsigned char *bytes, size_t length, size_t total_length) {
+	//Reserved word, type 1 (icon), at least one image, and that image's reserved byte is 0.
+	return (length >= 22U) && ((bytes[4] | bytes[5]) != 0U) && (bytes[9] == 0U);
+}
+static bool looks_like_psd(const unsigned char *bytes, size_t length, size_t total_length) {
+	//Version 1 (PSD) or 2 (PSB), then six reserved bytes that are always 0.
+	if(length < 12U)
+		return false;
+	if((bytes[4] != 0U) || ((bytes[5] != 1U) && (bytes[5] != 2U)))
+		return false;
+	for(size_t i = 6U; i < 12U; ++i) {
+		if(bytes[i] != 0U)
+			return false;
+	}
+	return true;
+}
+static bool looks_like_icns(const unsigned char *bytes, size_t length, size_t total_length) {
+	//The header's length field covers the whole file, header included.
+	return (length >= 8U) && (read_be32(&bytes[4]) == total_length);
+}
+static bool looks_like_id3(const unsigned char *bytes, size_t length, size_t total_length) {
+	//ID3v2.2 through 2.4, a revision that is never 0xFF, and a size made of four 7-bit bytes.
+	if(length < 10U)
+		return false;
+	if((bytes[3] < 2U) || (bytes[3] > 4U) || (bytes[4] == 0xFFU))
+		return false;
+	return ((bytes[6] | bytes[7] | bytes[8] | bytes[9]) & 0x80U) == 0U;
+}
+static bool looks_like_bzip2(const unsigned char *bytes, size_t length, size_t total_length) {
+	//A block size from 1 to 9 (hundreds of KB), then the magic number of the first block (or of the end of the stream, if there are no blocks).
+	if(length < 10U)
+		return false;
+	if((bytes[3] < '1') || (bytes[3] > '9'))
+		return false;
+	return (memcmp(&bytes[4], "1AY&SY", 6U) == 0) || (memcmp(&bytes[4], "\x17rE8P\x90", 6U) == 0);
+}
+
+#pragma mark Signatures
+
+enum {
+	//Skip any leading whitespace (and a UTF-8 BOM), and ignore case. For markup, which people write however they like.
+	sniff_markup = 1U << 0,
+};
+
+static const struct signature {
+	size_t offset;
+	const char *magic;
+	size_t magic_length;
+	//A second magic number that must also be present, for containers like RIFF whose first one is shared by several formats.
+	size_t offset2;
+	const char *magic2;
+	size_t magic2_length;
+	unsigned flags;
+	bool (*check)(const unsigned char *bytes, size_t length, size_t total_length);
+	const char *UTI;
+} signatures[] = {
+#define SIGNATURE(offset, magic, flags, check, UTI) { offset, magic, sizeof(magic) - 1U, 0U, NULL, 0U, flags, check, UTI }
+#define SIGNATURE2(offset, magic, offset2, magic2, UTI) { offset, magic, sizeof(magic) - 1U, offset2, magic2, sizeof(magic2) - 1U, 0U, NULL, UTI }
+	//Images
+	SIGNATURE(0U, "\x89PNG\r\n\x1A\n",            0U, NULL, "public.png"),
+	SIGNATURE(0U, "\xFF\xD8\xFF",                 0U, NULL, "public.jpeg"),
+	SIGNATURE(0U, "GIF87a",                       0U, NULL, "com.compuserve.gif"),
+	SIGNATURE(0U, "GIF89a",                       0U, NULL, "com.compuserve.gif"),
+	SIGNATURE(0U, "II*\0",                        0U, NULL, "public.tiff"),
+	SIGNATURE(0U, "MM\0*",                        0U, NULL, "public.tiff"),
+	SIGNATURE(0U, "\0\0\0\x0CjP  \r\n\x87\n",     0U, NULL, "public.jpeg-2000"),
+	SIGNATURE(0U, "8BPS",                         0U, looks_like_psd, "com.adobe.photoshop-image"),
+	SIGNATURE(0U, "icns",                         0U, looks_like_icns, "com.apple.icns"),
+	SIGNATURE(0U, "BM",                           0U, looks_like_bmp, "com.microsoft.bmp"),
+	SIGNATURE(0U, "\0\0\x01\0",                   0U, looks_like_ico, "com.microsoft.ico"),
+	SIGNATURE2(0U, "RIFF", 8U, "WEBP",                              "org.webmproject.webp"),
+	//Documents
+	SIGNATURE(0U, "%PDF-",                        0U, NULL, "com.adobe.pdf"),
+	SIGNATURE(0U, "{\\rtf",                       0U, NULL, "public.rtf"),
+	SIGNATURE(0U, "bplist00",                     0U, NULL, "com.apple.binary-property-list"),
+	SIGNATURE(0U, "<!DOCTYPE html",               sniff_markup, NULL, "public.html"),
+	SIGNATURE(0U, "<html",                        sniff_markup, NULL, "public.html"),
+	SIGNATURE(0U, "<?xml",                        sniff_markup, NULL, "public.xml"),
+	//Archives
+	SIGNATURE(0U, "PK\x03\x04",                   0U, NULL, "public.zip-archive"),
+	SIGNATURE(0U, "\x1F\x8B\x08",                 0U, NULL, "org.gnu.gnu-zip-archive"),
+	SIGNATURE(0U, "BZh",                          0U, looks_like_bzip2, "public.bzip2-archive"),
+	//Audio and video (and HEIF and AVIF images, which share MPEG-4's container)
+	SIGNATURE(0U, "ID3",                          0U, looks_like_id3, "public.mp3"),
+	SIGNATURE2(0U, "RIFF", 8U, "WAVE",                              "com.microsoft.waveform-audio"),
+	SIGNATURE2(0U, "FORM", 8U, "AIFF",                              "public.aiff-audio"),
+	//ISO base media files all start with an ftyp box; its major brand says which kind this is. Brands not listed here (there are many) go unrecognized rather than being called MPEG-4.
+	SIGNATURE(4U, "ftypqt  ",                     0U, NULL, "com.apple.quicktime-movie"),
+	SIGNATURE(4U, "ftypM4A ",                     0U, NULL, "com.apple.m4a-audio"),
+	SIGNATURE(4U, "ftypM4V ",                     0U, NULL, "com.apple.m4v-video"),
+	SIGNATURE(4U, "ftypisom",                     0U, NULL, "public.mpeg-4"),
+	SIGNATURE(4U, "ftypiso2",                     0U, NULL, "public.mpeg-4"),
+	SIGNATURE(4U, "ftypmp41",                     0U, NULL, "public.mpeg-4"),
+	SIGNATURE(4U, "ftypmp42",                     0U, NULL, "public.mpeg-4"),
+	SIGNATURE(4U, "ftypavc1",                     0U, NULL, "public.mpeg-4"),
+	SIGNATURE(4U, "ftyp3gp4",                     0U, NULL, "public.3gpp"),
+	SIGNATURE(4U, "ftyp3gp5",                     0U, NULL, "public.3gpp"),
+	SIGNATURE(4U, "ftypheic",                     0U, NULL, "public.heic"),
+	SIGNATURE(4U, "ftypheix",                     0U, NULL, "public.heic"),
+	SIGNATURE(4U, "ftypmif1",                     0U, NULL, "public.heif"),
+	SIGNATURE(4U, "ftypavif",                     0U, NULL, "public.avif"),
+#undef SIGNATURE
+#undef SIGNATURE2
+};
+
+static inline bool matches_at(const unsigned char *bytes, size_t length, size_t offset, const char *magic, size_t magic_length, bool ignore_case) {
+	if((offset > length) || (magic_length > length - offset))
+		return false;
+	if(ignore_case)
+		return strncasecmp((const char *)&bytes[offset], magic, magic_length) == 0;
+	return memcmp(&bytes[offset], magic, magic_length) == 0;
+}
+
+const char *pb_sniff_type(const void *bytes, size_t length) {
+	const unsigned char *start = bytes;
+	size_t total_length = length;
+	if(length > pb_sniff_length)
+		length = pb_sniff_length;
+
+	//Where markup really starts: after a UTF-8 BOM and any whitespace.
+	const unsigned char *markup = start, *end = start + length;
+	if((length >= 3U) && (memcmp(markup, "\xEF\xBB\xBF", 3U) == 0))
+		markup += 3;
+	while((markup < end) && ((*markup == ' ') || (*markup == '\t') || (*markup == '\r') || (*markup == '\n')))
+		++markup;
+
+	for(size_t i = 0U; i < sizeof(signatures) / sizeof(*signatures); ++i) {
+		const struct signature *signature = &signatures[i];
+		bool is_markup = (signature->flags & sniff_markup);
+		const unsigned char *p = is_markup ? markup : start;
+		size_t available = (size_t)(end - p);
+
+		if(!matches_at(p, available, signature->offset, signature->magic, signature->magic_length, is_markup))
+			continue;
+		if(signature->magic2 && !matches_at(p, available, signature->offset2, signature->magic2, signature->magic2_length, false))
+			continue;
+		if(signature->check && !signature->check(p, available, total_length))
+			continue;
+		return signature->UTI;
+	}
+	return NULL;
+}
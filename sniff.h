@@ -0,0 +1,11 @@
+#include <stddef.h>
+
+//The sniffer never looks further into the data than this.
+enum { pb_sniff_length = 4096U };
+
+/*
+ *Guesses the type of some data from its content alone: magic numbers for binary formats (PNG, JPEG, PDF, ZIP, …) and the opening tag or control word for markup (RTF, HTML, XML).
+ *Returns the UTI as a C string, or NULL if nothing matched (in which case the data may well be plain text).
+ *Only the first pb_sniff_length bytes are examined, and nothing outside the buffer is consulted.
+ */
+const char *pb_sniff_type(const void *bytes, size_t length);
@@ -0,0 +1,80 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ *Just enough of a test harness for pb's modules: each test program checks as it goes, reports every failure with its line, and exits with 1 if there were any.
+ */
+
+static unsigned long tests_run, tests_failed;
+
+#define CHECK(condition) \
+	do { \
+		++tests_run; \
+		if(!(condition)) { \
+			++tests_failed; \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+		} \
+	} while(0)
+
+//Compares a buffer against the bytes that should be in it, showing both if they differ.
+#define CHECK_BYTES(bytes, length, expected, expected_length) \
+	check_bytes(__FILE__, __LINE__, #bytes, (bytes), (length), (expected), (expected_length))
+
+static inline void print_escaped_bytes(const void *bytes, size_t length) {
+	const unsigned char *p = bytes;
+	for(size_t i = 0U; (i < length) && (i < 64U); ++i) {
+		if((p[i] >= 0x20U) && (p[i] < 0x7FU) && (p[i] != '\\'))
+			fputc(p[i], stderr);
+		else
+			fprintf(stderr, "\\x%02X", p[i]);
+	}
+	if(length > 64U)
+		fprintf(stderr, "… (%zu bytes)", length);
+}
+static inline void check_bytes(const char *file, int line, const char *name, const void *bytes, size_t length, const void *expected, size_t expected_length) {
+	++tests_run;
+	if((length == expected_length) && ((length == 0U) || (memcmp(bytes, expected, length) == 0)))
+		return;
+	++tests_failed;
+	fprintf(stderr, "%s:%d: %s is \"", file, line, name);
+	print_escaped_bytes(bytes, length);
+	fprintf(stderr, "\", expected \"");
+	print_escaped_bytes(expected, expected_length);
+	fprintf(stderr, "\"\n");
+}
+
+//Collects the pieces a streaming function writes out, for the writer callbacks that most modules take.
+struct test_output {
+	unsigned char *bytes;
+	size_t length, capacity;
+	unsigned long num_pieces;
+};
+static inline bool test_output_write(void *context, const void *bytes, size_t length) {
+	struct test_output *output = context;
+	if(output->length + length > output->capacity) {
+		size_t capacity = (output->capacity ? output->capacity : 256U);
+		while(capacity < output->length + length)
+			capacity *= 2U;
+		unsigned char *newBytes = realloc(output->bytes, capacity);
+		if(!newBytes)
+			return false;
+		output->bytes = newBytes;
+		output->capacity = capacity;
+	}
+	memcpy(output->bytes + output->length, bytes, length);
+	output->length += length;
+	++output->num_pieces;
+	return true;
+}
+static inline void test_output_reset(struct test_output *output) {
+	output->length = 0U;
+	output->num_pieces = 0U;
+}
+
+static inline int test_summary(const char *name) {
+	fprintf(stderr, "%s: %lu checks, %lu failed\n", name, tests_run, tests_failed);
+	return tests_failed ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+#include "test.h"
+#include "../bintext.h"
+
+//Encodes the data in pieces of piece_length bytes (all at once if 0), the way paste --encode feeds it.
+static void check_encoding(int line, enum pb_bintext_format format, const void *in, size_t in_length, size_t piece_length, const char *expected) {
+	struct pb_bintext_encoder encoder;
+	pb_bintext_encoder_init(&encoder, format);
+	char out[256];
+	size_t out_length = 0U;
+	const unsigned char *p = in;
+	if(!piece_length)
+		piece_length = in_length ? in_length : 1U;
+	for(size_t start = 0U; start < in_length; start += piece_length) {
+		size_t length = (in_length - start < piece_length) ? (in_length - start) : piece_length;
+		out_length += pb_bintext_encode(&encoder, p + start, length, out + out_length);
+	}
+	out_length += pb_bintext_encode_finish(&encoder, out + out_length);
+	check_bytes(__FILE__, line, "out", out, out_length, expected, strlen(expected));
+}
+
+//Decodes the text in pieces, and returns false if the decoder did.
+static bool decode(enum pb_bintext_format format, const char *in, size_t piece_length, unsigned char *out, size_t *out_length) {
+	struct pb_bintext_decoder decoder;
+	pb_bintext_decoder_init(&decoder, format);
+	size_t in_length = strlen(in), total = 0U;
+	if(!piece_length)
+		piece_length = in_length ? in_length : 1U;
+	for(size_t start = 0U; start < in_length; start += piece_length) {
+		size_t length = (in_length - start < piece_length) ? (in_length - start) : piece_length, decoded = 0U;
+		if(!pb_bintext_decode(&decoder, in + start, length, out + total, &decoded))
+			return false;
+		total += decoded;
+	}
+	size_t decoded = 0U;
+	if(!pb_bintext_decode_finish(&decoder, out + total, &decoded))
+		return false;
+	*out_length = total + decoded;
+	return true;
+}
+static void check_decoding(int line, enum pb_bintext_format format, const char *in, size_t piece_length, const void *expected, size_t expected_length) {
+	unsigned char out[256];
+	size_t out_length = 0U;
+	++tests_run;
+	if(!decode(format, in, piece_length, out, &out_length)) {
+		++tests_failed;
+		fprintf(stderr, "%s:%d: decoding \"%s\" failed\n", __FILE__, line, in);
+		return;
+	}
+	check_bytes(__FILE__, line, "out", out, out_length, expected, expected_length);
+}
+
+static void test_names(void) {
+	enum pb_bintext_format format = pb_bintext_none;
+	CHECK(pb_bintext_format_for_name("Base64", &format) && (format == pb_bintext_base64));
+	CHECK(pb_bintext_format_for_name("hex", &format) && (format == pb_bintext_hex));
+	CHECK(!pb_bintext_format_for_name("uuencode", &format));
+	CHECK(strcmp(pb_bintext_format_name(pb_bintext_base64), "base64") == 0);
+}
+
+static void test_base64(void) {
+	//The RFC 4648 test vectors, whole and a byte at a time (which holds bytes over between every call).
+	static const char *const vectors[][2] = {
+		{ "", "" }, { "f", "Zg==" }, { "fo", "Zm8=" }, { "foo", "Zm9v" },
+		{ "foob", "Zm9vYg==" }, { "fooba", "Zm9vYmE=" }, { "foobar", "Zm9vYmFy" },
+	};
+	for(size_t i = 0U; i < sizeof(vectors) / sizeof(*vectors); ++i) {
+		size_t length = strlen(vectors[i][0]);
+		check_encoding(__LINE__, pb_bintext_base64, vectors[i][0], length, 0U, vectors[i][1]);
+		check_encoding(__LINE__, pb_bintext_base64, vectors[i][0], length, 1U, vectors[i][1]);
+		check_encoding(__LINE__, pb_bintext_base64, vectors[i][0], length, 2U, vectors[i][1]);
+		check_decoding(__LINE__, pb_bintext_base64, vectors[i][1], 0U, vectors[i][0], length);
+		check_decoding(__LINE__, pb_bintext_base64, vectors[i][1], 1U, vectors[i][0], length);
+	}
+	check_encoding(__LINE__, pb_bintext_base64, "\xFB\xFF\xBF", 3U, 0U, "+/+/");
+
+	//Whitespace and line breaks are ignored anywhere, and padding may be left off.
+	check_decoding(__LINE__, pb_bintext_base64, "Zm9v\r\nYmFy\n", 0U, "foobar", 6U);
+	check_decoding(__LINE__, pb_bintext_base64, " Z m 9 v Y g", 3U, "foob", 4U);
+	check_decoding(__LINE__, pb_bintext_base64, "Zm9vYg", 0U, "foob", 4U);
+
+	unsigned char out[64];
+	size_t out_length = 0U;
+	CHECK(!decode(pb_bintext_base64, "Zm9v!", 0U, out, &out_length));     //Not a digit
+	CHECK(!decode(pb_bintext_base64, "Zg==Zg==", 0U, out, &out_length));  //Data after the padding
+	CHECK(!decode(pb_bintext_base64, "Z", 0U, out, &out_length));         //Ends partway into a byte
+}
+
+static void test_hex(void) {
+	check_encoding(__LINE__, pb_bintext_hex, "\x00\x7F\xAB\xFF", 4U, 0U, "007fabff");
+	check_encoding(__LINE__, pb_bintext_hex, "\x00\x7F\xAB\xFF", 4U, 1U, "007fabff");
+	check_decoding(__LINE__, pb_bintext_hex, "007fabff", 0U, "\x00\x7F\xAB\xFF", 4U);
+	//Either case, whitespace anywhere, and a byte split between pieces.
+	check_decoding(__LINE__, pb_bintext_hex, "00 7F\nAb ff", 1U, "\x00\x7F\xAB\xFF", 4U);
+
+	unsigned char out[64];
+	size_t out_length = 0U;
+	CHECK(!decode(pb_bintext_hex, "0g", 0U, out, &out_length));
+	CHECK(!decode(pb_bintext_hex, "abc", 0U, out, &out_length));
+}
+
+static void test_lengths(void) {
+	//The maximums have to cover every piece size, including bytes held over from the last piece.
+	CHECK(pb_bintext_encoded_length_max(pb_bintext_base64, 1U) >= 4U);
+	CHECK(pb_bintext_encoded_length_max(pb_bintext_base64, 3000U) >= 4004U);
+	CHECK(pb_bintext_encoded_length_max(pb_bintext_hex, 10U) >= 20U);
+	CHECK(pb_bintext_decoded_length_max(pb_bintext_base64, 4U) >= 3U);
+	CHECK(pb_bintext_decoded_length_max(pb_bintext_hex, 4U) >= 2U);
+}
+
+int main(void) {
+	test_names();
+	test_base64();
+	test_hex();
+	test_lengths();
+	return test_summary("bintext");
+}
@@ -0,0 +1,154 @@
+#include <ApplicationServices/ApplicationServices.h>
+#include "test.h"
+#include "../libpb.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+//A provider that doesn't answer until it's told to, like an app that's hung.
+static pthread_mutex_t provider_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t provider_released = PTHREAD_COND_INITIALIZER;
+static bool provider_answers;
+static unsigned long num_asked, num_answered;
+
+static OSStatus hung_copier(PasteboardRef pasteboard, PasteboardItemID item, CFStringRef type, CFDataRef *outData) {
+	pthread_mutex_lock(&provider_lock);
+	++num_asked;
+	while(!provider_answers)
+		pthread_cond_wait(&provider_released, &provider_lock);
+	++num_answered;
+	pthread_mutex_unlock(&provider_lock);
+	*outData = CFDataCreate(kCFAllocatorDefault, (const UInt8 *)"late", 4);
+	return noErr;
+}
+static OSStatus prompt_copier(PasteboardRef pasteboard, PasteboardItemID item, CFStringRef type, CFDataRef *outData) {
+	*outData = CFDataCreate(kCFAllocatorDefault, (const UInt8 *)"prompt", 6);
+	return noErr;
+}
+
+static void set_provider_answers(bool answers) {
+	pthread_mutex_lock(&provider_lock);
+	provider_answers = answers;
+	pthread_cond_broadcast(&provider_released);
+	pthread_mutex_unlock(&provider_lock);
+}
+//Waits (for up to a few seconds) until the provider has answered that many times in all.
+static bool wait_for_answers(unsigned long count) {
+	for(unsigned tries = 0U; tries < 300U; ++tries) {
+		pthread_mutex_lock(&provider_lock);
+		bool answered = (num_answered >= count);
+		pthread_mutex_unlock(&provider_lock);
+		if(answered)
+			return true;
+		usleep(10000U);
+	}
+	return false;
+}
+
+static OSStatus fetch(pb_pasteboard *pasteboard, const char *expected) {
+	CFDataRef data = NULL;
+	OSStatus err = pb_copy_flavor_data(pasteboard, pb_sequential_item_ID(0), CFSTR("public.utf8-plain-text"), &data);
+	if(err == noErr) {
+		CHECK(data != NULL);
+		if(data) {
+			CHECK_BYTES(CFDataGetBytePtr(data), (size_t)CFDataGetLength(data), expected, strlen(expected));
+			CFRelease(data);
+		}
+	}
+	return err;
+}
+
+//Fetches that time out leave their threads waiting, but only so many of them; past that, fetches fail without asking until some of the threads are let go.
+static void test_outstanding_fetches(void) {
+	pb_pasteboard *pasteboard = NULL;
+	if(pb_pasteboard_open_unique(&pasteboard) != noErr) {
+		CHECK(pasteboard != NULL);
+		return;
+	}
+	pb_pasteboard_set_timeout(pasteboard, 50UL);
+	pb_pasteboard_set_flavor_data_copier(pasteboard, hung_copier);
+
+	set_provider_answers(false);
+	for(unsigned i = 0U; i < pb_max_outstanding_fetches; ++i)
+		CHECK(fetch(pasteboard, "") == kMPTimeoutErr);
+	CHECK(fetch(pasteboard, "") == kMPInsufficientResourcesErr);
+	pthread_mutex_lock(&provider_lock);
+	CHECK(num_asked == pb_max_outstanding_fetches);
+	pthread_mutex_unlock(&provider_lock);
+
+	//Once the provider answers, the threads finish, and fetches go through again.
+	pb_pasteboard_set_flavor_data_copier(pasteboard, prompt_copier);
+	set_provider_answers(true);
+	CHECK(wait_for_answers(pb_max_outstanding_fetches));
+	OSStatus err = kMPInsufficientResourcesErr;
+	for(unsigned tries = 0U; (err == kMPInsufficientResourcesErr) && (tries < 300U); ++tries) {
+		if((err = fetch(pasteboard, "prompt")) == kMPInsufficientResourcesErr)
+			usleep(10000U);
+	}
+	CHECK(err == noErr);
+
+	//Without a timeout, the copier is called directly.
+	pb_pasteboard_set_timeout(pasteboard, 0UL);
+	CHECK(fetch(pasteboard, "prompt") == noErr);
+
+	//A handle can be closed while fetches from it are still waiting; they clean up when they finish.
+	pb_pasteboard_set_timeout(pasteboard, 50UL);
+	pb_pasteboard_set_flavor_data_copier(pasteboard, hung_copier);
+	set_provider_answers(false);
+	CHECK(fetch(pasteboard, "") == kMPTimeoutErr);
+	CHECK(fetch(pasteboard, "") == kMPTimeoutErr);
+	pb_pasteboard_close(pasteboard);
+	set_provider_answers(true);
+	CHECK(wait_for_answers(pb_max_outstanding_fetches + 2U));
+	//Give the threads time to let go of the fetches after answering.
+	usleep(100000U);
+}
+
+//A provider that has every flavor but one.
+static OSStatus failing_copier(PasteboardRef pasteboard, PasteboardItemID item, CFStringRef type, CFDataRef *outData) {
+	if(UTTypeEqual(type, kUTTypeUTF16PlainText))
+		return badPasteboardFlavorErr;
+	return PasteboardCopyItemFlavorData(pasteboard, item, type, outData);
+}
+static unsigned long num_skipped;
+static bool skip_flavor(void *context, size_t item_index, const char *type, pb_status status) {
+	++num_skipped;
+	CHECK((item_index == 1U) && (strcmp(type, "public.utf16-plain-text") == 0) && (status == badPasteboardFlavorErr));
+	return true;
+}
+
+//A flavor that can't be read stops anything that would put the item back without it, unless the caller says to leave it out.
+static void test_unavailable_flavors(void) {
+	pb_pasteboard *pasteboard = NULL;
+	if(pb_pasteboard_open_unique(&pasteboard) != noErr) {
+		CHECK(pasteboard != NULL);
+		return;
+	}
+	CHECK(pb_pasteboard_copy(pasteboard, NULL, "text", 4U, /*options*/ 0U) == noErr);
+	pb_pasteboard_set_flavor_data_copier(pasteboard, failing_copier);
+
+	struct pb_item item;
+	CHECK(pb_fetch_item(pasteboard, 1, /*types*/ NULL, /*numTypes*/ 0, &item) == badPasteboardFlavorErr);
+	CHECK((item.numFlavors == 0) && (item.flavors == NULL));
+	size_t count = 0U;
+	CHECK(pb_pasteboard_copy(pasteboard, NULL, "more", 4U, pb_copy_append) == badPasteboardFlavorErr);
+	CHECK((pb_pasteboard_count(pasteboard, &count) == noErr) && (count == 1U));
+
+	pb_pasteboard_set_unavailable_flavor_callback(pasteboard, skip_flavor, /*context*/ NULL);
+	CHECK(pb_fetch_item(pasteboard, 1, /*types*/ NULL, /*numTypes*/ 0, &item) == noErr);
+	CHECK(item.numFlavors > 0);
+	for(CFIndex i = 0; i < item.numFlavors; ++i)
+		CHECK(!UTTypeEqual(item.flavors[i].type, kUTTypeUTF16PlainText));
+	pb_release_item(&item);
+	CHECK(pb_pasteboard_copy(pasteboard, NULL, "more", 4U, pb_copy_append) == noErr);
+	CHECK((pb_pasteboard_count(pasteboard, &count) == noErr) && (count == 2U));
+	CHECK(num_skipped == 2U);
+
+	pb_pasteboard_close(pasteboard);
+}
+
+int main(void) {
+	test_outstanding_fetches();
+	test_unavailable_flavors();
+	return test_summary("libpb");
+}
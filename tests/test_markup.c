@@ -0,0 +1,108 @@
+#include "test.h"
+#include "../markup.h"
+
+static void check_extraction(int line, enum pb_markup_format format, const char *document, const char *expected) {
+	struct test_output output = { NULL, 0U, 0U, 0UL };
+	++tests_run;
+	if(!pb_extract_markup_text(format, document, strlen(document), test_output_write, &output)) {
+		++tests_failed;
+		fprintf(stderr, "%s:%d: extraction failed\n", __FILE__, line);
+	} else
+		check_bytes(__FILE__, line, "text", output.bytes, output.length, expected, strlen(expected));
+	free(output.bytes);
+}
+#define CHECK_RTF(document, expected) check_extraction(__LINE__, pb_markup_rtf, (document), (expected))
+#define CHECK_HTML(document, expected) check_extraction(__LINE__, pb_markup_html, (document), (expected))
+
+static void test_rtf(void) {
+	CHECK_RTF("{\\rtf1\\ansi Hello, world.}", "Hello, world.");
+	CHECK_RTF("{\\rtf1\\ansi one\\par two\\line three\\tab four}", "one\ntwo\nthree\tfour");
+	//Escaped specials, and a space after a control word belongs to the word.
+	CHECK_RTF("{\\rtf1 a\\{b\\}c\\\\d}", "a{b}c\\d");
+	CHECK_RTF("{\\rtf1 {\\b bold} plain}", "bold plain");
+
+	//Character control words, from both ends of the table.
+	CHECK_RTF("{\\rtf1 \\bullet\\emdash\\endash\\ldblquote x\\rdblquote\\zwnj}", "\xE2\x80\xA2\xE2\x80\x94\xE2\x80\x93\xE2\x80\x9Cx\xE2\x80\x9D\xE2\x80\x8C");
+	//\'hh is in the document's code page: Windows-1252 by default, MacRoman with \mac.
+	CHECK_RTF("{\\rtf1\\ansi\\ansicpg1252 caf\\'e9 \\'93hi\\'94}", "caf\xC3\xA9 \xE2\x80\x9Chi\xE2\x80\x9D");
+	CHECK_RTF("{\\rtf1\\mac caf\\'8e}", "caf\xC3\xA9");
+	//\uN is followed by a fallback that readers who know Unicode skip: one character, or \ucN of them. Negative N is how RTF writes code units above 32767.
+	CHECK_RTF("{\\rtf1 \\u233?t\\u233?}", "\xC3\xA9t\xC3\xA9");
+	CHECK_RTF("{\\rtf1\\uc2 \\u8212\\'97\\'97 done}", "\xE2\x80\x94 done");
+	CHECK_RTF("{\\rtf1 \\u-10179?\\u-8704?}", "\xF0\x9F\x98\x80");
+
+	//Groups that aren't text are skipped, however deeply nested.
+	CHECK_RTF("{\\rtf1{\\fonttbl{\\f0 Helvetica;}}{\\colortbl;\\red0\\green0\\blue0;}{\\*\\generator Foo;}text}", "text");
+	CHECK_RTF("{\\rtf1 a{\\pict\\pngblip 89504e47}b}", "ab");
+	CHECK_RTF("{\\rtf1 {\\field{\\*\\fldinst HYPERLINK \"x\"}{\\fldrslt link}}}", "link");
+
+	//A document that ends early gives what text it had.
+	CHECK_RTF("{\\rtf1 cut off", "cut off");
+	CHECK_RTF("{\\rtf1 trailing\\", "trailing");
+}
+
+static void test_html(void) {
+	CHECK_HTML("Hello, <b>world</b>.", "Hello, world.");
+	//Whitespace collapses outside <pre>, and blocks end in line breaks.
+	CHECK_HTML("<p>Hello, <b>world</b>.</p>", "Hello, world.\n");
+	CHECK_HTML("<div>one\n   two</div><div>three</div>", "one two\nthree\n");
+	CHECK_HTML("<pre>a\n  b</pre>", "a\n  b\n");
+	CHECK_HTML("a<br>b", "a\nb");
+	CHECK_HTML("<table><tr><td>1</td><td>2</td></tr></table>", "1\t2\n");
+	CHECK_HTML("<script>var x = '<p>';</script><style>p { }</style>seen", "seen");
+	CHECK_HTML("<!-- <p>hidden</p> -->shown", "shown");
+
+	//Character references: named (from both ends of the table and its middle), decimal, and hex.
+	CHECK_HTML("&AElig;&amp;&lt;&gt;&quot;&nbsp;&zwnj;", "\xC3\x86&<>\"\xC2\xA0\xE2\x80\x8C");
+	CHECK_HTML("&#233;&#xE9;&#X1F600;", "\xC3\xA9\xC3\xA9\xF0\x9F\x98\x80");
+	//Unknown references, and ampersands that aren't references at all, are left as they are.
+	CHECK_HTML("&bogus; AT&T &", "&bogus; AT&T &");
+
+	//Bytes that aren't UTF-8 are read as Windows-1252.
+	CHECK_HTML("caf\xE9 \x93hi\x94", "caf\xC3\xA9 \xE2\x80\x9Chi\xE2\x80\x9D");
+	CHECK_HTML("caf\xC3\xA9", "caf\xC3\xA9");
+}
+
+//Documents bigger than the extractor's output buffer come out whole, in several pieces.
+static void test_large(void) {
+	enum { repetitions = 50000 };
+	static const char word[] = "<i>word</i> ";
+	size_t length = (sizeof(word) - 1U) * repetitions;
+	char *document = malloc(length + 1U), *expected = malloc(5U * repetitions);
+	if(!(document && expected)) {
+		CHECK(document && expected);
+		free(document);
+		free(expected);
+		return;
+	}
+	for(size_t i = 0U; i < repetitions; ++i) {
+		memcpy(document + i * (sizeof(word) - 1U), word, sizeof(word) - 1U);
+		memcpy(expected + i * 5U, "word ", 5U);
+	}
+	document[length] = '\0';
+
+	struct test_output output = { NULL, 0U, 0U, 0UL };
+	CHECK(pb_extract_markup_text(pb_markup_html, document, length, test_output_write, &output));
+	//Trailing whitespace collapses like any other.
+	CHECK((output.length >= 5U * repetitions - 1U) && (memcmp(output.bytes, expected, 5U * repetitions - 1U) == 0));
+	CHECK(output.num_pieces > 1U);
+	free(output.bytes);
+	free(document);
+	free(expected);
+}
+
+static bool refuse_output(void *context, const void *bytes, size_t length) {
+	return false;
+}
+static void test_writer_stops(void) {
+	CHECK(!pb_extract_markup_text(pb_markup_html, "<p>text</p>", 11U, refuse_output, NULL));
+	CHECK(!pb_extract_markup_text(pb_markup_rtf, "{\\rtf1 text}", 12U, refuse_output, NULL));
+}
+
+int main(void) {
+	test_rtf();
+	test_html();
+	test_large();
+	test_writer_stops();
+	return test_summary("markup");
+}
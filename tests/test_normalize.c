@@ -0,0 +1,65 @@
+#include "test.h"
+#include "../normalize.h"
+
+static void check_normalization(int line, enum pb_normalization_form form, const char *text, size_t length, const char *expected, size_t expected_length) {
+	struct test_output output = { NULL, 0U, 0U, 0UL };
+	++tests_run;
+	if(!pb_normalize_utf8(form, text, length, test_output_write, &output)) {
+		++tests_failed;
+		fprintf(stderr, "%s:%d: normalizing to %s failed\n", __FILE__, line, pb_normalization_form_name(form));
+	} else
+		check_bytes(__FILE__, line, "output", output.bytes, output.length, expected, expected_length);
+	free(output.bytes);
+}
+#define CHECK_NORMALIZATION(form, text, expected) check_normalization(__LINE__, (form), (text), sizeof(text) - 1U, (expected), sizeof(expected) - 1U)
+
+static void test_names(void) {
+	enum pb_normalization_form form = pb_normalization_none;
+	CHECK(pb_normalization_form_for_name("NFC", &form) && (form == pb_normalization_nfc));
+	CHECK(pb_normalization_form_for_name("nfkc", &form) && (form == pb_normalization_nfkc));
+	CHECK(!pb_normalization_form_for_name("nfkd", &form));
+}
+
+static void test_forms(void) {
+	//"é" precomposed, and as e plus a combining acute.
+	CHECK_NORMALIZATION(pb_normalization_nfc, "caf" "e\xCC\x81", "caf\xC3\xA9");
+	CHECK_NORMALIZATION(pb_normalization_nfd, "caf\xC3\xA9", "caf" "e\xCC\x81");
+	CHECK_NORMALIZATION(pb_normalization_nfc, "caf\xC3\xA9", "caf\xC3\xA9");
+	//Compatibility forms fold only under NFKC: the "fi" ligature and a full-width A.
+	CHECK_NORMALIZATION(pb_normalization_nfc, "\xEF\xAC\x81\xEF\xBC\xA1", "\xEF\xAC\x81\xEF\xBC\xA1");
+	CHECK_NORMALIZATION(pb_normalization_nfkc, "\xEF\xAC\x81\xEF\xBC\xA1", "fiA");
+	//Combining marks are put in canonical order.
+	CHECK_NORMALIZATION(pb_normalization_nfd, "a\xCC\x81\xCC\xA3", "a\xCC\xA3\xCC\x81");
+	CHECK_NORMALIZATION(pb_normalization_nfc, "", "");
+
+	struct test_output output = { NULL, 0U, 0U, 0UL };
+	CHECK(!pb_normalize_utf8(pb_normalization_nfc, "bad \xC3", 5U, test_output_write, &output));
+	free(output.bytes);
+}
+
+//Text that's already normalized is passed through from the input; long runs that aren't are done in pieces. Either way, the result is the same as normalizing the whole.
+static void test_large(void) {
+	enum { repetitions = 3000 };
+	static const char decomposed[] = "e\xCC\x81 plain ", composed[] = "\xC3\xA9 plain ";
+	char *text = malloc((sizeof(decomposed) - 1U) * repetitions), *expected = malloc((sizeof(composed) - 1U) * repetitions);
+	if(!(text && expected)) {
+		CHECK(text && expected);
+		free(text);
+		free(expected);
+		return;
+	}
+	for(size_t i = 0U; i < repetitions; ++i) {
+		memcpy(text + i * (sizeof(decomposed) - 1U), decomposed, sizeof(decomposed) - 1U);
+		memcpy(expected + i * (sizeof(composed) - 1U), composed, sizeof(composed) - 1U);
+	}
+	check_normalization(__LINE__, pb_normalization_nfc, text, (sizeof(decomposed) - 1U) * repetitions, expected, (sizeof(composed) - 1U) * repetitions);
+	free(text);
+	free(expected);
+}
+
+int main(void) {
+	test_names();
+	test_forms();
+	test_large();
+	return test_summary("normalize");
+}
@@ -0,0 +1,79 @@
+#include "test.h"
+#include "../pastecache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+//Serves the slot into a temporary file and reads back what was written.
+static enum pb_paste_cache_result serve(const char *directory, const char *slot, const unsigned char *digest, uint64_t source_length, struct test_output *output) {
+	char path[] = "/tmp/pb-test-output.XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0)
+		return pb_paste_cache_write_failed;
+	unlink(path);
+	enum pb_paste_cache_result result = pb_paste_cache_serve(directory, slot, digest, source_length, fd);
+	test_output_reset(output);
+	char buf[4096];
+	ssize_t amt_read;
+	lseek(fd, 0, SEEK_SET);
+	while((amt_read = read(fd, buf, sizeof(buf))) > 0)
+		test_output_write(output, buf, (size_t)amt_read);
+	close(fd);
+	return result;
+}
+
+static void test_round_trip(const char *directory) {
+	unsigned char digest[pb_paste_cache_digest_length], other_digest[pb_paste_cache_digest_length];
+	pb_paste_cache_digest_source("public.utf8-plain-text", "source", 6U, digest);
+	pb_paste_cache_digest_source("public.utf8-plain-text", "changed", 7U, other_digest);
+	CHECK(memcmp(digest, other_digest, sizeof(digest)) != 0);
+
+	struct test_output output = { NULL, 0U, 0U, 0UL };
+	CHECK(serve(directory, "slot", digest, 6U, &output) == pb_paste_cache_miss);
+
+	//Written in pieces, served whole.
+	struct pb_paste_cache_entry entry;
+	CHECK(pb_paste_cache_begin(directory, "slot", digest, 6U, &entry));
+	CHECK(pb_paste_cache_append(&entry, "conv", 4U));
+	CHECK(pb_paste_cache_append(&entry, "erted", 5U));
+	CHECK(pb_paste_cache_commit(&entry));
+	CHECK(serve(directory, "slot", digest, 6U, &output) == pb_paste_cache_hit);
+	CHECK_BYTES(output.bytes, output.length, "converted", 9U);
+
+	//Other slots are separate.
+	CHECK(serve(directory, "other slot", digest, 6U, &output) == pb_paste_cache_miss);
+
+	//Once the source changes, the entry is stale, and gone for good.
+	CHECK(serve(directory, "slot", other_digest, 7U, &output) == pb_paste_cache_miss);
+	CHECK(serve(directory, "slot", digest, 6U, &output) == pb_paste_cache_miss);
+
+	//An empty entry is still a hit.
+	CHECK(pb_paste_cache_begin(directory, "empty", digest, 6U, &entry));
+	CHECK(pb_paste_cache_commit(&entry));
+	CHECK(serve(directory, "empty", digest, 6U, &output) == pb_paste_cache_hit);
+	CHECK(output.length == 0U);
+
+	//An abandoned entry never shows up.
+	CHECK(pb_paste_cache_begin(directory, "abandoned", digest, 6U, &entry));
+	CHECK(pb_paste_cache_append(&entry, "half", 4U));
+	pb_paste_cache_abandon(&entry);
+	CHECK(serve(directory, "abandoned", digest, 6U, &output) == pb_paste_cache_miss);
+
+	free(output.bytes);
+}
+
+int main(void) {
+	char directory[] = "/tmp/pb-test-cache.XXXXXX";
+	if(!mkdtemp(directory)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	test_round_trip(directory);
+
+	//Leave nothing behind.
+	char command[sizeof(directory) + 16U];
+	snprintf(command, sizeof(command), "rm -rf '%s'", directory);
+	if(system(command) != 0)
+		fprintf(stderr, "could not remove %s\n", directory);
+	return test_summary("pastecache");
+}
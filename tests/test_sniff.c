@@ -0,0 +1,78 @@
+#include "test.h"
+#include "../sniff.h"
+
+static void check_sniff(int line, const void *bytes, size_t length, const char *expected) {
+	const char *type = pb_sniff_type(bytes, length);
+	++tests_run;
+	if((type == expected) || (type && expected && (strcmp(type, expected) == 0)))
+		return;
+	++tests_failed;
+	fprintf(stderr, "%s:%d: sniffed %s, expected %s\n", __FILE__, line, type ? type : "nothing", expected ? expected : "nothing");
+}
+#define CHECK_SNIFF(bytes, expected) check_sniff(__LINE__, (bytes), sizeof(bytes) - 1U, (expected))
+
+static void test_formats(void) {
+	CHECK_SNIFF("\x89PNG\r\n\x1A\n\0\0\0\rIHDR", "public.png");
+	CHECK_SNIFF("\xFF\xD8\xFF\xE0\0\x10JFIF", "public.jpeg");
+	CHECK_SNIFF("GIF89a\x01\0\x01\0", "com.compuserve.gif");
+	CHECK_SNIFF("MM\0*\0\0\0\x08", "public.tiff");
+	CHECK_SNIFF("%PDF-1.4\n", "com.adobe.pdf");
+	CHECK_SNIFF("{\\rtf1\\ansi hello}", "public.rtf");
+	CHECK_SNIFF("bplist00\xD1\x01\x02", "com.apple.binary-property-list");
+	CHECK_SNIFF("PK\x03\x04\x14\0\0\0", "public.zip-archive");
+	CHECK_SNIFF("\x1F\x8B\x08\0\0\0\0\0", "org.gnu.gnu-zip-archive");
+	CHECK_SNIFF("RIFF\x24\0\0\0WAVEfmt ", "com.microsoft.waveform-audio");
+	CHECK_SNIFF("RIFF\x24\0\0\0WEBPVP8 ", "org.webmproject.webp");
+	//A BMP's file header is followed by a DIB header of a known size.
+	CHECK_SNIFF("BM\x3A\0\0\0\0\0\0\0\x36\0\0\0\x28\0\0\0", "com.microsoft.bmp");
+	CHECK_SNIFF("BMW car\nBMX bike\n", NULL);
+}
+
+static void test_markup(void) {
+	//Markup may start after a BOM and whitespace, in any case.
+	CHECK_SNIFF("\xEF\xBB\xBF  \n<!doctype HTML><html>", "public.html");
+	CHECK_SNIFF("<HTML><body>hi</body></HTML>", "public.html");
+	CHECK_SNIFF("<?xml version=\"1.0\"?><a/>", "public.xml");
+	CHECK_SNIFF("<b>not a document</b>", NULL);
+}
+
+static void test_weak_signatures(void) {
+	//Text that happens to start with a short magic number isn't taken for the format.
+	CHECK_SNIFF("ID3 tags are how MP3s carry titles\n", NULL);
+	CHECK_SNIFF("ID3\x03\0\0\0\0\x01\x7F", "public.mp3");
+	CHECK_SNIFF("BZh is how bzip2 files start\n", NULL);
+	CHECK_SNIFF("BZh91AY&SY\0\0", "public.bzip2-archive");
+	CHECK_SNIFF("8BPS is Photoshop's signature\n", NULL);
+	CHECK_SNIFF("8BPS\0\x01\0\0\0\0\0\0\0\x03", "com.adobe.photoshop-image");
+	CHECK_SNIFF("icns are Mac icons\n", NULL);
+	CHECK_SNIFF("icns\0\0\0\x10ic08\0\0\0\x08", "com.apple.icns");
+
+	//ISO base media files are recognized by their brand, not just the ftyp box.
+	CHECK_SNIFF("\0\0\0\x18" "ftypisom\0\0\0\0", "public.mpeg-4");
+	CHECK_SNIFF("\0\0\0\x18" "ftypheic\0\0\0\0", "public.heic");
+	CHECK_SNIFF("\0\0\0\x18" "ftypavif\0\0\0\0", "public.avif");
+	CHECK_SNIFF("\0\0\0\x18" "ftypqt  \0\0\0\0", "com.apple.quicktime-movie");
+	CHECK_SNIFF("\0\0\0\x18" "ftypcrx \0\0\0\0", NULL);
+}
+
+static void test_limits(void) {
+	CHECK(pb_sniff_type("", 0U) == NULL);
+	CHECK(pb_sniff_type("\x89PNG", 4U) == NULL);
+
+	//Nothing past pb_sniff_length is looked at, so markup that starts after that much whitespace isn't found.
+	char *late = malloc(pb_sniff_length + 16U);
+	if(late) {
+		memset(late, ' ', pb_sniff_length);
+		memcpy(late + pb_sniff_length, "<html>", 6U);
+		CHECK(pb_sniff_type(late, pb_sniff_length + 6U) == NULL);
+		free(late);
+	}
+}
+
+int main(void) {
+	test_formats();
+	test_markup();
+	test_weak_signatures();
+	test_limits();
+	return test_summary("sniff");
+}
@@ -0,0 +1,205 @@
+#include "test.h"
+#include "../transcode.h"
+
+//"Aé€😀": one character each of one, two, three, and four bytes of UTF-8 (and a surrogate pair in UTF-16).
+static const char sample_utf8[] = "A\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80";
+static const char sample_utf16le[] = "A\0\xE9\0\xAC\x20\x3D\xD8\x00\xDE";
+static const char sample_utf16be[] = "\0A\0\xE9\x20\xAC\xD8\x3D\xDE\x00";
+static const char sample_utf32be[] = "\0\0\0A\0\0\0\xE9\0\0\x20\xAC\0\x01\xF6\x00";
+
+static void check_transcode(int line, enum pb_text_encoding from, enum pb_text_encoding to, const void *in, size_t in_length, const void *expected, size_t expected_length) {
+	void *out = NULL;
+	size_t out_length = 0U;
+	bool converted = pb_transcode(from, to, in, in_length, /*leading_space*/ 0U, &out, &out_length);
+	++tests_run;
+	if(!converted) {
+		++tests_failed;
+		fprintf(stderr, "%s:%d: %s to %s failed\n", __FILE__, line, pb_text_encoding_name(from), pb_text_encoding_name(to));
+		return;
+	}
+	check_bytes(__FILE__, line, "out", out, out_length, expected, expected_length);
+	free(out);
+}
+static bool transcodes(enum pb_text_encoding from, enum pb_text_encoding to, const void *in, size_t in_length) {
+	void *out = NULL;
+	size_t out_length = 0U;
+	bool converted = pb_transcode(from, to, in, in_length, /*leading_space*/ 0U, &out, &out_length);
+	free(out);
+	return converted;
+}
+
+static void test_names(void) {
+	enum pb_text_encoding encoding = pb_text_encoding_count;
+	CHECK(pb_text_encoding_for_name("UTF-8", &encoding) && (encoding == pb_text_encoding_utf8));
+	CHECK(pb_text_encoding_for_name("Windows-1252", &encoding) && (encoding == pb_text_encoding_cp1252));
+	CHECK(pb_text_encoding_for_name("macintosh", &encoding) && (encoding == pb_text_encoding_macroman));
+	CHECK(!pb_text_encoding_for_name("ebcdic", &encoding));
+	for(unsigned i = 0U; i < pb_text_encoding_count; ++i)
+		CHECK(pb_text_encoding_for_name(pb_text_encoding_name(i), &encoding) && (encoding == i));
+}
+
+static void test_unicode(void) {
+	size_t length8 = sizeof(sample_utf8) - 1U, length16 = sizeof(sample_utf16le) - 1U;
+	check_transcode(__LINE__, pb_text_encoding_utf8, pb_text_encoding_utf16le, sample_utf8, length8, sample_utf16le, length16);
+	check_transcode(__LINE__, pb_text_encoding_utf8, pb_text_encoding_utf16be, sample_utf8, length8, sample_utf16be, length16);
+	check_transcode(__LINE__, pb_text_encoding_utf8, pb_text_encoding_utf32be, sample_utf8, length8, sample_utf32be, sizeof(sample_utf32be) - 1U);
+	check_transcode(__LINE__, pb_text_encoding_utf16le, pb_text_encoding_utf8, sample_utf16le, length16, sample_utf8, length8);
+	check_transcode(__LINE__, pb_text_encoding_utf16be, pb_text_encoding_utf16le, sample_utf16be, length16, sample_utf16le, length16);
+	check_transcode(__LINE__, pb_text_encoding_utf32be, pb_text_encoding_utf8, sample_utf32be, sizeof(sample_utf32be) - 1U, sample_utf8, length8);
+	check_transcode(__LINE__, pb_text_encoding_utf8, pb_text_encoding_utf8, "", 0U, "", 0U);
+
+	//Malformed input of every kind is refused rather than passed through.
+	CHECK(!transcodes(pb_text_encoding_utf8, pb_text_encoding_utf16le, "\xC0\xAF", 2U));         //Overlong
+	CHECK(!transcodes(pb_text_encoding_utf8, pb_text_encoding_utf16le, "\xED\xA0\x80", 3U));     //Encoded surrogate
+	CHECK(!transcodes(pb_text_encoding_utf8, pb_text_encoding_utf16le, "ab\xE2\x82", 4U));       //Cut off
+	CHECK(!transcodes(pb_text_encoding_utf8, pb_text_encoding_utf16le, "\xF4\x90\x80\x80", 4U)); //Past U+10FFFF
+	CHECK(!transcodes(pb_text_encoding_utf16le, pb_text_encoding_utf8, "A\0B", 3U));             //Odd length
+	CHECK(!transcodes(pb_text_encoding_utf16le, pb_text_encoding_utf8, "\x3D\xD8" "A\0", 4U));   //Lone high surrogate
+	CHECK(!transcodes(pb_text_encoding_utf16le, pb_text_encoding_utf8, "\x00\xDE", 2U));         //Lone low surrogate
+}
+
+static void test_single_byte(void) {
+	check_transcode(__LINE__, pb_text_encoding_latin1, pb_text_encoding_utf8, "caf\xE9", 4U, "caf\xC3\xA9", 5U);
+	check_transcode(__LINE__, pb_text_encoding_cp1252, pb_text_encoding_utf8, "\x93hi\x94 \x80", 6U, "\xE2\x80\x9Chi\xE2\x80\x9D \xE2\x82\xAC", 12U);
+	check_transcode(__LINE__, pb_text_encoding_macroman, pb_text_encoding_utf8, "caf\x8E", 4U, "caf\xC3\xA9", 5U);
+	check_transcode(__LINE__, pb_text_encoding_utf8, pb_text_encoding_macroman, "caf\xC3\xA9", 5U, "caf\x8E", 4U);
+	check_transcode(__LINE__, pb_text_encoding_utf8, pb_text_encoding_cp1252, "\xE2\x82\xAC", 3U, "\x80", 1U);
+	//Characters the destination doesn't have are refused, not replaced.
+	CHECK(!transcodes(pb_text_encoding_utf8, pb_text_encoding_latin1, "\xE2\x82\xAC", 3U));
+	CHECK(!transcodes(pb_text_encoding_utf8, pb_text_encoding_macroman, "\xF0\x9F\x98\x80", 4U));
+
+	CHECK(pb_single_byte_code_point(pb_text_encoding_macroman, 0xD5U) == 0x2019U);
+	CHECK(pb_single_byte_code_point(pb_text_encoding_cp1252, 0x80U) == 0x20ACU);
+	CHECK(pb_single_byte_code_point(pb_text_encoding_latin1, 0x80U) == 0x80U);
+}
+
+static void test_leading_space(void) {
+	void *out = NULL;
+	size_t out_length = 0U;
+	CHECK(pb_transcode(pb_text_encoding_utf8, pb_text_encoding_utf16le, "hi", 2U, /*leading_space*/ 2U, &out, &out_length));
+	CHECK(out_length == 4U);
+	if(out)
+		CHECK_BYTES((unsigned char *)out + 2, out_length, "h\0i\0", 4U);
+	free(out);
+}
+
+//Big enough to be split across threads, with characters of every length straddling every chunk boundary.
+static void test_large(void) {
+	size_t length = pb_transcode_parallel_threshold * 3U + 7U, sample_length = sizeof(sample_utf8) - 1U;
+	char *in = malloc(length);
+	if(!in) {
+		CHECK(in != NULL);
+		return;
+	}
+	for(size_t i = 0U; i + sample_length <= length; i += sample_length)
+		memcpy(in + i, sample_utf8, sample_length);
+	length -= length % sample_length;
+
+	void *utf16 = NULL, *utf8 = NULL;
+	size_t utf16_length = 0U, utf8_length = 0U;
+	CHECK(pb_transcode(pb_text_encoding_utf8, pb_text_encoding_utf16be, in, length, /*leading_space*/ 0U, &utf16, &utf16_length));
+	CHECK(utf16_length == (length / sample_length) * (sizeof(sample_utf16be) - 1U));
+	CHECK(utf16 && pb_transcode(pb_text_encoding_utf16be, pb_text_encoding_utf8, utf16, utf16_length, /*leading_space*/ 0U, &utf8, &utf8_length));
+	CHECK((utf8_length == length) && utf8 && (memcmp(utf8, in, length) == 0));
+
+	//The streaming converter, which works a chunk at a time, produces the same bytes in bounded pieces.
+	struct test_output output = { NULL, 0U, 0U, 0UL };
+	CHECK(pb_transcode_stream(pb_text_encoding_utf8, pb_text_encoding_utf16be, in, length, test_output_write, &output));
+	CHECK((output.length == utf16_length) && utf16 && (memcmp(output.bytes, utf16, utf16_length) == 0));
+	CHECK(output.num_pieces > 1U);
+
+	//A bad byte far into the input still fails the whole conversion.
+	in[length - 2U] = '\xFF';
+	CHECK(!transcodes(pb_text_encoding_utf8, pb_text_encoding_utf16le, in, length));
+
+	free(output.bytes);
+	free(utf8);
+	free(utf16);
+	free(in);
+}
+
+static void check_detection(int line, const char *bytes, size_t length, enum pb_text_encoding expected, size_t expected_bom_length) {
+	struct pb_text_encoding_guess guess;
+	++tests_run;
+	if(!pb_detect_text_encoding(bytes, length, &guess)) {
+		++tests_failed;
+		fprintf(stderr, "%s:%d: no guess, expected %s\n", __FILE__, line, pb_text_encoding_name(expected));
+	} else if((guess.encoding != expected) || (guess.bom_length != expected_bom_length)) {
+		++tests_failed;
+		fprintf(stderr, "%s:%d: guessed %s (BOM %zu), expected %s (BOM %zu)\n", __FILE__, line, pb_text_encoding_name(guess.encoding), guess.bom_length, pb_text_encoding_name(expected), expected_bom_length);
+	}
+}
+#define CHECK_DETECTION(bytes, expected, expected_bom_length) check_detection(__LINE__, (bytes), sizeof(bytes) - 1U, (expected), (expected_bom_length))
+
+static void test_detection(void) {
+	CHECK_DETECTION("\xEF\xBB\xBFhi", pb_text_encoding_utf8, 3U);
+	CHECK_DETECTION("\xFF\xFEh\0i\0", pb_text_encoding_utf16le, 2U);
+	CHECK_DETECTION("\xFE\xFF\0h\0i", pb_text_encoding_utf16be, 2U);
+	CHECK_DETECTION("\xFF\xFE\0\0h\0\0\0", pb_text_encoding_utf32le, 4U);
+	CHECK_DETECTION("\0\0\xFE\xFF\0\0\0h", pb_text_encoding_utf32be, 4U);
+	//No BOM: UTF-16 shows itself by where its NULs fall.
+	CHECK_DETECTION("h\0e\0l\0l\0o\0", pb_text_encoding_utf16le, 0U);
+	CHECK_DETECTION("\0h\0e\0l\0l\0o", pb_text_encoding_utf16be, 0U);
+	CHECK_DETECTION("plain ASCII", pb_text_encoding_utf8, 0U);
+	CHECK_DETECTION("caf\xC3\xA9 cr\xC3\xA8me", pb_text_encoding_utf8, 0U);
+	//Single-byte encodings, told apart by whose reading of the high bytes makes sense.
+	CHECK_DETECTION("caf\x8E au lait, cr\x8Fme br\x9Bl\x8E" "e", pb_text_encoding_macroman, 0U);
+	CHECK_DETECTION("don\xD5t \xD2quote\xD3 me", pb_text_encoding_macroman, 0U);
+	CHECK_DETECTION("caf\xE9 na\xEFve", pb_text_encoding_latin1, 0U);
+	CHECK_DETECTION("I don\x92t know, it\x92s fine.", pb_text_encoding_cp1252, 0U);
+	CHECK_DETECTION("She said \x93yes\x94 \x96 then left.", pb_text_encoding_cp1252, 0U);
+	CHECK_DETECTION("Price: 5\x80", pb_text_encoding_cp1252, 0U);
+
+	//Binary data isn't text in any encoding. Without high bytes, it's valid UTF-8, but only just.
+	struct pb_text_encoding_guess guess;
+	CHECK(!pb_detect_text_encoding("\x01\x02\x03\x81\x04\x8D\x05\x06\x90\x0E", 10U, &guess));
+	CHECK(!pb_detect_text_encoding("h\0e\0l", 5U, &guess));
+	CHECK(pb_detect_text_encoding("\x01\x02\x03\x04\x05\x06", 6U, &guess) && (guess.confidence <= 50U));
+}
+
+static void check_line_endings(int line, enum pb_line_ending line_ending, enum pb_text_encoding encoding, const void *in, size_t in_length, const void *expected, size_t expected_length) {
+	void *out = NULL;
+	size_t out_length = 0U;
+	++tests_run;
+	if(!pb_convert_line_endings(line_ending, encoding, in, in_length, &out, &out_length)) {
+		++tests_failed;
+		fprintf(stderr, "%s:%d: line ending conversion failed\n", __FILE__, line);
+		return;
+	}
+	//No buffer means nothing had to change.
+	if(out)
+		check_bytes(__FILE__, line, "out", out, out_length, expected, expected_length);
+	else
+		check_bytes(__FILE__, line, "in", in, in_length, expected, expected_length);
+	free(out);
+}
+
+static void test_line_endings(void) {
+	enum pb_line_ending line_ending = pb_line_ending_keep;
+	CHECK(pb_line_ending_for_name("CRLF", &line_ending) && (line_ending == pb_line_ending_crlf));
+	CHECK(!pb_line_ending_for_name("nel", &line_ending));
+
+	check_line_endings(__LINE__, pb_line_ending_lf, pb_text_encoding_utf8, "a\r\nb\rc\nd\r", 9U, "a\nb\nc\nd\n", 8U);
+	check_line_endings(__LINE__, pb_line_ending_crlf, pb_text_encoding_utf8, "a\nb\r\nc\r", 7U, "a\r\nb\r\nc\r\n", 9U);
+	check_line_endings(__LINE__, pb_line_ending_cr, pb_text_encoding_utf8, "a\r\n\r\nb", 6U, "a\r\rb", 4U);
+	check_line_endings(__LINE__, pb_line_ending_lf, pb_text_encoding_utf16le, "a\0\r\0\n\0b\0", 8U, "a\0\n\0b\0", 6U);
+	check_line_endings(__LINE__, pb_line_ending_crlf, pb_text_encoding_utf16be, "\0a\0\n", 4U, "\0a\0\r\0\n", 6U);
+	//A code unit whose low byte is 0x0A isn't a line feed.
+	check_line_endings(__LINE__, pb_line_ending_crlf, pb_text_encoding_utf16le, "\x0A\x01", 2U, "\x0A\x01", 2U);
+
+	void *out = NULL;
+	size_t out_length = 0U;
+	CHECK(pb_convert_line_endings(pb_line_ending_lf, pb_text_encoding_utf8, "a\nb\n", 4U, &out, &out_length) && (out == NULL));
+	free(out);
+}
+
+int main(void) {
+	test_names();
+	test_unicode();
+	test_single_byte();
+	test_leading_space();
+	test_large();
+	test_detection();
+	test_line_endings();
+	return test_summary("transcode");
+}
@@ -0,0 +1,145 @@
+#include "test.h"
+#include "../transform.h"
+
+#include <errno.h>
+
+//Runs the text through the filters, fed piece_length bytes at a time (all at once if 0).
+static bool run_transform(const struct pb_transform_filter *filters, size_t num_filters, const char *text, size_t piece_length, struct test_output *output) {
+	struct pb_transform_pipeline *pipeline = pb_transform_create(filters, num_filters, test_output_write, output);
+	if(!pipeline)
+		return false;
+	size_t length = strlen(text);
+	if(!piece_length)
+		piece_length = length ? length : 1U;
+	bool succeeded = true;
+	for(size_t start = 0U; succeeded && (start < length); start += piece_length)
+		succeeded = pb_transform_feed(pipeline, text + start, (length - start < piece_length) ? (length - start) : piece_length);
+	if(succeeded)
+		succeeded = pb_transform_finish(pipeline);
+	pb_transform_destroy(pipeline);
+	return succeeded;
+}
+static void check_transform(int line, const struct pb_transform_filter *filters, size_t num_filters, const char *text, const char *expected) {
+	//Pieces of every size must give the same result as the whole text at once, wherever they split a line or a CRLF.
+	static const size_t piece_lengths[] = { 0U, 1U, 2U, 3U, 7U };
+	for(size_t i = 0U; i < sizeof(piece_lengths) / sizeof(*piece_lengths); ++i) {
+		struct test_output output = { NULL, 0U, 0U, 0UL };
+		++tests_run;
+		if(!run_transform(filters, num_filters, text, piece_lengths[i], &output)) {
+			++tests_failed;
+			fprintf(stderr, "%s:%d: transform failed (pieces of %zu)\n", __FILE__, line, piece_lengths[i]);
+		} else
+			check_bytes(__FILE__, line, "output", output.bytes, output.length, expected, strlen(expected));
+		free(output.bytes);
+	}
+}
+
+static struct pb_transform_filter filter_named(const char *name) {
+	struct pb_transform_filter filter;
+	memset(&filter, 0, sizeof(filter));
+	CHECK(pb_transform_filter_for_name(name, &filter));
+	return filter;
+}
+
+static void test_names(void) {
+	struct pb_transform_filter filter;
+	CHECK(pb_transform_filter_for_name("trim", &filter) && (filter.kind == pb_transform_trim));
+	CHECK(pb_transform_filter_for_name("Fold-Case", &filter) && (filter.kind == pb_transform_fold_case));
+	CHECK(pb_transform_filter_for_name("dedupe", &filter) && (filter.kind == pb_transform_dedupe));
+	CHECK(pb_transform_filter_for_name("sort", &filter) && (filter.kind == pb_transform_sort));
+	CHECK(!pb_transform_filter_for_name("replace", &filter));
+	CHECK(!pb_transform_filter_for_name("shuffle", &filter));
+}
+
+static void test_replacement_parsing(void) {
+	struct pb_transform_filter filter;
+	CHECK(pb_transform_parse_replacement("/foo/bar/", &filter) && (filter.kind == pb_transform_replace));
+	CHECK((filter.from_length == 3U) && (memcmp(filter.from, "foo", 3U) == 0) && (filter.to_length == 3U) && (memcmp(filter.to, "bar", 3U) == 0));
+	//Any separator, the last one optional, and an empty replacement.
+	CHECK(pb_transform_parse_replacement("|a/b|", &filter) && (filter.from_length == 3U) && (filter.to_length == 0U));
+	CHECK(pb_transform_parse_replacement("/x/y", &filter) && (filter.to_length == 1U));
+	CHECK(!pb_transform_parse_replacement("//y/", &filter));
+	CHECK(!pb_transform_parse_replacement("", &filter));
+	CHECK(!pb_transform_parse_replacement("/a\nb/c/", &filter));
+}
+
+static void test_filters(void) {
+	struct pb_transform_filter trim = filter_named("trim"), dedupe = filter_named("dedupe"), sort = filter_named("sort");
+	check_transform(__LINE__, &trim, 1U, "  a \n\tb\t\n c\n", "a\nb\nc\n");
+	check_transform(__LINE__, &dedupe, 1U, "b\na\nb\na\nc\n", "b\na\nc\n");
+	check_transform(__LINE__, &sort, 1U, "pear\napple\nBanana\n", "Banana\napple\npear\n");
+
+	struct pb_transform_filter replace;
+	CHECK(pb_transform_parse_replacement("/aa/b/", &replace));
+	//Replacements don't overlap, and what they put in isn't searched again.
+	check_transform(__LINE__, &replace, 1U, "aaa aaaa\n", "ba bb\n");
+
+	//Matches at either end, ones that start with a false start, and a partial match cut off by the end of the line.
+	check_transform(__LINE__, &replace, 1U, "aab\nbaa\nabaab\nba\n", "bb\nbb\nabbb\nba\n");
+
+	//Folding is full Unicode case folding, not just ASCII.
+	struct pb_transform_filter fold_dedupe[] = { filter_named("fold-case"), dedupe };
+	check_transform(__LINE__, fold_dedupe, 2U, "\xC3\x89" "cole\n\xC3\xA9" "COLE\nStra\xC3\x9F" "e\n", "\xC3\xA9" "cole\nstrasse\n");
+
+	//In order: trimming first makes the padded lines duplicates, and sorting last orders what's left.
+	struct pb_transform_filter chain[] = { trim, dedupe, sort };
+	check_transform(__LINE__, chain, 3U, "b\n  a\nb \na\n", "a\nb\n");
+}
+
+//fold-case can't fold what isn't UTF-8, and says so.
+static void test_malformed(void) {
+	struct pb_transform_filter fold = filter_named("fold-case");
+	struct test_output output = { NULL, 0U, 0U, 0UL };
+	errno = 0;
+	CHECK(!run_transform(&fold, 1U, "ok\nbad \xC3\n", 0U, &output));
+	CHECK(errno == EILSEQ);
+	free(output.bytes);
+}
+
+static void test_lines(void) {
+	struct pb_transform_filter sort = filter_named("sort");
+	//CRLF in, CRLF out; a final line without a line ending stays without one.
+	check_transform(__LINE__, &sort, 1U, "b\r\na\r\n", "a\r\nb\r\n");
+	check_transform(__LINE__, &sort, 1U, "b\na", "a\nb");
+	check_transform(__LINE__, &sort, 1U, "", "");
+	check_transform(__LINE__, &sort, 1U, "\n\n", "\n\n");
+	//No filters at all passes the text through.
+	check_transform(__LINE__, NULL, 0U, "as\r\nis", "as\r\nis");
+}
+
+//More text than the output buffer holds, and one line longer than it.
+static void test_large(void) {
+	enum { num_lines = 40000 };
+	size_t long_line_length = 200000U;
+	char *text = malloc(num_lines * 8U + long_line_length + 2U);
+	if(!text) {
+		CHECK(text != NULL);
+		return;
+	}
+	char *p = text;
+	for(unsigned i = 0U; i < num_lines; ++i)
+		p += sprintf(p, "%07u\n", (num_lines - 1U - i) / 2U);
+	memset(p, 'z', long_line_length);
+	p[long_line_length] = '\n';
+	p[long_line_length + 1U] = '\0';
+
+	struct pb_transform_filter chain[] = { filter_named("dedupe"), filter_named("sort") };
+	struct test_output output = { NULL, 0U, 0U, 0UL };
+	CHECK(run_transform(chain, 2U, text, 4096U, &output));
+	CHECK(output.length == (num_lines / 2U) * 8U + long_line_length + 1U);
+	CHECK(output.num_pieces > 1U);
+	if(output.length >= 16U)
+		CHECK(memcmp(output.bytes, "0000000\n0000001\n", 16U) == 0);
+	free(output.bytes);
+	free(text);
+}
+
+int main(void) {
+	test_names();
+	test_replacement_parsing();
+	test_filters();
+	test_malformed();
+	test_lines();
+	test_large();
+	return test_summary("transform");
+}
@@ -0,0 +1,757 @@
+#include "transcode.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <dispatch/dispatch.h>
+#if defined(__SSE2__)
+#	include <emmintrin.h>
+#endif
+
+#pragma mark Code pages
+
+//Mac OS Roman, per Apple's ROMAN.TXT (with the euro sign at 0xDB). The lower half is ASCII.
+#define PB_MACROMAN_UPPER_HALF(X) \
+	X(0x80, 0x00C4) X(0x81, 0x00C5) X(0x82, 0x00C7) X(0x83, 0x00C9) X(0x84, 0x00D1) X(0x85, 0x00D6) X(0x86, 0x00DC) X(0x87, 0x00E1) \
+	X(0x88, 0x00E0) X(0x89, 0x00E2) X(0x8A, 0x00E4) X(0x8B, 0x00E3) X(0x8C, 0x00E5) X(0x8D, 0x00E7) X(0x8E, 0x00E9) X(0x8F, 0x00E8) \
+	X(0x90, 0x00EA) X(0x91, 0x00EB) X(0x92, 0x00ED) X(0x93, 0x00EC) X(0x94, 0x00EE) X(0x95, 0x00EF) X(0x96, 0x00F1) X(0x97, 0x00F3) \
+	X(0x98, 0x00F2) X(0x99, 0x00F4) X(0x9A, 0x00F6) X(0x9B, 0x00F5) X(0x9C, 0x00FA) X(0x9D, 0x00F9) X(0x9E, 0x00FB) X(0x9F, 0x00FC) \
+	X(0xA0, 0x2020) X(0xA1, 0x00B0) X(0xA2, 0x00A2) X(0xA3, 0x00A3) X(0xA4, 0x00A7) X(0xA5, 0x2022) X(0xA6, 0x00B6) X(0xA7, 0x00DF) \
+	X(0xA8, 0x00AE) X(0xA9, 0x00A9) X(0xAA, 0x2122) X(0xAB, 0x00B4) X(0xAC, 0x00A8) X(0xAD, 0x2260) X(0xAE, 0x00C6) X(0xAF, 0x00D8) \
+	X(0xB0, 0x221E) X(0xB1, 0x00B1) X(0xB2, 0x2264) X(0xB3, 0x2265) X(0xB4, 0x00A5) X(0xB5, 0x00B5) X(0xB6, 0x2202) X(0xB7, 0x2211) \
+	X(0xB8, 0x220F) X(0xB9, 0x03C0) X(0xBA, 0x222B) X(0xBB, 0x00AA) X(0xBC, 0x00BA) X(0xBD, 0x03A9) X(0xBE, 0x00E6) X(0xBF, 0x00F8) \
+	X(0xC0, 0x00BF) X(0xC1, 0x00A1) X(0xC2, 0x00AC) X(0xC3, 0x221A) X(0xC4, 0x0192) X(0xC5, 0x2248) X(0xC6, 0x2206) X(0xC7, 0x00AB) \
+	X(0xC8, 0x00BB) X(0xC9, 0x2026) X(0xCA, 0x00A0) X(0xCB, 0x00C0) X(0xCC, 0x00C3) X(0xCD, 0x00D5) X(0xCE, 0x0152) X(0xCF, 0x0153) \
+	X(0xD0, 0x2013) X(0xD1, 0x2014) X(0xD2, 0x201C) X(0xD3, 0x201D) X(0xD4, 0x2018) X(0xD5, 0x2019) X(0xD6, 0x00F7) X(0xD7, 0x25CA) \
+	X(0xD8, 0x00FF) X(0xD9, 0x0178) X(0xDA, 0x2044) X(0xDB, 0x20AC) X(0xDC, 0x2039) X(0xDD, 0x203A) X(0xDE, 0xFB01) X(0xDF, 0xFB02) \
+	X(0xE0, 0x2021) X(0xE1, 0x00B7) X(0xE2, 0x201A) X(0xE3, 0x201E) X(0xE4, 0x2030) X(0xE5, 0x00C2) X(0xE6, 0x00CA) X(0xE7, 0x00C1) \
+	X(0xE8, 0x00CB) X(0xE9, 0x00C8) X(0xEA, 0x00CD) X(0xEB, 0x00CE) X(0xEC, 0x00CF) X(0xED, 0x00CC) X(0xEE, 0x00D3) X(0xEF, 0x00D4) \
+	X(0xF0, 0xF8FF) X(0xF1, 0x00D2) X(0xF2, 0x00DA) X(0xF3, 0x00DB) X(0xF4, 0x00D9) X(0xF5, 0x0131) X(0xF6, 0x02C6) X(0xF7, 0x02DC) \
+	X(0xF8, 0x00AF) X(0xF9, 0x02D8) X(0xFA, 0x02D9) X(0xFB, 0x02DA) X(0xFC, 0x00B8) X(0xFD, 0x02DD) X(0xFE, 0x02DB) X(0xFF, 0x02C7)
+
+//Windows-1252: Latin-1 with printable characters in most of 0x80-0x9F. The five bytes Windows leaves undefined decode to the C1 controls of the same value, as in the WHATWG encoding standard, so that every byte sequence decodes.
+#define PB_CP1252_UPPER_HALF(X) \
+	X(0x80, 0x20AC) X(0x81, 0x0081) X(0x82, 0x201A) X(0x83, 0x0192) X(0x84, 0x201E) X(0x85, 0x2026) X(0x86, 0x2020) X(0x87, 0x2021) \
+	X(0x88, 0x02C6) X(0x89, 0x2030) X(0x8A, 0x0160) X(0x8B, 0x2039) X(0x8C, 0x0152) X(0x8D, 0x008D) X(0x8E, 0x017D) X(0x8F, 0x008F) \
+	X(0x90, 0x0090) X(0x91, 0x2018) X(0x92, 0x2019) X(0x93, 0x201C) X(0x94, 0x201D) X(0x95, 0x2022) X(0x96, 0x2013) X(0x97, 0x2014) \
+	X(0x98, 0x02DC) X(0x99, 0x2122) X(0x9A, 0x0161) X(0x9B, 0x203A) X(0x9C, 0x0153) X(0x9D, 0x009D) X(0x9E, 0x017E) X(0x9F, 0x0178)
+
+/*Defines the decoder, encoder, and boundary finder for a code page whose lower half is ASCII.
+ *UPPER_HALF lists the bytes of the upper half that don't stand for the Latin-1 character of the same value. Both directions are generated from that one list at compile time: an array for decoding, and a switch (which the compiler turns into a jump table or binary search) for encoding.
+ */
+#define PB_DECODE_ENTRY(byte, code_point) [(byte) - 0x80] = (code_point),
+#define PB_ENCODE_CASE(byte, code_point) case (code_point): *out = (byte); return 1U;
+#define PB_DEFINE_SINGLE_BYTE_CODEC(name, UPPER_HALF)                                                  \
+	/*0 means the byte is the Latin-1 character of the same value.*/                                   \
+	static const uint16_t name##_upper_half[128] = { UPPER_HALF(PB_DECODE_ENTRY) };                    \
+	static inline bool decode_##name(const unsigned char **p, const unsigned char *end, uint32_t *out_code_point) { \
+		uint32_t c = *((*p)++);                                                                         \
+		*out_code_point = ((c < 0x80U) || !name##_upper_half[c - 0x80U]) ? c : name##_upper_half[c - 0x80U]; \
+		return true;                                                                                    \
+	}                                                                                                   \
+	static inline size_t encode_##name(uint32_t c, unsigned char *out) {                                \
+		if(c < 0x80U) {                                                                                 \
+			*out = (unsigned char)c;                                                                    \
+			return 1U;                                                                                  \
+		}                                                                                               \
+		switch(c) {                                                                                     \
+			UPPER_HALF(PB_ENCODE_CASE)                                                                  \
+		}                                                                                               \
+		if((c <= 0xFFU) && !name##_upper_half[c - 0x80U]) {                                             \
+			*out = (unsigned char)c;                                                                    \
+			return 1U;                                                                                  \
+		}                                                                                               \
+		return 0U;                                                                                      \
+	}                                                                                                   \
+	static inline size_t boundary_##name(const unsigned char *in, size_t offset) {                      \
+		return offset;                                                                                  \
+	}
+
+#pragma mark Decoders
+
+//Each decoder reads one character starting at *p, advances *p past it, and returns false if the input there is malformed.
+//Each encoder writes one character to out and returns the number of bytes written, or 0 if the encoding can't represent it.
+//Each boundary function returns the nearest offset at or before the given one where a character starts.
+
+static inline bool decode_utf8(const unsigned char **p, const unsigned char *end, uint32_t *out_code_point) {
+	return pb_decode_utf8(p, end, out_code_point);
+}
+static inline size_t encode_utf8(uint32_t c, unsigned char *out) {
+	return pb_encode_utf8(c, out);
+}
+static inline size_t boundary_utf8(const unsigned char *in, size_t offset) {
+	//Back up over continuation bytes. (Malformed input may have any number of them; the decoder will reject it either way.)
+	while(offset && ((in[offset] & 0xC0U) == 0x80U))
+		--offset;
+	return offset;
+}
+
+static inline uint32_t read_utf16le(const unsigned char *s) { return (uint32_t)s[0] | ((uint32_t)s[1] << 8); }
+static inline uint32_t read_utf16be(const unsigned char *s) { return ((uint32_t)s[0] << 8) | (uint32_t)s[1]; }
+static inline void write_utf16le(uint32_t unit, unsigned char *out) { out[0] = (unsigned char)unit; out[1] = (unsigned char)(unit >> 8); }
+static inline void write_utf16be(uint32_t unit, unsigned char *out) { out[0] = (unsigned char)(unit >> 8); out[1] = (unsigned char)unit; }
+
+#define PB_DEFINE_UTF16_CODEC(order)                                                                   \
+	static inline bool decode_utf16##order(const unsigned char **p, const unsigned char *end, uint32_t *out_code_point) { \
+		const unsigned char *s = *p;                                                                    \
+		if((end - s) < 2)                                                                               \
+			return false;                                                                               \
+		uint32_t c = read_utf16##order(s);                                                              \
+		if((c >= 0xD800U) && (c <= 0xDBFFU)) {                                                          \
+			if((end - s) < 4)                                                                           \
+				return false;                                                                           \
+			uint32_t low = read_utf16##order(s + 2);                                                    \
+			if((low < 0xDC00U) || (low > 0xDFFFU))                                                      \
+				return false;                                                                           \
+			*out_code_point = 0x10000U + ((c - 0xD800U) << 10) + (low - 0xDC00U);                      \
+			*p = s + 4;                                                                                 \
+			return true;                                                                                \
+		} else if((c >= 0xDC00U) && (c <= 0xDFFFU))                                                     \
+			return false;                                                                               \
+		*out_code_point = c;                                                                            \
+		*p = s + 2;                                                                                     \
+		return true;                                                                                    \
+	}                                                                                                   \
+	static inline size_t encode_utf16##order(uint32_t c, unsigned char *out) {                          \
+		if(c < 0x10000U) {                                                                              \
+			write_utf16##order(c, out);                                                                 \
+			return 2U;                                                                                  \
+		}                                                                                               \
+		c -= 0x10000U;                                                                                  \
+		write_utf16##order(0xD800U + (c >> 10), out);                                                   \
+		write_utf16##order(0xDC00U + (c & 0x3FFU), out + 2);                                            \
+		return 4U;                                                                                      \
+	}                                                                                                   \
+	static inline size_t boundary_utf16##order(const unsigned char *in, size_t offset) {                \
+		offset &= ~(size_t)1U;                                                                          \
+		/*Don't split a surrogate pair.*/                                                               \
+		if(offset) {                                                                                    \
+			uint32_t c = read_utf16##order(in + offset);                                                \
+			if((c >= 0xDC00U) && (c <= 0xDFFFU))                                                        \
+				offset -= 2U;                                                                           \
+		}                                                                                               \
+		return offset;                                                                                  \
+	}
+PB_DEFINE_UTF16_CODEC(le)
+PB_DEFINE_UTF16_CODEC(be)
+
+static inline uint32_t read_utf32le(const unsigned char *s) { return (uint32_t)s[0] | ((uint32_t)s[1] << 8) | ((uint32_t)s[2] << 16) | ((uint32_t)s[3] << 24); }
+static inline uint32_t read_utf32be(const unsigned char *s) { return ((uint32_t)s[0] << 24) | ((uint32_t)s[1] << 16) | ((uint32_t)s[2] << 8) | (uint32_t)s[3]; }
+static inline void write_utf32le(uint32_t c, unsigned char *out) { out[0] = (unsigned char)c; out[1] = (unsigned char)(c >> 8); out[2] = (unsigned char)(c >> 16); out[3] = (unsigned char)(c >> 24); }
+static inline void write_utf32be(uint32_t c, unsigned char *out) { out[0] = (unsigned char)(c >> 24); out[1] = (unsigned char)(c >> 16); out[2] = (unsigned char)(c >> 8); out[3] = (unsigned char)c; }
+
+#define PB_DEFINE_UTF32_CODEC(order)                                                                   \
+	static inline bool decode_utf32##order(const unsigned char **p, const unsigned char *end, uint32_t *out_code_point) { \
+		if((end - *p) < 4)                                                                              \
+			return false;                                                                               \
+		uint32_t c = read_utf32##order(*p);                                                             \
+		if(((c >= 0xD800U) && (c <= 0xDFFFU)) || (c > 0x10FFFFU))                                       \
+			return false;                                                                               \
+		*out_code_point = c;                                                                            \
+		*p += 4;                                                                                        \
+		return true;                                                                                    \
+	}                                                                                                   \
+	static inline size_t encode_utf32##order(uint32_t c, unsigned char *out) {                          \
+		write_utf32##order(c, out);                                                                     \
+		return 4U;                                                                                      \
+	}                                                                                                   \
+	static inline size_t boundary_utf32##order(const unsigned char *in, size_t offset) {                \
+		return offset & ~(size_t)3U;                                                                    \
+	}
+PB_DEFINE_UTF32_CODEC(le)
+PB_DEFINE_UTF32_CODEC(be)
+
+PB_DEFINE_SINGLE_BYTE_CODEC(macroman, PB_MACROMAN_UPPER_HALF)
+PB_DEFINE_SINGLE_BYTE_CODEC(cp1252, PB_CP1252_UPPER_HALF)
+
+//Latin-1 is every code point below 256, one byte each.
+static inline bool decode_latin1(const unsigned char **p, const unsigned char *end, uint32_t *out_code_point) {
+	*out_code_point = *((*p)++);
+	return true;
+}
+static inline size_t encode_latin1(uint32_t c, unsigned char *out) {
+	if(c > 0xFFU)
+		return 0U;
+	*out = (unsigned char)c;
+	return 1U;
+}
+static inline size_t boundary_latin1(const unsigned char *in, size_t offset) {
+	return offset;
+}
+
+//Whether the encoding stores ASCII as itself, one byte per character. Lets the transcoders skip decoding for runs of plain ASCII.
+enum {
+	ascii_compatible_utf8     = true,
+	ascii_compatible_utf16le  = false,
+	ascii_compatible_utf16be  = false,
+	ascii_compatible_utf32le  = false,
+	ascii_compatible_utf32be  = false,
+	ascii_compatible_macroman = true,
+	ascii_compatible_latin1   = true,
+	ascii_compatible_cp1252   = true,
+};
+
+#pragma mark Transcoders
+
+//Converts one chunk. If out is NULL, only measures. Returns false on malformed input or an unrepresentable character.
+typedef bool (*pb_transcoder)(const unsigned char *in, size_t in_length, unsigned char *out, size_t *out_length);
+typedef size_t (*pb_boundary_finder)(const unsigned char *in, size_t offset);
+
+//Every encoding, once for the source and once for the destination. Add new encodings to both lists.
+#define PB_FOR_EACH_ENCODING(X) X(utf8) X(utf16le) X(utf16be) X(utf32le) X(utf32be) X(macroman) X(latin1) X(cp1252)
+#define PB_FOR_EACH_DESTINATION(X, from) X(from, utf8) X(from, utf16le) X(from, utf16be) X(from, utf32le) X(from, utf32be) X(from, macroman) X(from, latin1) X(from, cp1252)
+
+//One specialized transcoder per (source, destination) pair, so that the decoder and encoder get inlined into the loop.
+#define PB_DEFINE_TRANSCODER(from, to)                                                                 \
+	static bool transcode_##from##_to_##to(const unsigned char *in, size_t in_length, unsigned char *out, size_t *out_length) { \
+		const unsigned char *p = in, *end = in + in_length;                                             \
+		unsigned char scratch[4];                                                                       \
+		size_t n = 0U;                                                                                  \
+		while(p < end) {                                                                                \
+			if(ascii_compatible_##from) {                                                               \
+				/*Eight bytes at a time, as long as they're all ASCII.*/                                \
+				while(((size_t)(end - p) >= 8U)) {                                                      \
+					uint64_t word;                                                                      \
+					memcpy(&word, p, sizeof(word));                                                     \
+					if(word & 0x8080808080808080ULL)                                                    \
+						break;                                                                          \
+					for(unsigned i = 0U; i < 8U; ++i)                                                   \
+						n += encode_##to(p[i], out ? out + n : scratch);                                \
+					p += 8;                                                                             \
+				}                                                                                       \
+				if(p >= end)                                                                            \
+					break;                                                                              \
+			}                                                                                           \
+			uint32_t c;                                                                                 \
+			if(!decode_##from(&p, end, &c))                                                             \
+				return false;                                                                           \
+			size_t written = encode_##to(c, out ? out + n : scratch);                                   \
+			if(!written)                                                                                \
+				return false;                                                                           \
+			n += written;                                                                               \
+		}                                                                                               \
+		*out_length = n;                                                                                \
+		return true;                                                                                    \
+	}
+#define PB_DEFINE_TRANSCODERS_FROM(from) PB_FOR_EACH_DESTINATION(PB_DEFINE_TRANSCODER, from)
+PB_FOR_EACH_ENCODING(PB_DEFINE_TRANSCODERS_FROM)
+
+#define PB_TRANSCODER_ENTRY(from, to) [pb_text_encoding_##to] = transcode_##from##_to_##to,
+#define PB_TRANSCODER_ROW(from) [pb_text_encoding_##from] = { PB_FOR_EACH_DESTINATION(PB_TRANSCODER_ENTRY, from) },
+static const pb_transcoder transcoders[pb_text_encoding_count][pb_text_encoding_count] = { PB_FOR_EACH_ENCODING(PB_TRANSCODER_ROW) };
+
+#define PB_BOUNDARY_ENTRY(from) [pb_text_encoding_##from] = boundary_##from,
+static const pb_boundary_finder boundary_finders[pb_text_encoding_count] = { PB_FOR_EACH_ENCODING(PB_BOUNDARY_ENTRY) };
+
+#pragma mark -
+
+static const struct {
+	const char *name;
+	enum pb_text_encoding encoding;
+} encoding_names[] = {
+	//The first name for each encoding is the one pb_text_encoding_name returns.
+	{ "utf-8",        pb_text_encoding_utf8 },
+	{ "utf8",         pb_text_encoding_utf8 },
+	{ "utf-16le",     pb_text_encoding_utf16le },
+	{ "utf16le",      pb_text_encoding_utf16le },
+	{ "utf-16be",     pb_text_encoding_utf16be },
+	{ "utf16be",      pb_text_encoding_utf16be },
+	{ "utf-32le",     pb_text_encoding_utf32le },
+	{ "utf32le",      pb_text_encoding_utf32le },
+	{ "utf-32be",     pb_text_encoding_utf32be },
+	{ "utf32be",      pb_text_encoding_utf32be },
+	{ "macroman",     pb_text_encoding_macroman },
+	{ "macintosh",    pb_text_encoding_macroman },
+	{ "x-mac-roman",  pb_text_encoding_macroman },
+	{ "iso-8859-1",   pb_text_encoding_latin1 },
+	{ "latin1",       pb_text_encoding_latin1 },
+	{ "windows-1252", pb_text_encoding_cp1252 },
+	{ "cp1252",       pb_text_encoding_cp1252 },
+};
+
+bool pb_text_encoding_for_name(const char *name, enum pb_text_encoding *out_encoding) {
+	for(size_t i = 0U; i < sizeof(encoding_names) / sizeof(*encoding_names); ++i) {
+		if(strcasecmp(name, encoding_names[i].name) == 0) {
+			*out_encoding = encoding_names[i].encoding;
+			return true;
+		}
+	}
+	return false;
+}
+const char *pb_text_encoding_name(enum pb_text_encoding encoding) {
+	for(size_t i = 0U; i < sizeof(encoding_names) / sizeof(*encoding_names); ++i) {
+		if(encoding_names[i].encoding == encoding)
+			return encoding_names[i].name;
+	}
+	return "???";
+}
+
+struct transcode_chunk {
+	const unsigned char *in;
+	size_t in_length;
+	unsigned char *out; //NULL during the measuring pass.
+	size_t out_length;
+	bool succeeded;
+};
+struct transcode_job {
+	pb_transcoder transcoder;
+	struct transcode_chunk *chunks;
+};
+
+//dispatch_apply_f callback.
+static void transcode_one_chunk(void *context, size_t index) {
+	struct transcode_job *job = context;
+	struct transcode_chunk *chunk = &(job->chunks[index]);
+	chunk->succeeded = job->transcoder(chunk->in, chunk->in_length, chunk->out, &(chunk->out_length));
+}
+
+bool pb_transcode(enum pb_text_encoding from, enum pb_text_encoding to, const void *in, size_t in_length, size_t leading_space, void **out_buffer, size_t *out_length) {
+	if((from >= pb_text_encoding_count) || (to >= pb_text_encoding_count))
+		return false;
+
+	struct transcode_job job = { transcoders[from][to], NULL };
+
+	size_t numChunks = 1U;
+	if(in_length >= pb_transcode_parallel_threshold) {
+		//A few chunks per core, so that one slow chunk doesn't hold up everything else.
+		long numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+		size_t maxChunks = (numCPUs > 0) ? (size_t)numCPUs * 4U : 4U;
+		numChunks = in_length / (pb_transcode_parallel_threshold / 4U);
+		if(numChunks > maxChunks)
+			numChunks = maxChunks;
+	}
+
+	struct transcode_chunk single_chunk;
+	job.chunks = (numChunks > 1U) ? calloc(numChunks, sizeof(struct transcode_chunk)) : &single_chunk;
+	if(!job.chunks)
+		return false;
+
+	//Cut the input at character boundaries, as near to evenly as we can.
+	const unsigned char *bytes = in;
+	size_t start = 0U;
+	for(size_t i = 0U; i < numChunks; ++i) {
+		size_t chunk_end = (i == numChunks - 1U) ? in_length : boundary_finders[from](bytes, (in_length / numChunks) * (i + 1U));
+		if(chunk_end < start)
+			chunk_end = start;
+		job.chunks[i].in = bytes + start;
+		job.chunks[i].in_length = chunk_end - start;
+		job.chunks[i].out = NULL;
+		start = chunk_end;
+	}
+
+	dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+	bool succeeded = true;
+	unsigned char *buffer = NULL;
+	size_t total_length = 0U;
+
+	//Pass 1: measure.
+	if(numChunks > 1U)
+		dispatch_apply_f(numChunks, queue, &job, transcode_one_chunk);
+	else
+		transcode_one_chunk(&job, 0U);
+	for(size_t i = 0U; succeeded && (i < numChunks); ++i) {
+		succeeded = job.chunks[i].succeeded;
+		total_length += job.chunks[i].out_length;
+	}
+
+	//Pass 2: convert each chunk into its own slice of the output, at the offset given by the sizes of the chunks before it.
+	if(succeeded) {
+		buffer = malloc((leading_space + total_length) ? (leading_space + total_length) : 1U);
+		succeeded = (buffer != NULL);
+	}
+	if(succeeded) {
+		size_t offset = leading_space;
+		for(size_t i = 0U; i < numChunks; ++i) {
+			job.chunks[i].out = buffer + offset;
+			offset += job.chunks[i].out_length;
+		}
+		if(numChunks > 1U)
+			dispatch_apply_f(numChunks, queue, &job, transcode_one_chunk);
+		else
+			transcode_one_chunk(&job, 0U);
+	}
+
+	if(job.chunks != &single_chunk)
+		free(job.chunks);
+
+	if(succeeded) {
+		*out_buffer = buffer;
+		*out_length = total_length;
+	}
+	return succeeded;
+}
+
+bool pb_transcode_stream(enum pb_text_encoding from, enum pb_text_encoding to, const void *in, size_t in_length, pb_transcode_writer write_function, void *context) {
+	if((from >= pb_text_encoding_count) || (to >= pb_text_encoding_count))
+		return false;
+
+	//No character takes more than four times as many bytes in one encoding as in another (Latin-1 to UTF-32 being the worst), so this much input always fits in the buffer.
+	enum { chunk_length = pb_transcode_stream_buffer_size / 4U };
+	unsigned char buffer[pb_transcode_stream_buffer_size];
+	pb_transcoder transcoder = transcoders[from][to];
+
+	const unsigned char *bytes = in;
+	size_t start = 0U;
+	while(start < in_length) {
+		size_t chunk_end = start + chunk_length;
+		if(chunk_end >= in_length)
+			chunk_end = in_length;
+		else {
+			chunk_end = boundary_finders[from](bytes, chunk_end);
+			//Only malformed input goes a whole chunk without a character boundary. Cut it anywhere; the transcoder will reject it.
+			if(chunk_end <= start)
+				chunk_end = start + chunk_length;
+		}
+
+		size_t out_length = 0U;
+		if(!transcoder(bytes + start, chunk_end - start, buffer, &out_length))
+			return false;
+		if(out_length && !write_function(context, buffer, out_length))
+			return false;
+		start = chunk_end;
+	}
+	return true;
+}
+
+uint32_t pb_single_byte_code_point(enum pb_text_encoding encoding, unsigned char byte) {
+	const unsigned char *p = &byte;
+	uint32_t c = byte;
+	if(encoding == pb_text_encoding_macroman)
+		decode_macroman(&p, p + 1, &c);
+	else if(encoding == pb_text_encoding_cp1252)
+		decode_cp1252(&p, p + 1, &c);
+	return c;
+}
+
+#pragma mark Detection
+
+static inline bool is_ASCII_letter(unsigned char c) {
+	return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'));
+}
+static inline bool is_ASCII_word_character(unsigned char c) {
+	return is_ASCII_letter(c) || ((c >= '0') && (c <= '9'));
+}
+static inline bool is_ASCII_word_boundary(unsigned char c) {
+	return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') || (c == '(') || (c == '.') || (c == ',') || (c == ';') || (c == ':') || (c == '!') || (c == '?');
+}
+
+/*How much the character looks like something from real text, given the bytes on either side of it: common accented letters and typographic punctuation score well; math symbols, spacing diacritics, capitals in the middle of a word, and C1 controls score badly.
+ *This is what tells the single-byte encodings apart, since each of them makes the other's text into a jumble of exactly those. MacRoman and Windows-1252 put accented letters where the other has punctuation, so punctuation scores best where punctuation belongs (an apostrophe inside a word, quotes hugging one, a dash between spaces), which no letter can match.
+ */
+static inline int text_plausibility(uint32_t c, unsigned char previous, unsigned char next) {
+	bool afterLowercase = (previous >= 'a') && (previous <= 'z');
+	if((c >= 0x80U) && (c <= 0x9FU))
+		return -3;
+	if(((c >= 0xDFU) && (c <= 0xFFU) && (c != 0xF7U)) || (c == 0x0153U))
+		return 2;
+	if(((c >= 0xC0U) && (c <= 0xDEU) && (c != 0xD7U)) || (c == 0x0152U))
+		return afterLowercase ? -1 : 1;
+	switch(c) {
+		case 0x2019U: //Apostrophe
+			return (is_ASCII_letter(previous) && is_ASCII_letter(next)) ? 3 : 2;
+		case 0x2018U: case 0x201CU: //Opening quotes
+			return (is_ASCII_word_boundary(previous) && is_ASCII_word_character(next)) ? 3 : 2;
+		case 0x201DU: //Closing quote
+			return (!is_ASCII_word_boundary(previous) && (is_ASCII_word_boundary(next) || (next == '\0'))) ? 3 : 2;
+		case 0x2013U: case 0x2014U: //Dashes
+			return ((previous == ' ') && (next == ' ')) || (is_ASCII_word_character(previous) && is_ASCII_word_character(next)) ? 3 : 2;
+		case 0x20ACU: //Euro sign, which goes next to an amount
+			return ((previous >= '0') && (previous <= '9')) || ((next >= '0') && (next <= '9')) ? 2 : 1;
+		case 0x2022U: //Bullet, which starts a list item rather than sitting inside a word
+			return (is_ASCII_letter(previous) && is_ASCII_letter(next)) ? 0 : 2;
+		case 0x00A0U: //No-break space
+		case 0x2026U: //Ellipsis
+			return 2;
+		case 0x00A1U: case 0x00A3U: case 0x00A9U: case 0x00ABU: case 0x00AEU: case 0x00B0U: case 0x00BBU: case 0x00BFU: case 0x2122U:
+			return 1;
+	}
+	return (c < 0x100U) ? 0 : -1;
+}
+
+//Returns true if all of the input is well-formed UTF-8. Runs of ASCII are skipped a block at a time.
+static bool is_valid_utf8(const unsigned char *p, const unsigned char *end) {
+	while(p < end) {
+#if defined(__SSE2__)
+		while(((size_t)(end - p) >= 16U) && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p)))
+			p += 16;
+#else
+		uint64_t word;
+		while(((size_t)(end - p) >= 8U) && (memcpy(&word, p, sizeof(word)), !(word & 0x8080808080808080ULL)))
+			p += 8;
+#endif
+		uint32_t c;
+		if((p < end) && !pb_decode_utf8(&p, end, &c))
+			return false;
+	}
+	return true;
+}
+
+//Scores each single-byte encoding by how plausible its reading of the high bytes is. Returns the best, with a confidence based on how well it scored.
+static void guess_single_byte_encoding(const unsigned char *p, size_t length, struct pb_text_encoding_guess *out_guess) {
+	//In order of preference when they tie: MacRoman was pb's guess before there was any detection, and Latin-1 and Windows-1252 read the same outside 0x80-0x9F.
+	static const enum pb_text_encoding candidates[] = { pb_text_encoding_macroman, pb_text_encoding_latin1, pb_text_encoding_cp1252 };
+	enum { num_candidates = sizeof(candidates) / sizeof(*candidates), cp1252_candidate = 2U };
+	long scores[num_candidates] = { 0 };
+	size_t num_high = 0U, num_C1 = 0U;
+
+	for(size_t i = 0U; i < length; ++i) {
+		uint32_t c = p[i];
+		if(c < 0x80U)
+			continue;
+		++num_high;
+		num_C1 += (c <= 0x9FU);
+		unsigned char previous = i ? p[i - 1U] : ' ';
+		unsigned char next = (i + 1U < length) ? p[i + 1U] : '\0';
+		scores[0] += text_plausibility(macroman_upper_half[c - 0x80U] ? macroman_upper_half[c - 0x80U] : c, previous, next);
+		scores[1] += text_plausibility(c, previous, next);
+		scores[2] += text_plausibility(cp1252_upper_half[c - 0x80U] ? cp1252_upper_half[c - 0x80U] : c, previous, next);
+	}
+
+	//Bytes in 0x80-0x9F are where Windows-1252 keeps its punctuation, and far more text comes from Windows than from classic Mac OS, so it gets those ties.
+	unsigned best = num_C1 ? cp1252_candidate : 0U;
+	for(unsigned j = 0U; j < num_candidates; ++j) {
+		if(scores[j] > scores[best])
+			best = j;
+	}
+	out_guess->encoding = candidates[best];
+	//Every high byte scoring 2 would be a sure thing (punctuation in exactly the right place can score higher); anything at or below 0 is no evidence at all.
+	long confidence = num_high ? (scores[best] * 95L) / (long)(num_high * 2U) : 0L;
+	if(confidence > 95L)
+		confidence = 95L;
+	out_guess->confidence = (confidence > 0L) ? (unsigned)confidence : 0U;
+}
+
+bool pb_detect_text_encoding(const void *bytes, size_t length, struct pb_text_encoding_guess *out_guess) {
+	const unsigned char *p = bytes;
+	out_guess->bom_length = 0U;
+
+	//A BOM settles it. UTF-32LE's starts with UTF-16LE's, so it's checked first.
+	static const struct {
+		const char *bom;
+		size_t length;
+		enum pb_text_encoding encoding;
+	} boms[] = {
+		{ "\xEF\xBB\xBF", 3U, pb_text_encoding_utf8 },
+		{ "\xFF\xFE\0\0", 4U, pb_text_encoding_utf32le },
+		{ "\0\0\xFE\xFF", 4U, pb_text_encoding_utf32be },
+		{ "\xFF\xFE",     2U, pb_text_encoding_utf16le },
+		{ "\xFE\xFF",     2U, pb_text_encoding_utf16be },
+	};
+	for(size_t i = 0U; i < sizeof(boms) / sizeof(*boms); ++i) {
+		if((length >= boms[i].length) && (memcmp(p, boms[i].bom, boms[i].length) == 0)) {
+			out_guess->encoding = boms[i].encoding;
+			out_guess->confidence = 100U;
+			out_guess->bom_length = boms[i].length;
+			return true;
+		}
+	}
+
+	//One pass over the sample counts every byte value, separately for even and odd offsets (so we can see where the NULs fall). Two tables for each keep neighboring bytes from contending for the same counter, and let the compiler keep the loop tight.
+	size_t sample_length = (length < pb_detect_sample_length) ? length : pb_detect_sample_length;
+	uint32_t even_counts[2][256], odd_counts[2][256];
+	memset(even_counts, 0, sizeof(even_counts));
+	memset(odd_counts, 0, sizeof(odd_counts));
+	size_t i = 0U;
+	for(; i + 4U <= sample_length; i += 4U) {
+		++even_counts[0][p[i]];
+		++odd_counts[0][p[i + 1U]];
+		++even_counts[1][p[i + 2U]];
+		++odd_counts[1][p[i + 3U]];
+	}
+	for(; i < sample_length; ++i)
+		++((i & 1U) ? odd_counts : even_counts)[0][p[i]];
+
+	size_t even_NULs = even_counts[0][0] + even_counts[1][0], odd_NULs = odd_counts[0][0] + odd_counts[1][0];
+	size_t num_controls = 0U;
+	for(unsigned c = 1U; c < 0x20U; ++c) {
+		//Tab, line feed, vertical tab, form feed, carriage return, and escape all turn up in text.
+		if(((c < '\t') || (c > '\r')) && (c != 0x1BU))
+			num_controls += even_counts[0][c] + even_counts[1][c] + odd_counts[0][c] + odd_counts[1][c];
+	}
+
+	if(even_NULs || odd_NULs) {
+		//UTF-16 without a BOM: Latin text has a NUL in every other byte, on the high side of each code unit.
+		size_t num_units = sample_length / 2U;
+		if((length % 2U) || !num_units)
+			return false;
+		size_t high = (odd_NULs > even_NULs) ? odd_NULs : even_NULs, low = (odd_NULs > even_NULs) ? even_NULs : odd_NULs;
+		if((high * 4U < num_units) || (low * 20U > high))
+			return false;
+		out_guess->encoding = (odd_NULs > even_NULs) ? pb_text_encoding_utf16le : pb_text_encoding_utf16be;
+		out_guess->confidence = 50U + (unsigned)((high - low) * 49U / num_units);
+		return true;
+	}
+
+	if(is_valid_utf8(p, p + length)) {
+		out_guess->encoding = pb_text_encoding_utf8;
+		//Valid UTF-8 is almost never an accident, but binary data without high bytes is valid too.
+		out_guess->confidence = (num_controls * 20U > sample_length) ? 50U : 100U;
+		return true;
+	}
+	if(num_controls * 20U > sample_length)
+		return false;
+
+	guess_single_byte_encoding(p, sample_length, out_guess);
+	return true;
+}
+
+#pragma mark Line endings
+
+static const struct {
+	const char *name;
+	enum pb_line_ending line_ending;
+} line_ending_names[] = {
+	{ "keep", pb_line_ending_keep },
+	{ "lf",   pb_line_ending_lf },
+	{ "crlf", pb_line_ending_crlf },
+	{ "cr",   pb_line_ending_cr },
+};
+
+bool pb_line_ending_for_name(const char *name, enum pb_line_ending *out_line_ending) {
+	for(size_t i = 0U; i < sizeof(line_ending_names) / sizeof(*line_ending_names); ++i) {
+		if(strcasecmp(name, line_ending_names[i].name) == 0) {
+			*out_line_ending = line_ending_names[i].line_ending;
+			return true;
+		}
+	}
+	return false;
+}
+
+//In every encoding we support, CR and LF are a single code unit whose low byte is 0x0D or 0x0A and whose other bytes are zero. Neither byte value ever turns up inside a multi-byte UTF-8 sequence.
+static inline size_t code_unit_size(enum pb_text_encoding encoding) {
+	switch(encoding) {
+		case pb_text_encoding_utf16le:
+		case pb_text_encoding_utf16be:
+			return 2U;
+		case pb_text_encoding_utf32le:
+		case pb_text_encoding_utf32be:
+			return 4U;
+		default:
+			return 1U;
+	}
+}
+static inline size_t low_byte_offset(enum pb_text_encoding encoding) {
+	switch(encoding) {
+		case pb_text_encoding_utf16be: return 1U;
+		case pb_text_encoding_utf32be: return 3U;
+		default:                       return 0U;
+	}
+}
+
+//Returns the first byte at or after p that is 0x0D or 0x0A, or end if there is none.
+static inline const unsigned char *find_line_break_byte(const unsigned char *p, const unsigned char *end) {
+#if defined(__SSE2__)
+	const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+	while((size_t)(end - p) >= 16U) {
+		__m128i block = _mm_loadu_si128((const __m128i *)p);
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, cr), _mm_cmpeq_epi8(block, lf)));
+		if(mask)
+			return p + __builtin_ctz((unsigned)mask);
+		p += 16;
+	}
+#else
+	//Eight bytes at a time: a byte of (word ^ pattern) is zero exactly where the word has that byte.
+	const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+	while((size_t)(end - p) >= 8U) {
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		uint64_t x = word ^ (ones * '\r'), y = word ^ (ones * '\n');
+		if(((x - ones) & ~x & highs) | ((y - ones) & ~y & highs))
+			break;
+		p += 8;
+	}
+#endif
+	while((p < end) && (*p != '\r') && (*p != '\n'))
+		++p;
+	return p;
+}
+
+//Returns the character if the code unit at unit is CR or LF, or 0 if it is anything else.
+static inline unsigned char line_break_unit(const unsigned char *unit, size_t unit_size, size_t low_byte) {
+	unsigned char c = unit[low_byte];
+	if((c != '\r') && (c != '\n'))
+		return 0;
+	for(size_t i = 0U; i < unit_size; ++i) {
+		if((i != low_byte) && unit[i])
+			return 0;
+	}
+	return c;
+}
+
+bool pb_convert_line_endings(enum pb_line_ending line_ending, enum pb_text_encoding encoding, const void *in, size_t in_length, void **out_buffer, size_t *out_length) {
+	*out_buffer = NULL;
+	if(line_ending == pb_line_ending_keep)
+		return true;
+
+	const size_t unit_size = code_unit_size(encoding), low_byte = low_byte_offset(encoding);
+
+	//The line ending we're converting to, in this encoding's code units.
+	unsigned char eol[8] = { 0 };
+	size_t eol_length = 0U;
+	if((line_ending == pb_line_ending_crlf) || (line_ending == pb_line_ending_cr)) {
+		eol[eol_length + low_byte] = '\r';
+		eol_length += unit_size;
+	}
+	if((line_ending == pb_line_ending_crlf) || (line_ending == pb_line_ending_lf)) {
+		eol[eol_length + low_byte] = '\n';
+		eol_length += unit_size;
+	}
+
+	const unsigned char *start = in;
+	//A partial code unit at the end can't be a line ending; it gets copied through as is.
+	const unsigned char *end = start + (in_length - (in_length % unit_size));
+	const unsigned char *p = start, *copied_up_to = start;
+	unsigned char *out = NULL;
+	size_t n = 0U;
+
+	while(p < end) {
+		const unsigned char *found = find_line_break_byte(p, end);
+		if(found >= end)
+			break;
+		//Make sure it's a whole code unit and not, say, the high byte of U+0A00 or U+0D0A.
+		size_t offset = (size_t)(found - start);
+		const unsigned char *unit = found - low_byte;
+		unsigned char c;
+		if(((offset % unit_size) != low_byte) || !(c = line_break_unit(unit, unit_size, low_byte))) {
+			p = found + 1;
+			continue;
+		}
+
+		size_t break_length = unit_size;
+		if((c == '\r') && ((size_t)(end - unit) >= unit_size * 2U) && (line_break_unit(unit + unit_size, unit_size, low_byte) == '\n'))
+			break_length = unit_size * 2U;
+
+		bool already_right;
+		switch(line_ending) {
+			case pb_line_ending_lf:   already_right = (c == '\n'); break;
+			case pb_line_ending_cr:   already_right = (c == '\r') && (break_length == unit_size); break;
+			case pb_line_ending_crlf: already_right = (break_length == unit_size * 2U); break;
+			default:                  already_right = true; break;
+		}
+		if(!already_right) {
+			if(!out) {
+				//Only CRLF can make the text longer, and then by at most one code unit per line ending.
+				size_t capacity = (line_ending == pb_line_ending_crlf) ? in_length * 2U : in_length;
+				out = malloc(capacity ? capacity : 1U);
+				if(!out)
+					return false;
+			}
+			memcpy(out + n, copied_up_to, (size_t)(unit - copied_up_to));
+			n += (size_t)(unit - copied_up_to);
+			memcpy(out + n, eol, eol_length);
+			n += eol_length;
+			copied_up_to = unit + break_length;
+		}
+		p = unit + break_length;
+	}
+
+	if(out) {
+		size_t rest = in_length - (size_t)(copied_up_to - start);
+		memcpy(out + n, copied_up_to, rest);
+		*out_buffer = out;
+		*out_length = n + rest;
+	}
+	return true;
+}
@@ -0,0 +1,149 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//The encodings pb can convert between without going through CFString.
+enum pb_text_encoding {
+	pb_text_encoding_utf8,
+	pb_text_encoding_utf16le,
+	pb_text_encoding_utf16be,
+	pb_text_encoding_utf32le,
+	pb_text_encoding_utf32be,
+	pb_text_encoding_macroman,
+	pb_text_encoding_latin1, //ISO-8859-1
+	pb_text_encoding_cp1252, //Windows-1252
+
+	pb_text_encoding_count
+};
+
+//UTF-16 as it appears in public.utf16-plain-text (no BOM) is in host byte order.
+#if defined(__BIG_ENDIAN__) || (defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__))
+#	define pb_text_encoding_utf16_host    pb_text_encoding_utf16be
+#	define pb_text_encoding_utf16_swapped pb_text_encoding_utf16le
+#else
+#	define pb_text_encoding_utf16_host    pb_text_encoding_utf16le
+#	define pb_text_encoding_utf16_swapped pb_text_encoding_utf16be
+#endif
+
+//Looks up an encoding by name (e.g. "utf-8", "windows-1252", "macroman"), ignoring case. Returns false if the name is not one we know.
+bool pb_text_encoding_for_name(const char *name, enum pb_text_encoding *out_encoding);
+//The canonical name of the encoding.
+const char *pb_text_encoding_name(enum pb_text_encoding encoding);
+
+//Inputs smaller than this aren't worth splitting across threads.
+enum { pb_transcode_parallel_threshold = 1048576U };
+
+/*
+ *Converts in_length bytes of text from one encoding to another.
+ *
+ *On success, *out_buffer is a malloc'd buffer (free it with free) and *out_length is the number of bytes in it, not counting leading_space.
+ *leading_space bytes at the start of the buffer are left uninitialized for the caller to fill in (e.g. with a BOM).
+ *
+ *Large inputs are split into chunks at character boundaries and converted on all cores: one pass measures each chunk's output, and a second pass converts each chunk straight into its place in the output buffer. The result is byte-for-byte the same as converting the whole thing in one go.
+ *
+ *Returns false if the input is malformed in the source encoding, if it contains a character that the destination encoding can't represent, or if memory runs out. Nothing is returned through the out pointers in that case.
+ */
+bool pb_transcode(enum pb_text_encoding from, enum pb_text_encoding to, const void *in, size_t in_length, size_t leading_space, void **out_buffer, size_t *out_length);
+
+//Receives converted text a piece at a time. Return false to stop.
+typedef bool (*pb_transcode_writer)(void *context, const void *bytes, size_t length);
+//The most output pb_transcode_stream holds at once.
+enum { pb_transcode_stream_buffer_size = 65536U };
+/*
+ *Converts text like pb_transcode, but a chunk at a time into a fixed-size buffer, handing each converted chunk to write_function before starting on the next. Memory use doesn't grow with the input, and the first piece goes out after one chunk's work rather than the whole text's.
+ *Returns false if the input is malformed or has a character the destination encoding can't represent (everything before that chunk has already been written), or if write_function returns false.
+ */
+bool pb_transcode_stream(enum pb_text_encoding from, enum pb_text_encoding to, const void *in, size_t in_length, pb_transcode_writer write_function, void *context);
+
+//How much of the input pb_detect_text_encoding takes its byte counts from. Whether it's valid UTF-8 is checked over all of it.
+enum { pb_detect_sample_length = 65536U };
+
+struct pb_text_encoding_guess {
+	enum pb_text_encoding encoding;
+	unsigned confidence; //0 (a shot in the dark) to 100 (a BOM, or valid UTF-8)
+	size_t bom_length;   //Bytes of BOM at the start of the input, which are not part of the text
+};
+/*
+ *Guesses the encoding of text that came with no label, in one cheap pass and without converting anything: a byte-order mark if there is one; otherwise where the NULs fall (every other byte, for UTF-16 without a BOM), whether it's valid UTF-8, and whether its high bytes make more sense as MacRoman, Latin-1, or Windows-1252.
+ *Returns false if the data doesn't look like text in any of those (NULs or control characters all over the place).
+ */
+bool pb_detect_text_encoding(const void *bytes, size_t length, struct pb_text_encoding_guess *out_guess);
+
+//Line ending styles. Keep means leave them as they are.
+enum pb_line_ending {
+	pb_line_ending_keep,
+	pb_line_ending_lf,   //Unix and Mac OS X
+	pb_line_ending_crlf, //Windows
+	pb_line_ending_cr,   //Classic Mac OS
+};
+
+//Looks up a line ending style by name ("lf", "crlf", "cr", "keep"), ignoring case. Returns false if the name is not one we know.
+bool pb_line_ending_for_name(const char *name, enum pb_line_ending *out_line_ending);
+
+/*
+ *Rewrites every line ending (CRLF, lone CR, or lone LF) in text in the given encoding to the given style, working on the encoding's own code units rather than decoding the text.
+ *
+ *On success, if anything had to change, *out_buffer is a malloc'd buffer (free it with free) and *out_length is the number of bytes in it. If the text already uses that style throughout, *out_buffer is NULL and no copy is made.
+ *Returns false only if memory runs out.
+ */
+bool pb_convert_line_endings(enum pb_line_ending line_ending, enum pb_text_encoding encoding, const void *in, size_t in_length, void **out_buffer, size_t *out_length);
+
+//Reads one character of UTF-8 starting at *p and advances *p past it. Returns false, leaving *p alone, if the input there is malformed (overlong forms and encoded surrogates included).
+static inline bool pb_decode_utf8(const unsigned char **p, const unsigned char *end, uint32_t *out_code_point) {
+	const unsigned char *s = *p;
+	uint32_t c = *s;
+	size_t length;
+	uint32_t minimum;
+	if(c < 0x80U) {
+		*out_code_point = c;
+		*p = s + 1;
+		return true;
+	} else if((c & 0xE0U) == 0xC0U) {
+		length = 2U; minimum = 0x80U;    c &= 0x1FU;
+	} else if((c & 0xF0U) == 0xE0U) {
+		length = 3U; minimum = 0x800U;   c &= 0x0FU;
+	} else if((c & 0xF8U) == 0xF0U) {
+		length = 4U; minimum = 0x10000U; c &= 0x07U;
+	} else
+		return false;
+
+	if((size_t)(end - s) < length)
+		return false;
+	for(size_t i = 1U; i < length; ++i) {
+		if((s[i] & 0xC0U) != 0x80U)
+			return false;
+		c = (c << 6) | (s[i] & 0x3FU);
+	}
+	//Overlong forms, surrogates, and anything past the end of Unicode are all malformed.
+	if((c < minimum) || ((c >= 0xD800U) && (c <= 0xDFFFU)) || (c > 0x10FFFFU))
+		return false;
+
+	*out_code_point = c;
+	*p = s + length;
+	return true;
+}
+//Writes one character as UTF-8 (up to 4 bytes) and returns the number of bytes written.
+static inline size_t pb_encode_utf8(uint32_t c, unsigned char *out) {
+	if(c < 0x80U) {
+		out[0] = (unsigned char)c;
+		return 1U;
+	} else if(c < 0x800U) {
+		out[0] = (unsigned char)(0xC0U | (c >> 6));
+		out[1] = (unsigned char)(0x80U | (c & 0x3FU));
+		return 2U;
+	} else if(c < 0x10000U) {
+		out[0] = (unsigned char)(0xE0U | (c >> 12));
+		out[1] = (unsigned char)(0x80U | ((c >> 6) & 0x3FU));
+		out[2] = (unsigned char)(0x80U | (c & 0x3FU));
+		return 3U;
+	} else {
+		out[0] = (unsigned char)(0xF0U | (c >> 18));
+		out[1] = (unsigned char)(0x80U | ((c >> 12) & 0x3FU));
+		out[2] = (unsigned char)(0x80U | ((c >> 6) & 0x3FU));
+		out[3] = (unsigned char)(0x80U | (c & 0x3FU));
+		return 4U;
+	}
+}
+
+//The character that one byte stands for in a single-byte encoding (MacRoman, Latin-1, or Windows-1252). For any other encoding, the byte is taken as Latin-1.
+uint32_t pb_single_byte_code_point(enum pb_text_encoding encoding, unsigned char byte);
@@ -0,0 +1,520 @@
+#include "transform.h"
+#include "digest.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <CoreFoundation/CoreFoundation.h>
+
+//Output is handed to the writer in pieces of this size.
+enum { pb_transform_output_buffer_size = 65536U };
+
+static const struct {
+	const char *name;
+	enum pb_transform_filter_kind kind;
+} filter_names[] = {
+	{ "trim",      pb_transform_trim },
+	{ "fold-case", pb_transform_fold_case },
+	{ "dedupe",    pb_transform_dedupe },
+	{ "sort",      pb_transform_sort },
+};
+
+bool pb_transform_filter_for_name(const char *name, struct pb_transform_filter *out_filter) {
+	for(size_t i = 0U; i < sizeof(filter_names) / sizeof(*filter_names); ++i) {
+		if(strcasecmp(name, filter_names[i].name) == 0) {
+			memset(out_filter, 0, sizeof(*out_filter));
+			out_filter->kind = filter_names[i].kind;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool pb_transform_parse_replacement(const char *spec, struct pb_transform_filter *out_filter) {
+	char delimiter = *spec;
+	if(!delimiter)
+		return false;
+	const char *from = spec + 1;
+	const char *from_end = strchr(from, delimiter);
+	if(!from_end || (from_end == from))
+		return false;
+	const char *to = from_end + 1;
+	const char *to_end = strchr(to, delimiter);
+	if(!to_end)
+		to_end = to + strlen(to);
+	else if(to_end[1])
+		return false;
+	if(memchr(from, '\n', (size_t)(from_end - from)))
+		return false;
+
+	out_filter->kind = pb_transform_replace;
+	out_filter->from = from;
+	out_filter->from_length = (size_t)(from_end - from);
+	out_filter->to = to;
+	out_filter->to_length = (size_t)(to_end - to);
+	return true;
+}
+
+#pragma mark Line storage
+
+//A growing buffer that lines are copied into, for the filters that have to remember them. Lines are referred to by offset, since the buffer moves as it grows.
+struct arena {
+	char *bytes;
+	size_t length, capacity;
+};
+
+static bool reserve(char **bytes, size_t *capacity, size_t needed) {
+	if(needed <= *capacity)
+		return true;
+	size_t new_capacity = *capacity ? *capacity : 4096U;
+	while(new_capacity < needed) {
+		if(new_capacity > (SIZE_MAX / 2U)) {
+			errno = ENOMEM;
+			return false;
+		}
+		new_capacity *= 2U;
+	}
+	char *new_bytes = realloc(*bytes, new_capacity);
+	if(!new_bytes) {
+		errno = ENOMEM;
+		return false;
+	}
+	*bytes = new_bytes;
+	*capacity = new_capacity;
+	return true;
+}
+
+static bool arena_append(struct arena *arena, const char *line, size_t length, size_t *out_offset) {
+	if(!reserve(&arena->bytes, &arena->capacity, arena->length + length))
+		return false;
+	if(length)
+		memcpy(arena->bytes + arena->length, line, length);
+	*out_offset = arena->length;
+	arena->length += length;
+	return true;
+}
+
+struct line_ref {
+	size_t offset, length;
+	//Filled in once the arena is done growing.
+	const char *bytes;
+};
+
+#pragma mark Pipeline
+
+struct stage {
+	const struct pb_transform_filter *filter;
+
+	//Where fold-case and replace build the changed line.
+	char *scratch;
+	size_t scratch_capacity;
+
+	//Lines that dedupe has seen, or that sort is holding.
+	struct arena arena;
+	struct line_ref *lines;
+	size_t num_lines, lines_capacity;
+
+	//dedupe: an open-addressing set of line numbers (indices into lines, plus one; 0 is an empty slot), keyed by XXH64.
+	size_t *slots;
+	uint64_t *slot_hashes;
+	size_t num_slots;
+};
+
+struct pb_transform_pipeline {
+	struct stage *stages;
+	size_t num_stages;
+
+	pb_transform_writer write_function;
+	void *context;
+	bool failed;
+
+	//The unfinished line at the end of what's been fed so far.
+	char *partial;
+	size_t partial_length, partial_capacity;
+
+	bool found_line_break, uses_CRLF, ended_with_line_break;
+	size_t num_lines_written;
+
+	size_t output_length;
+	char output[pb_transform_output_buffer_size];
+};
+
+static bool write_output(struct pb_transform_pipeline *pipeline, const char *bytes, size_t length) {
+	if(pipeline->output_length + length > sizeof(pipeline->output)) {
+		if(pipeline->output_length && !pipeline->write_function(pipeline->context, pipeline->output, pipeline->output_length))
+			return false;
+		pipeline->output_length = 0U;
+		if(length >= sizeof(pipeline->output))
+			return pipeline->write_function(pipeline->context, bytes, length);
+	}
+	memcpy(pipeline->output + pipeline->output_length, bytes, length);
+	pipeline->output_length += length;
+	return true;
+}
+static bool write_line_break(struct pb_transform_pipeline *pipeline) {
+	return pipeline->uses_CRLF ? write_output(pipeline, "\r\n", 2U) : write_output(pipeline, "\n", 1U);
+}
+
+static bool run_stage(struct pb_transform_pipeline *pipeline, size_t stage_index, const char *line, size_t length);
+
+static bool is_blank(char ch) {
+	return (ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\v') || (ch == '\f');
+}
+
+static bool fold_case(struct stage *stage, const char *line, size_t length, const char **out_line, size_t *out_length) {
+	size_t i;
+	for(i = 0U; (i < length) && !(line[i] & 0x80); ++i);
+	if(i == length) {
+		//All ASCII: no need to bother CF.
+		if(!reserve(&stage->scratch, &stage->scratch_capacity, length))
+			return false;
+		for(i = 0U; i < length; ++i) {
+			char ch = line[i];
+			stage->scratch[i] = ((ch >= 'A') && (ch <= 'Z')) ? (char)(ch + ('a' - 'A')) : ch;
+		}
+		*out_line = stage->scratch;
+		*out_length = length;
+		return true;
+	}
+
+	CFStringRef string = CFStringCreateWithBytes(kCFAllocatorDefault, (const UInt8 *)line, (CFIndex)length, kCFStringEncodingUTF8, /*isExternalRepresentation*/ false);
+	if(!string) {
+		//CF gives up on malformed UTF-8.
+		errno = EILSEQ;
+		return false;
+	}
+	CFMutableStringRef folded = CFStringCreateMutableCopy(kCFAllocatorDefault, /*maxLength*/ 0, string);
+	CFRelease(string);
+	if(!folded) {
+		errno = ENOMEM;
+		return false;
+	}
+	CFStringFold(folded, kCFCompareCaseInsensitive, /*locale*/ NULL);
+
+	CFRange range = CFRangeMake(0, CFStringGetLength(folded));
+	CFIndex foldedLength = 0;
+	CFStringGetBytes(folded, range, kCFStringEncodingUTF8, /*lossByte*/ 0, /*isExternalRepresentation*/ false, /*buffer*/ NULL, /*maxBufLen*/ 0, &foldedLength);
+	bool success = reserve(&stage->scratch, &stage->scratch_capacity, (size_t)foldedLength);
+	if(success) {
+		CFStringGetBytes(folded, range, kCFStringEncodingUTF8, /*lossByte*/ 0, /*isExternalRepresentation*/ false, (UInt8 *)stage->scratch, foldedLength, &foldedLength);
+		*out_line = stage->scratch;
+		*out_length = (size_t)foldedLength;
+	}
+	CFRelease(folded);
+	return success;
+}
+
+//memmem, which isn't in the 10.6 SDK. memchr finds each candidate for the first byte, and memcmp checks the rest.
+static const char *find_bytes(const char *bytes, size_t length, const char *pattern, size_t pattern_length) {
+	if(pattern_length > length)
+		return NULL;
+	const char *p = bytes, *last = bytes + (length - pattern_length);
+	while((p <= last) && (p = memchr(p, pattern[0], (size_t)(last - p) + 1U))) {
+		if(memcmp(p + 1, pattern + 1, pattern_length - 1U) == 0)
+			return p;
+		++p;
+	}
+	return NULL;
+}
+
+static bool replace(struct stage *stage, const char *line, size_t length, const char **out_line, size_t *out_length) {
+	const struct pb_transform_filter *filter = stage->filter;
+	const char *match = find_bytes(line, length, filter->from, filter->from_length);
+	if(!match) {
+		//Most lines don't have it; pass those along as they are.
+		*out_line = line;
+		*out_length = length;
+		return true;
+	}
+
+	const char *p = line, *end = line + length;
+	size_t new_length = 0U;
+	while(match) {
+		size_t before = (size_t)(match - p);
+		if(!reserve(&stage->scratch, &stage->scratch_capacity, new_length + before + filter->to_length))
+			return false;
+		memcpy(stage->scratch + new_length, p, before);
+		new_length += before;
+		memcpy(stage->scratch + new_length, filter->to, filter->to_length);
+		new_length += filter->to_length;
+
+		p = match + filter->from_length;
+		match = find_bytes(p, (size_t)(end - p), filter->from, filter->from_length);
+	}
+	if(!reserve(&stage->scratch, &stage->scratch_capacity, new_length + (size_t)(end - p)))
+		return false;
+	memcpy(stage->scratch + new_length, p, (size_t)(end - p));
+	new_length += (size_t)(end - p);
+
+	*out_line = stage->scratch;
+	*out_length = new_length;
+	return true;
+}
+
+static bool hold_line(struct stage *stage, const char *line, size_t length) {
+	if(stage->num_lines == stage->lines_capacity) {
+		size_t new_capacity = stage->lines_capacity ? stage->lines_capacity * 2U : 1024U;
+		struct line_ref *new_lines = realloc(stage->lines, new_capacity * sizeof(*new_lines));
+		if(!new_lines) {
+			errno = ENOMEM;
+			return false;
+		}
+		stage->lines = new_lines;
+		stage->lines_capacity = new_capacity;
+	}
+	struct line_ref *ref = &stage->lines[stage->num_lines];
+	if(!arena_append(&stage->arena, line, length, &ref->offset))
+		return false;
+	ref->length = length;
+	ref->bytes = NULL;
+	++stage->num_lines;
+	return true;
+}
+
+static uint64_t hash_line(const char *line, size_t length) {
+	unsigned char digest[pb_digest_max_length];
+	pb_digest_buffer(pb_digest_xxh64, line, length, digest);
+	uint64_t hash;
+	memcpy(&hash, digest, sizeof(hash));
+	return hash;
+}
+
+static bool grow_slots(struct stage *stage) {
+	size_t new_num_slots = stage->num_slots ? stage->num_slots * 2U : 4096U;
+	size_t *new_slots = calloc(new_num_slots, sizeof(*new_slots));
+	uint64_t *new_hashes = malloc(new_num_slots * sizeof(*new_hashes));
+	if(!(new_slots && new_hashes)) {
+		free(new_slots);
+		free(new_hashes);
+		errno = ENOMEM;
+		return false;
+	}
+	for(size_t i = 0U; i < stage->num_slots; ++i) {
+		if(!stage->slots[i])
+			continue;
+		size_t j = (size_t)stage->slot_hashes[i] & (new_num_slots - 1U);
+		while(new_slots[j])
+			j = (j + 1U) & (new_num_slots - 1U);
+		new_slots[j] = stage->slots[i];
+		new_hashes[j] = stage->slot_hashes[i];
+	}
+	free(stage->slots);
+	free(stage->slot_hashes);
+	stage->slots = new_slots;
+	stage->slot_hashes = new_hashes;
+	stage->num_slots = new_num_slots;
+	return true;
+}
+
+//Returns true in *out_is_new if the line hasn't been seen before, and remembers it.
+static bool dedupe(struct stage *stage, const char *line, size_t length, bool *out_is_new) {
+	//Keep the set at most half full.
+	if(((stage->num_lines + 1U) * 2U > stage->num_slots) && !grow_slots(stage))
+		return false;
+
+	uint64_t hash = hash_line(line, length);
+	size_t mask = stage->num_slots - 1U;
+	size_t i = (size_t)hash & mask;
+	for(; stage->slots[i]; i = (i + 1U) & mask) {
+		if(stage->slot_hashes[i] != hash)
+			continue;
+		const struct line_ref *ref = &stage->lines[stage->slots[i] - 1U];
+		if((ref->length == length) && (memcmp(stage->arena.bytes + ref->offset, line, length) == 0)) {
+			*out_is_new = false;
+			return true;
+		}
+	}
+
+	if(!hold_line(stage, line, length))
+		return false;
+	stage->slots[i] = stage->num_lines;
+	stage->slot_hashes[i] = hash;
+	*out_is_new = true;
+	return true;
+}
+
+//Passes a line through the stage at stage_index and on down the chain. Past the last stage, the line is written out.
+static bool run_stage(struct pb_transform_pipeline *pipeline, size_t stage_index, const char *line, size_t length) {
+	if(stage_index == pipeline->num_stages) {
+		if(pipeline->num_lines_written++ && !write_line_break(pipeline))
+			return false;
+		return write_output(pipeline, line, length);
+	}
+
+	struct stage *stage = &pipeline->stages[stage_index];
+	switch(stage->filter->kind) {
+		case pb_transform_trim:
+			while(length && is_blank(*line)) {
+				++line;
+				--length;
+			}
+			while(length && is_blank(line[length - 1U]))
+				--length;
+			break;
+
+		case pb_transform_fold_case:
+			if(!fold_case(stage, line, length, &line, &length))
+				return false;
+			break;
+
+		case pb_transform_dedupe: {
+			bool is_new = false;
+			if(!dedupe(stage, line, length, &is_new))
+				return false;
+			if(!is_new)
+				return true;
+			break;
+		}
+
+		case pb_transform_sort:
+			//Held until pb_transform_finish.
+			return hold_line(stage, line, length);
+
+		case pb_transform_replace:
+			if(!replace(stage, line, length, &line, &length))
+				return false;
+			break;
+	}
+	return run_stage(pipeline, stage_index + 1U, line, length);
+}
+
+static int compare_lines(const void *a, const void *b) {
+	const struct line_ref *line_a = a, *line_b = b;
+	size_t shorter = (line_a->length < line_b->length) ? line_a->length : line_b->length;
+	int result = shorter ? memcmp(line_a->bytes, line_b->bytes, shorter) : 0;
+	if(result == 0)
+		result = (line_a->length > line_b->length) - (line_a->length < line_b->length);
+	return result;
+}
+
+//Sorts the lines a sort stage is holding and sends them on.
+static bool release_sorted_lines(struct pb_transform_pipeline *pipeline, size_t stage_index) {
+	struct stage *stage = &pipeline->stages[stage_index];
+	for(size_t i = 0U; i < stage->num_lines; ++i)
+		stage->lines[i].bytes = stage->arena.bytes + stage->lines[i].offset;
+	//UTF-8 sorted bytewise is in code point order.
+	qsort(stage->lines, stage->num_lines, sizeof(*stage->lines), compare_lines);
+
+	for(size_t i = 0U; i < stage->num_lines; ++i) {
+		if(!run_stage(pipeline, stage_index + 1U, stage->lines[i].bytes, stage->lines[i].length))
+			return false;
+	}
+	return true;
+}
+
+#pragma mark Public API
+
+struct pb_transform_pipeline *pb_transform_create(const struct pb_transform_filter *filters, size_t num_filters, pb_transform_writer write_function, void *context) {
+	struct pb_transform_pipeline *pipeline = calloc(1U, sizeof(*pipeline));
+	struct stage *stages = num_filters ? calloc(num_filters, sizeof(*stages)) : NULL;
+	if(!pipeline || (num_filters && !stages)) {
+		free(pipeline);
+		free(stages);
+		errno = ENOMEM;
+		return NULL;
+	}
+	for(size_t i = 0U; i < num_filters; ++i)
+		stages[i].filter = &filters[i];
+
+	pipeline->stages = stages;
+	pipeline->num_stages = num_filters;
+	pipeline->write_function = write_function;
+	pipeline->context = context;
+	return pipeline;
+}
+
+//Sends one complete line (without its line break) down the chain.
+static bool start_line(struct pb_transform_pipeline *pipeline, const char *line, size_t length) {
+	if(!pipeline->found_line_break) {
+		//The first line decides which line break we use.
+		pipeline->found_line_break = true;
+		pipeline->uses_CRLF = length && (line[length - 1U] == '\r');
+	}
+	if(pipeline->uses_CRLF && length && (line[length - 1U] == '\r'))
+		--length;
+	return run_stage(pipeline, 0U, line, length);
+}
+
+bool pb_transform_feed(struct pb_transform_pipeline *pipeline, const void *bytes, size_t length) {
+	if(pipeline->failed)
+		return false;
+	if(!length)
+		return true;
+
+	const char *p = bytes, *end = p + length;
+	const char *newline;
+	while((newline = memchr(p, '\n', (size_t)(end - p)))) {
+		bool success;
+		if(pipeline->partial_length) {
+			//Finish the line left over from the last piece.
+			size_t rest = (size_t)(newline - p);
+			success = reserve(&pipeline->partial, &pipeline->partial_capacity, pipeline->partial_length + rest);
+			if(success) {
+				memcpy(pipeline->partial + pipeline->partial_length, p, rest);
+				success = start_line(pipeline, pipeline->partial, pipeline->partial_length + rest);
+				pipeline->partial_length = 0U;
+			}
+		} else {
+			//Whole lines go through straight from the input.
+			success = start_line(pipeline, p, (size_t)(newline - p));
+		}
+		if(!success) {
+			pipeline->failed = true;
+			return false;
+		}
+		p = newline + 1;
+	}
+
+	pipeline->ended_with_line_break = (p == end);
+	if(p < end) {
+		size_t rest = (size_t)(end - p);
+		if(!reserve(&pipeline->partial, &pipeline->partial_capacity, pipeline->partial_length + rest)) {
+			pipeline->failed = true;
+			return false;
+		}
+		memcpy(pipeline->partial + pipeline->partial_length, p, rest);
+		pipeline->partial_length += rest;
+	}
+	return true;
+}
+
+bool pb_transform_finish(struct pb_transform_pipeline *pipeline) {
+	if(pipeline->failed)
+		return false;
+
+	bool success = true;
+	if(pipeline->partial_length) {
+		success = start_line(pipeline, pipeline->partial, pipeline->partial_length);
+		pipeline->partial_length = 0U;
+	}
+	//Each sort lets go of its lines in turn, into whatever comes after it (which may be another sort).
+	for(size_t i = 0U; success && (i < pipeline->num_stages); ++i) {
+		if(pipeline->stages[i].filter->kind == pb_transform_sort)
+			success = release_sorted_lines(pipeline, i);
+	}
+	if(success && pipeline->ended_with_line_break && pipeline->num_lines_written)
+		success = write_line_break(pipeline);
+	if(success && pipeline->output_length)
+		success = pipeline->write_function(pipeline->context, pipeline->output, pipeline->output_length);
+	pipeline->output_length = 0U;
+
+	pipeline->failed = true;
+	return success;
+}
+
+void pb_transform_destroy(struct pb_transform_pipeline *pipeline) {
+	if(!pipeline)
+		return;
+	for(size_t i = 0U; i < pipeline->num_stages; ++i) {
+		struct stage *stage = &pipeline->stages[i];
+		free(stage->scratch);
+		free(stage->arena.bytes);
+		free(stage->lines);
+		free(stage->slots);
+		free(stage->slot_hashes);
+	}
+	free(pipeline->stages);
+	free(pipeline->partial);
+	free(pipeline);
+}
@@ -0,0 +1,44 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//The filters that pb transform can chain. Each one works on lines of UTF-8 text.
+enum pb_transform_filter_kind {
+	pb_transform_trim,      //Strip spaces and tabs (and stray CRs) from both ends of each line.
+	pb_transform_fold_case, //Fold each line to lowercase (full Unicode case folding), for case-insensitive sort and dedupe.
+	pb_transform_dedupe,    //Drop every line that's the same as an earlier one.
+	pb_transform_sort,      //Sort the lines by code point. Holds every line until the end of the text.
+	pb_transform_replace,   //Replace every occurrence of a string within each line with another.
+};
+
+struct pb_transform_filter {
+	enum pb_transform_filter_kind kind;
+	//For replace. Not copied; they must last as long as the pipeline.
+	const char *from, *to;
+	size_t from_length, to_length;
+};
+
+//Looks up a filter by name ("trim", "fold-case", "dedupe", "sort"), ignoring case. Returns false if the name is not one we know. Replace filters come from pb_transform_parse_replacement instead.
+bool pb_transform_filter_for_name(const char *name, struct pb_transform_filter *out_filter);
+/*Parses a replacement in sed's form: /FROM/TO/, where the first character (whatever it is) separates the two strings. The trailing separator is optional. FROM and TO are plain strings, not patterns.
+ *Returns false if there is no FROM, or if FROM contains a line break (which no line ever will). out_filter points into spec.
+ */
+bool pb_transform_parse_replacement(const char *spec, struct pb_transform_filter *out_filter);
+
+//Called with each piece of output, in order. Return false to stop.
+typedef bool (*pb_transform_writer)(void *context, const void *bytes, size_t length);
+
+struct pb_transform_pipeline;
+
+/*
+ *Runs text through the filters in order, a line at a time: each line goes as far down the chain as it can (to the end, unless a sort is holding lines back) before the next one is read, and comes out through write_function in a fixed-size buffer.
+ *Text goes in with pb_transform_feed, in pieces of any size; pieces can end in the middle of a line. Lines end with LF or CRLF (whichever the first line uses), and the output uses the same line ending, with one after the last line only if the input had one.
+ *
+ *Returns NULL if memory runs out. The filters are not copied, and must last as long as the pipeline.
+ */
+struct pb_transform_pipeline *pb_transform_create(const struct pb_transform_filter *filters, size_t num_filters, pb_transform_writer write_function, void *context);
+//Returns false if memory runs out (errno is ENOMEM), fold-case is given malformed UTF-8 (errno is EILSEQ), or write_function returns false. Either way, the pipeline is done; call pb_transform_destroy.
+bool pb_transform_feed(struct pb_transform_pipeline *pipeline, const void *bytes, size_t length);
+//Pushes out the last line and anything still held by a sort. Same return as pb_transform_feed.
+bool pb_transform_finish(struct pb_transform_pipeline *pipeline);
+void pb_transform_destroy(struct pb_transform_pipeline *pipeline);